@@ -1,7 +1,7 @@
 # Potato developer commands.
 param(
     [Parameter(Position = 0)]
-    [ValidateSet('run', 'build', 'test', 'layout', 'clean', 'analyze-wiki-css')]
+    [ValidateSet('run', 'build', 'test', 'layout', 'clean', 'analyze-wiki-css', 'fetch-bench')]
     [string] $Command = 'run',
 
     [ValidateSet('Debug', 'Release')]
@@ -223,6 +223,113 @@ function Invoke-WikiCssAnalysis {
     Write-Host "var() without fallback (simple): $withoutFallback"
 }
 
+function Invoke-FetchBench {
+    # dd fetch-bench [--stylesheets:N] [--images:N] [--latency:MS] [--runs:N]
+    $options = @{ stylesheets = 8; images = 40; latency = 60; runs = 5 }
+    foreach ($arg in $Rest) {
+        if ($arg -match '^--(stylesheets|images|latency|runs):(\d+)$') {
+            $options[$Matches[1]] = [int]$Matches[2]
+        }
+    }
+
+    Invoke-Build
+
+    # A loopback site with a fixed delay per request: half the stylesheets in
+    # <head>, the rest linked after a page of images, the shape that starves
+    # late stylesheets when images take every connection first.
+    Add-Type -TypeDefinition @'
+using System;
+using System.Net;
+using System.Text;
+using System.Threading;
+
+public static class FetchBenchSite {
+    static HttpListener listener;
+
+    public static void Start(int port, int sheets, int images, int latency) {
+        listener = new HttpListener();
+        listener.Prefixes.Add("http://localhost:" + port + "/");
+        listener.Start();
+        ThreadPool.SetMinThreads(64, 64);
+        var accept = new Thread(() => {
+            while (listener.IsListening) {
+                HttpListenerContext ctx;
+                try { ctx = listener.GetContext(); } catch { break; }
+                ThreadPool.QueueUserWorkItem(_ => Serve(ctx, sheets, images, latency));
+            }
+        });
+        accept.IsBackground = true;
+        accept.Start();
+    }
+
+    public static void Stop() {
+        listener.Stop();
+        listener.Close();
+    }
+
+    static void Serve(HttpListenerContext ctx, int sheets, int images, int latency) {
+        Thread.Sleep(latency);
+        var path = ctx.Request.Url.AbsolutePath;
+        var body = new StringBuilder();
+        var type = "text/html; charset=utf-8";
+
+        if (path.StartsWith("/s")) {
+            type = "text/css";
+            body.Append(".c" + path.Substring(2).Replace(".css", "") + " { color: #333; margin: 4px; }");
+        } else if (path.StartsWith("/i")) {
+            type = "image/svg+xml";
+            body.Append("<svg xmlns='http://www.w3.org/2000/svg' width='64' height='64'><rect width='64' height='64' fill='#8ac'/></svg>");
+        } else {
+            body.Append("<!DOCTYPE html><html><head><title>fetch bench</title>");
+            for (int i = 0; i < sheets / 2; i++) body.Append("<link rel=stylesheet href=/s" + i + ".css>");
+            body.Append("</head><body>");
+            for (int i = 0; i < images; i++) body.Append("<img src=/i" + i + ".svg width=64 height=64>");
+            for (int i = sheets / 2; i < sheets; i++) body.Append("<link rel=stylesheet href=/s" + i + ".css>");
+            body.Append("</body></html>");
+        }
+
+        var bytes = Encoding.UTF8.GetBytes(body.ToString());
+        try {
+            ctx.Response.ContentType = type;
+            ctx.Response.ContentLength64 = bytes.Length;
+            ctx.Response.OutputStream.Write(bytes, 0, bytes.Length);
+            ctx.Response.Close();
+        } catch { }
+    }
+}
+'@
+
+    $port = 8731
+    [FetchBenchSite]::Start($port, $options.stylesheets, $options.images, $options.latency)
+    $exe = Get-ExePath
+    $times = @()
+
+    Push-Location $PSScriptRoot
+    try {
+        for ($run = 1; $run -le $options.runs; $run++) {
+            $output = & $exe "--eval:http://localhost:$port/" | Out-String
+            $landed = [regex]::Matches($output, '\[\s*(\d+) ms\] All stylesheets landed')
+            if ($landed.Count -eq 0) {
+                Write-Host "run ${run}: stylesheets never landed"
+                continue
+            }
+            $ms = [int]$landed[$landed.Count - 1].Groups[1].Value
+            Write-Host "run ${run}: all stylesheets landed at $ms ms"
+            $times += $ms
+        }
+    }
+    finally {
+        Pop-Location
+        [FetchBenchSite]::Stop()
+    }
+
+    if ($times.Count -gt 0) {
+        $sorted = $times | Sort-Object
+        $median = $sorted[[Math]::Floor(($sorted.Count - 1) / 2)]
+        Write-Host "median: $median ms to last stylesheet ($($options.stylesheets) stylesheets, $($options.images) images, $($options.latency) ms latency)"
+    }
+}
+
 switch ($Command) {
     'run' { Invoke-Run }
     'build' { Invoke-Build }
@@ -230,4 +337,5 @@ switch ($Command) {
     'layout' { Invoke-Layout }
     'clean' { Invoke-Clean }
     'analyze-wiki-css' { Invoke-WikiCssAnalysis }
+    'fetch-bench' { Invoke-FetchBench }
 }
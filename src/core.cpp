@@ -3,6 +3,30 @@
 
 #include "pch.h"
 
+// The vector paths need SSE2, which every x86-64 compiler targets. SSSE3 is
+// checked at run time, and GCC and Clang compile those functions for it alone.
+#if defined(_M_X64) || (defined(__x86_64__) && defined(__SSE2__))
+#define CORE_X64_SIMD 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define CORE_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define CORE_TARGET_SSSE3
+#endif
+#endif
+#include <malloc.h>
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 
 std::string empty;
 
@@ -98,24 +122,64 @@ bool value_in_list(const std::string_view val, const char* strings, const char d
 
 namespace
 {
-	bool is_valid_utf8(const std::string_view s)
+	// Length of the leading run of ASCII bytes in `s`.
+	size_t ascii_prefix(const std::string_view s)
+	{
+		const auto* p = s.data();
+		const size_t n = s.size();
+		size_t i = 0;
+
+#if defined(CORE_X64_SIMD)
+		for (; i + 16 <= n; i += 16)
+		{
+			const auto high = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)));
+			if (high) return i + std::countr_zero(static_cast<unsigned>(high));
+		}
+#else
+		for (; i + 8 <= n; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, p + i, 8);
+			if (word & 0x8080808080808080ull) break;
+		}
+#endif
+
+		while (i < n && static_cast<uint8_t>(p[i]) < 0x80) ++i;
+		return i;
+	}
+
+	// Byte-at-a-time check, for processors without SSSE3. Overlong forms,
+	// surrogates and code points past U+10FFFF are rejected, as the vector
+	// check rejects them.
+	bool is_valid_utf8_scalar(const std::string_view s)
 	{
 		size_t i = 0;
 
 		while (i < s.size())
 		{
+			i += ascii_prefix(s.substr(i));
+			if (i == s.size()) break;
+
 			const auto b = static_cast<uint8_t>(s[i]);
 			size_t n;
+			uint8_t lo = 0x80, hi = 0xBF; // allowed range of the second byte
 
-			if (b < 0x80) n = 1;
-			else if ((b & 0xE0) == 0xC0 && b >= 0xC2) n = 2;
+			if ((b & 0xE0) == 0xC0 && b >= 0xC2) n = 2;
 			else if ((b & 0xF0) == 0xE0) n = 3;
 			else if ((b & 0xF8) == 0xF0 && b <= 0xF4) n = 4;
 			else return false;
 
+			if (b == 0xE0) lo = 0xA0;
+			else if (b == 0xED) hi = 0x9F;
+			else if (b == 0xF0) lo = 0x90;
+			else if (b == 0xF4) hi = 0x8F;
+
 			if (i + n > s.size()) return false;
 
-			for (size_t k = 1; k < n; ++k)
+			const auto b1 = static_cast<uint8_t>(s[i + 1]);
+			if (b1 < lo || b1 > hi) return false;
+
+			for (size_t k = 2; k < n; ++k)
 			{
 				if (!pf::is_utf8_continuation(s[i + k])) return false;
 			}
@@ -126,6 +190,739 @@ namespace
 		return true;
 	}
 
+#if defined(CORE_X64_SIMD)
+	bool has_ssse3()
+	{
+		static const bool supported = []
+		{
+#if defined(_MSC_VER)
+			int info[4] = {};
+			__cpuid(info, 1);
+			return (info[2] & (1 << 9)) != 0;
+#else
+			return __builtin_cpu_supports("ssse3") != 0;
+#endif
+		}();
+
+		return supported;
+	}
+
+	CORE_TARGET_SSSE3
+	__m128i high_nibbles(const __m128i v)
+	{
+		return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+	}
+
+	// Keiser and Lemire's lookup validator. Each byte is classified together
+	// with the one before it by three 16-entry nibble tables; a bit left set in
+	// all three names an error. Third and fourth bytes of a sequence are checked
+	// by position from their lead byte instead.
+	CORE_TARGET_SSSE3
+	__m128i utf8_block_errors(const __m128i input, const __m128i prev_input)
+	{
+		constexpr uint8_t too_short = 1 << 0; // lead byte not followed by a continuation
+		constexpr uint8_t too_long = 1 << 1; // continuation after an ASCII byte
+		constexpr uint8_t overlong_3 = 1 << 2;
+		constexpr uint8_t too_large = 1 << 3; // past U+10FFFF
+		constexpr uint8_t surrogate = 1 << 4;
+		constexpr uint8_t overlong_2 = 1 << 5;
+		constexpr uint8_t too_large_1000 = 1 << 6;
+		constexpr uint8_t overlong_4 = 1 << 6;
+		constexpr uint8_t two_conts = 1 << 7; // continuation after a continuation
+		constexpr uint8_t carry = too_short | too_long | two_conts;
+
+		const auto table = [](auto... v) { return _mm_setr_epi8(static_cast<char>(v)...); };
+
+		const __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+
+		const __m128i byte_1_high = _mm_shuffle_epi8(table(
+			too_long, too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+			two_conts, two_conts, two_conts, two_conts,
+			too_short | overlong_2,
+			too_short,
+			too_short | overlong_3 | surrogate,
+			too_short | too_large | too_large_1000 | overlong_4), high_nibbles(prev1));
+
+		const __m128i byte_1_low = _mm_shuffle_epi8(table(
+			carry | overlong_3 | overlong_2 | overlong_4,
+			carry | overlong_2,
+			carry,
+			carry,
+			carry | too_large,
+			carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000 | surrogate,
+			carry | too_large | too_large_1000,
+			carry | too_large | too_large_1000), _mm_and_si128(prev1, _mm_set1_epi8(0x0F)));
+
+		const __m128i byte_2_high = _mm_shuffle_epi8(table(
+			too_short, too_short, too_short, too_short, too_short, too_short, too_short, too_short,
+			too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4,
+			too_long | overlong_2 | two_conts | overlong_3 | too_large,
+			too_long | overlong_2 | two_conts | surrogate | too_large,
+			too_long | overlong_2 | two_conts | surrogate | too_large,
+			too_short, too_short, too_short, too_short), high_nibbles(input));
+
+		const __m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+		// Bytes two after a 3- or 4-byte lead, or three after a 4-byte lead,
+		// must be continuations; the tables above flagged them as two_conts.
+		const __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+		const __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+		const __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+		const __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+		const __m128i must_continue = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(static_cast<char>(0x80)));
+
+		return _mm_xor_si128(must_continue, special);
+	}
+
+	CORE_TARGET_SSSE3
+	bool is_valid_utf8_ssse3(const std::string_view s)
+	{
+		const auto* p = s.data();
+		const size_t n = s.size();
+		const __m128i zero = _mm_setzero_si128();
+		// Leads in the last three bytes whose sequence runs into the next block.
+		const __m128i max_complete = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+		                                           static_cast<char>(0xEF), static_cast<char>(0xDF),
+		                                           static_cast<char>(0xBF));
+		__m128i error = zero;
+		__m128i prev_input = zero;
+		__m128i prev_incomplete = zero;
+		size_t i = 0;
+
+		while (i < n)
+		{
+			// ASCII fast path, 32 bytes a step.
+			for (; i + 32 <= n; i += 32)
+			{
+				const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+				const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i + 16));
+				if (_mm_movemask_epi8(_mm_or_si128(a, b))) break;
+
+				error = _mm_or_si128(error, prev_incomplete);
+				prev_incomplete = zero;
+				prev_input = b;
+			}
+
+			if (i >= n) break;
+
+			__m128i input;
+
+			if (i + 16 <= n)
+			{
+				input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+			}
+			else
+			{
+				// Zero padding reads as ASCII, so a truncated tail still fails.
+				alignas(16) char tail[16] = {};
+				memcpy(tail, p + i, n - i);
+				input = _mm_load_si128(reinterpret_cast<const __m128i*>(tail));
+			}
+
+			if (_mm_movemask_epi8(input))
+			{
+				error = _mm_or_si128(error, utf8_block_errors(input, prev_input));
+				prev_incomplete = _mm_subs_epu8(input, max_complete);
+			}
+			else
+			{
+				error = _mm_or_si128(error, prev_incomplete);
+				prev_incomplete = zero;
+			}
+
+			prev_input = input;
+			i += 16;
+		}
+
+		error = _mm_or_si128(error, prev_incomplete);
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(error, zero)) == 0xFFFF;
+	}
+#endif
+
+	bool is_valid_utf8(const std::string_view s)
+	{
+#if defined(CORE_X64_SIMD)
+		if (has_ssse3()) return is_valid_utf8_ssse3(s);
+#endif
+		return is_valid_utf8_scalar(s);
+	}
+
+	struct single_byte_charset
+	{
+		uint32_t codepage;
+		char16_t high[128]; // characters for bytes 0x80-0xFF
+	};
+
+	// From the Unicode mapping tables. Bytes a code page leaves undefined are
+	// U+FFFD, except in 0x80-0x9F where Windows passes them through as C1
+	// controls.
+	constexpr single_byte_charset g_single_byte_charsets[] = {
+		{874, // windows-874
+			{
+				0x20AC, 0x0081, 0x0082, 0x0083, 0x0084, 0x2026, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x0E01, 0x0E02, 0x0E03, 0x0E04, 0x0E05, 0x0E06, 0x0E07,
+				0x0E08, 0x0E09, 0x0E0A, 0x0E0B, 0x0E0C, 0x0E0D, 0x0E0E, 0x0E0F,
+				0x0E10, 0x0E11, 0x0E12, 0x0E13, 0x0E14, 0x0E15, 0x0E16, 0x0E17,
+				0x0E18, 0x0E19, 0x0E1A, 0x0E1B, 0x0E1C, 0x0E1D, 0x0E1E, 0x0E1F,
+				0x0E20, 0x0E21, 0x0E22, 0x0E23, 0x0E24, 0x0E25, 0x0E26, 0x0E27,
+				0x0E28, 0x0E29, 0x0E2A, 0x0E2B, 0x0E2C, 0x0E2D, 0x0E2E, 0x0E2F,
+				0x0E30, 0x0E31, 0x0E32, 0x0E33, 0x0E34, 0x0E35, 0x0E36, 0x0E37,
+				0x0E38, 0x0E39, 0x0E3A, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0x0E3F,
+				0x0E40, 0x0E41, 0x0E42, 0x0E43, 0x0E44, 0x0E45, 0x0E46, 0x0E47,
+				0x0E48, 0x0E49, 0x0E4A, 0x0E4B, 0x0E4C, 0x0E4D, 0x0E4E, 0x0E4F,
+				0x0E50, 0x0E51, 0x0E52, 0x0E53, 0x0E54, 0x0E55, 0x0E56, 0x0E57,
+				0x0E58, 0x0E59, 0x0E5A, 0x0E5B, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD
+			}
+		},
+		{1250, // windows-1250
+			{
+				0x20AC, 0x0081, 0x201A, 0x0083, 0x201E, 0x2026, 0x2020, 0x2021,
+				0x0088, 0x2030, 0x0160, 0x2039, 0x015A, 0x0164, 0x017D, 0x0179,
+				0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+				0x0098, 0x2122, 0x0161, 0x203A, 0x015B, 0x0165, 0x017E, 0x017A,
+				0x00A0, 0x02C7, 0x02D8, 0x0141, 0x00A4, 0x0104, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0x015E, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x017B,
+				0x00B0, 0x00B1, 0x02DB, 0x0142, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+				0x00B8, 0x0105, 0x015F, 0x00BB, 0x013D, 0x02DD, 0x013E, 0x017C,
+				0x0154, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x0139, 0x0106, 0x00C7,
+				0x010C, 0x00C9, 0x0118, 0x00CB, 0x011A, 0x00CD, 0x00CE, 0x010E,
+				0x0110, 0x0143, 0x0147, 0x00D3, 0x00D4, 0x0150, 0x00D6, 0x00D7,
+				0x0158, 0x016E, 0x00DA, 0x0170, 0x00DC, 0x00DD, 0x0162, 0x00DF,
+				0x0155, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x013A, 0x0107, 0x00E7,
+				0x010D, 0x00E9, 0x0119, 0x00EB, 0x011B, 0x00ED, 0x00EE, 0x010F,
+				0x0111, 0x0144, 0x0148, 0x00F3, 0x00F4, 0x0151, 0x00F6, 0x00F7,
+				0x0159, 0x016F, 0x00FA, 0x0171, 0x00FC, 0x00FD, 0x0163, 0x02D9
+			}
+		},
+		{1251, // windows-1251
+			{
+				0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+				0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+				0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+				0x0098, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+				0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+				0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+				0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+				0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+				0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+				0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+				0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+				0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+				0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+				0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+				0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+				0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F
+			}
+		},
+		{1252, // windows-1252
+			{
+				0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+				0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+				0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+				0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+				0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+				0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+				0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+				0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+				0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+				0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+				0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+				0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+				0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+				0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF
+			}
+		},
+		{1253, // windows-1253
+			{
+				0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+				0x0088, 0x2030, 0x008A, 0x2039, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+				0x0098, 0x2122, 0x009A, 0x203A, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x0385, 0x0386, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0xFFFD, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x2015,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x0384, 0x00B5, 0x00B6, 0x00B7,
+				0x0388, 0x0389, 0x038A, 0x00BB, 0x038C, 0x00BD, 0x038E, 0x038F,
+				0x0390, 0x0391, 0x0392, 0x0393, 0x0394, 0x0395, 0x0396, 0x0397,
+				0x0398, 0x0399, 0x039A, 0x039B, 0x039C, 0x039D, 0x039E, 0x039F,
+				0x03A0, 0x03A1, 0xFFFD, 0x03A3, 0x03A4, 0x03A5, 0x03A6, 0x03A7,
+				0x03A8, 0x03A9, 0x03AA, 0x03AB, 0x03AC, 0x03AD, 0x03AE, 0x03AF,
+				0x03B0, 0x03B1, 0x03B2, 0x03B3, 0x03B4, 0x03B5, 0x03B6, 0x03B7,
+				0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD, 0x03BE, 0x03BF,
+				0x03C0, 0x03C1, 0x03C2, 0x03C3, 0x03C4, 0x03C5, 0x03C6, 0x03C7,
+				0x03C8, 0x03C9, 0x03CA, 0x03CB, 0x03CC, 0x03CD, 0x03CE, 0xFFFD
+			}
+		},
+		{1254, // windows-1254
+			{
+				0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+				0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+				0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x009E, 0x0178,
+				0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+				0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+				0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+				0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+				0x011E, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+				0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x0130, 0x015E, 0x00DF,
+				0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+				0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+				0x011F, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+				0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x0131, 0x015F, 0x00FF
+			}
+		},
+		{1255, // windows-1255
+			{
+				0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+				0x02C6, 0x2030, 0x008A, 0x2039, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+				0x02DC, 0x2122, 0x009A, 0x203A, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x20AA, 0x00A5, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0x00D7, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+				0x00B8, 0x00B9, 0x00F7, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+				0x05B0, 0x05B1, 0x05B2, 0x05B3, 0x05B4, 0x05B5, 0x05B6, 0x05B7,
+				0x05B8, 0x05B9, 0xFFFD, 0x05BB, 0x05BC, 0x05BD, 0x05BE, 0x05BF,
+				0x05C0, 0x05C1, 0x05C2, 0x05C3, 0x05F0, 0x05F1, 0x05F2, 0x05F3,
+				0x05F4, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD,
+				0x05D0, 0x05D1, 0x05D2, 0x05D3, 0x05D4, 0x05D5, 0x05D6, 0x05D7,
+				0x05D8, 0x05D9, 0x05DA, 0x05DB, 0x05DC, 0x05DD, 0x05DE, 0x05DF,
+				0x05E0, 0x05E1, 0x05E2, 0x05E3, 0x05E4, 0x05E5, 0x05E6, 0x05E7,
+				0x05E8, 0x05E9, 0x05EA, 0xFFFD, 0xFFFD, 0x200E, 0x200F, 0xFFFD
+			}
+		},
+		{1256, // windows-1256
+			{
+				0x20AC, 0x067E, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+				0x02C6, 0x2030, 0x0679, 0x2039, 0x0152, 0x0686, 0x0698, 0x0688,
+				0x06AF, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+				0x06A9, 0x2122, 0x0691, 0x203A, 0x0153, 0x200C, 0x200D, 0x06BA,
+				0x00A0, 0x060C, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0x06BE, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+				0x00B8, 0x00B9, 0x061B, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x061F,
+				0x06C1, 0x0621, 0x0622, 0x0623, 0x0624, 0x0625, 0x0626, 0x0627,
+				0x0628, 0x0629, 0x062A, 0x062B, 0x062C, 0x062D, 0x062E, 0x062F,
+				0x0630, 0x0631, 0x0632, 0x0633, 0x0634, 0x0635, 0x0636, 0x00D7,
+				0x0637, 0x0638, 0x0639, 0x063A, 0x0640, 0x0641, 0x0642, 0x0643,
+				0x00E0, 0x0644, 0x00E2, 0x0645, 0x0646, 0x0647, 0x0648, 0x00E7,
+				0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x0649, 0x064A, 0x00EE, 0x00EF,
+				0x064B, 0x064C, 0x064D, 0x064E, 0x00F4, 0x064F, 0x0650, 0x00F7,
+				0x0651, 0x00F9, 0x0652, 0x00FB, 0x00FC, 0x200E, 0x200F, 0x06D2
+			}
+		},
+		{1257, // windows-1257
+			{
+				0x20AC, 0x0081, 0x201A, 0x0083, 0x201E, 0x2026, 0x2020, 0x2021,
+				0x0088, 0x2030, 0x008A, 0x2039, 0x008C, 0x00A8, 0x02C7, 0x00B8,
+				0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+				0x0098, 0x2122, 0x009A, 0x203A, 0x009C, 0x00AF, 0x02DB, 0x009F,
+				0x00A0, 0xFFFD, 0x00A2, 0x00A3, 0x00A4, 0xFFFD, 0x00A6, 0x00A7,
+				0x00D8, 0x00A9, 0x0156, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00C6,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+				0x00F8, 0x00B9, 0x0157, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00E6,
+				0x0104, 0x012E, 0x0100, 0x0106, 0x00C4, 0x00C5, 0x0118, 0x0112,
+				0x010C, 0x00C9, 0x0179, 0x0116, 0x0122, 0x0136, 0x012A, 0x013B,
+				0x0160, 0x0143, 0x0145, 0x00D3, 0x014C, 0x00D5, 0x00D6, 0x00D7,
+				0x0172, 0x0141, 0x015A, 0x016A, 0x00DC, 0x017B, 0x017D, 0x00DF,
+				0x0105, 0x012F, 0x0101, 0x0107, 0x00E4, 0x00E5, 0x0119, 0x0113,
+				0x010D, 0x00E9, 0x017A, 0x0117, 0x0123, 0x0137, 0x012B, 0x013C,
+				0x0161, 0x0144, 0x0146, 0x00F3, 0x014D, 0x00F5, 0x00F6, 0x00F7,
+				0x0173, 0x0142, 0x015B, 0x016B, 0x00FC, 0x017C, 0x017E, 0x02D9
+			}
+		},
+		{1258, // windows-1258
+			{
+				0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+				0x02C6, 0x2030, 0x008A, 0x2039, 0x0152, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+				0x02DC, 0x2122, 0x009A, 0x203A, 0x0153, 0x009D, 0x009E, 0x0178,
+				0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+				0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+				0x00C0, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+				0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x0300, 0x00CD, 0x00CE, 0x00CF,
+				0x0110, 0x00D1, 0x0309, 0x00D3, 0x00D4, 0x01A0, 0x00D6, 0x00D7,
+				0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x01AF, 0x0303, 0x00DF,
+				0x00E0, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+				0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x0301, 0x00ED, 0x00EE, 0x00EF,
+				0x0111, 0x00F1, 0x0323, 0x00F3, 0x00F4, 0x01A1, 0x00F6, 0x00F7,
+				0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x01B0, 0x20AB, 0x00FF
+			}
+		},
+		{20866, // KOI8-R
+			{
+				0x2500, 0x2502, 0x250C, 0x2510, 0x2514, 0x2518, 0x251C, 0x2524,
+				0x252C, 0x2534, 0x253C, 0x2580, 0x2584, 0x2588, 0x258C, 0x2590,
+				0x2591, 0x2592, 0x2593, 0x2320, 0x25A0, 0x2219, 0x221A, 0x2248,
+				0x2264, 0x2265, 0x00A0, 0x2321, 0x00B0, 0x00B2, 0x00B7, 0x00F7,
+				0x2550, 0x2551, 0x2552, 0x0451, 0x2553, 0x2554, 0x2555, 0x2556,
+				0x2557, 0x2558, 0x2559, 0x255A, 0x255B, 0x255C, 0x255D, 0x255E,
+				0x255F, 0x2560, 0x2561, 0x0401, 0x2562, 0x2563, 0x2564, 0x2565,
+				0x2566, 0x2567, 0x2568, 0x2569, 0x256A, 0x256B, 0x256C, 0x00A9,
+				0x044E, 0x0430, 0x0431, 0x0446, 0x0434, 0x0435, 0x0444, 0x0433,
+				0x0445, 0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E,
+				0x043F, 0x044F, 0x0440, 0x0441, 0x0442, 0x0443, 0x0436, 0x0432,
+				0x044C, 0x044B, 0x0437, 0x0448, 0x044D, 0x0449, 0x0447, 0x044A,
+				0x042E, 0x0410, 0x0411, 0x0426, 0x0414, 0x0415, 0x0424, 0x0413,
+				0x0425, 0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E,
+				0x041F, 0x042F, 0x0420, 0x0421, 0x0422, 0x0423, 0x0416, 0x0412,
+				0x042C, 0x042B, 0x0417, 0x0428, 0x042D, 0x0429, 0x0427, 0x042A
+			}
+		},
+		{21866, // KOI8-U
+			{
+				0x2500, 0x2502, 0x250C, 0x2510, 0x2514, 0x2518, 0x251C, 0x2524,
+				0x252C, 0x2534, 0x253C, 0x2580, 0x2584, 0x2588, 0x258C, 0x2590,
+				0x2591, 0x2592, 0x2593, 0x2320, 0x25A0, 0x2219, 0x221A, 0x2248,
+				0x2264, 0x2265, 0x00A0, 0x2321, 0x00B0, 0x00B2, 0x00B7, 0x00F7,
+				0x2550, 0x2551, 0x2552, 0x0451, 0x0454, 0x2554, 0x0456, 0x0457,
+				0x2557, 0x2558, 0x2559, 0x255A, 0x255B, 0x0491, 0x255D, 0x255E,
+				0x255F, 0x2560, 0x2561, 0x0401, 0x0404, 0x2563, 0x0406, 0x0407,
+				0x2566, 0x2567, 0x2568, 0x2569, 0x256A, 0x0490, 0x256C, 0x00A9,
+				0x044E, 0x0430, 0x0431, 0x0446, 0x0434, 0x0435, 0x0444, 0x0433,
+				0x0445, 0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E,
+				0x043F, 0x044F, 0x0440, 0x0441, 0x0442, 0x0443, 0x0436, 0x0432,
+				0x044C, 0x044B, 0x0437, 0x0448, 0x044D, 0x0449, 0x0447, 0x044A,
+				0x042E, 0x0410, 0x0411, 0x0426, 0x0414, 0x0415, 0x0424, 0x0413,
+				0x0425, 0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E,
+				0x041F, 0x042F, 0x0420, 0x0421, 0x0422, 0x0423, 0x0416, 0x0412,
+				0x042C, 0x042B, 0x0417, 0x0428, 0x042D, 0x0429, 0x0427, 0x042A
+			}
+		},
+		{28591, // ISO-8859-1
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+				0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+				0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+				0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+				0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+				0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+				0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+				0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+				0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+				0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF
+			}
+		},
+		{28592, // ISO-8859-2
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x0104, 0x02D8, 0x0141, 0x00A4, 0x013D, 0x015A, 0x00A7,
+				0x00A8, 0x0160, 0x015E, 0x0164, 0x0179, 0x00AD, 0x017D, 0x017B,
+				0x00B0, 0x0105, 0x02DB, 0x0142, 0x00B4, 0x013E, 0x015B, 0x02C7,
+				0x00B8, 0x0161, 0x015F, 0x0165, 0x017A, 0x02DD, 0x017E, 0x017C,
+				0x0154, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x0139, 0x0106, 0x00C7,
+				0x010C, 0x00C9, 0x0118, 0x00CB, 0x011A, 0x00CD, 0x00CE, 0x010E,
+				0x0110, 0x0143, 0x0147, 0x00D3, 0x00D4, 0x0150, 0x00D6, 0x00D7,
+				0x0158, 0x016E, 0x00DA, 0x0170, 0x00DC, 0x00DD, 0x0162, 0x00DF,
+				0x0155, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x013A, 0x0107, 0x00E7,
+				0x010D, 0x00E9, 0x0119, 0x00EB, 0x011B, 0x00ED, 0x00EE, 0x010F,
+				0x0111, 0x0144, 0x0148, 0x00F3, 0x00F4, 0x0151, 0x00F6, 0x00F7,
+				0x0159, 0x016F, 0x00FA, 0x0171, 0x00FC, 0x00FD, 0x0163, 0x02D9
+			}
+		},
+		{28593, // ISO-8859-3
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x0126, 0x02D8, 0x00A3, 0x00A4, 0xFFFD, 0x0124, 0x00A7,
+				0x00A8, 0x0130, 0x015E, 0x011E, 0x0134, 0x00AD, 0xFFFD, 0x017B,
+				0x00B0, 0x0127, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x0125, 0x00B7,
+				0x00B8, 0x0131, 0x015F, 0x011F, 0x0135, 0x00BD, 0xFFFD, 0x017C,
+				0x00C0, 0x00C1, 0x00C2, 0xFFFD, 0x00C4, 0x010A, 0x0108, 0x00C7,
+				0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+				0xFFFD, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x0120, 0x00D6, 0x00D7,
+				0x011C, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x016C, 0x015C, 0x00DF,
+				0x00E0, 0x00E1, 0x00E2, 0xFFFD, 0x00E4, 0x010B, 0x0109, 0x00E7,
+				0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+				0xFFFD, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x0121, 0x00F6, 0x00F7,
+				0x011D, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x016D, 0x015D, 0x02D9
+			}
+		},
+		{28594, // ISO-8859-4
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x0104, 0x0138, 0x0156, 0x00A4, 0x0128, 0x013B, 0x00A7,
+				0x00A8, 0x0160, 0x0112, 0x0122, 0x0166, 0x00AD, 0x017D, 0x00AF,
+				0x00B0, 0x0105, 0x02DB, 0x0157, 0x00B4, 0x0129, 0x013C, 0x02C7,
+				0x00B8, 0x0161, 0x0113, 0x0123, 0x0167, 0x014A, 0x017E, 0x014B,
+				0x0100, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x012E,
+				0x010C, 0x00C9, 0x0118, 0x00CB, 0x0116, 0x00CD, 0x00CE, 0x012A,
+				0x0110, 0x0145, 0x014C, 0x0136, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+				0x00D8, 0x0172, 0x00DA, 0x00DB, 0x00DC, 0x0168, 0x016A, 0x00DF,
+				0x0101, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x012F,
+				0x010D, 0x00E9, 0x0119, 0x00EB, 0x0117, 0x00ED, 0x00EE, 0x012B,
+				0x0111, 0x0146, 0x014D, 0x0137, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+				0x00F8, 0x0173, 0x00FA, 0x00FB, 0x00FC, 0x0169, 0x016B, 0x02D9
+			}
+		},
+		{28595, // ISO-8859-5
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x0401, 0x0402, 0x0403, 0x0404, 0x0405, 0x0406, 0x0407,
+				0x0408, 0x0409, 0x040A, 0x040B, 0x040C, 0x00AD, 0x040E, 0x040F,
+				0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+				0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+				0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+				0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+				0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+				0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+				0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+				0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+				0x2116, 0x0451, 0x0452, 0x0453, 0x0454, 0x0455, 0x0456, 0x0457,
+				0x0458, 0x0459, 0x045A, 0x045B, 0x045C, 0x00A7, 0x045E, 0x045F
+			}
+		},
+		{28596, // ISO-8859-6
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0xFFFD, 0xFFFD, 0xFFFD, 0x00A4, 0xFFFD, 0xFFFD, 0xFFFD,
+				0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0x060C, 0x00AD, 0xFFFD, 0xFFFD,
+				0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD,
+				0xFFFD, 0xFFFD, 0xFFFD, 0x061B, 0xFFFD, 0xFFFD, 0xFFFD, 0x061F,
+				0xFFFD, 0x0621, 0x0622, 0x0623, 0x0624, 0x0625, 0x0626, 0x0627,
+				0x0628, 0x0629, 0x062A, 0x062B, 0x062C, 0x062D, 0x062E, 0x062F,
+				0x0630, 0x0631, 0x0632, 0x0633, 0x0634, 0x0635, 0x0636, 0x0637,
+				0x0638, 0x0639, 0x063A, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD,
+				0x0640, 0x0641, 0x0642, 0x0643, 0x0644, 0x0645, 0x0646, 0x0647,
+				0x0648, 0x0649, 0x064A, 0x064B, 0x064C, 0x064D, 0x064E, 0x064F,
+				0x0650, 0x0651, 0x0652, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD,
+				0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD
+			}
+		},
+		{28597, // ISO-8859-7
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x2018, 0x2019, 0x00A3, 0x20AC, 0x20AF, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0x037A, 0x00AB, 0x00AC, 0x00AD, 0xFFFD, 0x2015,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x0384, 0x0385, 0x0386, 0x00B7,
+				0x0388, 0x0389, 0x038A, 0x00BB, 0x038C, 0x00BD, 0x038E, 0x038F,
+				0x0390, 0x0391, 0x0392, 0x0393, 0x0394, 0x0395, 0x0396, 0x0397,
+				0x0398, 0x0399, 0x039A, 0x039B, 0x039C, 0x039D, 0x039E, 0x039F,
+				0x03A0, 0x03A1, 0xFFFD, 0x03A3, 0x03A4, 0x03A5, 0x03A6, 0x03A7,
+				0x03A8, 0x03A9, 0x03AA, 0x03AB, 0x03AC, 0x03AD, 0x03AE, 0x03AF,
+				0x03B0, 0x03B1, 0x03B2, 0x03B3, 0x03B4, 0x03B5, 0x03B6, 0x03B7,
+				0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD, 0x03BE, 0x03BF,
+				0x03C0, 0x03C1, 0x03C2, 0x03C3, 0x03C4, 0x03C5, 0x03C6, 0x03C7,
+				0x03C8, 0x03C9, 0x03CA, 0x03CB, 0x03CC, 0x03CD, 0x03CE, 0xFFFD
+			}
+		},
+		{28598, // ISO-8859-8
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0xFFFD, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0x00D7, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+				0x00B8, 0x00B9, 0x00F7, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0xFFFD,
+				0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD,
+				0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD,
+				0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD,
+				0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0xFFFD, 0x2017,
+				0x05D0, 0x05D1, 0x05D2, 0x05D3, 0x05D4, 0x05D5, 0x05D6, 0x05D7,
+				0x05D8, 0x05D9, 0x05DA, 0x05DB, 0x05DC, 0x05DD, 0x05DE, 0x05DF,
+				0x05E0, 0x05E1, 0x05E2, 0x05E3, 0x05E4, 0x05E5, 0x05E6, 0x05E7,
+				0x05E8, 0x05E9, 0x05EA, 0xFFFD, 0xFFFD, 0x200E, 0x200F, 0xFFFD
+			}
+		},
+		{28599, // ISO-8859-9
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+				0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+				0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+				0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+				0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+				0x011E, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+				0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x0130, 0x015E, 0x00DF,
+				0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+				0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+				0x011F, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+				0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x0131, 0x015F, 0x00FF
+			}
+		},
+		{28603, // ISO-8859-13
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x201D, 0x00A2, 0x00A3, 0x00A4, 0x201E, 0x00A6, 0x00A7,
+				0x00D8, 0x00A9, 0x0156, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00C6,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x201C, 0x00B5, 0x00B6, 0x00B7,
+				0x00F8, 0x00B9, 0x0157, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00E6,
+				0x0104, 0x012E, 0x0100, 0x0106, 0x00C4, 0x00C5, 0x0118, 0x0112,
+				0x010C, 0x00C9, 0x0179, 0x0116, 0x0122, 0x0136, 0x012A, 0x013B,
+				0x0160, 0x0143, 0x0145, 0x00D3, 0x014C, 0x00D5, 0x00D6, 0x00D7,
+				0x0172, 0x0141, 0x015A, 0x016A, 0x00DC, 0x017B, 0x017D, 0x00DF,
+				0x0105, 0x012F, 0x0101, 0x0107, 0x00E4, 0x00E5, 0x0119, 0x0113,
+				0x010D, 0x00E9, 0x017A, 0x0117, 0x0123, 0x0137, 0x012B, 0x013C,
+				0x0161, 0x0144, 0x0146, 0x00F3, 0x014D, 0x00F5, 0x00F6, 0x00F7,
+				0x0173, 0x0142, 0x015B, 0x016B, 0x00FC, 0x017C, 0x017E, 0x2019
+			}
+		},
+		{28605, // ISO-8859-15
+			{
+				0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+				0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+				0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+				0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+				0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x20AC, 0x00A5, 0x0160, 0x00A7,
+				0x0161, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+				0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x017D, 0x00B5, 0x00B6, 0x00B7,
+				0x017E, 0x00B9, 0x00BA, 0x00BB, 0x0152, 0x0153, 0x0178, 0x00BF,
+				0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+				0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+				0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+				0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+				0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+				0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+				0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+				0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF
+			}
+		},
+
+	};
+
+	const single_byte_charset* find_single_byte_charset(const uint32_t cp)
+	{
+		for (const auto& cs : g_single_byte_charsets)
+		{
+			if (cs.codepage == cp) return &cs;
+		}
+
+		return nullptr;
+	}
+
+	// Appends `bytes` to `out` as UTF-8. Runs of ASCII are copied as they are.
+	void transcode_single_byte(const std::string_view bytes, const single_byte_charset& cs, std::string& out)
+	{
+		out.reserve(out.size() + bytes.size());
+
+		size_t i = 0;
+
+		while (i < bytes.size())
+		{
+			const size_t run = ascii_prefix(bytes.substr(i));
+			out.append(bytes.data() + i, run);
+			i += run;
+
+			char buf[64];
+			size_t len = 0;
+
+			while (i < bytes.size() && len + 3 <= sizeof(buf))
+			{
+				const auto b = static_cast<uint8_t>(bytes[i]);
+				if (b < 0x80) break;
+
+				const char16_t c = cs.high[b - 0x80];
+
+				if (c < 0x800)
+				{
+					buf[len++] = static_cast<char>(0xC0 | c >> 6);
+					buf[len++] = static_cast<char>(0x80 | (c & 0x3F));
+				}
+				else
+				{
+					buf[len++] = static_cast<char>(0xE0 | c >> 12);
+					buf[len++] = static_cast<char>(0x80 | (c >> 6 & 0x3F));
+					buf[len++] = static_cast<char>(0x80 | (c & 0x3F));
+				}
+
+				++i;
+			}
+
+			out.append(buf, len);
+		}
+	}
+
+	// Appends `bytes`, in code page `cp`, to `out` as UTF-8. Single-byte code
+	// pages are converted here; the rest go through the platform.
+	void append_transcoded(const std::string_view bytes, const uint32_t cp, std::string& out)
+	{
+		if (const auto* cs = find_single_byte_charset(cp)) transcode_single_byte(bytes, *cs, out);
+		else out += pf::transcode_to_utf8(bytes, cp);
+	}
+
+	std::string transcoded(const std::string_view bytes, const uint32_t cp)
+	{
+		std::string out;
+		append_transcoded(bytes, cp, out);
+		return out;
+	}
+
+	// Code pages where every byte is one character, so a body can be cut
+	// anywhere and each piece transcoded on its own.
+	bool is_single_byte_codepage(const uint32_t cp)
+	{
+		return cp == 874 || (cp >= 1250 && cp <= 1258) || cp == 20866 || cp == 21866 ||
+			(cp >= 28591 && cp <= 28605);
+	}
+
+	// Length of the prefix of `s` that ends on a UTF-8 sequence boundary. Only
+	// a lead byte whose sequence is still short is held back, so at most three
+	// bytes wait for the next piece.
+	size_t complete_utf8_prefix(const std::string_view s)
+	{
+		const size_t n = s.size();
+
+		for (size_t back = 1; back <= std::min<size_t>(3, n); ++back)
+		{
+			const auto b = static_cast<uint8_t>(s[n - back]);
+			if (b < 0x80) return n;
+			if (pf::is_utf8_continuation(static_cast<char>(b))) continue;
+
+			const size_t len = (b & 0xE0) == 0xC0 ? 2 : (b & 0xF0) == 0xE0 ? 3 : (b & 0xF8) == 0xF0 ? 4 : 1;
+			return len > back ? n - back : n;
+		}
+
+		return n;
+	}
+
 	// Pull the value of a `charset=` parameter out of a Content-Type header or
 	// a <meta http-equiv> content attribute.
 	std::string_view charset_param(const std::string_view text)
@@ -182,12 +979,19 @@ namespace
 	}
 }
 
-std::string decode_to_utf8(const std::string_view bytes, const std::string_view content_type)
+std::string decode_to_utf8(std::string bytes, const std::string_view content_type)
 {
+	// Bytes that are already UTF-8 are handed back in the buffer they came in.
+	const auto keep = [&](const size_t skip)
+	{
+		bytes.erase(0, skip);
+		return std::move(bytes);
+	};
+
 	// 1. A byte-order mark wins over everything else.
-	if (bytes.size() >= 3 && memcmp(bytes.data(), "\xEF\xBB\xBF", 3) == 0)
+	if (bytes.starts_with("\xEF\xBB\xBF"))
 	{
-		return std::string(bytes.substr(3));
+		return keep(3);
 	}
 
 	if (bytes.size() >= 2)
@@ -195,8 +999,8 @@ std::string decode_to_utf8(const std::string_view bytes, const std::string_view
 		const auto b0 = static_cast<uint8_t>(bytes[0]);
 		const auto b1 = static_cast<uint8_t>(bytes[1]);
 
-		if (b0 == 0xFF && b1 == 0xFE) return pf::transcode_to_utf8(bytes.substr(2), 1200);
-		if (b0 == 0xFE && b1 == 0xFF) return pf::transcode_to_utf8(bytes.substr(2), 1201);
+		if (b0 == 0xFF && b1 == 0xFE) return pf::transcode_to_utf8(std::string_view(bytes).substr(2), 1200);
+		if (b0 == 0xFE && b1 == 0xFF) return pf::transcode_to_utf8(std::string_view(bytes).substr(2), 1201);
 	}
 
 	// 2. The transport-level charset, then the in-document declaration.
@@ -208,15 +1012,795 @@ std::string decode_to_utf8(const std::string_view bytes, const std::string_view
 		// An unrecognised label falls through to the heuristic below.
 		if (const auto cp = pf::charset_to_codepage(charset))
 		{
-			return pf::transcode_to_utf8(bytes, cp);
+			if (cp == 65001 && is_valid_utf8(bytes)) return keep(0);
+			return transcoded(bytes, cp);
 		}
 	}
 
 	// 3. Nothing usable declared: trust the bytes if they are valid UTF-8,
 	// otherwise fall back to the de-facto legacy default.
-	return is_valid_utf8(bytes) ? std::string(bytes) : pf::transcode_to_utf8(bytes, 1252);
+	return is_valid_utf8(bytes) ? keep(0) : transcoded(bytes, 1252);
+}
+
+void incremental_decoder::push(const std::string_view bytes, std::string& out)
+{
+	m_pending.append(bytes);
+
+	if (m_mode == mode::sniffing)
+	{
+		if (m_pending.size() < 1024) return;
+		choose_mode();
+	}
+
+	drain(out, false);
+}
+
+void incremental_decoder::finish(std::string& out)
+{
+	if (m_mode == mode::sniffing) choose_mode();
+	drain(out, true);
+}
+
+// Same precedence as decode_to_utf8, decided once from the leading bytes.
+void incremental_decoder::choose_mode()
+{
+	const std::string_view bytes = m_pending;
+
+	if (bytes.size() >= 3 && memcmp(bytes.data(), "\xEF\xBB\xBF", 3) == 0)
+	{
+		m_pending.erase(0, 3);
+		m_mode = mode::utf8;
+		return;
+	}
+
+	if (bytes.size() >= 2)
+	{
+		const auto b0 = static_cast<uint8_t>(bytes[0]);
+		const auto b1 = static_cast<uint8_t>(bytes[1]);
+
+		if ((b0 == 0xFF && b1 == 0xFE) || (b0 == 0xFE && b1 == 0xFF))
+		{
+			m_mode = mode::whole;
+			return;
+		}
+	}
+
+	auto charset = charset_param(m_content_type);
+	if (charset.empty()) charset = sniff_meta_charset(bytes);
+
+	if (!charset.empty())
+	{
+		if (const auto cp = pf::charset_to_codepage(charset))
+		{
+			m_codepage = cp;
+			m_mode = cp == 65001 ? mode::utf8 : is_single_byte_codepage(cp) ? mode::single_byte : mode::whole;
+			return;
+		}
+	}
+
+	m_mode = mode::utf8_unlabelled;
+}
+
+void incremental_decoder::drain(std::string& out, const bool last)
+{
+	if (m_mode == mode::whole)
+	{
+		if (last)
+		{
+			out += decode_to_utf8(std::move(m_pending), m_content_type);
+			m_pending.clear();
+		}
+		return;
+	}
+
+	const size_t n = m_mode == mode::single_byte || last ? m_pending.size() : complete_utf8_prefix(m_pending);
+	const std::string_view piece(m_pending.data(), n);
+	if (piece.empty()) return;
+
+	switch (m_mode)
+	{
+	case mode::utf8:
+		// Clean pieces are adopted as they are; only damaged ones go through
+		// the platform's repair, as the whole body would have.
+		if (!m_codepage || is_valid_utf8(piece)) out.append(piece);
+		else append_transcoded(piece, m_codepage, out);
+		break;
+	case mode::utf8_unlabelled:
+		if (is_valid_utf8(piece))
+		{
+			out.append(piece);
+			break;
+		}
+		// Not UTF-8 after all. decode_to_utf8 would read the whole body as
+		// windows-1252; text already handed out is left as it was.
+		m_mode = mode::single_byte;
+		m_codepage = 1252;
+		[[fallthrough]];
+	case mode::single_byte:
+		append_transcoded(piece, m_codepage, out);
+		break;
+	default:
+		break;
+	}
+
+	m_pending.erase(0, n);
+}
+
+
+namespace
+{
+	// The validator decode_to_utf8 used before the vector one, kept to measure
+	// against.
+	bool is_valid_utf8_bytewise(const std::string_view s)
+	{
+		size_t i = 0;
+
+		while (i < s.size())
+		{
+			const auto b = static_cast<uint8_t>(s[i]);
+			size_t n;
+
+			if (b < 0x80) n = 1;
+			else if ((b & 0xE0) == 0xC0 && b >= 0xC2) n = 2;
+			else if ((b & 0xF0) == 0xE0) n = 3;
+			else if ((b & 0xF8) == 0xF0 && b <= 0xF4) n = 4;
+			else return false;
+
+			if (i + n > s.size()) return false;
+
+			for (size_t k = 1; k < n; ++k)
+			{
+				if (!pf::is_utf8_continuation(s[i + k])) return false;
+			}
+
+			i += n;
+		}
+
+		return true;
+	}
+
+	// About 1 MB made by repeating `unit`.
+	std::string bench_text(const std::string_view unit)
+	{
+		std::string text;
+		while (text.size() < 1024 * 1024) text.append(unit);
+		return text;
+	}
+
+	// Bytes per ns (GB/s) of f over `input`, repeated until ~100 ms pass.
+	template <typename F>
+	double gb_per_second(const std::string& input, F f)
+	{
+		size_t sink = 0;
+		size_t bytes = 0;
+		const auto started = std::chrono::steady_clock::now();
+		auto elapsed = std::chrono::steady_clock::duration();
+
+		while (elapsed < std::chrono::milliseconds(100))
+		{
+			sink += static_cast<size_t>(f(input));
+			bytes += input.size();
+			elapsed = std::chrono::steady_clock::now() - started;
+		}
+
+		[[maybe_unused]] static volatile size_t keep;
+		keep = sink;
+		return static_cast<double>(bytes) / std::chrono::duration<double, std::nano>(elapsed).count();
+	}
+}
+
+std::string run_decode_benchmark()
+{
+	std::string report = std::format("{:<20} {:>6} {:>10} {:>10} {:>8}\n", "path", "KB", "before", "after",
+	                                 "speedup");
+	const auto row = [&](const char* name, const std::string& input, const double before, const double after)
+	{
+		report += std::format("{:<20} {:>6} {:>10.2f} {:>10.2f} {:>7.1f}x\n", name, input.size() / 1024, before,
+		                      after, after / before);
+	};
+
+	const auto ascii = bench_text("<p class=\"note\">The quick brown fox jumps over the lazy dog.</p>\n");
+	const auto mixed = bench_text("<p>Caf\xC3\xA9 cr\xC3\xA8me \xE2\x80\x94 \xE4\xB8\xAD\xE6\x96\x87 "
+		"\xF0\x9F\x98\x80 na\xC3\xAFve r\xC3\xA9sum\xC3\xA9</p>\n");
+	const auto latin = bench_text("<p>Caf\xE9 cr\xE8me \x93quoted\x94 \x96 na\xEFve r\xE9sum\xE9</p>\n");
+
+	row("validate ascii", ascii,
+	    gb_per_second(ascii, is_valid_utf8_bytewise), gb_per_second(ascii, is_valid_utf8));
+	row("validate utf-8", mixed,
+	    gb_per_second(mixed, is_valid_utf8_bytewise), gb_per_second(mixed, is_valid_utf8));
+	row("windows-1252", latin,
+	    gb_per_second(latin, [](const std::string& s) { return pf::transcode_to_utf8(s, 1252).size(); }),
+	    gb_per_second(latin, [](const std::string& s) { return transcoded(s, 1252).size(); }));
+	row("iso-8859-2", latin,
+	    gb_per_second(latin, [](const std::string& s) { return pf::transcode_to_utf8(s, 28592).size(); }),
+	    gb_per_second(latin, [](const std::string& s) { return transcoded(s, 28592).size(); }));
+
+	// Before: validated, then copied out of the caller's buffer. After: the
+	// buffer is moved in and handed straight back, so it is reused each pass.
+	auto owned = mixed;
+	row("decode utf-8 page", mixed,
+	    gb_per_second(mixed, [](const std::string& s) { return is_valid_utf8_bytewise(s) ? std::string(s).size() : 0; }),
+	    gb_per_second(mixed, [&](const std::string&)
+	    {
+		    owned = decode_to_utf8(std::move(owned), "text/html");
+		    return owned.size();
+	    }));
+
+	return report + "GB/s; before is the byte-at-a-time validator, the platform transcoder, and a copy.\n";
+}
+
+
+std::string_view text_arena::store(const std::string_view text)
+{
+	if (text.empty()) return {};
+
+	if (text.size() > m_left)
+	{
+		// A string too big for a block gets one of its own, and the current
+		// block stays open for the short strings that follow.
+		const auto size = std::max(block_size, text.size());
+		m_blocks.push_back(std::make_unique<char[]>(size));
+		m_allocated += size;
+
+		if (size > block_size)
+		{
+			memcpy(m_blocks.back().get(), text.data(), text.size());
+			return {m_blocks.back().get(), text.size()};
+		}
+
+		m_next = m_blocks.back().get();
+		m_left = size;
+	}
+
+	memcpy(m_next, text.data(), text.size());
+	const std::string_view kept(m_next, text.size());
+	m_next += text.size();
+	m_left -= text.size();
+	return kept;
+}
+
+
+worker_pool::worker_pool(const unsigned threads)
+{
+	for (unsigned i = 0; i < std::max(1u, threads); ++i)
+	{
+		m_threads.emplace_back([this] { run(); });
+	}
+}
+
+worker_pool::~worker_pool()
+{
+	{
+		std::lock_guard lk(m_mutex);
+		m_stopping = true;
+		m_tasks.clear();
+	}
+	m_ready.notify_all();
+	for (auto& t : m_threads) t.join();
+}
+
+void worker_pool::post(std::function<void()> task)
+{
+	{
+		std::lock_guard lk(m_mutex);
+		if (m_stopping) return;
+		m_tasks.push_back(std::move(task));
+	}
+	m_ready.notify_one();
+}
+
+void worker_pool::run()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock lk(m_mutex);
+			m_ready.wait(lk, [this] { return m_stopping || !m_tasks.empty(); });
+			if (m_stopping) return;
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void parallel_for(const unsigned threads, const size_t count, const std::function<void(size_t)>& fn)
+{
+	std::atomic<size_t> next{0};
+	const auto work = [&]
+	{
+		for (auto i = next.fetch_add(1, std::memory_order_relaxed); i < count;
+		     i = next.fetch_add(1, std::memory_order_relaxed))
+		{
+			fn(i);
+		}
+	};
+
+	std::vector<std::thread> helpers;
+	const auto extra = count > 1 ? std::min<size_t>(std::max(1u, threads), count) - 1 : 0;
+	for (size_t t = 0; t < extra; ++t) helpers.emplace_back(work);
+	work();
+	for (auto& h : helpers) h.join();
 }
 
+namespace trace
+{
+	std::atomic<bool> g_on{false};
+
+	namespace
+	{
+		struct event
+		{
+			const char* name;
+			const char* category;
+			char phase; // 'X' span, 'C' counter
+			uint32_t thread;
+			int64_t start_ns;
+			int64_t value; // span length, or the counter's value
+			std::string detail;
+		};
+
+		std::mutex g_mutex;
+		std::vector<event> g_events;
+		std::string g_path;
+		int64_t g_origin = 0;
+
+		uint32_t thread_index()
+		{
+			static std::atomic<uint32_t> next{1};
+			thread_local const uint32_t index = next++;
+			return index;
+		}
+
+		void record(event e)
+		{
+			std::lock_guard lk(g_mutex);
+			if (on()) g_events.push_back(std::move(e));
+		}
+	}
+
+	int64_t now_ns()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void start(std::string path)
+	{
+		std::lock_guard lk(g_mutex);
+		g_events.clear();
+		g_path = std::move(path);
+		g_origin = now_ns();
+		g_on = true;
+	}
+
+	void complete(const char* name, const char* category, const int64_t start_ns, const int64_t end_ns,
+	              const std::string_view detail)
+	{
+		record({name, category, 'X', thread_index(), start_ns, end_ns - start_ns, std::string(detail)});
+	}
+
+	void counter(const char* name, const int64_t value)
+	{
+		if (on()) record({name, "counter", 'C', thread_index(), now_ns(), value, {}});
+	}
+
+	bool finish()
+	{
+		std::vector<event> events;
+		std::string path;
+		{
+			std::lock_guard lk(g_mutex);
+			if (!on()) return false;
+			g_on = false;
+			events.swap(g_events);
+			path.swap(g_path);
+		}
+
+		// Timestamps are microseconds; the fraction keeps nanosecond spans.
+		std::string out = "{\"traceEvents\":[";
+		for (size_t i = 0; i < events.size(); ++i)
+		{
+			const auto& e = events[i];
+			if (i) out += ",\n";
+			out += "{\"name\":";
+			append_json_string(out, e.name);
+			out += std::format(",\"cat\":\"{}\",\"ph\":\"{}\",\"pid\":1,\"tid\":{},\"ts\":{:.3f}",
+			                   e.category, e.phase, e.thread, static_cast<double>(e.start_ns - g_origin) / 1000.0);
+
+			if (e.phase == 'X')
+			{
+				out += std::format(",\"dur\":{:.3f}", static_cast<double>(e.value) / 1000.0);
+				if (!e.detail.empty())
+				{
+					out += ",\"args\":{\"detail\":";
+					append_json_string(out, e.detail);
+					out += '}';
+				}
+			}
+			else
+			{
+				out += std::format(",\"args\":{{\"value\":{}}}", e.value);
+			}
+			out += '}';
+		}
+		out += "],\"displayTimeUnit\":\"ms\"}\n";
+
+		std::ofstream file(path, std::ios::out | std::ios::binary);
+		file.write(out.data(), static_cast<std::streamsize>(out.size()));
+		return static_cast<bool>(file);
+	}
+}
+
+
+namespace alloc_stats
+{
+	std::atomic<bool> g_on{false};
+
+	namespace
+	{
+		std::atomic<uint64_t> g_count{0};
+		std::atomic<uint64_t> g_bytes{0};
+		std::atomic<int64_t> g_live{0};
+		std::atomic<int64_t> g_peak{0};
+		// Counting window; start() opens the next one. Zero means never counted.
+		std::atomic<uint32_t> g_window{0};
+
+		struct totals
+		{
+			const char* name;
+			uint64_t count;
+			uint64_t bytes;
+			int64_t peak;
+			int64_t retained;
+		};
+
+		// Fixed, so recording a stage never allocates while counting.
+		std::mutex g_mutex;
+		std::array<totals, 16> g_stages{};
+		size_t g_stage_count = 0;
+
+		int64_t block_size(void* p)
+		{
+#ifdef _WIN32
+			return static_cast<int64_t>(_msize(p));
+#else
+			return static_cast<int64_t>(malloc_usable_size(p));
+#endif
+		}
+	}
+
+	void start()
+	{
+		std::lock_guard lk(g_mutex);
+		g_stage_count = 0;
+		g_count = 0;
+		g_bytes = 0;
+		g_live = 0;
+		g_peak = 0;
+		if (++g_window == 0) ++g_window;
+		g_on = true;
+	}
+
+	void stop()
+	{
+		g_on = false;
+	}
+
+	void allocated(block_header* h, const size_t size)
+	{
+		h->window = g_window.load(std::memory_order_relaxed);
+		h->size = block_size(h);
+		g_count.fetch_add(1, std::memory_order_relaxed);
+		g_bytes.fetch_add(size, std::memory_order_relaxed);
+		const auto live = g_live.fetch_add(h->size, std::memory_order_relaxed) + h->size;
+		auto peak = g_peak.load(std::memory_order_relaxed);
+		while (live > peak && !g_peak.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	// A block from before start(), or from an earlier window, was never added
+	// to what is live now.
+	void freed(const block_header* h)
+	{
+		if (on() && h->window == g_window.load(std::memory_order_relaxed))
+		{
+			g_live.fetch_sub(h->size, std::memory_order_relaxed);
+		}
+	}
+
+	stage::stage(const char* name) : m_name(on() ? name : nullptr)
+	{
+		if (!m_name) return;
+		m_count = g_count;
+		m_bytes = g_bytes;
+		m_live = g_live;
+		// The peak restarts at what is live now; the outer stage's is put back
+		// at the end, raised by anything this one reached.
+		m_outer_peak = g_peak.exchange(m_live);
+	}
+
+	void stage::end()
+	{
+		if (!m_name) return;
+
+		const int64_t peak = g_peak;
+		const totals t{m_name, g_count - m_count, g_bytes - m_bytes, peak - m_live, g_live - m_live};
+		g_peak = std::max(peak, m_outer_peak);
+
+		std::lock_guard lk(g_mutex);
+		auto* const used = g_stages.data() + g_stage_count;
+		auto* row = std::find_if(g_stages.data(), used,
+		                         [&](const totals& r) { return std::strcmp(r.name, m_name) == 0; });
+		if (row == used)
+		{
+			if (g_stage_count == g_stages.size()) row = nullptr;
+			else g_stages[g_stage_count++] = {m_name, 0, 0, 0, 0};
+		}
+		if (row)
+		{
+			row->count += t.count;
+			row->bytes += t.bytes;
+			row->peak = std::max(row->peak, t.peak);
+			row->retained += t.retained;
+		}
+		m_name = nullptr;
+	}
+
+	std::string report()
+	{
+		std::lock_guard lk(g_mutex);
+		auto result = std::format("  {:<18} {:>10} {:>12} {:>12} {:>12}\n", "stage", "allocs", "KB", "peak KB",
+		                          "kept KB");
+		for (size_t i = 0; i < g_stage_count; ++i)
+		{
+			const auto& r = g_stages[i];
+			result += std::format("  {:<18} {:>10} {:>12.1f} {:>12.1f} {:>12.1f}\n", r.name, r.count,
+			                      r.bytes / 1024.0, r.peak / 1024.0, r.retained / 1024.0);
+		}
+		result += std::format("  {:<18} {:>10} {:>12.1f} {:>12.1f} {:>12.1f}\n", "total", g_count.load(),
+		                      g_bytes / 1024.0, g_peak / 1024.0, g_live / 1024.0);
+		return result;
+	}
+}
+
+namespace hw_counters
+{
+	namespace
+	{
+		struct totals
+		{
+			const char* name;
+			std::array<double, event_count> count;
+		};
+
+		// Written only by the thread that called start(), which alone counts.
+		std::array<int, event_count> g_fds = {-1, -1, -1, -1, -1};
+		std::atomic<bool> g_on = false;
+		std::thread::id g_owner;
+		std::string g_status = "not started";
+		std::array<totals, 8> g_stages{};
+		size_t g_stage_count = 0;
+
+#if defined(__linux__)
+		int open_event(perf_event_attr& attr)
+		{
+			// This thread only, on whichever CPU it runs.
+			return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+		}
+
+		// The tests swap this to stand in for a kernel with or without counters.
+		int (*g_open_event)(perf_event_attr&) = open_event;
+#endif
+
+		// Value, then the time the counter was enabled and actually counting;
+		// the two differ when the PMU is shared and the kernel multiplexes.
+		void read_counter(const int fd, uint64_t& raw, uint64_t& enabled, uint64_t& running)
+		{
+			uint64_t values[3] = {};
+#if defined(__linux__)
+			if (fd >= 0 && ::read(fd, values, sizeof(values)) != sizeof(values)) values[0] = 0;
+#endif
+			raw = values[0];
+			enabled = values[1];
+			running = values[2];
+		}
+	}
+
+	bool on() { return g_on; }
+
+	const std::string& status() { return g_status; }
+
+	bool start()
+	{
+		if (g_on) return true;
+		g_stage_count = 0;
+
+#if defined(__linux__)
+		struct event_config
+		{
+			uint32_t type;
+			uint64_t config;
+		};
+		constexpr event_config configs[event_count] = {
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+			{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+			                     PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+			{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+		};
+
+		int opened = 0;
+		int error = 0;
+		for (int i = 0; i < event_count; ++i)
+		{
+			perf_event_attr attr{};
+			attr.size = sizeof(attr);
+			attr.type = configs[i].type;
+			attr.config = configs[i].config;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			g_fds[i] = g_open_event(attr);
+			if (g_fds[i] >= 0) ++opened;
+			else error = errno;
+		}
+
+		if (!opened)
+		{
+			g_status = std::format("unavailable: perf_event_open failed ({}); see "
+			                       "/proc/sys/kernel/perf_event_paranoid", std::strerror(error));
+			return false;
+		}
+
+		g_status = opened == event_count ? "ok" : std::format("{} of {} events available", opened, +event_count);
+		g_owner = std::this_thread::get_id();
+		g_on = true;
+		return true;
+#else
+		g_status = "unavailable: hardware counters are read with perf_event_open, on Linux only";
+		return false;
+#endif
+	}
+
+	void stop()
+	{
+#if defined(__linux__)
+		for (auto& fd : g_fds)
+		{
+			if (fd >= 0) ::close(fd);
+			fd = -1;
+		}
+#endif
+		g_on = false;
+	}
+
+	void reset()
+	{
+		g_stage_count = 0;
+	}
+
+	// The counters follow the thread that opened them; a stage on any other
+	// would read that thread's counts, so it is not recorded.
+	stage::stage(const char* name) : m_name(g_on && std::this_thread::get_id() == g_owner ? name : nullptr)
+	{
+		if (!m_name) return;
+		for (int i = 0; i < event_count; ++i) read_counter(g_fds[i], m_raw[i], m_enabled[i], m_running[i]);
+	}
+
+	void stage::end()
+	{
+		if (!m_name) return;
+
+		std::array<double, event_count> delta{};
+		for (int i = 0; i < event_count; ++i)
+		{
+			uint64_t raw, enabled, running;
+			read_counter(g_fds[i], raw, enabled, running);
+			const auto ran = running - m_running[i];
+			// Scale up for the share of the stage the counter was multiplexed out.
+			if (ran) delta[i] = static_cast<double>(raw - m_raw[i]) * (enabled - m_enabled[i]) / ran;
+		}
+
+		auto* const used = g_stages.data() + g_stage_count;
+		auto* row = std::find_if(g_stages.data(), used,
+		                         [&](const totals& r) { return std::strcmp(r.name, m_name) == 0; });
+		if (row == used)
+		{
+			if (g_stage_count == g_stages.size()) row = nullptr;
+			else g_stages[g_stage_count++] = {m_name, {}};
+		}
+		if (row)
+		{
+			for (int i = 0; i < event_count; ++i) row->count[i] += delta[i];
+		}
+		m_name = nullptr;
+	}
+
+	std::string report(const size_t elements, const int runs)
+	{
+		if (!g_on) return std::format("Counters: {}\n", g_status);
+
+		const auto per_run = [&](const totals& r, const event e) { return r.count[e] / std::max(1, runs); };
+		const auto per_element = [&](const totals& r, const event e) -> std::string
+		{
+			if (g_fds[e] < 0) return "-";
+			return std::format("{:.2f}", per_run(r, e) / static_cast<double>(std::max<size_t>(1, elements)));
+		};
+
+		auto result = std::format("Counters per run, {} elements ({}):\n  {:<8} {:>14} {:>14} {:>6} {:>10} {:>10} "
+		                          "{:>10}\n", elements, g_status, "stage", "cycles", "instructions", "IPC",
+		                          "L1d/el", "LLC/el", "br-miss/el");
+		for (size_t i = 0; i < g_stage_count; ++i)
+		{
+			const auto& r = g_stages[i];
+			const auto c = per_run(r, cycles);
+			const auto n = per_run(r, instructions);
+			result += std::format("  {:<8} {:>14} {:>14} {:>6} {:>10} {:>10} {:>10}\n", r.name,
+			                      g_fds[cycles] < 0 ? std::string("-") : std::format("{:.0f}", c),
+			                      g_fds[instructions] < 0 ? std::string("-") : std::format("{:.0f}", n),
+			                      c > 0 && n > 0 ? std::format("{:.2f}", n / c) : std::string("-"),
+			                      per_element(r, l1d_misses), per_element(r, llc_misses),
+			                      per_element(r, branch_misses));
+		}
+		return result;
+	}
+}
+
+#ifdef POTATO_ALLOC_STATS
+// Replaced so --alloc-stats can count. Each block carries an
+// alloc_stats::block_header ahead of what is returned, so every form that
+// allocates or frees is replaced here: a runtime that supplies its own, as
+// the sanitizers do, would otherwise free a block without its header. The
+// aligned forms are left alone; they never reach these.
+void* operator new(const size_t size)
+{
+	alloc_stats::block_header* h;
+	while (!(h = static_cast<alloc_stats::block_header*>(std::malloc(sizeof(alloc_stats::block_header) + size))))
+	{
+		const auto handler = std::get_new_handler();
+		if (!handler) throw std::bad_alloc();
+		handler();
+	}
+	h->window = 0;
+	if (alloc_stats::on()) alloc_stats::allocated(h, size);
+	return h + 1;
+}
+
+void operator delete(void* p) noexcept
+{
+	if (!p) return;
+	auto* const h = static_cast<alloc_stats::block_header*>(p) - 1;
+	if (h->window) alloc_stats::freed(h);
+	std::free(h);
+}
+
+void* operator new[](const size_t size) { return operator new(size); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+void* operator new(const size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch (const std::bad_alloc&)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](const size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { operator delete(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { operator delete(p); }
+#endif
+
 
 std::vector<std::string> split_string(const std::string& strings, const char delim)
 {
@@ -286,7 +1870,7 @@ struct def_color
 	const char* rgb;
 };
 
-static def_color g_def_colors[] =
+static constexpr def_color g_def_colors[] =
 {
 	{"transparent", "rgba(0, 0, 0, 0)"},
 	{"AliceBlue", "#F0F8FF"},
@@ -434,10 +2018,14 @@ static def_color g_def_colors[] =
 	{"WhiteSmoke", "#F5F5F5"},
 	{"Yellow", "#FFFF00"},
 	{"YellowGreen", "#9ACD32"},
-	{nullptr, nullptr}
 };
 
-static std::map<const char*, web_color, ltstr> colorMap;
+static constexpr std::string_view color_name(const size_t i)
+{
+	return g_def_colors[i].name;
+}
+
+static constexpr perfect_hash<std::size(g_def_colors)> g_color_names(color_name, true);
 
 static bool can_parse(const char* str)
 {
@@ -625,12 +2213,16 @@ static web_color parse_rgb(const char* str)
 	return result;
 }
 
-static void load_names()
+// Parsed once on first use, since parse_rgb is not constexpr.
+static const web_color& named_color(const int index)
 {
-	for (int i = 0; g_def_colors[i].name; i++)
+	static const auto colors = []
 	{
-		colorMap[g_def_colors[i].name] = parse_rgb(g_def_colors[i].rgb);
-	}
+		std::array<web_color, std::size(g_def_colors)> result;
+		for (size_t i = 0; i < result.size(); ++i) result[i] = parse_rgb(g_def_colors[i].rgb);
+		return result;
+	}();
+	return colors[index];
 }
 
 web_color web_color::from_string(const char* str)
@@ -645,16 +2237,11 @@ web_color web_color::from_string(const char* str)
 		}
 		else
 		{
-			if (colorMap.empty())
-			{
-				load_names();
-			}
-
-			const auto found = colorMap.find(str);
+			const int found = g_color_names.find(str, color_name);
 
-			if (found != colorMap.end())
+			if (found >= 0)
 			{
-				result = found->second;
+				result = named_color(found);
 			}
 		}
 	}
@@ -662,6 +2249,13 @@ web_color web_color::from_string(const char* str)
 	return result;
 }
 
+std::vector<std::string> web_color::names()
+{
+	std::vector<std::string> result;
+	for (const auto& c : g_def_colors) result.emplace_back(c.name);
+	return result;
+}
+
 bool web_color::is_color(const char* str)
 {
 	if (can_parse(str))
@@ -669,12 +2263,7 @@ bool web_color::is_color(const char* str)
 		return true;
 	}
 
-	if (colorMap.empty())
-	{
-		load_names();
-	}
-
-	return colorMap.contains(str);
+	return str && g_color_names.find(str, color_name) >= 0;
 }
 
 
@@ -684,6 +2273,27 @@ static void should_find_value_index()
 	should::equal(8, index);
 }
 
+static void should_find_keywords_ignoring_case()
+{
+	should::equal(css_units_px, static_cast<css_units>(value_index("PX", css_units_strings, css_units_none)));
+	should::equal(-1, value_index("table-columns", style_display_strings));
+	should::EqualTrue(value_in_list("Inline-Flex", style_display_strings), "inline-flex");
+}
+
+static void should_find_every_named_color()
+{
+	for (const auto& name : web_color::names())
+	{
+		auto lower = name;
+		transform_text(lower, text_transform_lowercase);
+		should::EqualTrue(web_color::is_color(lower), name.c_str());
+	}
+
+	const auto navy = web_color::from_string("NAVY");
+	should::equal(128, static_cast<int>(navy.blue), "navy blue");
+	should::EqualTrue(!web_color::is_color("notacolor"), "unknown name");
+}
+
 static void should_pass_css_size()
 {
 	css_length sz;
@@ -693,13 +2303,133 @@ static void should_pass_css_size()
 	should::equal(css_units_em, sz.units());
 }
 
+static void should_validate_utf8_across_blocks()
+{
+	const std::pair<std::string_view, bool> cases[] = {
+		{"\xC3\xA9", true}, {"\xE2\x80\x94", true}, {"\xF0\x9F\x98\x80", true}, {"\xF4\x8F\xBF\xBF", true},
+		{"\xC3", false}, {"\xA9", false}, {"\xC0\xAF", false}, {"\xE0\x80\xAF", false},
+		{"\xED\xA0\x80", false}, {"\xF4\x90\x80\x80", false}, {"\xF8\x88\x80\x80\x80", false},
+		{"\xE2\x80", false}, {"\xC3\xA9\xA9", false},
+	};
+
+	// Each sequence at every offset around the 16- and 32-byte block edges.
+	for (const auto& [seq, valid] : cases)
+	{
+		for (size_t at = 0; at < 40; ++at)
+		{
+			auto text = std::string(at, 'a') + std::string(seq) + std::string(at % 7, 'b');
+			should::equal(valid, is_valid_utf8(text), std::format("offset {}", at).c_str());
+			should::equal(valid, is_valid_utf8_scalar(text), std::format("scalar offset {}", at).c_str());
+#if defined(CORE_X64_SIMD)
+			if (has_ssse3())
+			{
+				should::equal(valid, is_valid_utf8_ssse3(text), std::format("vector offset {}", at).c_str());
+			}
+#endif
+		}
+	}
+
+	// Single-byte pages convert without the platform, and UTF-8 is adopted.
+	should::equal("\xE2\x80\x9Chi\xE2\x80\x9D \xC5\x99", decode_to_utf8("\x93hi\x94 \xF8", "charset=windows-1250"));
+	should::equal("\xD0\x96", decode_to_utf8("\xB6", "charset=iso-8859-5"));
+}
+
+// Bench output names pages by file name, which may hold quotes or
+// backslashes; the baseline reader has to get the same name back.
+static void should_round_trip_json_strings()
+{
+	for (const std::string_view name : {"plain.html", "a \"quoted\" page.html", "dir\\page.htm", "tab\there", ""})
+	{
+		std::string json;
+		append_json_string(json, name);
+		should::equal(static_cast<int>(json.size()), static_cast<int>(json_string_length(json + ",\"next\":1")),
+		              "length stops at the close quote");
+		should::equal(std::string(name), read_json_string(json), "read back");
+	}
+}
+
+// One wchar_t per code point where it is 32 bits, a surrogate pair beyond
+// the BMP where it is 16.
+static void should_widen_utf8_by_code_point()
+{
+	const std::string text = "a\xE2\x82\xAC\xF0\x9F\x98\x80"; // a, euro sign, emoji
+	const auto wide = to_utf16(text);
+	should::equal(sizeof(wchar_t) == 4 ? 3 : 4, static_cast<int>(wide.size()), "units");
+	if (sizeof(wchar_t) == 4) should::equal(0x1F600, static_cast<int>(wide[2]), "code point");
+	should::equal(text, to_utf8(wide), "round trip");
+}
+
+// Freeing what was allocated before start(), or in an earlier window, must
+// not take the stage below zero.
+static void should_count_frees_only_for_counted_blocks()
+{
+	auto* const before = new std::string(4096, 'x');
+	alloc_stats::start();
+	auto* const earlier = new std::string(4096, 'y');
+	alloc_stats::start();
+	{
+		alloc_stats::stage stage("free uncounted");
+		delete before;
+		delete earlier;
+	}
+	alloc_stats::stop();
+	const auto row = std::format("  {:<18} {:>10} {:>12.1f} {:>12.1f} {:>12.1f}\n", "free uncounted", 0, 0.0, 0.0, 0.0);
+	should::EqualTrue(alloc_stats::report().find(row) != std::string::npos, "nothing released");
+}
+
+// With no counters a stage records nothing and the report says why; with
+// them each stage name gets one row, however often it runs.
+static void should_keep_counter_stages_by_name()
+{
+	hw_counters::stop();
+	hw_counters::reset();
+#if defined(__linux__)
+	hw_counters::g_open_event = [](perf_event_attr&) { errno = EACCES; return -1; };
+#endif
+	should::EqualTrue(!hw_counters::start(), "nothing opened");
+	should::EqualTrue(hw_counters::status().starts_with("unavailable: "), "reason given");
+	{
+		hw_counters::stage stage("layout");
+	}
+	should::equal("Counters: " + hw_counters::status() + "\n", hw_counters::report(10), "no rows");
+
+#if defined(__linux__)
+	// /dev/null reads as a counter that never moved.
+	hw_counters::g_open_event = [](perf_event_attr&) { return ::open("/dev/null", O_RDONLY | O_CLOEXEC); };
+	should::EqualTrue(hw_counters::start(), "opened");
+	should::equal("ok", hw_counters::status());
+	for (const auto* name : {"parse", "style", "parse", "layout"})
+	{
+		hw_counters::stage stage(name);
+	}
+	std::thread([] { hw_counters::stage stage("worker"); }).join();
+
+	const auto report = hw_counters::report(10);
+	should::equal(5, static_cast<int>(std::ranges::count(report, '\n')), "two header lines and three rows");
+	should::EqualTrue(report.find("  parse ") < report.find("  style ") &&
+	                  report.find("  style ") < report.find("  layout "), "first use order");
+	should::EqualTrue(report.find("worker") == std::string::npos, "other thread ignored");
+
+	hw_counters::reset();
+	should::equal(2, static_cast<int>(std::ranges::count(hw_counters::report(10), '\n')), "reset");
+	hw_counters::stop();
+	hw_counters::g_open_event = hw_counters::open_event;
+#endif
+}
 
 std::string run_tests()
 {
 	tests tests;
 
 	tests.register_test("Should find value index", should_find_value_index);
+	tests.register_test("Should find keywords ignoring case", should_find_keywords_ignoring_case);
+	tests.register_test("Should find every named color", should_find_every_named_color);
 	tests.register_test("Should pass css size", should_pass_css_size);
+	tests.register_test("Should validate utf-8 across blocks", should_validate_utf8_across_blocks);
+	tests.register_test("Should round-trip JSON strings", should_round_trip_json_strings);
+	tests.register_test("Should widen UTF-8 by code point", should_widen_utf8_by_code_point);
+	tests.register_test("Should count frees only for counted blocks", should_count_frees_only_for_counted_blocks);
+	tests.register_test("Should keep counter stages by name", should_keep_counter_stages_by_name);
 	register_scanner_tests(tests);
 	register_style_tests(tests);
 	register_layout_tests(tests);
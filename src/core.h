@@ -23,9 +23,30 @@ namespace sizing
 #define countof(dt) sizeof(::sizing::lengthof_impl(dt))
 }
 
+// What the platform layer offers beyond the interface every platform has.
+// platform-h offers neither; src/headless/platform.h turns both on. Engine
+// code branches on these rather than on the platform's macros.
+namespace pf
+{
+	// font_def::face may be a whole CSS family list.
+#ifdef PF_FONT_FACE_LIST
+	constexpr bool font_face_list = true;
+#else
+	constexpr bool font_face_list = false;
+#endif
+
+	// Text can be measured from several threads at once.
+#ifdef PF_CONCURRENT_TEXT
+	constexpr bool concurrent_text = true;
+#else
+	constexpr bool concurrent_text = false;
+#endif
+}
+
 
 class document;
 class element;
+struct position;
 
 // View host abstract interface (implemented by html_view in ui.h). Allows the
 // document layer to invoke layout/invalidate without depending on Win32.
@@ -35,12 +56,26 @@ public:
 	virtual ~view_host() = default;
 	virtual void layout() = 0;
 	virtual void invalidate() = 0;
+
+	// Repaint one box, in document coordinates.
+	virtual void invalidate_box(const position&)
+	{
+		invalidate();
+	}
+
 	virtual void open(const std::string& url) = 0;
 
 	virtual void diagnostic(const std::string&)
 	{
 	}
 
+	// False when diagnostics go nowhere, so figures only they report, such as
+	// estimates that cost a pass of their own, can be skipped.
+	virtual bool diagnostics_on() const
+	{
+		return false;
+	}
+
 	virtual void resource_started(const std::string&, const std::string&)
 	{
 	}
@@ -180,7 +215,195 @@ enum draw_flag
 	draw_positioned,
 };
 
-#define style_display_strings "none;block;inline;inline-block;list-item;table;table-caption;table-cell;table-column;table-column-group;table-footer-group;table-header-group;table-row;table-row-group;flex;inline-flex"
+// Compile-time perfect hashing for fixed keyword lists. The compiler builds
+// the table: keys are spread over buckets, and each bucket gets a seed that
+// puts all its keys in slots no other key uses. A lookup is then two hashes,
+// two array reads and one compare, however long the list.
+constexpr char ascii_lower(const char c)
+{
+	return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+constexpr uint32_t keyword_hash(const std::string_view s, const uint32_t seed, const bool fold)
+{
+	uint32_t h = 2166136261u ^ (seed * 0x9E3779B9u);
+	for (const char c : s)
+	{
+		h ^= static_cast<uint8_t>(fold ? ascii_lower(c) : c);
+		h *= 16777619u;
+	}
+	return h ^ (h >> 16);
+}
+
+constexpr bool keyword_equal(const std::string_view a, const std::string_view b, const bool fold)
+{
+	if (a.size() != b.size()) return false;
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		if (fold ? ascii_lower(a[i]) != ascii_lower(b[i]) : a[i] != b[i]) return false;
+	}
+	return true;
+}
+
+// Slots and bucket seeds for Count keys. Keys that are equal (ignoring case
+// when folding) share the slot of the first one, so lookups find the earliest
+// entry just as a linear scan would.
+template <size_t Count>
+struct perfect_hash
+{
+	static constexpr size_t slot_count = std::bit_ceil(Count * 2);
+	static constexpr size_t bucket_count = std::max<size_t>(1, std::bit_ceil(Count) / 2);
+
+	std::array<int16_t, slot_count> slots{};
+	std::array<uint16_t, bucket_count> seeds{};
+	bool fold = true;
+
+	constexpr perfect_hash() = default;
+
+	template <typename KeyAt>
+	consteval perfect_hash(const KeyAt key, const bool fold_case) : fold(fold_case)
+	{
+		slots.fill(-1);
+
+		// Keys grouped by bucket: members[first[b]] .. members[first[b + 1]].
+		std::array<uint16_t, bucket_count + 1> first{};
+		for (size_t i = 0; i < Count; ++i) ++first[bucket_of(key(i)) + 1];
+		for (size_t b = 0; b < bucket_count; ++b) first[b + 1] += first[b];
+
+		std::array<uint16_t, Count> members{};
+		std::array<uint16_t, bucket_count> filled{};
+		for (size_t i = 0; i < Count; ++i)
+		{
+			const auto b = bucket_of(key(i));
+			members[first[b] + filled[b]++] = static_cast<uint16_t>(i);
+		}
+
+		// Largest buckets first, while most slots are still free.
+		std::array<uint16_t, bucket_count> order{};
+		for (size_t b = 0; b < bucket_count; ++b) order[b] = static_cast<uint16_t>(b);
+		for (size_t i = 1; i < bucket_count; ++i)
+		{
+			for (size_t j = i; j > 0 && filled[order[j]] > filled[order[j - 1]]; --j)
+			{
+				std::swap(order[j], order[j - 1]);
+			}
+		}
+
+		std::array<size_t, Count> placed{};
+
+		for (const auto b : order)
+		{
+			if (!filled[b]) break;
+
+			for (uint16_t seed = 1;; ++seed)
+			{
+				size_t n = 0;
+				bool fits = true;
+
+				for (size_t m = first[b]; m < first[b + 1] && fits; ++m)
+				{
+					const auto i = members[m];
+					const auto s = keyword_hash(key(i), seed, fold) & (slot_count - 1);
+					if (slots[s] < 0)
+					{
+						slots[s] = static_cast<int16_t>(i);
+						placed[n++] = s;
+					}
+					else if (bucket_of(key(slots[s])) != b || !keyword_equal(key(slots[s]), key(i), fold))
+					{
+						fits = false;
+					}
+				}
+
+				if (fits)
+				{
+					seeds[b] = seed;
+					break;
+				}
+
+				while (n) slots[placed[--n]] = -1;
+			}
+		}
+	}
+
+	// Index of the key equal to val, or -1.
+	template <typename KeyAt>
+	constexpr int find(const std::string_view val, const KeyAt key) const
+	{
+		const auto seed = seeds[bucket_of(val)];
+		const int i = slots[keyword_hash(val, seed, fold) & (slot_count - 1)];
+		return i >= 0 && keyword_equal(key(i), val, fold) ? i : -1;
+	}
+
+private:
+	constexpr size_t bucket_of(const std::string_view s) const
+	{
+		return keyword_hash(s, 0, fold) & (bucket_count - 1);
+	}
+};
+
+constexpr size_t keyword_count(const std::string_view text)
+{
+	return text.empty() ? 0 : static_cast<size_t>(std::ranges::count(text, ';')) + 1;
+}
+
+// Calls f with each keyword of a ';'-separated list, at compile time if need be.
+template <typename F>
+constexpr void for_each_keyword(const std::string_view text, F f)
+{
+	for (size_t start = 0; start < text.size();)
+	{
+		const auto end = std::min(text.find(';', start), text.size());
+		f(text.substr(start, end - start));
+		start = end + 1;
+	}
+}
+
+// A ';'-separated keyword list with its perfect hash, all built at compile
+// time. find() gives the keyword's position in the list, ignoring case.
+template <size_t Count, size_t Length>
+class keyword_table
+{
+public:
+	consteval keyword_table(const char (&text)[Length])
+	{
+		std::copy_n(text, Length, m_text);
+
+		size_t start = 0;
+		size_t n = 0;
+		for (size_t i = 0; i < Length; ++i)
+		{
+			if (i == Length - 1 || text[i] == ';')
+			{
+				m_starts[n] = static_cast<uint16_t>(start);
+				m_lengths[n] = static_cast<uint8_t>(i - start);
+				++n;
+				start = i + 1;
+			}
+		}
+
+		m_hash = perfect_hash<Count>([this](const size_t i) { return key(i); }, true);
+	}
+
+	constexpr std::string_view key(const size_t i) const { return {m_text + m_starts[i], m_lengths[i]}; }
+	constexpr const char* c_str() const { return m_text; }
+	static constexpr size_t size() { return Count; }
+
+	constexpr int find(const std::string_view val) const
+	{
+		return m_hash.find(val, [this](const size_t i) { return key(i); });
+	}
+
+private:
+	char m_text[Length]{};
+	std::array<uint16_t, Count> m_starts{};
+	std::array<uint8_t, Count> m_lengths{};
+	perfect_hash<Count> m_hash;
+};
+
+#define keyword_list(name, text) inline constexpr keyword_table<keyword_count(text), sizeof(text)> name{text}
+
+keyword_list(style_display_strings, "none;block;inline;inline-block;list-item;table;table-caption;table-cell;table-column;table-column-group;table-footer-group;table-header-group;table-row;table-row-group;flex;inline-flex");
 
 enum style_display
 {
@@ -203,7 +426,7 @@ enum style_display
 	display_inline_text,
 };
 
-#define flex_direction_strings "row;row-reverse;column;column-reverse"
+keyword_list(flex_direction_strings, "row;row-reverse;column;column-reverse");
 
 enum flex_direction
 {
@@ -213,7 +436,7 @@ enum flex_direction
 	flex_direction_column_reverse,
 };
 
-#define flex_wrap_strings "nowrap;wrap;wrap-reverse"
+keyword_list(flex_wrap_strings, "nowrap;wrap;wrap-reverse");
 
 enum flex_wrap
 {
@@ -222,7 +445,7 @@ enum flex_wrap
 	flex_wrap_wrap_reverse,
 };
 
-#define flex_justify_content_strings "flex-start;flex-end;center;space-between;space-around;space-evenly"
+keyword_list(flex_justify_content_strings, "flex-start;flex-end;center;space-between;space-around;space-evenly");
 
 enum flex_justify_content
 {
@@ -234,7 +457,7 @@ enum flex_justify_content
 	flex_justify_content_space_evenly,
 };
 
-#define flex_align_items_strings "stretch;flex-start;flex-end;center;baseline"
+keyword_list(flex_align_items_strings, "stretch;flex-start;flex-end;center;baseline");
 
 enum flex_align_items
 {
@@ -245,7 +468,7 @@ enum flex_align_items
 	flex_align_items_baseline,
 };
 
-#define font_size_strings "xx-small;x-small;small;medium;large;x-large;xx-large;smaller;larger"
+keyword_list(font_size_strings, "xx-small;x-small;small;medium;large;x-large;xx-large;smaller;larger");
 
 enum font_size
 {
@@ -260,7 +483,7 @@ enum font_size
 	font_size_larger,
 };
 
-#define font_style_strings "normal;italic"
+keyword_list(font_style_strings, "normal;italic");
 
 enum font_style
 {
@@ -268,7 +491,7 @@ enum font_style
 	font_style_italic
 };
 
-#define font_variant_strings "normal;small-caps"
+keyword_list(font_variant_strings, "normal;small-caps");
 
 enum font_variant
 {
@@ -276,7 +499,7 @@ enum font_variant
 	font_variant_small_caps
 };
 
-#define font_weight_strings "normal;bold;bolder;lighter;100;200;300;400;500;600;700"
+keyword_list(font_weight_strings, "normal;bold;bolder;lighter;100;200;300;400;500;600;700");
 
 enum font_weight
 {
@@ -293,7 +516,7 @@ enum font_weight
 	font_weight_700
 };
 
-#define list_style_type_strings "none;circle;disc;square;armenian;cjk-ideographic;decimal;decimal-leading-zero;georgian;hebrew;hiragana;hiragana-iroha;katakana;katakana-iroha;lower-alpha;lower-greek;lower-latin;lower-roman;upper-alpha;upper-latin;upper-roman"
+keyword_list(list_style_type_strings, "none;circle;disc;square;armenian;cjk-ideographic;decimal;decimal-leading-zero;georgian;hebrew;hiragana;hiragana-iroha;katakana;katakana-iroha;lower-alpha;lower-greek;lower-latin;lower-roman;upper-alpha;upper-latin;upper-roman");
 
 enum list_style_type
 {
@@ -320,7 +543,7 @@ enum list_style_type
 	list_style_type_upper_roman,
 };
 
-#define list_style_position_strings "inside;outside"
+keyword_list(list_style_position_strings, "inside;outside");
 
 enum list_style_position
 {
@@ -328,7 +551,7 @@ enum list_style_position
 	list_style_position_outside
 };
 
-#define vertical_align_strings "baseline;sub;super;top;text-top;middle;bottom;text-bottom"
+keyword_list(vertical_align_strings, "baseline;sub;super;top;text-top;middle;bottom;text-bottom");
 
 enum vertical_align
 {
@@ -342,7 +565,7 @@ enum vertical_align
 	va_text_bottom
 };
 
-#define border_width_strings "thin;medium;thick"
+keyword_list(border_width_strings, "thin;medium;thick");
 
 enum border_width
 {
@@ -351,7 +574,7 @@ enum border_width
 	border_width_thick
 };
 
-#define border_style_strings "none;hidden;dotted;dashed;solid;double;groove;ridge;inset;outset"
+keyword_list(border_style_strings, "none;hidden;dotted;dashed;solid;double;groove;ridge;inset;outset");
 
 enum border_style
 {
@@ -367,7 +590,7 @@ enum border_style
 	border_style_outset
 };
 
-#define element_float_strings "none;left;right"
+keyword_list(element_float_strings, "none;left;right");
 
 enum element_float
 {
@@ -376,7 +599,7 @@ enum element_float
 	float_right
 };
 
-#define element_clear_strings "none;left;right;both"
+keyword_list(element_clear_strings, "none;left;right;both");
 
 enum element_clear
 {
@@ -386,7 +609,7 @@ enum element_clear
 	clear_both
 };
 
-#define css_units_strings "none;%;in;cm;mm;em;ex;pt;pc;px;dpi;dpcm;rem;vw;vh;vmin;vmax"
+keyword_list(css_units_strings, "none;%;in;cm;mm;em;ex;pt;pc;px;dpi;dpcm;rem;vw;vh;vmin;vmax");
 
 enum css_units
 {
@@ -409,7 +632,7 @@ enum css_units
 	css_units_vmax,
 };
 
-#define background_attachment_strings "scroll;fixed"
+keyword_list(background_attachment_strings, "scroll;fixed");
 
 enum background_attachment
 {
@@ -417,7 +640,7 @@ enum background_attachment
 	background_attachment_fixed
 };
 
-#define background_repeat_strings "repeat;repeat-x;repeat-y;no-repeat"
+keyword_list(background_repeat_strings, "repeat;repeat-x;repeat-y;no-repeat");
 
 enum background_repeat
 {
@@ -427,7 +650,7 @@ enum background_repeat
 	background_repeat_no_repeat
 };
 
-#define background_box_strings "border-box;padding-box;content-box"
+keyword_list(background_box_strings, "border-box;padding-box;content-box");
 
 enum background_box
 {
@@ -436,7 +659,7 @@ enum background_box
 	background_box_content
 };
 
-#define element_position_strings "static;relative;absolute;fixed"
+keyword_list(element_position_strings, "static;relative;absolute;fixed");
 
 enum element_position
 {
@@ -446,7 +669,7 @@ enum element_position
 	element_position_fixed,
 };
 
-#define text_align_strings "left;right;center;justify"
+keyword_list(text_align_strings, "left;right;center;justify");
 
 enum text_align
 {
@@ -456,7 +679,7 @@ enum text_align
 	text_align_justify
 };
 
-#define text_transform_strings "none;capitalize;uppercase;lowercase"
+keyword_list(text_transform_strings, "none;capitalize;uppercase;lowercase");
 
 enum text_transform
 {
@@ -466,7 +689,7 @@ enum text_transform
 	text_transform_lowercase
 };
 
-#define white_space_strings "normal;nowrap;pre;pre-line;pre-wrap"
+keyword_list(white_space_strings, "normal;nowrap;pre;pre-line;pre-wrap");
 
 enum white_space
 {
@@ -477,7 +700,7 @@ enum white_space
 	white_space_pre_wrap
 };
 
-#define overflow_strings "visible;hidden;scroll;auto;no-display;no-content"
+keyword_list(overflow_strings, "visible;hidden;scroll;auto;no-display;no-content");
 
 enum overflow
 {
@@ -489,7 +712,7 @@ enum overflow
 	overflow_no_content
 };
 
-#define background_size_strings "auto;cover;contain"
+keyword_list(background_size_strings, "auto;cover;contain");
 
 enum background_size
 {
@@ -498,7 +721,7 @@ enum background_size
 	background_size_contain,
 };
 
-#define visibility_strings "visible;hidden;collapse"
+keyword_list(visibility_strings, "visible;hidden;collapse");
 
 enum visibility
 {
@@ -507,7 +730,7 @@ enum visibility
 	visibility_collapse,
 };
 
-#define border_collapse_strings "collapse;separate"
+keyword_list(border_collapse_strings, "collapse;separate");
 
 enum border_collapse
 {
@@ -516,7 +739,7 @@ enum border_collapse
 };
 
 
-#define pseudo_class_strings "only-child;only-of-type;first-child;first-of-type;last-child;last-of-type;nth-child;nth-of-type;nth-last-child;nth-last-of-type;not;root"
+keyword_list(pseudo_class_strings, "only-child;only-of-type;first-child;first-of-type;last-child;last-of-type;nth-child;nth-of-type;nth-last-child;nth-last-of-type;not;root");
 
 enum pseudo_class
 {
@@ -534,7 +757,7 @@ enum pseudo_class
 	pseudo_class_root,
 };
 
-#define content_property_string "none;normal;open-quote;close-quote;no-open-quote;no-close-quote"
+keyword_list(content_property_string, "none;normal;open-quote;close-quote;no-open-quote;no-close-quote");
 
 enum content_property
 {
@@ -623,7 +846,7 @@ public:
 };
 
 
-#define media_orientation_strings "portrait;landscape"
+keyword_list(media_orientation_strings, "portrait;landscape");
 
 enum media_orientation
 {
@@ -631,7 +854,7 @@ enum media_orientation
 	media_orientation_landscape,
 };
 
-#define media_feature_strings "none;width;min-width;max-width;height;min-height;max-height;device-width;min-device-width;max-device-width;device-height;min-device-height;max-device-height;orientation;aspect-ratio;min-aspect-ratio;max-aspect-ratio;device-aspect-ratio;min-device-aspect-ratio;max-device-aspect-ratio;color;min-color;max-color;color-index;min-color-index;max-color-index;monochrome;min-monochrome;max-monochrome;resolution;min-resolution;max-resolution"
+keyword_list(media_feature_strings, "none;width;min-width;max-width;height;min-height;max-height;device-width;min-device-width;max-device-width;device-height;min-device-height;max-device-height;orientation;aspect-ratio;min-aspect-ratio;max-aspect-ratio;device-aspect-ratio;min-device-aspect-ratio;max-device-aspect-ratio;color;min-color;max-color;color-index;min-color-index;max-color-index;monochrome;min-monochrome;max-monochrome;resolution;min-resolution;max-resolution");
 
 enum media_feature
 {
@@ -680,7 +903,7 @@ enum media_feature
 	media_feature_max_resolution,
 };
 
-#define box_sizing_strings "content-box;border-box"
+keyword_list(box_sizing_strings, "content-box;border-box");
 
 enum box_sizing
 {
@@ -689,7 +912,7 @@ enum box_sizing
 };
 
 
-#define media_type_strings "none;all;screen;print;braille;embossed;handheld;projection;speech;tty;tv"
+keyword_list(media_type_strings, "none;all;screen;print;braille;embossed;handheld;projection;speech;tty;tv");
 
 enum media_type
 {
@@ -733,9 +956,6 @@ enum render_type
 	render_fixed_only,
 };
 
-// List of the Void Elements (can't have any contents)
-const auto void_elements = "area;base;br;col;command;embed;hr;img;input;keygen;link;meta;param;source;track;wbr";
-
 
 class size_i;
 class point_i;
@@ -1185,6 +1405,85 @@ inline void trim(std::string& s)
 	s.erase(std::find_if(s.rbegin(), s.rend(), [](const int ch) { return !is_space_char(ch); }).base(), s.end());
 }
 
+// Appends value as a quoted JSON string.
+inline void append_json_string(std::string& out, const std::string_view value)
+{
+	out.push_back('"');
+	for (const unsigned char c : value)
+	{
+		switch (c)
+		{
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\b': out += "\\b"; break;
+		case '\f': out += "\\f"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (c < 0x20) out += std::format("\\u{:04x}", c);
+			else out.push_back(static_cast<char>(c));
+			break;
+		}
+	}
+	out.push_back('"');
+}
+
+// The text of a quoted JSON string value, escapes decoded.
+inline std::string read_json_string(const std::string_view raw)
+{
+	std::string result;
+	if (raw.size() < 2 || raw.front() != '"') return result;
+
+	for (size_t i = 1; i + 1 < raw.size(); ++i)
+	{
+		if (raw[i] != '\\' || i + 2 >= raw.size())
+		{
+			result += raw[i];
+			continue;
+		}
+
+		switch (const auto c = raw[++i])
+		{
+		case 'b': result += '\b'; break;
+		case 'f': result += '\f'; break;
+		case 'n': result += '\n'; break;
+		case 'r': result += '\r'; break;
+		case 't': result += '\t'; break;
+		case 'u':
+			{
+				auto cp = static_cast<char32_t>(std::strtoul(std::string(raw.substr(i + 1, 4)).c_str(), nullptr, 16));
+				i += 4;
+
+				if (cp >= 0xD800 && cp < 0xDC00 && raw.substr(i + 1, 2) == "\\u")
+				{
+					const auto low = std::strtoul(std::string(raw.substr(i + 3, 4)).c_str(), nullptr, 16);
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+					i += 6;
+				}
+
+				pf::char32_to_utf8(std::back_inserter(result), cp);
+				break;
+			}
+		default: result += c; break;
+		}
+	}
+
+	return result;
+}
+
+// Length of the quoted JSON string at the start of text, quotes included;
+// the whole of text if it is not closed.
+inline size_t json_string_length(const std::string_view text)
+{
+	for (size_t i = 1; i < text.size(); ++i)
+	{
+		if (text[i] == '\\') ++i;
+		else if (text[i] == '"') return i + 1;
+	}
+	return text.size();
+}
+
 inline std::string trimmed(__in const std::string& ss)
 {
 	auto s = ss;
@@ -1252,6 +1551,8 @@ inline void transform_text(std::string& text, const text_transform tt)
 		for (auto& ch : text)
 			ch = tolower(ch);
 		break;
+	case text_transform_none:
+		break;
 	}
 }
 
@@ -1355,6 +1656,19 @@ struct ltstr_sv
 int value_index(std::string_view val, const char* strings, int defValue = -1, char delim = ';');
 bool value_in_list(std::string_view val, const char* strings, char delim = ';');
 
+template <size_t Count, size_t Length>
+int value_index(const std::string_view val, const keyword_table<Count, Length>& keywords, const int defValue = -1)
+{
+	const int i = keywords.find(val);
+	return i >= 0 ? i : defValue;
+}
+
+template <size_t Count, size_t Length>
+bool value_in_list(const std::string_view val, const keyword_table<Count, Length>& keywords)
+{
+	return keywords.find(val) >= 0;
+}
+
 std::string::size_type find_close_bracket(const std::string& s, std::string::size_type off, char open_b = '(',
                                           char close_b = ')');
 
@@ -1408,6 +1722,9 @@ struct web_color
 
 	static bool is_color(const char* str);
 	static bool is_color(const std::string& str) { return is_color(str.c_str()); };
+
+	// Every named color, as spelled in the table.
+	static std::vector<std::string> names();
 };
 
 
@@ -1529,6 +1846,18 @@ public:
 	}
 
 	void fromString(const std::string& str, const char* predefs = "", const int defValue = 0)
+	{
+		parse_length(str, value_index(str, predefs, -1), defValue);
+	}
+
+	template <size_t Count, size_t Length>
+	void fromString(const std::string& str, const keyword_table<Count, Length>& predefs, const int defValue = 0)
+	{
+		parse_length(str, predefs.find(str), defValue);
+	}
+
+	// predef is the keyword index of str, or -1 when it is not a keyword.
+	void parse_length(const std::string& str, const int predef, const int defValue)
 	{
 		if (str.size() > 5 && str.substr(0, 4) == "calc")
 		{
@@ -1536,8 +1865,6 @@ public:
 			return;
 		}
 
-		const int predef = value_index(str, predefs, -1);
-
 		if (predef >= 0)
 		{
 			m_is_predefined = true;
@@ -1854,8 +2181,328 @@ inline int round_d(const double val)
 // Decode a byte buffer into UTF-8. The encoding is taken from (in order): a
 // byte-order mark, the HTTP Content-Type charset, a <meta charset> in the
 // leading bytes, and finally a UTF-8 validity check with a windows-1252
-// fallback.
-std::string decode_to_utf8(std::string_view bytes, std::string_view content_type);
+// fallback. Bytes that are already UTF-8 come back in the buffer passed in, so
+// a caller that moves it in pays for no copy.
+std::string decode_to_utf8(std::string bytes, std::string_view content_type);
+
+// Throughput of UTF-8 validation, single-byte transcoding and decode_to_utf8,
+// each against the code it replaced, as a printable table.
+std::string run_decode_benchmark();
+
+// Piecewise counterpart of decode_to_utf8, for a body that arrives over the
+// network. Text is withheld until the encoding is settled by the leading 1024
+// bytes, where a <meta charset> has to appear, and a character split between
+// two pieces is carried over to the next. Encodings that cannot be cut at an
+// arbitrary byte are buffered and decoded whole by finish().
+class incremental_decoder
+{
+public:
+	explicit incremental_decoder(const std::string_view content_type) : m_content_type(content_type)
+	{
+	}
+
+	// Appends whatever text is now safe to parse to `out`.
+	void push(std::string_view bytes, std::string& out);
+
+	// Appends the remainder once the last byte has arrived.
+	void finish(std::string& out);
+
+private:
+	enum class mode { sniffing, utf8, utf8_unlabelled, single_byte, whole };
+
+	std::string m_content_type;
+	std::string m_pending; // bytes not yet decoded
+	mode m_mode = mode::sniffing;
+	uint32_t m_codepage = 0; // 0 for a byte-order-marked UTF-8 body
+
+	void choose_mode();
+	void drain(std::string& out, bool last);
+};
+
+// Vector that holds its first N items inline, for the short lists every
+// element carries. Only for trivially copyable items.
+template <typename T, size_t N>
+class small_vector
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+
+public:
+	small_vector() = default;
+
+	small_vector(const small_vector& other) { *this = other; }
+
+	small_vector& operator=(const small_vector& other)
+	{
+		if (this != &other)
+		{
+			m_size = 0;
+			reserve(other.m_size);
+			std::copy_n(other.data(), other.m_size, data());
+			m_size = other.m_size;
+		}
+		return *this;
+	}
+
+	size_t heap_bytes() const { return m_heap ? m_capacity * sizeof(T) : 0; }
+
+	T* data() { return m_heap ? m_heap.get() : m_inline; }
+	const T* data() const { return m_heap ? m_heap.get() : m_inline; }
+	T* begin() { return data(); }
+	T* end() { return data() + m_size; }
+	const T* begin() const { return data(); }
+	const T* end() const { return data() + m_size; }
+	size_t size() const { return m_size; }
+	bool empty() const { return m_size == 0; }
+	T& operator[](const size_t i) { return data()[i]; }
+	const T& operator[](const size_t i) const { return data()[i]; }
+
+	void push_back(const T& item)
+	{
+		if (m_size == m_capacity) reserve(m_capacity * 2);
+		data()[m_size++] = item;
+	}
+
+	void reserve(const size_t capacity)
+	{
+		if (capacity <= m_capacity) return;
+
+		auto heap = std::make_unique<T[]>(capacity);
+		std::copy_n(data(), m_size, heap.get());
+		m_heap = std::move(heap);
+		m_capacity = capacity;
+	}
+
+private:
+	T m_inline[N]{};
+	std::unique_ptr<T[]> m_heap;
+	size_t m_size = 0;
+	size_t m_capacity = N;
+};
+
+// Append-only store for short strings that have to outlive the buffer they
+// came from. Blocks are never moved or freed before the arena is, so a view
+// handed out by store() stays valid for the arena's lifetime.
+class text_arena
+{
+public:
+	std::string_view store(std::string_view text);
+
+	// Bytes allocated for blocks so far.
+	size_t allocated() const { return m_allocated; }
+
+private:
+	static constexpr size_t block_size = 16 * 1024;
+
+	std::vector<std::unique_ptr<char[]>> m_blocks;
+	char* m_next = nullptr;
+	size_t m_left = 0;
+	size_t m_allocated = 0;
+};
+
+// Fixed set of background threads running queued work in arrival order. The
+// destructor drops work that has not started and waits for the rest.
+class worker_pool
+{
+public:
+	explicit worker_pool(unsigned threads);
+	~worker_pool();
+
+	worker_pool(const worker_pool&) = delete;
+	worker_pool& operator=(const worker_pool&) = delete;
+
+	void post(std::function<void()> task);
+
+private:
+	std::mutex m_mutex;
+	std::condition_variable m_ready;
+	std::deque<std::function<void()>> m_tasks;
+	std::vector<std::thread> m_threads;
+	bool m_stopping = false;
+
+	void run();
+};
+
+// Calls fn(i) for every i below count, on up to `threads` threads counting the
+// caller. Indexes are handed out in order as threads come free, so uneven work
+// balances itself; returns once every call has.
+void parallel_for(unsigned threads, size_t count, const std::function<void(size_t)>& fn);
+
+// Chrome trace-event recording for --trace. Nothing is recorded until start();
+// until then a zone costs one relaxed load, and names are string literals so
+// nothing is formatted or allocated on the way in.
+namespace trace
+{
+	extern std::atomic<bool> g_on;
+
+	inline bool on() { return g_on.load(std::memory_order_relaxed); }
+
+	// Begins recording events for the file finish() writes.
+	void start(std::string path);
+
+	// Writes what was recorded as Chrome/Perfetto trace JSON and stops
+	// recording. False when nothing was recording or the file cannot be written.
+	bool finish();
+
+	int64_t now_ns();
+
+	// One span, for work that starts and ends in different places.
+	void complete(const char* name, const char* category, int64_t start_ns, int64_t end_ns,
+	              std::string_view detail = {});
+	void counter(const char* name, int64_t value);
+
+	// A span covering the enclosing scope. A null name records nothing.
+	class zone
+	{
+	public:
+		explicit zone(const char* name, const char* category = "potato") :
+			m_name(on() ? name : nullptr), m_category(category)
+		{
+			if (m_name) m_start = now_ns();
+		}
+
+		~zone()
+		{
+			if (m_name) complete(m_name, m_category, m_start, now_ns(), m_detail);
+		}
+
+		zone(const zone&) = delete;
+		zone& operator=(const zone&) = delete;
+
+		// Shown as the span's argument, e.g. the URL a fetch was for.
+		void detail(const std::string_view text)
+		{
+			if (m_name) m_detail = text;
+		}
+
+	private:
+		const char* m_name;
+		const char* m_category;
+		int64_t m_start = 0;
+		std::string m_detail;
+	};
+}
+
+
+// Objects of one kind and the bytes they hold, for memory reports.
+struct memory_use
+{
+	size_t count = 0;
+	size_t bytes = 0;
+
+	void add(const size_t n, const size_t b)
+	{
+		count += n;
+		bytes += b;
+	}
+};
+
+// What a string holds beyond its own object: nothing while it fits the
+// small-string buffer.
+inline size_t heap_bytes(const std::string& s)
+{
+	return s.capacity() > std::string().capacity() ? s.capacity() + 1 : 0;
+}
+
+// Heap accounting for --alloc-stats. Built with POTATO_ALLOC_STATS, which only
+// potato-headless is, the global operator new and delete in core.cpp count
+// while start() is in effect; otherwise each pays one relaxed load. Live bytes
+// are the allocator's block sizes, so they include its rounding and the header
+// below. The counts are process-wide.
+namespace alloc_stats
+{
+#ifdef POTATO_ALLOC_STATS
+	constexpr bool available = true;
+#else
+	constexpr bool available = false; // stages are kept, but nothing is counted
+#endif
+
+	extern std::atomic<bool> g_on;
+
+	inline bool on() { return g_on.load(std::memory_order_relaxed); }
+
+	// Ahead of every block operator new returns. A free is counted only when
+	// the window that allocated the block is still the one counting.
+	struct alignas(std::max_align_t) block_header
+	{
+		int64_t size; // allocator block size, read once when counted
+		uint32_t window; // zero when allocated while not counting
+	};
+
+	// Clears the stage table and starts counting in a new window.
+	void start();
+	void stop();
+
+	void allocated(block_header* h, size_t size);
+	void freed(const block_header* h);
+
+	// Allocations, bytes and peak live bytes over a stage, added to the row of
+	// that name. Stages may nest; an outer one includes its inner ones.
+	class stage
+	{
+	public:
+		explicit stage(const char* name);
+		~stage() { end(); }
+
+		stage(const stage&) = delete;
+		stage& operator=(const stage&) = delete;
+
+		// Closes the stage before the scope does, when what it measured
+		// declares objects the rest of the function uses.
+		void end();
+
+	private:
+		const char* m_name;
+		uint64_t m_count = 0;
+		uint64_t m_bytes = 0;
+		int64_t m_live = 0;
+		int64_t m_outer_peak = 0;
+	};
+
+	// One line per stage in the order they first ran, then the total.
+	std::string report();
+}
+
+// Hardware counters per stage for --counters, read with perf_event_open on
+// Linux. Elsewhere, or where the kernel refuses (perf_event_paranoid, most
+// VMs), start() says why and every stage is a null check.
+namespace hw_counters
+{
+	enum event { cycles, instructions, l1d_misses, llc_misses, branch_misses, event_count };
+
+	bool on();
+
+	// Opens the counters for the calling thread; stages on other threads are
+	// not recorded. False, with the reason in status(), when none could be
+	// opened; events missing on their own are reported as "-".
+	bool start();
+	void stop();
+	const std::string& status();
+
+	// Clears the stage table, e.g. between the warmup and timed runs.
+	void reset();
+
+	// Counts over a stage, added to the row of that name.
+	class stage
+	{
+	public:
+		explicit stage(const char* name);
+		~stage() { end(); }
+
+		stage(const stage&) = delete;
+		stage& operator=(const stage&) = delete;
+
+		void end();
+
+	private:
+		const char* m_name;
+		std::array<uint64_t, event_count> m_raw{};
+		std::array<uint64_t, event_count> m_enabled{};
+		std::array<uint64_t, event_count> m_running{};
+	};
+
+	// Per run: cycles, instructions and IPC per stage, and misses per element.
+	std::string report(size_t elements, int runs = 1);
+}
 
 
 class should
@@ -113,74 +113,306 @@ namespace
 
 		return std::make_shared<pf::bitmap>(bitmap_width, bitmap_height, std::move(pixels));
 	}
+
+	int64_t bitmap_bytes(const pf::bitmap& bm)
+	{
+		return static_cast<int64_t>(bm.width) * bm.height * sizeof(uint32_t);
+	}
+
+	// Box filter: each output pixel is the average of the source pixels it
+	// covers, channel by channel.
+	pf::bitmap_ptr downscale_bitmap(const pf::bitmap& src, const int width, const int height)
+	{
+		std::vector<uint32_t> pixels(static_cast<size_t>(width) * height);
+
+		for (int y = 0; y < height; ++y)
+		{
+			const int y0 = y * src.height / height;
+			const int y1 = std::max(y0 + 1, (y + 1) * src.height / height);
+
+			for (int x = 0; x < width; ++x)
+			{
+				const int x0 = x * src.width / width;
+				const int x1 = std::max(x0 + 1, (x + 1) * src.width / width);
+				uint64_t sum[4] = {};
+
+				for (int sy = y0; sy < y1; ++sy)
+				{
+					const auto* row = src.pixels.data() + static_cast<size_t>(sy) * src.width;
+					for (int sx = x0; sx < x1; ++sx)
+					{
+						for (int c = 0; c < 4; ++c) sum[c] += (row[sx] >> (c * 8)) & 0xff;
+					}
+				}
+
+				const uint64_t count = static_cast<uint64_t>(y1 - y0) * (x1 - x0);
+				uint32_t result = 0;
+				for (int c = 0; c < 4; ++c) result |= static_cast<uint32_t>(sum[c] / count) << (c * 8);
+				pixels[static_cast<size_t>(y) * width + x] = result;
+			}
+		}
+
+		return std::make_shared<pf::bitmap>(width, height, std::move(pixels));
+	}
+
+	// Shared by every document; decoding is CPU-bound, so a few threads are
+	// plenty and leave the UI thread a core.
+	worker_pool& image_decoders()
+	{
+		static worker_pool pool(std::clamp(std::thread::hardware_concurrency() / 2, 1u, 4u));
+		return pool;
+	}
 }
 
+// A downloaded image file. Deleted when the decode task is done with it (or
+// dropped unrun at shutdown), or with the page if it is kept to decode again.
+struct owned_temp_file
+{
+	std::string path;
+
+	explicit owned_temp_file(std::string p) : path(std::move(p))
+	{
+	}
+
+	owned_temp_file(const owned_temp_file&) = delete;
+	owned_temp_file& operator=(const owned_temp_file&) = delete;
+	~owned_temp_file() { pf::platform_delete_file(pf::file_path(path)); }
+};
+
 
 // Async HTTP — wraps pf::async_http_session to download to a temp file and
 // then deliver a single completion callback (file_path, error, status, url).
 
+namespace
+{
+	// Browsers settled on six connections per host; past that, requests
+	// mostly queue behind the server's own limit.
+	constexpr int max_connections_per_host = 6;
+
+	// While a render-blocking stylesheet is still outstanding, offscreen
+	// images get no more than this, so a stylesheet found late in the page
+	// does not wait behind a screenful of images.
+	constexpr int max_offscreen_while_blocked = 2;
+
+	std::string url_host(const std::string& url)
+	{
+		const auto scheme = url.find("://");
+		const auto start = scheme == std::string::npos ? 0 : scheme + 3;
+		const auto end = url.find_first_of("/?#", start);
+		return url.substr(start, end == std::string::npos ? std::string::npos : end - start);
+	}
+
+	std::string fetch_url(const std::string& url)
+	{
+		if (starts(url, "http://") || starts(url, "https://")) return url;
+		return "https://" + url;
+	}
+}
+
 bool http::open(const std::string_view user_agent)
 {
-	m_session = pf::create_async_http_session(user_agent);
-	return static_cast<bool>(m_session);
+	m_sched = std::make_shared<scheduler>();
+	m_sched->session = pf::create_async_http_session(user_agent);
+	return static_cast<bool>(m_sched->session);
 }
 
 void http::close()
 {
 	stop();
-	m_session.reset();
+	m_sched.reset();
 }
 
 void http::stop()
 {
-	std::vector<std::shared_ptr<http_request>> snapshot;
+	if (!m_sched) return;
+
+	std::vector<pf::async_http_request_ptr> running;
+	std::vector<std::shared_ptr<http_request>> waiters;
+	{
+		std::lock_guard lk(m_sched->mutex);
+		m_sched->stopped = true;
+
+		// The waiters' callbacks hold their documents; letting go of them here
+		// frees a page that was navigated away from without waiting on its
+		// downloads.
+		for (const auto* list : {&m_sched->queued, &m_sched->active})
+		{
+			for (const auto& f : *list)
+			{
+				if (f->async) running.push_back(std::move(f->async));
+				std::ranges::move(f->waiters, std::back_inserter(waiters));
+				f->waiters.clear();
+			}
+		}
+		m_sched->queued.clear();
+	}
+	for (const auto& r : waiters) r->cancel();
+	for (const auto& a : running) a->cancel();
+	if (m_sched->session) m_sched->session->stop();
+}
+
+bool http::download_file(const std::string& url_in, const std::shared_ptr<http_request>& request,
+                         const fetch_priority priority)
+{
+	if (!request || !m_sched || !m_sched->session) return false;
+
+	const std::string url = fetch_url(url_in);
+
+	std::shared_ptr<fetch> target;
+	{
+		std::lock_guard lk(m_sched->mutex);
+		if (m_sched->stopped) return false;
+
+		// The same URL already queued or downloading: wait on that fetch.
+		for (const auto* list : {&m_sched->queued, &m_sched->active})
+		{
+			for (const auto& f : *list)
+			{
+				if (f->url == url)
+				{
+					target = f;
+					break;
+				}
+			}
+			if (target) break;
+		}
+
+		if (target)
+		{
+			target->priority = std::min(target->priority, priority);
+		}
+		else
+		{
+			target = std::make_shared<fetch>();
+			target->url = url;
+			target->host = url_host(url);
+			target->priority = priority;
+			target->order = m_sched->next_order++;
+			m_sched->queued.push_back(target);
+		}
+
+		target->waiters.push_back(request);
+	}
+
+	request->set_release([weak = std::weak_ptr(m_sched), weak_fetch = std::weak_ptr(target)]
+	{
+		const auto sched = weak.lock();
+		const auto f = weak_fetch.lock();
+		if (sched && f) release(sched, f);
+	});
+
+	pump(m_sched);
+	return true;
+}
+
+void http::promote(const std::string& url, const fetch_priority priority)
+{
+	if (!m_sched) return;
+
+	const std::string target = fetch_url(url);
+
+	std::lock_guard lk(m_sched->mutex);
+	for (const auto& f : m_sched->queued)
 	{
-		std::lock_guard lk(m_mutex);
-		snapshot = m_requests;
+		if (f->url == target)
+		{
+			f->priority = std::min(f->priority, priority);
+		}
 	}
-	for (const auto& r : snapshot) r->cancel();
-	if (m_session) m_session->stop();
 }
 
-bool http::download_file(const std::string& url_in, const std::shared_ptr<http_request>& request)
+size_t http::queued()
 {
-	if (!request || !m_session) return false;
+	if (!m_sched) return 0;
 
-	std::string url = url_in;
-	if (!starts(url, "http://") && !starts(url, "https://"))
+	std::lock_guard lk(m_sched->mutex);
+	return m_sched->queued.size();
+}
+
+// Starts the best queued fetches that have a connection free on their host:
+// highest priority first, then the order they were asked for.
+void http::pump(const std::shared_ptr<scheduler>& sched)
+{
+	std::vector<std::shared_ptr<fetch>> starting;
 	{
-		url = "https://" + url;
+		std::lock_guard lk(sched->mutex);
+		if (sched->stopped) return;
+
+		const auto is_blocking = [](const std::shared_ptr<fetch>& f)
+		{
+			return f->priority == fetch_priority::blocking;
+		};
+		const bool blocked = std::ranges::any_of(sched->queued, is_blocking) ||
+			std::ranges::any_of(sched->active, is_blocking);
+
+		for (;;)
+		{
+			auto best = sched->queued.end();
+
+			for (auto i = sched->queued.begin(); i != sched->queued.end(); ++i)
+			{
+				const auto& f = *i;
+				const auto host_active = sched->per_host[f->host];
+				if (host_active >= max_connections_per_host) continue;
+
+				if (blocked && f->priority == fetch_priority::offscreen)
+				{
+					const auto offscreen = std::ranges::count_if(sched->active, [&](const auto& a)
+					{
+						return a->priority == fetch_priority::offscreen && a->host == f->host;
+					});
+					if (offscreen >= max_offscreen_while_blocked) continue;
+				}
+
+				if (best == sched->queued.end() || f->priority < (*best)->priority ||
+					(f->priority == (*best)->priority && f->order < (*best)->order))
+				{
+					best = i;
+				}
+			}
+
+			if (best == sched->queued.end()) break;
+
+			auto f = *best;
+			sched->queued.erase(best);
+			++sched->per_host[f->host];
+			sched->active.push_back(f);
+			starting.push_back(std::move(f));
+		}
 	}
 
+	for (const auto& f : starting) launch(sched, f);
+}
+
+void http::launch(const std::shared_ptr<scheduler>& sched, const std::shared_ptr<fetch>& f)
+{
+	const std::weak_ptr weak = sched;
 	const std::string temp_path = pf::platform_temp_file_path("pot");
 	auto file = pf::open_file_for_write(pf::file_path(temp_path));
 	if (!file)
 	{
 		pf::platform_delete_file(pf::file_path(temp_path));
-		return false;
-	}
-
-	{
-		std::lock_guard lk(m_mutex);
-		m_requests.push_back(request);
+		complete(weak, f, {}, 1, 0);
+		return;
 	}
 
 	struct ctx_t
 	{
-		std::shared_ptr<http_request> req;
+		std::weak_ptr<scheduler> sched;
+		std::shared_ptr<fetch> f;
 		pf::writable_file_handle_ptr file;
 		std::string file_path;
-		std::string url;
-		http* parent = nullptr;
 		std::atomic<int> status_code{0};
+		std::atomic<int64_t> first_byte{0}; // steady_clock ticks, 0 until data arrives
 		std::atomic<bool> done{false};
+		int64_t trace_start = 0;
 	};
 	auto ctx = std::make_shared<ctx_t>();
-	ctx->req = request;
+	ctx->sched = weak;
+	ctx->f = f;
 	ctx->file = std::move(file);
 	ctx->file_path = temp_path;
-	ctx->url = url;
-	ctx->parent = this;
+	if (trace::on()) ctx->trace_start = trace::now_ns();
 
 	pf::async_http_callbacks cb;
 	cb.on_headers = [ctx](const int status, std::string, uint64_t)
@@ -189,53 +421,97 @@ bool http::download_file(const std::string& url_in, const std::shared_ptr<http_r
 	};
 	cb.on_data = [ctx](const uint8_t* data, const size_t size)
 	{
+		if (!ctx->first_byte.load(std::memory_order_relaxed))
+			ctx->first_byte = std::chrono::steady_clock::now().time_since_epoch().count();
 		if (ctx->file) ctx->file->write(data, static_cast<uint32_t>(size));
 	};
-	auto finish = [ctx](uint32_t error)
+	auto finish = [ctx](const uint32_t error)
 	{
 		if (ctx->done.exchange(true)) return;
 		ctx->file.reset();
-		auto cb_user = ctx->req->m_callback;
-		auto file_path = ctx->file_path;
-		auto url_capture = ctx->url;
-		auto status = static_cast<uint32_t>(ctx->status_code.load());
-		auto* parent = ctx->parent;
-		auto req = ctx->req;
-		// Remove the request from the parent http synchronously while we still
-		// know the parent is alive (this callback fires on the http worker
-		// thread, which the parent's destructor waits on via stop()).
-		if (parent)
-		{
-			std::lock_guard lk(parent->m_mutex);
-			std::erase(parent->m_requests, req);
-		}
-		dispatch_to_ui([cb_user = std::move(cb_user), file_path = std::move(file_path),
-				error, status, url_capture = std::move(url_capture), req]()
-			{
-				if (cb_user) cb_user(file_path, error, status, url_capture);
-				// The callback reads the body synchronously, so the download's
-				// scratch file has no readers left once it returns.
-				pf::platform_delete_file(pf::file_path(file_path));
-			});
+		if (ctx->trace_start) trace::complete("fetch", "net", ctx->trace_start, trace::now_ns(), ctx->f->url);
+		const std::chrono::steady_clock::time_point first_byte(std::chrono::steady_clock::duration(ctx->first_byte));
+		complete(ctx->sched, ctx->f, ctx->file_path, error, static_cast<uint32_t>(ctx->status_code.load()),
+		         first_byte);
 	};
 	cb.on_complete = [finish]() { finish(0); };
 	cb.on_error = [finish](std::string) { finish(1); };
 
-	auto async = m_session->get(url, std::move(cb));
+	auto async = sched->session->get(f->url, std::move(cb));
 	if (!async)
 	{
-		ctx->file.reset();
-		pf::platform_delete_file(pf::file_path(temp_path));
-		std::lock_guard lk(m_mutex);
-		std::erase(m_requests, request);
-		return false;
+		finish(1);
+		return;
 	}
-	request->set_async(std::move(async));
-	return true;
+
+	// The transfer is already running and may have completed by now, on this
+	// thread or another; complete() marks the fetch finished under the lock.
+	// A stop or release in the meantime found no handle to abort, so the
+	// abort happens here instead.
+	bool abort = false;
+	{
+		std::lock_guard lk(sched->mutex);
+		if (f->finished) return;
+		f->async = async;
+		abort = sched->stopped || std::ranges::all_of(f->waiters, [](const auto& r) { return r->cancelled(); });
+	}
+	if (abort) async->cancel();
+}
+
+// Runs on the http worker thread. The connection is handed back straight
+// away; the callbacks, and the pump that fills the freed connection, run on
+// the UI thread.
+void http::complete(const std::weak_ptr<scheduler>& weak, const std::shared_ptr<fetch>& f,
+                    const std::string& file_path, const uint32_t error, const uint32_t status,
+                    const std::chrono::steady_clock::time_point first_byte)
+{
+	std::vector<std::shared_ptr<http_request>> waiters;
+
+	if (const auto sched = weak.lock())
+	{
+		std::lock_guard lk(sched->mutex);
+		if (std::erase(sched->active, f)) --sched->per_host[f->host];
+		waiters = f->waiters;
+		f->async.reset();
+		f->finished = true;
+	}
+
+	dispatch_to_ui([weak, waiters = std::move(waiters), file_path, error, status, first_byte, url = f->url]()
+	{
+		bool kept = false;
+		for (const auto& r : waiters)
+		{
+			if (r->cancelled() || !r->m_callback) continue;
+			r->m_first_byte = first_byte;
+			r->m_callback(file_path, error, status, url);
+			kept = kept || r->m_keeps_file;
+		}
+
+		// Other callbacks read the body synchronously, so the download's
+		// scratch file has no readers left once they return.
+		if (!file_path.empty() && !kept) pf::platform_delete_file(pf::file_path(file_path));
+
+		if (const auto sched = weak.lock()) pump(sched);
+	});
+}
+
+// A request was withdrawn. Once nobody is left waiting, a queued fetch is
+// dropped and a running one aborted.
+void http::release(const std::shared_ptr<scheduler>& sched, const std::shared_ptr<fetch>& f)
+{
+	pf::async_http_request_ptr running;
+	{
+		std::lock_guard lk(sched->mutex);
+		if (!std::ranges::all_of(f->waiters, [](const auto& r) { return r->cancelled(); })) return;
+
+		if (!std::erase(sched->queued, f)) running = f->async;
+	}
+
+	if (running) running->cancel();
 }
 
 
-html_entities g_html_entities[] =
+constexpr html_entities g_html_entities[] =
 {
 	{"&quot;", 0x0022},
 	{"&amp;", 0x0026},
@@ -492,68 +768,118 @@ html_entities g_html_entities[] =
 	{"&hearts;", 0x2665},
 	{"&diams;", 0x2666},
 
-	{"", 0}
 };
 
 
-stop_tags_t parser::m_stop_tags[] =
+namespace
 {
-	{"body;head", "html"},
-	{"td;th;tr;tbody;thead;tfoot", "table"},
-	{nullptr, nullptr},
-};
+	// Every tag the tree-construction rules below name. A tag's atom is its
+	// position here; the rest share parse_tag_other.
+	keyword_list(parse_tag_strings,
+	             "html;head;body;table;td;th;tr;tbody;thead;tfoot;li;dt;dd;p;rb;rt;rtc;rp;optgroup;option;col;"
+	             "colgroup;address;article;aside;blockquote;div;dl;fieldset;footer;form;h1;h2;h3;h4;h5;h6;header;"
+	             "hgroup;hr;main;nav;ol;pre;section;ul;area;base;br;command;embed;img;input;keygen;link;meta;"
+	             "param;source;track;wbr");
 
-omitted_end_tags_t parser::m_omitted_end_tags[] =
-{
-	{"li", "li"},
-	{"dt", "dt;dd"},
-	{"dd", "dt;dd"},
-	{
-		"p",
-		"address;article;aside;blockquote;div;dl;fieldset;footer;form;h1;h2;h3;h4;h5;h6;header;hgroup;hr;main;nav;ol;p;pre;section;table;ul"
-	},
-	{"rb", "rb;rt;rtc;rp"},
-	{"rt", "rb;rt;rtc;rp"},
-	{"rtc", "rb;rt;rtc;rp"},
-	{"rp", "rb;rt;rtc;rp"},
-	{"optgroup", "optgroup"},
-	{"option", "optgroup;option"},
-	{"thead", "tbody;tfoot"},
-	{"tbody", "tbody;tfoot"},
-	{"tfoot", "tbody;tfoot"},
-	{"tr", "tr"},
-	{"td", "td;th"},
-	{"th", "td;th"},
-	{nullptr, nullptr},
-};
+	constexpr int parse_tag_other = static_cast<int>(parse_tag_strings.size());
+	static_assert(parse_tag_other <= 64, "tag sets are 64-bit masks");
+
+	constexpr int parse_tag(const std::string_view name)
+	{
+		const int i = parse_tag_strings.find(name);
+		return i >= 0 ? i : parse_tag_other;
+	}
+
+	constexpr uint64_t parse_tag_set(const std::string_view tags)
+	{
+		uint64_t set = 0;
+
+		for_each_keyword(tags, [&](const std::string_view tag) { set |= uint64_t{1} << parse_tag_strings.find(tag); });
+
+		return set;
+	}
+
+	constexpr bool in_tag_set(const uint64_t set, const int tag)
+	{
+		return tag != parse_tag_other && (set >> tag & 1) != 0;
+	}
+
+	// What the parser does around one kind of open element, so each start and
+	// end tag costs a few integer compares instead of string list searches.
+	struct parse_tag_rule
+	{
+		uint64_t closed_by = 0; // start tags that end this element implicitly
+		uint64_t parents = 0; // containers this element must open inside...
+		int implied_parent = parse_tag_other; // ...else this one is opened first
+		int end_stop = parse_tag_other; // an end tag searches no further up than this
+		bool is_void = false; // never has content
+	};
+
+	constexpr auto g_parse_tag_rules = []
+	{
+		std::array<parse_tag_rule, parse_tag_other + 1> rules{};
+
+		const auto closed_by = [&](const std::string_view tags, const std::string_view followers)
+		{
+			const auto set = parse_tag_set(followers);
+			for_each_keyword(tags, [&](const std::string_view tag) { rules[parse_tag(tag)].closed_by = set; });
+		};
+
+		closed_by("li", "li");
+		closed_by("dt;dd", "dt;dd");
+		closed_by("p", "address;article;aside;blockquote;div;dl;fieldset;footer;form;h1;h2;h3;h4;h5;h6;header;"
+		          "hgroup;hr;main;nav;ol;p;pre;section;table;ul");
+		closed_by("rb;rt;rtc;rp", "rb;rt;rtc;rp");
+		closed_by("optgroup", "optgroup");
+		closed_by("option", "optgroup;option");
+		closed_by("thead;tbody;tfoot", "tbody;tfoot");
+		closed_by("tr", "tr");
+		closed_by("td;th", "td;th");
+
+		rules[parse_tag("col")].parents = parse_tag_set("colgroup");
+		rules[parse_tag("col")].implied_parent = parse_tag("colgroup");
+		rules[parse_tag("tr")].parents = parse_tag_set("tbody;thead;tfoot");
+		rules[parse_tag("tr")].implied_parent = parse_tag("tbody");
+
+		const auto end_stop = [&](const std::string_view tags, const std::string_view stop)
+		{
+			for_each_keyword(tags, [&](const std::string_view tag) { rules[parse_tag(tag)].end_stop = parse_tag(stop); });
+		};
+
+		end_stop("body;head", "html");
+		end_stop("td;th;tr;tbody;thead;tfoot", "table");
+
+		for_each_keyword("area;base;br;col;command;embed;hr;img;input;keygen;link;meta;param;source;track;wbr",
+		                 [&](const std::string_view tag) { rules[parse_tag(tag)].is_void = true; });
+
+		return rules;
+	}();
+
+	static_assert(g_parse_tag_rules[parse_tag("p")].closed_by & uint64_t{1} << parse_tag("table"));
+	static_assert(g_parse_tag_rules[parse_tag("wbr")].is_void);
+}
 
 
 // ── html_scanner ────────────────────────────────────────────────────────────
 
 namespace
 {
-	uint32_t lookup_entity(const std::string_view name)
+	constexpr std::string_view entity_name(const size_t i)
 	{
-		uint32_t fallback = 0;
-
-		for (int i = 0; g_html_entities[i].szCode[0]; i++)
-		{
-			// Table entries are stored as "&name;".
-			const char* code = g_html_entities[i].szCode + 1;
-			const size_t n = strlen(code);
-			if (n != name.size() + 1 || code[name.size()] != ';') continue;
+		// Table entries are stored as "&name;".
+		const std::string_view code = g_html_entities[i].szCode;
+		return code.substr(1, code.size() - 2);
+	}
 
-			if (memcmp(code, name.data(), name.size()) == 0)
-			{
-				return g_html_entities[i].Code;
-			}
-			if (!fallback && _strnicmp(code, name.data(), name.size()) == 0)
-			{
-				fallback = g_html_entities[i].Code;
-			}
-		}
+	constexpr perfect_hash<std::size(g_html_entities)> g_entities_exact(entity_name, false);
+	constexpr perfect_hash<std::size(g_html_entities)> g_entities_folded(entity_name, true);
 
-		return fallback;
+	// The exact spelling wins; otherwise the first entry equal ignoring case.
+	uint32_t lookup_entity(const std::string_view name)
+	{
+		int i = g_entities_exact.find(name, entity_name);
+		if (i < 0) i = g_entities_folded.find(name, entity_name);
+		return i >= 0 ? g_html_entities[i].Code : 0;
 	}
 
 	int hex_digit(const char c)
@@ -975,16 +1301,81 @@ token_type html_scanner::scan_markup_decl()
 	return TT_DATA;
 }
 
+void html_scanner::save(resume_point& rp) const
+{
+	rp.pos = m_pos;
+	rp.scan = m_scan;
+	rp.close = m_close;
+	rp.end_token = m_end_token;
+	rp.got_tail = m_got_tail;
+	rp.tag = m_tag_store;
+}
+
+void html_scanner::restore(const resume_point& rp)
+{
+	m_pos = rp.pos;
+	m_scan = rp.scan;
+	m_close = rp.close;
+	m_end_token = rp.end_token;
+	m_got_tail = rp.got_tail;
+	m_tag_store = rp.tag;
+	m_tag_name = m_tag_store;
+}
+
+// Scans as usual, then rewinds if the token ran into the end of the buffer,
+// since the next piece could still extend it. A start tag is held back until
+// its whole attribute list has arrived, so the tree never holds an element
+// whose start tag was cut off.
+token_type html_scanner::get_partial_token()
+{
+	save(m_resume);
+	const token_type t = (this->*m_scan)();
+
+	if (t == TT_TAG_START && !at_end())
+	{
+		save(m_lookahead);
+		while ((this->*m_scan)() == TT_ATTR && !at_end())
+		{
+		}
+		const bool complete = !at_end();
+		restore(m_lookahead);
+
+		if (!complete)
+		{
+			restore(m_resume);
+			return TT_EOF;
+		}
+	}
+
+	if (at_end())
+	{
+		restore(m_resume);
+		return TT_EOF;
+	}
+
+	return t;
+}
+
 // Render a token stream as a compact string so expectations stay readable.
-static std::string dump_tokens(const std::string_view html)
+// A non-zero `chunk` feeds the source that many bytes at a time, the way a
+// network read would.
+static std::string dump_tokens(const std::string_view html, const size_t chunk = 0)
 {
+	size_t fed = chunk ? std::min(chunk, html.size()) : html.size();
 	html_scanner sc(html);
+	sc.set_input(html.substr(0, fed), fed < html.size());
 	std::string out;
 
 	for (;;)
 	{
 		const token_type t = sc.get_token();
-		if (t == TT_EOF) break;
+		if (t == TT_EOF)
+		{
+			if (fed == html.size()) break;
+			fed = std::min(fed + chunk, html.size());
+			sc.set_input(html.substr(0, fed), fed < html.size());
+			continue;
+		}
 
 		if (!out.empty()) out += ' ';
 
@@ -1076,6 +1467,19 @@ static void should_terminate_on_malformed_markup()
 	should::equal("<style d:oops </style", dump_tokens("<style>oops").c_str());
 }
 
+static void should_scan_in_pieces()
+{
+	const std::string html =
+		"<!DOCTYPE html><p class=\"a b\" id=x>Fish &amp; chips, caf\xC3\xA9 &lt;3<!-- note -->"
+		"<style>p > b { color: red }</style><br/><img src=a.png>end";
+	const auto whole = dump_tokens(html);
+
+	for (size_t chunk = 1; chunk <= 8; ++chunk)
+	{
+		should::equal(whole, dump_tokens(html, chunk));
+	}
+}
+
 static void should_detect_charset()
 {
 	// Declared windows-1252 in a meta tag: 0x93/0x94 are curly quotes.
@@ -1088,6 +1492,27 @@ static void should_detect_charset()
 	should::equal("\xC2\xA9", decode_to_utf8("\xA9", "text/html; charset=iso-8859-1").c_str());
 }
 
+static void should_decode_in_pieces()
+{
+	// Past the sniffing window a character split between reads is carried over.
+	const std::string padding(1100, ' ');
+	const std::string body = padding + "caf\xC3\xA9";
+	incremental_decoder utf8("");
+	std::string text;
+	utf8.push(std::string_view(body).substr(0, body.size() - 1), text);
+	should::equal(static_cast<int>(body.size() - 2), static_cast<int>(text.size()));
+	utf8.push(std::string_view(body).substr(body.size() - 1), text);
+	utf8.finish(text);
+	should::equal(body, text);
+
+	// Unlabelled bytes that stop being UTF-8 continue as windows-1252.
+	incremental_decoder legacy("");
+	text.clear();
+	legacy.push(padding + "\xE9t\xE9", text);
+	legacy.finish(text);
+	should::equal(padding + "\xC3\xA9t\xC3\xA9", text);
+}
+
 void register_scanner_tests(tests& t)
 {
 	t.register_test("Scanner: tags and attributes", should_scan_tags_and_attributes);
@@ -1097,7 +1522,9 @@ void register_scanner_tests(tests& t)
 	t.register_test("Scanner: comments and doctype", should_scan_comments_and_doctype);
 	t.register_test("Scanner: CJK word splitting", should_split_cjk_words);
 	t.register_test("Scanner: malformed markup terminates", should_terminate_on_malformed_markup);
+	t.register_test("Scanner: source arriving in pieces", should_scan_in_pieces);
 	t.register_test("Charset detection", should_detect_charset);
+	t.register_test("Charset decoding in pieces", should_decode_in_pieces);
 }
 
 
@@ -1108,6 +1535,7 @@ namespace
 	struct silent_view final : view_host
 	{
 		bool verbose = false;
+		std::vector<std::string>* log = nullptr;
 
 		void layout() override
 		{
@@ -1124,6 +1552,12 @@ namespace
 		void diagnostic(const std::string& message) override
 		{
 			if (verbose) pf::write_stdout("  " + message + "\n");
+			if (log) log->push_back(message);
+		}
+
+		bool diagnostics_on() const override
+		{
+			return verbose;
 		}
 
 		void resource_started(const std::string& type, const std::string& url) override
@@ -1140,31 +1574,55 @@ namespace
 
 // Runs parse -> cascade -> layout with no window and no message loop, so no
 // async stylesheet or image ever lands. Same input therefore gives same output.
-layout_result layout_html_headless(const std::string& html, const int width, const int height,
-								   const bool verbose, const int dump_depth, const bool dump_json)
+layout_result layout_html_headless(std::string html, const layout_options& options)
 {
 	layout_result result;
 	silent_view view;
-	view.verbose = verbose;
+	view.verbose = options.verbose;
 
+	css::s_profile = options.profile_selectors > 0;
 	const auto t0 = std::chrono::steady_clock::now();
-	const auto doc = document::create_from_bytes(view, "https://example.invalid/", html, "text/html");
+	const auto doc = document::create_from_bytes(view, "https://example.invalid/", std::move(html), "text/html",
+	                                             options.cache);
 	const auto t1 = std::chrono::steady_clock::now();
 
-	if (!doc) return result;
+	if (!doc)
+	{
+		css::s_profile = false;
+		return result;
+	}
 
-	const position client_pos(0, 0, width, height);
+	const position client_pos(0, 0, options.width, options.height);
 	doc->client_pos(client_pos);
-	doc->render(width);
+	if (options.profile_layout) doc->enable_layout_profile();
+	{
+		alloc_stats::stage stage("layout");
+		hw_counters::stage counters("layout");
+		doc->render(options.width);
+	}
 	const auto t2 = std::chrono::steady_clock::now();
+	alloc_stats::stage dump_stage("dump");
 
 	result.width = doc->width();
 	result.height = doc->height();
 	result.parse_style_us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+	result.parse_us = doc->stage_times().parse_us;
+	result.style_us = doc->stage_times().style_us;
 	result.layout_us = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
 	result.stats = doc->analyse_layout(&result.anomalies);
-	if (dump_depth > 0) result.box_dump = doc->dump_boxes(dump_depth);
-	if (dump_json) result.layout_json = doc->dump_layout_json();
+	if (options.dump_depth > 0) result.box_dump = doc->dump_boxes(options.dump_depth);
+	if (options.dump_json) result.layout_json = doc->dump_layout_json();
+	if (options.measure_memory) result.memory = doc->measure_memory();
+	if (options.profile_selectors > 0)
+	{
+		result.selector_profile = doc->styles().profile_report(options.profile_selectors);
+	}
+	if (options.profile_layout)
+	{
+		result.layout_profile = doc->layout_profiler()->report(15);
+		result.layout_folded = doc->layout_profiler()->folded_stacks();
+	}
+	css::s_profile = false;
 	return result;
 }
 
@@ -1211,7 +1669,7 @@ static void should_lay_out_fixture(const char* name, const int expect_w, const i
 	const auto html = get_file_contents(std::string("test-files/") + name);
 	if (html.empty()) return;
 
-	const auto r = layout_html_headless(html, 1902, 896);
+	const auto r = layout_html_headless(html);
 	should::equal(expect_w, r.width, (std::string(name) + " width").c_str());
 	should::equal(expect_h, r.height, (std::string(name) + " height").c_str());
 }
@@ -1278,21 +1736,167 @@ void register_layout_tests(tests& t)
 		should::equal(first_height, doc->height(), "repeated document height");
 	});
 
-	t.register_test("Layout: wikipedia main page", []
+	t.register_test("Layout: image size known before the bitmap", []
 	{
-		should_lay_out_fixture("wikipedia-main-page.html", 1902, 14921);
+		silent_view view;
+		const auto doc = document::create_from_bytes(view, "https://example.invalid/",
+			"<style>.fixed{width:20px;height:20px}</style>"
+			"<img src=a.png width=40 height=30><img src=b.png class=fixed>"
+			"<img src=c.png width=40><img src=d.png>", "text/html");
+		should::EqualTrue(doc != nullptr, "document");
+
+		std::vector<bool> sized;
+		std::function<void(const element*)> visit = [&](const element* el)
+		{
+			if (el->get_tag_name() == "img") sized.push_back(el->has_specified_size());
+			for (size_t i = 0; i < el->get_children_count(); ++i) visit(el->get_child(static_cast<int>(i)));
+		};
+		visit(doc->root());
+
+		should::equal(4, static_cast<int>(sized.size()), "image count");
+		should::EqualTrue(sized[0], "width and height attributes");
+		should::EqualTrue(sized[1], "width and height from CSS");
+		should::EqualTrue(!sized[2], "width only");
+		should::EqualTrue(!sized[3], "no size");
 	});
-	t.register_test("Layout: wikipedia web browser", []
+
+	// No message loop runs here, so the queued relayout is counted rather than
+	// run: however many unsized images land before it, there is only one.
+	t.register_test("Layout: image arrivals share one relayout", []
 	{
-		should_lay_out_fixture("wikipedia-web-browser.html", 2065, 15126);
+		silent_view view;
+		const auto doc = document::create_from_bytes(view, "https://example.invalid/",
+			"<img src=u1.png><img src=u2.png><img src=u3.png>"
+			"<img src=s1.png width=8 height=8><img src=s2.png width=8 height=8>", "text/html");
+		should::EqualTrue(doc != nullptr, "document");
+		doc->client_pos(position(0, 0, 400, 300));
+		doc->render(400);
+
+		const auto deliver = [&](const char* name)
+		{
+			const auto bitmap = std::make_shared<pf::bitmap>(8, 8, std::vector<uint32_t>(8 * 8));
+			return doc->image_decoded(std::string("https://example.invalid/") + name, bitmap, {8, 8}, 0, false);
+		};
+
+		should::EqualTrue(deliver("s1.png"), "s1");
+		should::equal(0, doc->image_layouts().queued, "sized image queues nothing");
+		should::equal(1, doc->image_layouts().avoided, "sized image avoided");
+
+		for (const auto* name : {"u1.png", "u2.png", "u3.png"}) should::EqualTrue(deliver(name), name);
+		should::equal(1, doc->image_layouts().queued, "one relayout");
+		should::equal(3, doc->image_layouts().pending, "three arrivals share it");
+
+		should::EqualTrue(deliver("s2.png"), "s2");
+		should::equal(1, doc->image_layouts().queued, "still one relayout");
+		should::equal(2, doc->image_layouts().avoided, "both sized images avoided");
 	});
-	t.register_test("Layout: wikipedia comparison table", []
+
+	t.register_test("Layout: downscaled image decoded again when its box grows", []
 	{
-		should_lay_out_fixture("wikipedia-comparison-of-web-browsers.html", 2065, 36898);
+		std::vector<std::string> log;
+		silent_view view;
+		view.log = &log;
+		const auto doc = document::create_from_bytes(view, "https://example.invalid/",
+			"<style>img{width:50px;height:40px}@media (min-width:600px){img{width:200px;height:160px}}</style>"
+			"<img src=a.png><img src=b.png width=10 height=10><div style=\"background-image:url(b.png)\"></div>",
+			"text/html");
+		should::EqualTrue(doc != nullptr, "document");
+
+		doc->client_pos(position(0, 0, 400, 300));
+		doc->render(400);
+		const std::string a = "https://example.invalid/a.png";
+		const std::string b = "https://example.invalid/b.png";
+		should::equal(50, doc->image_decode_target(a).width, "decode width");
+		should::equal(40, doc->image_decode_target(a).height, "decode height");
+		should::equal(0, doc->image_decode_target(b).width, "background keeps natural size");
+
+		const auto source = std::make_shared<owned_temp_file>("potato-test-missing.png");
+		should::EqualTrue(doc->image_decoded(a, std::make_shared<pf::bitmap>(50, 40, std::vector<uint32_t>(50 * 40)),
+		                                     {400, 320}, 0, false, {50, 40}, source), "delivered");
+		should::equal(400, doc->get_image_size("a.png", "").width, "layout sees natural width");
+
+		const auto redecodes = [&]
+		{
+			return static_cast<int>(std::ranges::count_if(log, [](const std::string& line)
+			{
+				return line.starts_with("Image outgrew its 50x40 bitmap");
+			}));
+		};
+
+		doc->render(400);
+		should::equal(0, redecodes(), "box unchanged");
+
+		doc->client_pos(position(0, 0, 800, 300));
+		doc->render(800);
+		should::equal(1, redecodes(), "box grew");
+		doc->render(800);
+		should::equal(1, redecodes(), "decode already running");
 	});
-	t.register_test("Layout: bbc news", []
+
+	t.register_test("Layout: attributes view the source unless decoded", []
 	{
-		should_lay_out_fixture("bbc-news.html", 1904, 5369);
+		silent_view view;
+		const std::string html = "<p ID=intro Data-Note=\"a &amp; b\" title=x title=y class=\"c d\">text</p>";
+		const auto doc = document::create_from_bytes(view, "https://example.invalid/", html, "text/html");
+		should::EqualTrue(doc != nullptr, "document");
+
+		const element* p = nullptr;
+		std::function<void(const element*)> visit = [&](const element* el)
+		{
+			if (el->get_tag_name() == "p") p = el;
+			for (size_t i = 0; !p && i < el->get_children_count(); ++i) visit(el->get_child(static_cast<int>(i)));
+		};
+		visit(doc->root());
+		should::EqualTrue(p != nullptr, "paragraph");
+
+		should::equal("intro", std::string(p->get_attr("id")));
+		should::equal("a & b", std::string(p->get_attr("data-note")));
+		should::equal("y", std::string(p->get_attr("TITLE")), "last value wins");
+		should::equal("fallback", std::string(p->get_attr("lang", "fallback")));
+		should::EqualTrue(p->find_attr("class") && p->find_attr("class")->name == "class", "interned name");
+	});
+
+	t.register_test("Layout: omitted end and start tags", []
+	{
+		silent_view view;
+		const auto doc = document::create_from_bytes(view, "https://example.invalid/",
+			"<table><tr><td>a<td>b</tr><tr><th>c</table><ul><li>x<li>y<ul><li>z</ul></ul>"
+			"<p>one<p>two<div>three</div><dl><dt>t<dd>d</dl>", "text/html");
+		should::EqualTrue(doc != nullptr, "document");
+
+		std::function<std::string(const element*)> shape = [&](const element* el)
+		{
+			std::string out = el->get_tag_name();
+			std::string inner;
+			for (size_t i = 0; i < el->get_children_count(); ++i)
+			{
+				const auto child = shape(el->get_child(static_cast<int>(i)));
+				if (child.empty()) continue;
+				if (!inner.empty()) inner += ",";
+				inner += child;
+			}
+			return inner.empty() ? out : out + "(" + inner + ")";
+		};
+
+		should::equal("html(body(table(tbody(tr(td,td),tr(th))),ul(li,li(ul(li))),p,p,div,dl(dt,dd)))",
+		              shape(doc->root()));
+	});
+
+	t.register_test("Layout: wikipedia main page", []
+	{
+		should_lay_out_fixture("wikipedia-main-page.html", 1902, 14921);
+	});
+	t.register_test("Layout: wikipedia web browser", []
+	{
+		should_lay_out_fixture("wikipedia-web-browser.html", 2065, 15126);
+	});
+	t.register_test("Layout: wikipedia comparison table", []
+	{
+		should_lay_out_fixture("wikipedia-comparison-of-web-browsers.html", 2065, 36898);
+	});
+	t.register_test("Layout: bbc news", []
+	{
+		should_lay_out_fixture("bbc-news.html", 1904, 5369);
 	});
 
 	// Selector bucketing reads id/class before parse_styles runs, so these
@@ -1314,6 +1918,190 @@ void register_layout_tests(tests& t)
 		should::equal(40, box.height, "id selector height");
 	});
 
+	// The cascade runs before the viewport is known; the first layout crosses
+	// into the right band and restyles what the flipped rules select.
+	t.register_test("Style: media queries follow the viewport width", []
+	{
+		const std::string html =
+			"<html><head><style>#t{width:100px;height:10px}@media (max-width:500px){#t{width:50px}}</style></head>"
+			"<body><div id='t' align='center'>x</div></body></html>";
+		should::equal(100, should_box_of(html, "t", 1000).width, "wide viewport");
+		should::equal(50, should_box_of(html, "t", 400).width, "narrow viewport");
+	});
+
+	// Selectors naming a class or id the page lacks are left out of the
+	// buckets; the rest still apply, with class names matched regardless of case.
+	t.register_test("Style: selectors for absent names are pruned", []
+	{
+		const std::string html =
+			"<html><head><style>.w{width:300px}.gone .w{width:10px}#nope{width:5px}div.w{height:40px}</style></head>"
+			"<body><div id='t' class='W'>x</div></body></html>";
+		silent_view view;
+		const auto doc = document::create_from_bytes(view, "https://example.invalid/", html, "text/html");
+		should::EqualTrue(doc != nullptr, "document");
+		if (!doc) return;
+
+		int pruned = 0;
+		for (uint32_t i = 0; i < doc->styles().selectors().size(); ++i)
+		{
+			if (doc->styles().rank(i) == UINT32_MAX) ++pruned;
+		}
+		should::EqualTrue(pruned >= 2, "absent class and id pruned");
+
+		const auto box = should_box_of(html, "t");
+		should::equal(300, box.width, "kept class selector");
+		should::equal(40, box.height, "kept compound selector");
+	});
+
+	// Streamed chunks add names all the time; only one a pruned selector is
+	// waiting for should ask for the buckets to be rebuilt.
+	t.register_test("Style: only names pruned selectors want trigger a re-sort", []
+	{
+		const std::string html =
+			"<html><head><style>.late{width:10px}</style></head><body><div class='early'>x</div></body></html>";
+		silent_view view;
+		const auto doc = document::create_from_bytes(view, "https://example.invalid/", html, "text/html");
+		should::EqualTrue(doc != nullptr, "document");
+		if (!doc) return;
+
+		auto& names = doc->names();
+		should::EqualTrue(!names.changed, "settled after the first sort");
+		names.add_classes("other Early");
+		should::EqualTrue(!names.changed, "names nothing waits for");
+		names.add_classes("LATE");
+		should::EqualTrue(names.changed, "name a pruned selector waits for");
+	});
+
+	// The profile attributes each selector to the sheet it was written in and
+	// counts a match only where select() said so.
+	t.register_test("Style: selector profile names selectors and sheets", []
+	{
+		const std::string html =
+			"<html><head><style>p.lead{color:red}\n.None  >SPAN[Title]{color:blue}\n"
+			"UL>LI:First-Child{color:green}\np.lead::after{content:'x'}</style></head>"
+			"<body><p class='lead'>a</p><p class=none>b <span title=t>c</span></p><ul><li>d</li></ul></body></html>";
+		const auto r = layout_html_headless(html, {.width = 1000, .profile_selectors = 50});
+		should::EqualTrue(r.selector_profile.find("p.lead") != std::string::npos, "selector text");
+		should::EqualTrue(r.selector_profile.find(".none > span[title]") != std::string::npos, "rebuilt selector");
+		should::EqualTrue(r.selector_profile.find("ul > li:first-child") != std::string::npos, "pseudo-class");
+		should::EqualTrue(r.selector_profile.find("p.lead::after") != std::string::npos, "pseudo-element");
+		should::EqualTrue(r.selector_profile.find("<style>") != std::string::npos, "inline sheet");
+		should::EqualTrue(r.selector_profile.find("master.css") != std::string::npos, "master sheet");
+		should::EqualTrue(!css::s_profile, "profiling switched off");
+	});
+
+	// Each element is charged once per layout, and its stack names every
+	// ancestor by tag, id and class.
+	t.register_test("Layout: profile folds element time into stacks", []
+	{
+		const std::string html =
+			"<html><body><div id='t' class='a b'><p>one</p><span>two</span></div></body></html>";
+		const auto r = layout_html_headless(html, {.width = 1000, .profile_layout = true});
+		should::EqualTrue(r.layout_folded.find("html;body;div#t.a.b;p ") != std::string::npos, "folded path");
+		should::EqualTrue(r.layout_profile.find("div#t.a.b") != std::string::npos, "report names element");
+	});
+
+	// Every pipeline stage shows up with the allocations it made, and nothing
+	// is counted once stopped.
+	t.register_test("Layout: allocation stats cover each stage", []
+	{
+		alloc_stats::start();
+		layout_html_headless("<html><head><style>p{color:red}</style></head><body><p>x</p></body></html>", {.width = 1000});
+		alloc_stats::stop();
+		const auto report = alloc_stats::report();
+		for (const auto* stage : {"decode", "parse", "master stylesheet", "cascade", "parse_styles", "layout", "dump"})
+		{
+			should::EqualTrue(report.find(std::string("  ") + stage + " ") != std::string::npos, stage);
+		}
+
+		const auto before = alloc_stats::report();
+		auto* kept = new std::string(64, 'x');
+		delete kept;
+		should::equal(before, alloc_stats::report(), "stopped");
+	});
+
+	// Only asked-for layouts walk the tree for the footprint. The author
+	// sheet's two rules are counted on top of master.css's.
+	t.register_test("Layout: memory footprint counts each subsystem", []
+	{
+		const std::string body = "<body><p class=a>one two</p><p>three</p></body></html>";
+		const auto styled = "<html><head><style>p{color:red} .a{margin:0}</style></head>" + body;
+		should::equal(0, static_cast<int>(layout_html_headless(styled, {.width = 1000}).memory.total()), "not asked for");
+
+		const auto m = layout_html_headless(styled, {.width = 1000, .measure_memory = true}).memory;
+		const auto plain = layout_html_headless("<html>" + body, {.width = 1000, .measure_memory = true}).memory;
+		should::equal(6, static_cast<int>(m.elements.count), "elements");
+		should::equal(4, static_cast<int>(m.text_nodes.count), "text nodes");
+		should::equal(2, static_cast<int>(m.source.count), "source and arena");
+		should::equal(2, static_cast<int>(m.selectors.count - plain.selectors.count), "author selectors");
+		should::equal(2, static_cast<int>(m.rules.count - plain.rules.count), "author rule blocks");
+		should::equal(0, static_cast<int>(m.images.count), "images");
+		for (const auto* use : {&m.elements, &m.text_nodes, &m.props, &m.style_entries, &m.line_boxes, &m.source,
+		                        &m.selectors, &m.rules, &m.buckets, &m.fonts})
+		{
+			should::EqualTrue(use->count > 0 && use->bytes > 0, "counted");
+		}
+		should::EqualTrue(m.total() > plain.total(), "author sheet adds to the total");
+	});
+
+	// A document given a layout cache copies master.css rather than parsing
+	// it, and must lay out exactly as one that parsed it.
+	t.register_test("Layout: cached master stylesheet matches a fresh parse", []
+	{
+		const std::string html =
+			"<html><head><style>@media (max-width:500px){ul{height:70px}}</style></head>"
+			"<body><h1>Title</h1><ul><li>a</li><li>b</li></ul><p>text <b>bold</b></p></body></html>";
+		const auto boxes = [](const layout_result& r)
+		{
+			std::string joined;
+			for (const auto& line : r.box_dump) joined += line + "\n";
+			return joined;
+		};
+		const auto fresh = layout_html_headless(html, {.width = 400, .dump_depth = 8});
+		const auto cache = std::make_shared<layout_cache>();
+		layout_html_headless(html, {.width = 800, .cache = cache});
+		should::EqualTrue(cache->master_stylesheet() != nullptr, "master stylesheet kept");
+		const auto cached = layout_html_headless(html, {.width = 400, .dump_depth = 8, .cache = cache});
+		should::equal(fresh.height, cached.height, "document height");
+		should::equal(boxes(fresh), boxes(cached), "box tree");
+	});
+
+	// Documents laid out at once on several threads, sharing one cache, must
+	// each come out as they do alone. Where the platform's text measurement is
+	// not known to be thread-safe the same pages share the cache on one thread.
+	t.register_test("Layout: concurrent layouts match serial ones", []
+	{
+		constexpr unsigned threads = pf::concurrent_text ? 4 : 1;
+		const std::string pages[] = {
+			"<html><body><h1>One</h1><p>a <b>b</b> <i>c</i></p></body></html>",
+			"<html><head><style>li{font:14px monospace}</style></head><body><ul><li>x</li><li>yy</li></ul></body></html>",
+			"<html><body><table><tr><td>1</td><td>22</td></tr></table><p data-k='v'>d</p></body></html>",
+			"<html><head><style>p{font:bold 20px sans-serif;width:120px}</style></head><body><p>wrap these words</p></body></html>",
+		};
+		const auto boxes = [](const layout_result& r)
+		{
+			std::string joined = std::format("{}x{}\n", r.width, r.height);
+			for (const auto& line : r.box_dump) joined += line + "\n";
+			return joined;
+		};
+
+		std::vector<std::string> serial;
+		for (const auto& html : pages) serial.push_back(boxes(layout_html_headless(html, {.width = 600, .dump_depth = 8})));
+
+		const auto cache = std::make_shared<layout_cache>();
+		std::vector<std::string> concurrent(std::size(pages) * 8);
+		parallel_for(threads, concurrent.size(), [&](const size_t i)
+		{
+			concurrent[i] = boxes(layout_html_headless(pages[i % std::size(pages)],
+			                                           {.width = 600, .dump_depth = 8, .cache = cache}));
+		});
+
+		for (size_t i = 0; i < concurrent.size(); ++i)
+		{
+			should::equal(serial[i % std::size(pages)], concurrent[i], "box tree");
+		}
+	});
+
 	// calc() carries its own parts and never sets units, so cvt_units used to
 	// read an unset value and collapse the box to nothing.
 	t.register_test("Style: calc max-width constrains rather than collapses", []
@@ -1341,6 +2129,22 @@ void register_layout_tests(tests& t)
 		should::equal(600, box.width, "grid item width");
 	});
 
+	// Structural matches read the sibling indexes, which must skip text and
+	// count every element, not just those of the selector's tag.
+	t.register_test("Style: structural pseudo-classes and sibling combinators", []
+	{
+		const std::string html =
+			"<html><head><style>li{height:10px}li:nth-child(2n+1){height:20px}li:last-of-type{height:30px}"
+			"p{margin:0}p~p{height:40px}p+p{height:50px}</style></head>"
+			"<body><ul><li>1</li> text <li id='b'>2</li><li id='c'>3</li><span></span><li id='d'>4</li></ul>"
+			"<p>x</p> <p id='f'>y</p><div></div><p id='g'>z</p></body></html>";
+		should::equal(10, should_box_of(html, "b").height, "second child");
+		should::equal(20, should_box_of(html, "c").height, "third child");
+		should::equal(30, should_box_of(html, "d").height, "last of type");
+		should::equal(50, should_box_of(html, "f").height, "adjacent sibling across text");
+		should::equal(40, should_box_of(html, "g").height, "general sibling");
+	});
+
 	t.register_test("Layout: flex auto basis uses intrinsic width", []
 	{
 		const auto box = should_box_of(
@@ -1517,87 +2321,30 @@ void register_layout_tests(tests& t)
 }
 
 
-std::unique_ptr<element> parser::create_element(const std::string_view tag_name)
+namespace
 {
-	std::unique_ptr<element> newTag;
+	// Tags with their own element type; everything else is el_html.
+	keyword_list(element_tag_strings, "br;p;img;table;td;th;link;title;a;tr;style;base;body;div;script;font;svg");
 
-	if (!newTag)
-	{
-		if (is_equal(tag_name, "br"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_break);
-		}
-		else if (is_equal(tag_name, "p"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_para);
-		}
-		else if (is_equal(tag_name, "img"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_image);
-		}
-		else if (is_equal(tag_name, "table"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_table);
-		}
-		else if (is_equal(tag_name, "td") || is_equal(tag_name, "th"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_td);
-		}
-		else if (is_equal(tag_name, "link"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_link);
-		}
-		else if (is_equal(tag_name, "title"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_title);
-		}
-		else if (is_equal(tag_name, "a"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_anchor);
-		}
-		else if (is_equal(tag_name, "tr"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_tr);
-		}
-		else if (is_equal(tag_name, "style"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_style);
-		}
-		else if (is_equal(tag_name, "base"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_base);
-		}
-		else if (is_equal(tag_name, "body"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_body);
-		}
-		else if (is_equal(tag_name, "div"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_div);
-		}
-		else if (is_equal(tag_name, "script"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_script);
-		}
-		else if (is_equal(tag_name, "font"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_font);
-		}
-		else if (is_equal(tag_name, "svg"))
-		{
-			newTag = std::make_unique<element>(m_doc, el_svg);
-		}
-		else
-		{
-			newTag = std::make_unique<element>(m_doc, el_html);
-		}
-	}
+	constexpr element_type element_tag_types[] = {
+		el_break, el_para, el_image, el_table, el_td, el_td, el_link, el_title, el_anchor, el_tr, el_style,
+		el_base, el_body, el_div, el_script, el_font, el_svg
+	};
 
-	if (newTag)
-	{
-		newTag->set_tag_name(tag_name);
-	}
+	static_assert(std::size(element_tag_types) == element_tag_strings.size());
+}
+
+parser::parser(document& d) : m_doc(d)
+{
+	m_root = create_element("html");
+	m_parse_stack.push_back({m_root.get(), parse_tag("html")});
+}
 
+std::unique_ptr<element> parser::create_element(const std::string_view tag_name)
+{
+	const int tag = element_tag_strings.find(tag_name);
+	auto newTag = std::make_unique<element>(m_doc, tag >= 0 ? element_tag_types[tag] : el_html);
+	newTag->set_tag_name(tag_name);
 	return newTag;
 }
 
@@ -1606,7 +2353,8 @@ void parser::parse_tag_start(const std::string_view tag_name)
 	parse_pop_void_element();
 
 	// We add the html(root) element before parsing
-	if (is_equal(tag_name, "html"))
+	const int tag = parse_tag(tag_name);
+	if (tag == parse_tag("html"))
 	{
 		return;
 	}
@@ -1615,18 +2363,18 @@ void parser::parse_tag_start(const std::string_view tag_name)
 
 	if (el)
 	{
-		if (!m_parse_stack.empty() && m_parse_stack.back()->get_tag_name() == "html")
+		if (!m_parse_stack.empty() && m_parse_stack.back().tag == parse_tag("html"))
 		{
 			// if last element is root we have to add head or body
-			if (!value_in_list(tag_name, "head;body"))
+			if (tag != parse_tag("head") && tag != parse_tag("body"))
 			{
-				parse_push_element(create_element("body"));
+				parse_push_element(create_element("body"), parse_tag("body"));
 			}
 		}
 
-		parse_close_omitted_end(tag_name);
-		parse_open_omitted_start(tag_name);
-		parse_push_element(std::move(el));
+		parse_close_omitted_end(tag);
+		parse_open_omitted_start(tag);
+		parse_push_element(std::move(el), tag);
 	}
 }
 
@@ -1635,40 +2383,32 @@ void parser::parse_tag_end(const std::string_view tag_name)
 {
 	if (!m_parse_stack.empty())
 	{
-		if (m_parse_stack.back()->get_tag_name() == tag_name)
+		const int tag = parse_tag(tag_name);
+
+		if (is_open_as(m_parse_stack.back(), tag, tag_name))
 		{
 			parse_pop_element();
 		}
 		else
 		{
-			auto stop_tag = "";
-
-			for (int i = 0; m_stop_tags[i].tags; i++)
-			{
-				if (value_in_list(tag_name, m_stop_tags[i].tags))
-				{
-					stop_tag = m_stop_tags[i].stop_parent;
-					break;
-				}
-			}
-			parse_pop_element(tag_name, stop_tag);
+			parse_pop_element(tag, tag_name, g_parse_tag_rules[tag].end_stop);
 		}
 	}
 }
 
 
-void parser::parse_push_element(std::unique_ptr<element> el)
+void parser::parse_push_element(std::unique_ptr<element> el, const int tag)
 {
 	if (!m_parse_stack.empty())
 	{
 		const auto raw = el.get();
 
-		if (auto refused = m_parse_stack.back()->append_child(std::move(el)))
+		if (auto refused = m_parse_stack.back().el->append_child(std::move(el)))
 		{
 			m_detached.push_back(std::move(refused));
 		}
 
-		m_parse_stack.push_back(raw);
+		m_parse_stack.push_back({raw, tag});
 	}
 }
 
@@ -1676,7 +2416,7 @@ void parser::parse_attribute(const std::string_view attr_name, const std::string
 {
 	if (!m_parse_stack.empty())
 	{
-		m_parse_stack.back()->set_attr(attr_name, attr_value);
+		m_parse_stack.back().el->set_attr(attr_name, attr_value);
 	}
 }
 
@@ -1684,16 +2424,16 @@ void parser::parse_word(const std::string_view val)
 {
 	if (m_parse_stack.empty()) return;
 
-	if (m_parse_stack.back()->get_tag_name() == "html")
+	if (m_parse_stack.back().tag == parse_tag("html"))
 	{
-		parse_push_element(create_element("body"));
+		parse_push_element(create_element("body"), parse_tag("body"));
 	}
 
 	parse_pop_void_element();
 
 	if (!m_parse_stack.empty())
 	{
-		m_parse_stack.back()->append_text(val);
+		m_parse_stack.back().el->append_text(val);
 	}
 }
 
@@ -1702,14 +2442,14 @@ void parser::parse_space(const std::string_view val)
 	parse_pop_void_element();
 	if (!m_parse_stack.empty())
 	{
-		m_parse_stack.back()->append_space(val);
+		m_parse_stack.back().el->append_space(val);
 	}
 }
 
 void parser::parse_comment_start()
 {
 	parse_pop_void_element();
-	parse_push_element(std::make_unique<element>(m_doc, el_comment));
+	parse_push_element(std::make_unique<element>(m_doc, el_comment), parse_tag_other);
 }
 
 void parser::parse_comment_end()
@@ -1720,7 +2460,7 @@ void parser::parse_comment_end()
 void parser::parse_cdata_start()
 {
 	parse_pop_void_element();
-	parse_push_element(std::make_unique<element>(m_doc, el_cdata));
+	parse_push_element(std::make_unique<element>(m_doc, el_cdata), parse_tag_other);
 }
 
 void parser::parse_cdata_end()
@@ -1732,10 +2472,16 @@ void parser::parse_data(const std::string_view val)
 {
 	if (!m_parse_stack.empty())
 	{
-		m_parse_stack.back()->set_data(val);
+		m_parse_stack.back().el->set_data(val);
 	}
 }
 
+// Tags outside the rule table share one atom, so those still compare names.
+bool parser::is_open_as(const open_element& open, const int tag, const std::string_view tag_name)
+{
+	return open.tag == tag && (tag != parse_tag_other || open.el->get_tag_name() == tag_name);
+}
+
 bool parser::parse_pop_element()
 {
 	if (!m_parse_stack.empty())
@@ -1746,24 +2492,24 @@ bool parser::parse_pop_element()
 	return false;
 }
 
-bool parser::parse_pop_element(const std::string_view tag, const char* stop_tags)
+bool parser::parse_pop_element(const int tag, const std::string_view tag_name, const int stop_tag)
 {
 	bool found = false;
 	for (auto iel = m_parse_stack.rbegin(); iel != m_parse_stack.rend(); ++iel)
 	{
-		if ((*iel)->get_tag_name() == tag)
+		if (is_open_as(*iel, tag, tag_name))
 		{
 			found = true;
 			break;
 		}
-		if (value_in_list((*iel)->get_tag_name(), stop_tags)) break;
+		if (stop_tag != parse_tag_other && iel->tag == stop_tag) break;
 	}
 
 	if (!found) return false;
 
 	while (found)
 	{
-		if (m_parse_stack.back()->get_tag_name() == tag)
+		if (is_open_as(m_parse_stack.back(), tag, tag_name))
 		{
 			found = false;
 		}
@@ -1774,78 +2520,29 @@ bool parser::parse_pop_element(const std::string_view tag, const char* stop_tags
 
 void parser::parse_pop_void_element()
 {
-	if (!m_parse_stack.empty())
-	{
-		if (value_in_list(m_parse_stack.back()->get_tag_name(), void_elements))
-		{
-			parse_pop_element();
-		}
-	}
-}
-
-void parser::parse_pop_to_parent(const char* parents, const char* stop_parent)
-{
-	std::vector<element*>::size_type parent = 0;
-	bool found = false;
-	auto p = split_string(parents, ';');
-
-	for (int i = static_cast<int>(m_parse_stack.size()) - 1; i >= 0 && !found; i--)
+	if (!m_parse_stack.empty() && g_parse_tag_rules[m_parse_stack.back().tag].is_void)
 	{
-		if (std::find(p.begin(), p.end(), m_parse_stack[i]->get_tag_name()) != p.end())
-		{
-			found = true;
-			parent = i;
-			break;
-		}
-		if (m_parse_stack[i]->get_tag_name() == stop_parent)
-		{
-			break;
-		}
-	}
-	if (found)
-	{
-		m_parse_stack.erase(m_parse_stack.begin() + parent + 1, m_parse_stack.end());
-	}
-	else
-	{
-		parse_tag_start(p.front());
+		parse_pop_element();
 	}
 }
 
-void parser::parse_close_omitted_end(const std::string_view tag)
+void parser::parse_close_omitted_end(const int tag)
 {
 	if (m_parse_stack.empty()) return;
 
-	for (int i = 0; m_omitted_end_tags[i].tag; i++)
+	if (in_tag_set(g_parse_tag_rules[m_parse_stack.back().tag].closed_by, tag))
 	{
-		if (m_parse_stack.back()->get_tag_name() == m_omitted_end_tags[i].tag)
-		{
-			if (value_in_list(tag, m_omitted_end_tags[i].followed_tags))
-			{
-				parse_pop_element();
-				break;
-			}
-		}
+		parse_pop_element();
 	}
 }
 
-void parser::parse_open_omitted_start(const std::string_view tag)
+void parser::parse_open_omitted_start(const int tag)
 {
-	if (is_equal(tag, "col"))
-	{
-		if (m_parse_stack.back()->get_tag_name() != "colgroup")
-		{
-			parse_tag_start("colgroup");
-		}
-	}
-	else if (is_equal(tag, "tr"))
+	const auto& rule = g_parse_tag_rules[tag];
+
+	if (rule.parents && !in_tag_set(rule.parents, m_parse_stack.back().tag))
 	{
-		if (m_parse_stack.back()->get_tag_name() != "tbody" &&
-			m_parse_stack.back()->get_tag_name() != "thead" &&
-			m_parse_stack.back()->get_tag_name() != "tfoot")
-		{
-			parse_tag_start("tbody");
-		}
+		parse_tag_start(parse_tag_strings.key(rule.implied_parent));
 	}
 }
 
@@ -1857,136 +2554,538 @@ document::document(view_host& v) : m_view(v), m_over_element(nullptr)
 
 document::~document()
 {
-	m_http.stop();
+	cancel_loads();
 	clear();
+}
+
+void document::cancel_loads()
+{
+	m_http.stop();
+}
 
-	std::lock_guard lock(m_fonts_mutex);
-	for (auto& [key, fi] : m_fonts)
+font_cache::~font_cache()
+{
+	for (auto& [key, fi] : fonts)
 	{
-		if (fi.font)
-		{
-			pf::delete_font_handle(fi.font);
-			fi.font = 0;
-		}
+		if (fi.font) pf::delete_font_handle(fi.font);
 	}
 }
 
+std::shared_ptr<const css> layout_cache::master_stylesheet()
+{
+	std::lock_guard lock(m_mutex);
+	return m_master;
+}
+
+void layout_cache::keep_master_stylesheet(const css& styles)
+{
+	// The copy gets media lists of its own; the originals belong to the
+	// document that parsed the sheet and are evaluated for it.
+	auto master = std::make_shared<css>(styles);
+	master->own_media_lists();
+
+	std::lock_guard lock(m_mutex);
+	if (!m_master) m_master = std::move(master);
+}
+
 void document::clear()
 {
+	m_stream.reset();
 	m_root.reset();
 	m_over_element = nullptr;
 
 	m_styles.clear();
+	m_page_names.clear();
+	m_pruned_reported = 0;
 	m_fixed_boxes.clear();
 	m_media_lists.clear();
+	m_breakpoints_stale = true;
+	m_media_size = {-1, -1};
+	// Decodes still running for the old page report into the same stats and
+	// take their bytes back out when they find their image gone.
+	for (const auto& [url, image] : m_images)
+	{
+		if (image) m_decode_stats->add(-bitmap_bytes(*image));
+	}
 	m_images.clear();
+	m_scaled_images.clear();
+	m_natural_images.clear();
+	m_decode_stats->peak_bytes = m_decode_stats->bitmap_bytes.load();
+	m_decode_stats->decode_us = 0;
+	m_preloads.clear();
+	m_first_css_reported = false;
+	m_image_layouts_pending = 0;
+	m_image_layouts_queued = 0;
+	m_image_layouts_avoided = 0;
 }
 
 void document::load_master_stylesheet(const std::string& text)
 {
 	auto media_list = media_query_list::create_from_string("screen");
-	m_styles.parse_stylesheet(text, empty, *this, media_list);
+	m_styles.parse_stylesheet(text, empty, *this, media_list, "master.css");
 }
 
-static void parse_stream(html_scanner& sc, parser& par)
+void document::load_master_stylesheet()
 {
-	token_type t;
-
-	while ((t = sc.get_token()) != TT_EOF && !par.is_stack_empty())
+	if (const auto master = m_cache ? m_cache->master_stylesheet() : nullptr)
 	{
-		switch (t)
-		{
-		case TT_CDATA_START:
-			par.parse_cdata_start();
-			break;
-		case TT_CDATA_END:
-			par.parse_cdata_end();
-			break;
-		case TT_COMMENT_START:
-			par.parse_comment_start();
-			break;
-		case TT_COMMENT_END:
-			par.parse_comment_end();
-			break;
-		case TT_DATA:
-			par.parse_data(sc.get_value());
-			break;
-		case TT_TAG_START:
-			// Markup declarations we do not model arrive here as "!name".
-			if (!sc.get_tag_name().empty() && sc.get_tag_name().front() != '!')
-			{
-				par.parse_tag_start(sc.get_tag_name());
-			}
-			break;
-		case TT_TAG_END_EMPTY:
-		case TT_TAG_END:
-			par.parse_tag_end(sc.get_tag_name());
-			break;
-		case TT_ATTR:
-			par.parse_attribute(sc.get_attr_name(), sc.get_value());
-			break;
-		case TT_WORD:
-			par.parse_word(sc.get_value());
-			break;
-		case TT_SPACE:
-			par.parse_space(sc.get_value());
-			break;
-		default:
-			break;
-		}
+		m_styles = *master;
+		for (const auto& list : m_styles.own_media_lists()) add_media_list(list);
+		return;
 	}
+
+	load_master_stylesheet(load_resource_html("master.css"));
+	if (m_cache) m_cache->keep_master_stylesheet(m_styles);
 }
 
-std::shared_ptr<document> document::create_from_bytes(view_host& view, const std::string& url,
-                                                      const std::string_view bytes,
-                                                      const std::string_view content_type)
+namespace
 {
-	auto doc = std::make_shared<document>(view);
-
-	doc->set_base_url(url);
-	doc->m_source = decode_to_utf8(bytes, content_type);
+	// Watches the token stream for resources the page is certain to request and
+	// starts fetching them straight away, so the downloads overlap the rest of
+	// the parse and the master stylesheet instead of waiting for
+	// parse_attributes. It sees tokens only; the tree makes its own requests
+	// later and finds these already in flight.
+	class preload_scanner
+	{
+		document& m_doc;
+		std::string m_tag;
+		std::string m_rel;
+		std::string m_href;
+		std::string m_src;
+		std::string m_media;
+		bool m_in_tag = false;
+		bool m_in_style = false;
+		bool m_past_imports = false; // the style element has had a rule, so later @imports are ignored
+
+	public:
+		explicit preload_scanner(document& doc) : m_doc(doc)
+		{
+		}
+
+		void feed(const token_type t, const html_scanner& sc)
+		{
+			if (t == TT_ATTR)
+			{
+				if (m_in_tag) attribute(sc.get_attr_name(), sc.get_value());
+				return;
+			}
+
+			// Anything other than an attribute means the start tag is complete.
+			if (m_in_tag) flush();
+
+			if (t == TT_TAG_START)
+			{
+				m_tag = sc.get_tag_name();
+				m_in_tag = m_tag == "link" || m_tag == "img" || m_tag == "base";
+				m_in_style = m_tag == "style";
+				m_past_imports = false;
+			}
+			else if (t == TT_DATA && m_in_style)
+			{
+				scan_imports(sc.get_value());
+			}
+			else
+			{
+				m_in_style = false;
+			}
+		}
+
+		void finish()
+		{
+			if (m_in_tag) flush();
+		}
+
+	private:
+		// Last value wins, as it does in element::set_attr.
+		void attribute(const std::string_view name, const std::string_view value)
+		{
+			if (name == "rel") m_rel = value;
+			else if (name == "href") m_href = value;
+			else if (name == "src") m_src = value;
+			else if (name == "media") m_media = value;
+		}
+
+		void flush()
+		{
+			// Same conditions element::parse_attributes uses, so every preload
+			// has a real request to be claimed by.
+			if (m_tag == "link" && m_rel == "stylesheet" && !m_href.empty())
+			{
+				m_doc.preload_css(m_href, m_media);
+			}
+			else if (m_tag == "img" && !m_src.empty())
+			{
+				m_doc.preload_image(m_src);
+			}
+			else if (m_tag == "base" && !m_href.empty())
+			{
+				m_doc.set_base_url(m_href);
+			}
+
+			m_in_tag = false;
+			m_rel.clear();
+			m_href.clear();
+			m_src.clear();
+			m_media.clear();
+		}
+
+		// Extracts the URL the way css::parse_atrule does, so the real @import
+		// resolves to the same key. Only the @import rules a parser honours
+		// count: those before any other rule but @charset, outside comments.
+		void scan_imports(const std::string_view text)
+		{
+			size_t pos = 0;
+
+			while (!m_past_imports)
+			{
+				while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+				const auto rest = text.substr(pos);
+				if (rest.empty()) return;
+
+				if (rest.starts_with("/*"))
+				{
+					const auto end = rest.find("*/", 2);
+					if (end == std::string_view::npos) return;
+					pos += end + 2;
+					continue;
+				}
+				if (rest.starts_with("<!--") || rest.starts_with("-->"))
+				{
+					pos += rest[0] == '<' ? 4 : 3;
+					continue;
+				}
+
+				const bool import = rest.starts_with("@import");
+				if (!import && !rest.starts_with("@charset"))
+				{
+					m_past_imports = true;
+					return;
+				}
+
+				const auto statement_end = rest.find(';');
+				if (import)
+				{
+					auto start = 7u;
+					while (start < rest.size() && isspace(static_cast<unsigned char>(rest[start]))) ++start;
+
+					const auto end = rest.find_first_of(" \t\r\n;", start);
+					const std::string token(rest.substr(start, (end == std::string_view::npos ? rest.size() : end) - start));
+
+					if (!token.empty())
+					{
+						auto url = css::parse_css_url(token);
+						if (url.empty()) url = token;
+						m_doc.preload_css(url, empty);
+					}
+				}
+
+				if (statement_end == std::string_view::npos) return;
+				pos += statement_end + 1;
+			}
+		}
+	};
+}
+
+static void parse_stream(html_scanner& sc, parser& par, preload_scanner* preload = nullptr)
+{
+	trace::zone zone("parse_stream", "parse");
+	token_type t;
+
+	while ((t = sc.get_token()) != TT_EOF && !par.is_stack_empty())
+	{
+		if (preload) preload->feed(t, sc);
+
+		switch (t)
+		{
+		case TT_CDATA_START:
+			par.parse_cdata_start();
+			break;
+		case TT_CDATA_END:
+			par.parse_cdata_end();
+			break;
+		case TT_COMMENT_START:
+			par.parse_comment_start();
+			break;
+		case TT_COMMENT_END:
+			par.parse_comment_end();
+			break;
+		case TT_DATA:
+			par.parse_data(sc.get_value());
+			break;
+		case TT_TAG_START:
+			// Markup declarations we do not model arrive here as "!name".
+			if (!sc.get_tag_name().empty() && sc.get_tag_name().front() != '!')
+			{
+				par.parse_tag_start(sc.get_tag_name());
+			}
+			break;
+		case TT_TAG_END_EMPTY:
+		case TT_TAG_END:
+			par.parse_tag_end(sc.get_tag_name());
+			break;
+		case TT_ATTR:
+			par.parse_attribute(sc.get_attr_name(), sc.get_value());
+			break;
+		case TT_WORD:
+			par.parse_word(sc.get_value());
+			break;
+		case TT_SPACE:
+			par.parse_space(sc.get_value());
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Parse state carried between the pieces of a page that is still arriving.
+struct html_stream
+{
+	incremental_decoder decoder;
+	parser par;
+	html_scanner sc;
+	preload_scanner preload;
+
+	html_stream(document& doc, const std::string_view content_type) : decoder(content_type), par(doc), sc({}),
+	                                                                  preload(doc)
+	{
+	}
+};
+
+std::shared_ptr<document> document::create_from_bytes(view_host& view, const std::string& url,
+                                                      std::string bytes,
+                                                      const std::string_view content_type,
+                                                      const std::shared_ptr<layout_cache>& cache)
+{
+	trace::zone zone("create_from_bytes", "parse");
+	zone.detail(url);
+	auto doc = std::make_shared<document>(view);
+
+	if (cache)
+	{
+		doc->m_cache = cache;
+		doc->m_fonts = cache->fonts();
+	}
+
+	doc->set_base_url(url);
+	{
+		alloc_stats::stage stage("decode");
+		doc->m_source = decode_to_utf8(std::move(bytes), content_type);
+	}
 
 	view.diagnostic(std::format("HTML parse started: {} ({} bytes)", url, doc->m_source.size()));
 
+	const auto t0 = std::chrono::steady_clock::now();
+	alloc_stats::stage parse_stage("parse");
+	hw_counters::stage parse_counters("parse");
 	parser par(*doc);
 	html_scanner sc(doc->m_source);
-	parse_stream(sc, par);
+	preload_scanner preload(*doc);
+	parse_stream(sc, par, &preload);
+	preload.finish();
+	parse_counters.end();
+	parse_stage.end();
+	const auto t1 = std::chrono::steady_clock::now();
 
 	view.diagnostic("HTML parse completed");
 
-	doc->load_master_stylesheet(load_resource_html("master.css"));
+	hw_counters::stage style_counters("style");
+	{
+		alloc_stats::stage stage("master stylesheet");
+		doc->load_master_stylesheet();
+	}
 	doc->set_root(par.release_root());
+	style_counters.end();
+	const auto t2 = std::chrono::steady_clock::now();
+
+	doc->m_stage_times.parse_us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+	doc->m_stage_times.style_us = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
+	return doc;
+}
 
+std::shared_ptr<document> document::begin_stream(view_host& view, const std::string& url,
+                                                 const std::string_view content_type)
+{
+	auto doc = std::make_shared<document>(view);
+
+	doc->set_base_url(url);
+	doc->load_master_stylesheet();
+	doc->m_stream = std::make_unique<html_stream>(*doc, content_type);
+
+	view.diagnostic(std::format("HTML stream started: {}", url));
 	return doc;
 }
 
+void document::append_bytes(const std::string_view bytes)
+{
+	if (!m_stream) return;
+
+	const auto decoded = m_source.size();
+	m_stream->decoder.push(bytes, m_source);
+	if (m_source.size() != decoded) parse_available(false);
+}
+
+std::string_view document::keep_text(const std::string_view text)
+{
+	// A page still streaming in can reallocate m_source as it grows.
+	const std::less<> before;
+	const auto* begin = m_source.data();
+	const auto* end = begin + m_source.size();
+
+	if (!m_stream && !before(text.data(), begin) && !before(end, text.data() + text.size()))
+	{
+		return text;
+	}
+
+	return m_text_arena.store(text);
+}
+
+void document::finish_stream()
+{
+	if (!m_stream) return;
+
+	m_stream->decoder.finish(m_source);
+	parse_available(true);
+	m_stream->preload.finish();
+
+	m_view.diagnostic(std::format("HTML parse completed ({} bytes)", m_source.size()));
+
+	// The early passes styled new nodes against the tree as it stood, so
+	// structural and sibling selectors get one full cascade now it is whole.
+	if (m_root) apply_stylesheet();
+	else set_root(m_stream->par.release_root());
+
+	m_stream.reset();
+}
+
+// m_source may have reallocated as it grew, so the scanner is re-pointed at it
+// before every run. It keeps its position, and any token cut off by the end of
+// the text so far waits for the next piece.
+void document::parse_available(const bool last)
+{
+	m_stream->sc.set_input(m_source, !last);
+	parse_stream(m_stream->sc, m_stream->par, &m_stream->preload);
+
+	if (!last) style_partial_tree();
+}
+
+// Early pass over a page that is still arriving. The first one is a full
+// cascade; after that only the appended nodes are styled, and the elements on
+// the right edge they hang from are re-initialised, so a pass costs what
+// arrived rather than the whole tree.
+void document::style_partial_tree()
+{
+	if (!m_root)
+	{
+		m_root = m_stream->par.release_root();
+		update_styles(m_root.get());
+		m_view.layout();
+		return;
+	}
+
+	std::vector<element*> spine;
+	std::vector<element*> appended;
+	m_root->collect_appended(spine, appended);
+	if (appended.empty()) return;
+
+	std::ranges::reverse(appended);
+
+	const auto selectors_before = m_styles.selectors().size();
+	for (const auto el : appended) el->parse_attributes();
+
+	if (m_styles.selectors().size() != selectors_before)
+	{
+		// An inline <style> arrived and may restyle anything already shown.
+		update_styles(m_root.get());
+	}
+	else
+	{
+		// A tag, id or class a pruned selector was waiting for brings it back.
+		// Names no pruned selector mentions leave the buckets as they are.
+		if (m_page_names.changed) sort_styles();
+
+		for (const auto el : appended)
+		{
+			el->apply_stylesheet(m_styles);
+			el->parse_styles();
+		}
+
+		for (auto i = spine.rbegin(); i != spine.rend(); ++i)
+		{
+			(*i)->init();
+		}
+	}
+
+	m_view.layout();
+}
+
 void document::set_root(std::unique_ptr<element> r)
 {
 	m_root = std::move(r);
 	apply_stylesheet();
 }
 
+namespace
+{
+	// Screen metrics for the static unit conversions, read from the platform
+	// once per cascade or layout pass instead of per vw/vh/pt value. Per
+	// thread, as a pass runs start to finish on one thread.
+	struct viewport_metrics
+	{
+		pf::isize screen{};
+		int dpi = 0;
+	};
+
+	thread_local viewport_metrics t_viewport;
+
+	void capture_viewport()
+	{
+		t_viewport.screen = pf::platform_screen_size();
+		t_viewport.dpi = pf::platform_screen_dpi();
+	}
+
+	const viewport_metrics& viewport()
+	{
+		if (!t_viewport.dpi) capture_viewport();
+		return t_viewport;
+	}
+}
+
 void document::update_styles(element* root_el)
 {
+	capture_viewport();
+	// Page sheets are parsed with the attributes, so they count as cascade.
+	alloc_stats::stage cascade_stage("cascade");
+
 	if (root_el)
 	{
 		root_el->parse_attributes();
 	}
-	m_styles.sort_selectors();
+	sort_styles();
 
 	if (!m_media_lists.empty())
 	{
 		media_features features;
 		get_media_features(features);
 		update_media_lists(features);
+		m_media_band = media_breakpoints_for().band(m_client_pos.width, m_client_pos.height);
+		m_media_size = {m_client_pos.width, m_client_pos.height};
 	}
 
 	if (root_el)
 	{
 		const auto t0 = std::chrono::steady_clock::now();
-		root_el->apply_stylesheet(m_styles);
+		{
+			trace::zone zone("apply_stylesheet", "style");
+			root_el->apply_stylesheet(m_styles);
+		}
+		cascade_stage.end();
 		const auto t1 = std::chrono::steady_clock::now();
-		root_el->parse_styles();
+		{
+			alloc_stats::stage stage("parse_styles");
+			trace::zone zone("parse_styles", "style");
+			root_el->parse_styles();
+		}
 		const auto t2 = std::chrono::steady_clock::now();
 		m_view.diagnostic(std::format("MATCH {} us, PARSE_STYLES {} us",
 		                              std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count(),
@@ -1994,10 +3093,29 @@ void document::update_styles(element* root_el)
 	}
 }
 
+// Selectors naming a tag, id or class the page never uses are left out of
+// the buckets, which on real sites is most of the sheet.
+void document::sort_styles()
+{
+	const bool report = m_view.diagnostics_on() || css::s_profile;
+	const auto stats = m_styles.sort_selectors(&m_page_names, report);
+	m_page_names.changed = false;
+	trace::counter("selectors", static_cast<int64_t>(stats.kept));
+
+	// Once per change in what is pruned, not once per sort.
+	if (report && stats.dropped && stats.dropped != m_pruned_reported)
+	{
+		m_view.diagnostic(std::format("Selectors pruned: {} of {} cannot match, buckets {} KB -> {} KB",
+		                              stats.dropped, stats.kept + stats.dropped,
+		                              stats.unpruned_bucket_bytes / 1024, stats.bucket_bytes / 1024));
+	}
+	m_pruned_reported = stats.dropped;
+}
+
 void document::add_stylesheet(const std::string& text, const std::string& baseurl, const std::string& media)
 {
 	auto media_list = media_query_list::create_from_string(media);
-	m_styles.parse_stylesheet(text, baseurl, *this, media_list);
+	m_styles.parse_stylesheet(text, baseurl, *this, media_list, baseurl.empty() ? "<style>" : baseurl);
 }
 
 void document::apply_stylesheet()
@@ -2027,6 +3145,164 @@ void document::request_restyle()
 	});
 }
 
+// Every <img> in the tree whose src resolves to image_url.
+std::vector<const element*> document::image_elements(const std::string& image_url) const
+{
+	std::vector<const element*> result;
+	if (!m_root) return result;
+
+	std::vector<const element*> stack = {m_root.get()};
+
+	while (!stack.empty())
+	{
+		const auto* el = stack.back();
+		stack.pop_back();
+
+		if (el->get_tag_name() == "img" && !el->get_src().empty() &&
+			make_url(el->get_src(), m_base_path) == image_url)
+		{
+			result.push_back(el);
+		}
+
+		for (int i = static_cast<int>(el->get_children_count()) - 1; i >= 0; --i)
+		{
+			stack.push_back(el->get_child(i));
+		}
+	}
+
+	return result;
+}
+
+// Largest box the <img>s give the bitmap, or nothing when one of them is
+// still sized by the bitmap itself or has not been laid out yet.
+static size largest_placement(const std::vector<const element*>& els)
+{
+	size result;
+
+	for (const auto* el : els)
+	{
+		const auto box = el->get_placement();
+		if (!el->has_specified_size() || box.width <= 0 || box.height <= 0) return {};
+		result.width = std::max(result.width, box.width);
+		result.height = std::max(result.height, box.height);
+	}
+
+	return result;
+}
+
+size document::image_display_size(const std::string& image_url) const
+{
+	return largest_placement(image_elements(image_url));
+}
+
+// Layout works in CSS pixels; the bitmap is drawn in device pixels, so a
+// high-DPI screen needs proportionally more of them.
+static size device_pixels(const size css)
+{
+	const auto ratio = viewport().dpi / 96.0;
+	if (css.width <= 0 || css.height <= 0 || ratio <= 1.0) return css;
+	return {static_cast<int>(std::ceil(css.width * ratio)), static_cast<int>(std::ceil(css.height * ratio))};
+}
+
+size document::image_decode_target(const std::string& image_url) const
+{
+	if (m_natural_images.contains(image_url)) return {};
+	return device_pixels(image_display_size(image_url));
+}
+
+// A box that grew past its bitmap (a wider window, a media query), or an
+// image now also used as a background, gets a fresh decode from the kept
+// file. The smaller bitmap is shown until it lands.
+void document::redecode_outgrown_images()
+{
+	if (m_scaled_images.empty() || !m_root) return;
+
+	std::map<std::string, std::vector<const element*>, ltstr> users;
+	std::vector<const element*> stack = {m_root.get()};
+
+	while (!stack.empty())
+	{
+		const auto* el = stack.back();
+		stack.pop_back();
+
+		if (el->get_tag_name() == "img" && !el->get_src().empty())
+		{
+			const auto url = make_url(el->get_src(), m_base_path);
+			if (m_scaled_images.contains(url)) users[url].push_back(el);
+		}
+
+		for (int i = static_cast<int>(el->get_children_count()) - 1; i >= 0; --i)
+		{
+			stack.push_back(el->get_child(i));
+		}
+	}
+
+	for (auto& [url, scaled] : m_scaled_images)
+	{
+		if (scaled.redecoding || !scaled.source) continue;
+
+		const auto needed = m_natural_images.contains(url) ? size{} : device_pixels(largest_placement(users[url]));
+		if (needed.width > 0 && needed.height > 0 &&
+			needed.width <= scaled.target.width && needed.height <= scaled.target.height)
+		{
+			continue;
+		}
+
+		m_view.diagnostic(std::format("Image outgrew its {}x{} bitmap, decoding again: {}", scaled.target.width,
+		                              scaled.target.height, url));
+		scaled.redecoding = true;
+		decode_image(url, scaled.source);
+	}
+}
+
+// A bitmap landed. If every <img> showing it already had its size from
+// width/height, only those boxes need repainting. Anything else (an <img>
+// sized by its bitmap, a list marker, an <img> the parser has not reached)
+// shares one relayout with the other arrivals queued behind it.
+void document::image_arrived(const std::string& image_url)
+{
+	const auto els = image_elements(image_url);
+	bool needs_layout = els.empty();
+	std::vector<position> boxes;
+
+	for (const auto* el : els)
+	{
+		if (!el->has_specified_size())
+		{
+			needs_layout = true;
+			break;
+		}
+		auto box = el->get_placement();
+		box += el->get_paddings();
+		box += el->get_borders();
+		boxes.push_back(box);
+	}
+
+	if (!needs_layout)
+	{
+		++m_image_layouts_avoided;
+		m_view.diagnostic(std::format("Image layout avoided ({} so far), size already known: {}",
+		                              m_image_layouts_avoided, image_url));
+		for (const auto& box : boxes) m_view.invalidate_box(box);
+		return;
+	}
+
+	if (m_image_layouts_pending++) return;
+
+	++m_image_layouts_queued;
+	auto pThis = shared_from_this();
+	dispatch_to_ui([pThis]()
+	{
+		if (pThis->m_image_layouts_pending > 1)
+		{
+			pThis->m_view.diagnostic(std::format("Image relayout: {} arrivals in one layout",
+			                                     pThis->m_image_layouts_pending));
+		}
+		pThis->m_image_layouts_pending = 0;
+		pThis->m_view.layout();
+	});
+}
+
 pf::font_handle document::add_font(const std::string& name_in, int size, const std::string& weight,
                                    const std::string& style,
                                    const std::string& decoration, font_metrics* fm)
@@ -2047,9 +3323,9 @@ pf::font_handle document::add_font(const std::string& name_in, int size, const s
 	const auto key = std::format("{}:{}:{}:{}:{}", name, size, weight, style, decoration);
 
 	{
-		std::lock_guard lock(m_fonts_mutex);
-		const auto it = m_fonts.find(key);
-		if (it != m_fonts.end())
+		std::shared_lock lock(m_fonts->mutex);
+		const auto it = m_fonts->fonts.find(key);
+		if (it != m_fonts->fonts.end())
 		{
 			if (fm) *fm = it->second.metrics;
 			return it->second.font;
@@ -2117,7 +3393,8 @@ pf::font_handle document::add_font(const std::string& name_in, int size, const s
 		const auto fonts = split_string(name, ',');
 
 		pf::font_def def;
-		def.face = fonts.empty() ? get_default_font_name() : fonts.front();
+		if (fonts.empty()) def.face = get_default_font_name();
+		else def.face = pf::font_face_list ? name : fonts.front();
 		def.size = size;
 		def.weight = fw;
 		def.italic = fs == font_style_italic;
@@ -2134,18 +3411,18 @@ pf::font_handle document::add_font(const std::string& name_in, int size, const s
 		fi.metrics.draw_spaces = true;
 
 		{
-			std::lock_guard lock(m_fonts_mutex);
+			std::lock_guard lock(m_fonts->mutex);
 			// Another thread may have created the same font while the lock was
 			// released; keep the existing entry and drop the duplicate handle.
-			const auto it = m_fonts.find(key);
-			if (it != m_fonts.end())
+			const auto it = m_fonts->fonts.find(key);
+			if (it != m_fonts->fonts.end())
 			{
 				if (fi.font) pf::delete_font_handle(fi.font);
 				fi = it->second;
 			}
 			else
 			{
-				m_fonts[key] = fi;
+				m_fonts->fonts[key] = fi;
 			}
 		}
 		ret = fi.font;
@@ -2177,9 +3454,9 @@ pf::font_handle document::get_font(const std::string& name_in, int size, const s
 	const auto key = std::format("{}:{}:{}:{}:{}", name, size, weight, style, decoration);
 
 	{
-		std::lock_guard lock(m_fonts_mutex);
-		const auto el = m_fonts.find(key);
-		if (el != m_fonts.end())
+		std::shared_lock lock(m_fonts->mutex);
+		const auto el = m_fonts->fonts.find(key);
+		if (el != m_fonts->fonts.end())
 		{
 			if (fm) *fm = el->second.metrics;
 			return el->second.font;
@@ -2189,12 +3466,175 @@ pf::font_handle document::get_font(const std::string& name_in, int size, const s
 	return add_font(name, size, weight, style, decoration, fm);
 }
 
+size_t memory_footprint::total() const
+{
+	size_t bytes = 0;
+	for (const auto* use : {&elements, &text_nodes, &props, &style_entries, &used_selectors, &line_boxes,
+	                        &table_grids, &source, &selectors, &rules, &buckets, &fonts, &images})
+	{
+		bytes += use->bytes;
+	}
+	return bytes;
+}
+
+std::string memory_footprint::report() const
+{
+	const std::pair<const char*, const memory_use*> rows[] = {
+		{"elements", &elements}, {"text nodes", &text_nodes}, {"css_props", &props},
+		{"style entries", &style_entries}, {"used selectors", &used_selectors}, {"line boxes", &line_boxes},
+		{"table grids", &table_grids}, {"source text", &source}, {"selectors", &selectors},
+		{"rule blocks", &rules}, {"buckets", &buckets}, {"fonts", &fonts}, {"images", &images},
+	};
+
+	std::string result = "Memory:\n";
+	for (const auto& [name, use] : rows)
+	{
+		result += std::format("  {:<16} {:>9} {:>12.1f} KB\n", name, use->count, use->bytes / 1024.0);
+	}
+	result += std::format("  {:<16} {:>9} {:>12.1f} KB\n", "total", "", total() / 1024.0);
+	return result;
+}
+
+memory_footprint document::measure_memory()
+{
+	memory_footprint m;
+	if (m_root) m_root->measure_memory(m);
+	m.source.add(1, m_source.capacity());
+	m.source.add(1, m_text_arena.allocated());
+	m_styles.measure_memory(m.selectors, m.rules, m.buckets);
+
+	// A map node is the pair plus three links and a colour flag.
+	constexpr size_t map_node = 4 * sizeof(void*);
+	{
+		std::shared_lock lk(m_fonts->mutex);
+		for (const auto& [key, item] : m_fonts->fonts)
+		{
+			m.fonts.add(1, map_node + sizeof(key) + sizeof(item) + heap_bytes(key));
+		}
+	}
+
+	for (const auto& [url, image] : m_images)
+	{
+		if (image) m.images.add(1, sizeof(pf::bitmap) + image->pixels.capacity() * sizeof(image->pixels[0]));
+	}
+
+	return m;
+}
+
+bool layout_profile::enter(const element* el, const bool pass)
+{
+	if (!m_stack.empty() && m_stack.back().el == el) return false;
+	if (pass) m_costs[el].passes += 1;
+	m_stack.push_back({el, trace::now_ns(), 0});
+	return true;
+}
+
+void layout_profile::leave()
+{
+	const auto f = m_stack.back();
+	m_stack.pop_back();
+
+	const auto total = trace::now_ns() - f.start_ns;
+	auto& cost = m_costs[f.el];
+	cost.inclusive_ns += total;
+	cost.exclusive_ns += total - f.child_ns;
+	if (!m_stack.empty()) m_stack.back().child_ns += total;
+}
+
+// "div#main.a.b": the tag, then the id and classes as a selector would name
+// them. Semicolons and spaces would split a folded stack, so they become '_'.
+static std::string layout_frame_name(const element* el)
+{
+	std::string name = el->get_tag_name().empty() ? std::string("?") : el->get_tag_name();
+	if (const auto id = el->get_attr("id"); !id.empty())
+	{
+		name += '#';
+		name += id;
+	}
+
+	const auto cls = el->get_attr("class");
+	for (size_t start = 0; start < cls.size();)
+	{
+		start = cls.find_first_not_of(" \t\r\n\f", start);
+		if (start == std::string_view::npos) break;
+		auto end = cls.find_first_of(" \t\r\n\f", start);
+		if (end == std::string_view::npos) end = cls.size();
+		name += '.';
+		name += cls.substr(start, end - start);
+		start = end;
+	}
+
+	std::ranges::replace(name, ';', '_');
+	std::ranges::replace(name, ' ', '_');
+	return name;
+}
+
+static std::string layout_frame_path(const element* el)
+{
+	std::vector<std::string> names;
+	for (; el; el = el->parent()) names.push_back(layout_frame_name(el));
+
+	std::string path;
+	for (auto it = names.rbegin(); it != names.rend(); ++it)
+	{
+		if (!path.empty()) path += ';';
+		path += *it;
+	}
+	return path;
+}
+
+std::string layout_profile::folded_stacks() const
+{
+	// Siblings with the same name share a path; a sorted map merges them and
+	// keeps the output stable from run to run.
+	std::map<std::string, int64_t> stacks;
+	for (const auto& [el, cost] : m_costs)
+	{
+		stacks[layout_frame_path(el)] += cost.exclusive_ns;
+	}
+
+	std::string result;
+	for (const auto& [path, ns] : stacks) result += std::format("{} {}\n", path, ns);
+	return result;
+}
+
+std::string layout_profile::report(const size_t top) const
+{
+	std::vector<std::pair<const element*, layout_cost>> order(m_costs.begin(), m_costs.end());
+	std::ranges::sort(order, [](const auto& a, const auto& b) { return a.second.exclusive_ns > b.second.exclusive_ns; });
+	if (order.size() > top) order.resize(top);
+
+	auto result = std::format("Layout: {} elements timed\n  {:>8} {:>8} {:>6}  {}\n", m_costs.size(), "self ms",
+	                          "total ms", "passes", "element");
+
+	for (const auto& [el, cost] : order)
+	{
+		// The last few frames are enough to find the element in the page.
+		auto path = layout_frame_path(el);
+		size_t cut = path.size();
+		for (int frames = 0; frames < 4 && cut != std::string::npos; ++frames)
+		{
+			cut = cut ? path.rfind(';', cut - 1) : std::string::npos;
+		}
+		if (cut != std::string::npos) path = "..." + path.substr(cut);
+
+		result += std::format("  {:>8.3f} {:>8.3f} {:>6}  {}\n", cost.exclusive_ns / 1e6, cost.inclusive_ns / 1e6,
+		                      cost.passes, path);
+	}
+
+	return result;
+}
+
 int document::render(const int max_width, const render_type rt)
 {
+	trace::zone zone("render", "layout");
 	const auto started = std::chrono::steady_clock::now();
+	capture_viewport();
 	int ret = 0;
 	if (m_root)
 	{
+		if (rt != render_fixed_only) restyle_for_viewport();
+
 		if (rt == render_fixed_only)
 		{
 			m_fixed_boxes.clear();
@@ -2211,6 +3651,9 @@ int document::render(const int max_width, const render_type rt)
 			m_size.width = 0;
 			m_size.height = 0;
 			m_root->calc_document_size(m_size);
+
+			if (m_http.queued()) promote_visible_images();
+			redecode_outgrown_images();
 		}
 	}
 	m_view.diagnostic(std::format("RENDER {} us", std::chrono::duration_cast<std::chrono::microseconds>(
@@ -2218,8 +3661,39 @@ int document::render(const int max_width, const render_type rt)
 	return ret;
 }
 
+// Images start out as offscreen fetches. Once layout knows where they sit,
+// the ones inside the first screenful move ahead of the rest.
+void document::promote_visible_images()
+{
+	const auto fold = m_client_pos.height > 0 ? m_client_pos.bottom() : pf::platform_screen_size().cy;
+	std::vector<const element*> stack = {m_root.get()};
+
+	while (!stack.empty())
+	{
+		const auto* el = stack.back();
+		stack.pop_back();
+
+		if (!el->is_visible()) continue;
+
+		if (el->get_tag_name() == "img")
+		{
+			const auto src = el->get_attr("src");
+			if (!src.empty() && el->get_placement().top() < fold)
+			{
+				m_http.promote(make_url(std::string(src), m_base_path), fetch_priority::viewport);
+			}
+		}
+
+		for (int i = static_cast<int>(el->get_children_count()) - 1; i >= 0; --i)
+		{
+			stack.push_back(el->get_child(i));
+		}
+	}
+}
+
 void document::draw(render_win32& renderer, const int x, const int y, const position* clip)
 {
+	trace::zone zone("draw", "paint");
 	if (m_root)
 	{
 		m_root->draw(renderer, x, y, clip);
@@ -2268,19 +3742,19 @@ int document::cvt_units(css_length& val, const int fontSize, const int size)
 		val.set_value(static_cast<float>(ret), css_units_px);
 		break;
 	case css_units_vw:
-		ret = round_f(val.val() * pf::platform_screen_size().cx / 100.0f);
+		ret = round_f(val.val() * viewport().screen.cx / 100.0f);
 		val.set_value(static_cast<float>(ret), css_units_px);
 		break;
 	case css_units_vh:
-		ret = round_f(val.val() * pf::platform_screen_size().cy / 100.0f);
+		ret = round_f(val.val() * viewport().screen.cy / 100.0f);
 		val.set_value(static_cast<float>(ret), css_units_px);
 		break;
 	case css_units_vmin:
-		ret = round_f(val.val() * std::min(pf::platform_screen_size().cx, pf::platform_screen_size().cy) / 100.0f);
+		ret = round_f(val.val() * std::min(viewport().screen.cx, viewport().screen.cy) / 100.0f);
 		val.set_value(static_cast<float>(ret), css_units_px);
 		break;
 	case css_units_vmax:
-		ret = round_f(val.val() * std::max(pf::platform_screen_size().cx, pf::platform_screen_size().cy) / 100.0f);
+		ret = round_f(val.val() * std::max(viewport().screen.cx, viewport().screen.cy) / 100.0f);
 		val.set_value(static_cast<float>(ret), css_units_px);
 		break;
 	case css_units_pt:
@@ -2497,40 +3971,10 @@ std::vector<std::string> document::dump_boxes(const int max_depth) const
 
 namespace
 {
-	void append_json_string(std::string& out, const std::string_view value)
+	template <size_t Count, size_t Length>
+	std::string_view indexed_value(const keyword_table<Count, Length>& values, const int index)
 	{
-		out.push_back('"');
-		for (const unsigned char c : value)
-		{
-			switch (c)
-			{
-			case '"': out += "\\\""; break;
-			case '\\': out += "\\\\"; break;
-			case '\b': out += "\\b"; break;
-			case '\f': out += "\\f"; break;
-			case '\n': out += "\\n"; break;
-			case '\r': out += "\\r"; break;
-			case '\t': out += "\\t"; break;
-			default:
-				if (c < 0x20) out += std::format("\\u{:04x}", c);
-				else out.push_back(static_cast<char>(c));
-				break;
-			}
-		}
-		out.push_back('"');
-	}
-
-	std::string_view indexed_value(const std::string_view values, const int index)
-	{
-		size_t start = 0;
-		for (int current = 0; current < index; ++current)
-		{
-			start = values.find(';', start);
-			if (start == std::string_view::npos) return {};
-			++start;
-		}
-		const auto end = values.find(';', start);
-		return values.substr(start, end == std::string_view::npos ? end : end - start);
+		return index >= 0 && static_cast<size_t>(index) < Count ? values.key(index) : std::string_view();
 	}
 
 	void append_edges(std::string& out, const margins& edges)
@@ -2738,26 +4182,110 @@ bool document::on_lbutton_down(const int x, const int y, const int client_x, con
 	return false;
 }
 
-bool document::on_lbutton_up(int x, int y, int client_x, int client_y, position::vector& redraw_boxes)
+bool document::on_lbutton_up(int, int, int, int, position::vector& redraw_boxes)
 {
 	const auto root = m_root;
 	if (!root)
 	{
 		return false;
 	}
-	if (m_over_element)
+	if (m_over_element)
+	{
+		if (m_over_element->on_lbutton_up())
+		{
+			return root->find_styles_changes(redraw_boxes, 0, 0);
+		}
+	}
+	return false;
+}
+
+void document::add_fixed_box(const position& pos)
+{
+	m_fixed_boxes.push_back(pos);
+}
+
+const media_breakpoints& document::media_breakpoints_for()
+{
+	if (m_breakpoints_stale)
+	{
+		m_breakpoints = {};
+		for (const auto& ml : m_media_lists) ml->add_breakpoints(m_breakpoints);
+		m_breakpoints.sort();
+		m_breakpoints_stale = false;
+	}
+	return m_breakpoints;
+}
+
+// Re-evaluates the media queries only when the viewport crossed a breakpoint,
+// and then restyles only the subtrees under elements that a rule whose media
+// list flipped selects.
+void document::restyle_for_viewport()
+{
+	if (m_media_lists.empty()) return;
+
+	const std::pair size_now{m_client_pos.width, m_client_pos.height};
+	if (size_now == m_media_size) return;
+
+	const auto& points = media_breakpoints_for();
+	const auto band = points.band(size_now.first, size_now.second);
+	m_media_size = size_now;
+	if (band == m_media_band && !points.any_resize) return;
+	m_media_band = band;
+
+	media_features features;
+	get_media_features(features);
+
+	std::vector<const media_query_list*> flipped;
+	for (const auto& ml : m_media_lists)
+	{
+		if (ml->apply_media_features(features)) flipped.push_back(ml.get());
+	}
+	if (flipped.empty()) return;
+
+	std::vector<uint32_t> affected;
+	for (uint32_t i = 0; i < m_styles.selectors().size(); ++i)
+	{
+		const auto& sel = m_styles.selector(i);
+		if (m_styles.rank(i) != UINT32_MAX && std::ranges::find(flipped, sel.m_media_query.get()) != flipped.end())
+		{
+			affected.push_back(i);
+		}
+	}
+
+	// Topmost elements any affected rule selects; restyling one covers its
+	// subtree, so nothing below a chosen element is visited.
+	std::vector<element*> targets;
+	std::vector<element*> stack = {m_root.get()};
+	while (!stack.empty())
 	{
-		if (m_over_element->on_lbutton_up())
+		const auto el = stack.back();
+		stack.pop_back();
+		if (el->is_text_node()) continue;
+
+		const bool hit = std::ranges::any_of(affected, [&](const uint32_t i)
 		{
-			return root->find_styles_changes(redraw_boxes, 0, 0);
+			const auto& sel = m_styles.selector(i);
+			return (sel.m_right.m_any_tag || sel.m_right.m_tag == el->get_tag_name()) &&
+				el->select(sel, false) != select_no_match;
+		});
+
+		if (hit)
+		{
+			targets.push_back(el);
+			continue;
 		}
+
+		for (size_t i = el->get_children_count(); i-- > 0;) stack.push_back(el->get_child(static_cast<int>(i)));
 	}
-	return false;
-}
 
-void document::add_fixed_box(const position& pos)
-{
-	m_fixed_boxes.push_back(pos);
+	for (const auto el : targets)
+	{
+		el->restyle(m_styles);
+		for (auto p = el->parent(); p; p = p->parent()) p->init();
+	}
+
+	m_view.diagnostic(std::format("Media breakpoint crossed at {}x{}: {} rules changed, {} subtrees restyled",
+	                              size_now.first, size_now.second, affected.size(), targets.size()));
 }
 
 bool document::update_media_lists(const media_features& features)
@@ -2782,6 +4310,7 @@ void document::add_media_list(const std::shared_ptr<media_query_list>& list)
 		if (std::find(m_media_lists.begin(), m_media_lists.end(), list) == m_media_lists.end())
 		{
 			m_media_lists.push_back(list);
+			m_breakpoints_stale = true;
 		}
 	}
 }
@@ -2837,50 +4366,127 @@ void document::import_css(const std::string& url, const std::string& baseurl, co
 		base_path = m_base_path;
 	}
 
-	auto css_url = make_url(url, base_path);
+	const auto css_url = make_url(url, base_path);
+	if (claim_preload(css_url, "stylesheet")) return;
+	fetch_css(css_url, media);
+}
+
+void document::preload_css(const std::string& url, const std::string& media)
+{
+	const auto css_url = make_url(url, m_base_path);
+	if (m_preloads.contains(css_url)) return;
+
+	m_preloads[css_url] = {std::chrono::steady_clock::now()};
+	fetch_css(css_url, media);
+}
+
+void document::preload_image(const std::string& url)
+{
+	const auto image_url = make_url(url, m_base_path);
+	if (m_images.contains(image_url)) return;
+
+	// Recorded after the fetch starts so load_image does not claim it itself.
+	load_image(url, empty);
+	m_preloads[image_url] = {std::chrono::steady_clock::now()};
+}
+
+// True when the preload scanner already fetched `url`. The first real request
+// reports how far ahead of the tree the download started.
+bool document::claim_preload(const std::string& url, const std::string& type)
+{
+	const auto found = m_preloads.find(url);
+	if (found == m_preloads.end()) return false;
+
+	if (!found->second.claimed)
+	{
+		found->second.claimed = true;
+		found->second.claimed_at = std::chrono::steady_clock::now();
+
+		const auto ahead_us = std::chrono::duration_cast<std::chrono::microseconds>(
+			found->second.claimed_at - found->second.started).count();
+		m_view.diagnostic(std::format("Preload hit: {} requested {:.1f} ms ahead of the parser: {}",
+		                              type, ahead_us / 1000.0, url));
+
+		if (type == "stylesheet") report_first_css_byte(url);
+	}
+
+	return true;
+}
+
+// Once the first preloaded stylesheet has both been asked for by the parser
+// and had its first byte arrive, in either order, reports when that byte came.
+void document::report_first_css_byte(const std::string& url)
+{
+	const auto found = m_preloads.find(url);
+	if (m_first_css_reported || found == m_preloads.end()) return;
+
+	const auto& p = found->second;
+	if (!p.claimed || p.first_byte == std::chrono::steady_clock::time_point()) return;
+	m_first_css_reported = true;
+
+	const auto ms = [](const auto d) { return std::chrono::duration<double, std::milli>(d).count(); };
+	const auto lead = ms(p.claimed_at - p.first_byte);
+	m_view.diagnostic(std::format("Preload: first stylesheet byte {:.1f} ms after the fetch started, {:.1f} ms {} "
+	                              "the parser asked for it: {}", ms(p.first_byte - p.started), std::abs(lead),
+	                              lead >= 0 ? "before" : "after", url));
+}
+
+void document::fetch_css(const std::string& css_url, const std::string& media)
+{
 	auto pThis = shared_from_this();
 	m_view.resource_started("stylesheet", css_url);
 
-	m_http.download_file(css_url, std::make_shared<http_request>(
-		                     [pThis, css_url, media](const std::string& file_name, const uint32_t error,
-		                                             const uint32_t httpStatus,
-		                                             const std::string& /*reqUrl*/)
-		                     {
-			                     if (error || httpStatus >= 400)
-			                     {
-				                     pThis->m_view.resource_finished("stylesheet", css_url, false);
-				                     return;
-			                     }
-			                     const auto css_text = get_file_contents(file_name);
-			                     if (css_text.empty())
-			                     {
-				                     pThis->m_view.resource_finished("stylesheet", css_url, false);
-				                     return;
-			                     }
-			                     pThis->m_view.diagnostic(std::format(
-				                     "Stylesheet downloaded: {} bytes, HTTP {}: {}",
-				                     css_text.size(), httpStatus, css_url));
-
-			                     dispatch_to_ui([pThis, css_url, css_text, media]()
-			                     {
-				                     const auto selectors_before = pThis->m_styles.selectors().size();
-				                     pThis->add_stylesheet(css_text, css_url, media);
-				                     pThis->m_styles.sort_selectors();
-				                     pThis->m_view.diagnostic(std::format(
-					                     "Stylesheet parsed: {} selectors added, {} total: {}",
-					                     pThis->m_styles.selectors().size() - selectors_before,
-					                     pThis->m_styles.selectors().size(), css_url));
-
-				                     if (pThis->m_root)
-				                     {
-					                     pThis->request_restyle();
-				                     }
-				                     pThis->m_view.resource_finished("stylesheet", css_url, true);
-			                     });
-		                     }));
+	// The callback is stored in the request, so it can see the request's
+	// first-byte time through a plain pointer.
+	const auto request = std::make_shared<http_request>(nullptr);
+	request->m_callback = [pThis, css_url, media, req = request.get()](const std::string& file_name,
+	                                                                   const uint32_t error, const uint32_t httpStatus,
+	                                                                   const std::string& /*reqUrl*/)
+	{
+		if (const auto p = pThis->m_preloads.find(css_url); p != pThis->m_preloads.end())
+		{
+			p->second.first_byte = req->m_first_byte;
+			pThis->report_first_css_byte(css_url);
+		}
+
+		if (error || httpStatus >= 400)
+		{
+			pThis->m_view.resource_finished("stylesheet", css_url, false);
+			return;
+		}
+		const auto css_text = get_file_contents(file_name);
+		if (css_text.empty())
+		{
+			pThis->m_view.resource_finished("stylesheet", css_url, false);
+			return;
+		}
+		pThis->m_view.diagnostic(std::format(
+			"Stylesheet downloaded: {} bytes, HTTP {}: {}",
+			css_text.size(), httpStatus, css_url));
+
+		dispatch_to_ui([pThis, css_url, css_text, media]()
+		{
+			trace::zone zone("parse_stylesheet", "decode");
+			zone.detail(css_url);
+			const auto selectors_before = pThis->m_styles.selectors().size();
+			pThis->add_stylesheet(css_text, css_url, media);
+			pThis->sort_styles();
+			pThis->m_view.diagnostic(std::format(
+				"Stylesheet parsed: {} selectors added, {} total: {}",
+				pThis->m_styles.selectors().size() - selectors_before,
+				pThis->m_styles.selectors().size(), css_url));
+
+			if (pThis->m_root)
+			{
+				pThis->request_restyle();
+			}
+			pThis->m_view.resource_finished("stylesheet", css_url, true);
+		});
+	};
+	m_http.download_file(css_url, request);
 }
 
-void document::on_anchor_click(const std::string& url, element* el)
+void document::on_anchor_click(const std::string& url, element*)
 {
 	auto full = make_url(url, m_base_path);
 	view_host* view = &m_view;
@@ -2892,11 +4498,14 @@ void document::set_cursor(const std::string& cursor)
 	m_cursor = cursor;
 }
 
-void document::load_image(const std::string& url, const std::string& base)
+void document::load_image(const std::string& url, const std::string& base, const bool natural_size)
 {
 	auto image_url = make_url(url, base.empty() ? m_base_path : base);
 	auto pThis = shared_from_this();
 
+	claim_preload(image_url, "image");
+	if (natural_size) m_natural_images.insert(image_url);
+
 	if (!m_images.contains(image_url))
 	{
 		m_images[image_url] = nullptr; // Indicate loading
@@ -2904,32 +4513,127 @@ void document::load_image(const std::string& url, const std::string& base)
 
 		m_http.download_file(image_url, std::make_shared<http_request>(
 			                     [pThis, image_url](const std::string& file_name, const uint32_t error,
-			                                        const uint32_t httpStatus, const std::string& reqUrl)
+			                                        const uint32_t httpStatus, const std::string&)
 			                     {
 				                     if (error || httpStatus >= 400)
 				                     {
+					                     if (!file_name.empty()) pf::platform_delete_file(pf::file_path(file_name));
 					                     pThis->m_view.resource_finished("image", image_url, false);
 					                     return;
 				                     }
-				                     auto image = pf::load_bitmap_file(pf::file_path(file_name));
-				                     if (!image)
-				                     {
-					                     image = create_svg_placeholder(get_file_contents(file_name));
-					                     if (image)
-					                     {
-						                     pThis->m_view.diagnostic(std::format(
-							                     "SVG placeholder: {}x{}: {}", image->width, image->height,
-							                     image_url));
-					                     }
-				                     }
-				                     pThis->m_images[image_url] = std::move(image);
-				                     pThis->m_view.resource_finished(
-					                     "image", image_url, pThis->m_images[image_url] != nullptr);
-				                     pThis->m_view.layout();
-			                     }));
+				                     pThis->decode_image(image_url, std::make_shared<owned_temp_file>(file_name));
+			                     }, true), fetch_priority::offscreen);
 	}
 }
 
+// Decodes on a worker, so a large photo never stalls input or paint. When
+// layout already shows the image at well under its natural size, the worker
+// keeps a bitmap of the displayed size instead, and the file to decode again
+// from if the box later grows; get_image_size still reports the natural size,
+// so layout is the same either way.
+void document::decode_image(const std::string& image_url, std::shared_ptr<owned_temp_file> file)
+{
+	const auto target = image_decode_target(image_url);
+	const auto stats = m_decode_stats;
+	const std::weak_ptr<document> weak = shared_from_this();
+
+	image_decoders().post([weak, stats, image_url, file = std::move(file), target]() mutable
+	{
+		// The page was navigated away from while this waited.
+		if (weak.expired()) return;
+
+		trace::zone zone("decode_image", "decode");
+		zone.detail(image_url);
+		const auto started = std::chrono::steady_clock::now();
+		auto image = pf::load_bitmap_file(pf::file_path(file->path));
+		bool placeholder = false;
+		if (!image)
+		{
+			image = create_svg_placeholder(get_file_contents(file->path));
+			placeholder = image != nullptr;
+		}
+
+		size natural;
+		bool scaled = false;
+		if (image)
+		{
+			natural = {image->width, image->height};
+			stats->add(bitmap_bytes(*image));
+
+			if (target.width > 0 && target.height > 0 &&
+				image->width >= target.width * 2 && image->height >= target.height * 2)
+			{
+				auto smaller = downscale_bitmap(*image, target.width, target.height);
+				stats->add(bitmap_bytes(*smaller));
+				stats->add(-bitmap_bytes(*image));
+				image = std::move(smaller);
+				scaled = true;
+			}
+		}
+		if (!scaled) file.reset();
+
+		const auto decode_us = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - started).count();
+		stats->decode_us += decode_us;
+
+		dispatch_to_ui([weak, stats, image_url, image = std::move(image), natural, decode_us, placeholder, target,
+			               file = std::move(file)]() mutable
+		{
+			const auto bytes = image ? bitmap_bytes(*image) : 0;
+			const auto doc = weak.lock();
+			if (!doc || !doc->image_decoded(image_url, std::move(image), natural, decode_us, placeholder, target,
+			                                std::move(file)))
+			{
+				stats->add(-bytes);
+			}
+		});
+	});
+}
+
+bool document::image_decoded(const std::string& image_url, pf::bitmap_ptr image, const size natural,
+                             const int64_t decode_us, const bool placeholder, const size target,
+                             std::shared_ptr<owned_temp_file> source)
+{
+	// Cleared for another page while the decode was running.
+	const auto slot = m_images.find(image_url);
+	if (slot == m_images.end()) return false;
+	if (slot->second) m_decode_stats->add(-bitmap_bytes(*slot->second));
+
+	const auto previous = m_scaled_images.find(image_url);
+	const bool redecoded = previous != m_scaled_images.end() && previous->second.redecoding;
+	if (previous != m_scaled_images.end()) m_scaled_images.erase(previous);
+
+	if (image)
+	{
+		if (placeholder)
+		{
+			m_view.diagnostic(std::format("SVG placeholder: {}x{}: {}", image->width, image->height, image_url));
+		}
+
+		const bool scaled = image->width != natural.width || image->height != natural.height;
+		if (scaled) m_scaled_images[image_url] = {natural, target, std::move(source)};
+
+		m_view.diagnostic(std::format(
+			"Image decoded in {:.1f} ms ({:.1f} ms total): {}x{}{}, bitmaps {} KB, peak {} KB: {}",
+			decode_us / 1000.0, m_decode_stats->decode_us / 1000.0, natural.width, natural.height,
+			scaled ? std::format(" shown at {}x{}", image->width, image->height) : std::string(),
+			m_decode_stats->bitmap_bytes / 1024, m_decode_stats->peak_bytes / 1024, image_url));
+	}
+
+	const bool ok = image != nullptr;
+	slot->second = std::move(image);
+	if (!redecoded) m_view.resource_finished("image", image_url, ok);
+	image_arrived(image_url);
+	return true;
+}
+
+size document::get_image_size(const std::string& url, const std::string& base)
+{
+	const auto image_url = make_url(url, base.empty() ? m_base_path : base);
+	const auto found = m_scaled_images.find(image_url);
+	return found != m_scaled_images.end() ? found->second.natural : image_size(find_image(url, base));
+}
+
 pf::bitmap_ptr document::find_image(const std::string& url)
 {
 	return find_image(url, m_base_path);
@@ -2956,14 +4660,14 @@ int document::text_width(const std::string_view text, const pf::font_handle hFon
 
 int document::pt_to_px(const int pt)
 {
-	return pt * pf::platform_screen_dpi() / 72;
+	return pt * viewport().dpi / 72;
 }
 
 
 void document::get_media_features(media_features& media)
 {
-	const auto dpi = pf::platform_screen_dpi();
-	const auto sz = pf::platform_screen_size();
+	const auto dpi = viewport().dpi;
+	const auto sz = viewport().screen;
 
 	media.type = media_type_screen;
 	media.width = m_client_pos.width;
@@ -2975,3 +4679,419 @@ void document::get_media_features(media_features& media)
 	media.device_width = sz.cx;
 	media.device_height = sz.cy;
 }
+
+
+namespace
+{
+	// The scans the perfect hashes replaced, kept for comparison.
+	uint32_t lookup_entity_linear(const std::string_view name)
+	{
+		uint32_t fallback = 0;
+
+		for (const auto& entity : g_html_entities)
+		{
+			const char* code = entity.szCode + 1;
+			const size_t n = strlen(code);
+			if (n != name.size() + 1 || code[name.size()] != ';') continue;
+
+			if (memcmp(code, name.data(), name.size()) == 0) return entity.Code;
+			if (!fallback && _strnicmp(code, name.data(), name.size()) == 0) fallback = entity.Code;
+		}
+
+		return fallback;
+	}
+
+	template <size_t Count, size_t Length>
+	std::vector<std::string> lookup_keys(const keyword_table<Count, Length>& table)
+	{
+		std::vector<std::string> keys = {"-unknown-", "X"};
+		for (size_t i = 0; i < Count; ++i) keys.emplace_back(table.key(i));
+		return keys;
+	}
+
+	// Average ns per call of f over every key, repeated until ~50 ms pass.
+	template <typename F>
+	double ns_per_lookup(const std::vector<std::string>& keys, F f)
+	{
+		size_t sink = 0;
+		size_t calls = 0;
+		const auto started = std::chrono::steady_clock::now();
+		auto elapsed = std::chrono::steady_clock::duration();
+
+		while (elapsed < std::chrono::milliseconds(50))
+		{
+			for (const auto& key : keys) sink += static_cast<size_t>(f(key));
+			calls += keys.size();
+			elapsed = std::chrono::steady_clock::now() - started;
+		}
+
+		[[maybe_unused]] static volatile size_t keep;
+		keep = sink;
+		return std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(calls);
+	}
+}
+
+std::string run_lookup_benchmark()
+{
+	std::string report = std::format("{:<16} {:>6} {:>10} {:>10} {:>8}\n", "lookup", "keys", "linear ns", "hashed ns",
+	                                 "speedup");
+	const auto row = [&](const char* name, const std::vector<std::string>& keys, const double linear,
+	                     const double hashed)
+	{
+		report += std::format("{:<16} {:>6} {:>10.1f} {:>10.1f} {:>7.1f}x\n", name, keys.size(), linear, hashed,
+		                      linear / hashed);
+	};
+
+	{
+		const auto keys = lookup_keys(prop_id_strings);
+		row("property name", keys,
+		    ns_per_lookup(keys, [](const std::string& k) { return value_index(k, prop_id_strings.c_str()); }),
+		    ns_per_lookup(keys, [](const std::string& k) { return value_index(k, prop_id_strings); }));
+	}
+	{
+		const auto keys = lookup_keys(css_units_strings);
+		row("css unit", keys,
+		    ns_per_lookup(keys, [](const std::string& k) { return value_index(k, css_units_strings.c_str()); }),
+		    ns_per_lookup(keys, [](const std::string& k) { return value_index(k, css_units_strings); }));
+	}
+	{
+		const auto keys = lookup_keys(style_display_strings);
+		row("display", keys,
+		    ns_per_lookup(keys, [](const std::string& k) { return value_index(k, style_display_strings.c_str()); }),
+		    ns_per_lookup(keys, [](const std::string& k) { return value_index(k, style_display_strings); }));
+	}
+	{
+		const auto keys = lookup_keys(element_tag_strings);
+		row("element tag", keys,
+		    ns_per_lookup(keys, [](const std::string& k) { return value_index(k, element_tag_strings.c_str()); }),
+		    ns_per_lookup(keys, [](const std::string& k) { return element_tag_strings.find(k); }));
+	}
+	{
+		std::vector<std::string> keys = {"notanentity", "AMP"};
+		for (size_t i = 0; i < std::size(g_html_entities); ++i) keys.emplace_back(entity_name(i));
+		row("html entity", keys,
+		    ns_per_lookup(keys, [](const std::string& k) { return lookup_entity_linear(k); }),
+		    ns_per_lookup(keys, [](const std::string& k) { return lookup_entity(k); }));
+	}
+	{
+		auto keys = web_color::names();
+		// The lazily filled map web_color::from_string used to search.
+		std::map<std::string, web_color, ltstr> names;
+		for (const auto& k : keys) names[k] = web_color::from_string(k);
+		keys.emplace_back("notacolor");
+		row("color name", keys,
+		    ns_per_lookup(keys, [&](const std::string& k) { return names.find(k) != names.end(); }),
+		    ns_per_lookup(keys, [](const std::string& k) { return web_color::is_color(k.c_str()); }));
+	}
+
+	return report;
+}
+
+std::string run_parse_benchmark()
+{
+	// Tag-dense markup that leans on the implied-tag rules: cells and rows
+	// left open, lists of unclosed items, paragraphs ended by blocks. No
+	// attributes, so the time is tokenizing and tree construction.
+	std::string table = "<table>";
+	for (int r = 0; r < 4000; ++r)
+	{
+		table += "<tr>";
+		for (int c = 0; c < 8; ++c) table += std::format("<td>{}", r * 8 + c);
+		table += "</tr>";
+	}
+	table += "</table>";
+
+	std::string lists;
+	for (int i = 0; i < 2000; ++i)
+	{
+		lists += "<ul><li>one<li>two<ol><li>a<li>b<ul><li>x<li>y</ul></ol><li>three<dl><dt>t<dd>d<dt>u<dd>e</dl></ul>";
+	}
+
+	std::string paragraphs;
+	for (int i = 0; i < 4000; ++i)
+	{
+		paragraphs += "<p>Lorem <b>ipsum</b> dolor<p>sit <i>amet</i><div>consectetur<br>adipiscing</div><hr>";
+	}
+
+	std::string report = std::format("{:<12} {:>6} {:>8} {:>8} {:>8}\n", "markup", "KB", "tags", "MB/s", "ns/tag");
+	silent_view view;
+	document doc(view);
+
+	const auto row = [&](const char* name, const std::string& html)
+	{
+		const auto tags = std::ranges::count(html, '<');
+		size_t runs = 0;
+		const auto started = std::chrono::steady_clock::now();
+		auto elapsed = std::chrono::steady_clock::duration();
+
+		while (elapsed < std::chrono::milliseconds(200))
+		{
+			parser par(doc);
+			html_scanner sc(html);
+			parse_stream(sc, par);
+			const auto root = par.release_root();
+			++runs;
+			elapsed = std::chrono::steady_clock::now() - started;
+		}
+
+		const auto ns = std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(runs);
+		report += std::format("{:<12} {:>6} {:>8} {:>8.1f} {:>8.1f}\n", name, html.size() / 1024, tags,
+		                      static_cast<double>(html.size()) * 1000.0 / ns, ns / static_cast<double>(tags));
+	};
+
+	row("table", table);
+	row("lists", lists);
+	row("paragraphs", paragraphs);
+	return report;
+}
+
+std::string run_selector_benchmark(const std::string& path)
+{
+	auto html = get_file_contents(path);
+	if (html.empty()) return std::format("{}: cannot read file\n", path);
+
+	silent_view view;
+	const auto doc = document::create_from_bytes(view, "https://example.invalid/", std::move(html), "text/html");
+	if (!doc || !doc->root()) return std::format("{}: no document\n", path);
+
+	std::vector<element*> elements;
+	std::function<void(element*)> collect = [&](element* el)
+	{
+		if (!el->is_text_node()) elements.push_back(el);
+		for (size_t i = 0; i < el->get_children_count(); ++i) collect(el->get_child(static_cast<int>(i)));
+	};
+	collect(doc->root());
+
+	// Every selector against every element, not just the bucketed candidates,
+	// so the figure is the matcher's own cost.
+	const auto& selectors = doc->styles().selectors();
+	size_t matches = 0;
+	size_t runs = 0;
+	const auto started = std::chrono::steady_clock::now();
+	auto elapsed = std::chrono::steady_clock::duration();
+
+	while (elapsed < std::chrono::milliseconds(500))
+	{
+		matches = 0;
+		for (const auto el : elements)
+		{
+			for (const auto& sel : selectors)
+			{
+				if (el->select(sel, true) != select_no_match) ++matches;
+			}
+		}
+		++runs;
+		elapsed = std::chrono::steady_clock::now() - started;
+	}
+
+	const auto tests = static_cast<double>(elements.size()) * static_cast<double>(selectors.size());
+	const auto ns = std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(runs);
+	return std::format("{}: {} selectors x {} elements, {} matches, {:.1f} ns/test, {:.2f} ms/pass\n",
+	                   path, selectors.size(), elements.size(), matches,
+	                   tests > 0 ? ns / tests : 0.0, ns / 1e6);
+}
+
+namespace
+{
+	struct stage_summary
+	{
+		int64_t median = 0;
+		int64_t p90 = 0;
+		int64_t min = 0;
+	};
+
+	stage_summary summarize(std::vector<int64_t> samples)
+	{
+		if (samples.empty()) return {};
+		std::ranges::sort(samples);
+		const auto rank = [&](const double q)
+		{
+			// Nearest rank, so p90 of ten runs is the ninth.
+			const auto i = static_cast<size_t>(std::ceil(q * static_cast<double>(samples.size())));
+			return samples[std::clamp<size_t>(i, 1, samples.size()) - 1];
+		};
+		return {rank(0.5), rank(0.9), samples.front()};
+	}
+
+	constexpr const char* bench_stages[] = {"parse", "style", "layout", "total"};
+
+	// Reads back the medians run_corpus_benchmark wrote: one page per line,
+	// each stage as "name":{"median":N,...}.
+	std::map<std::string, std::array<int64_t, 4>> read_bench_baseline(const std::string& text)
+	{
+		std::map<std::string, std::array<int64_t, 4>> pages;
+		size_t line_start = 0;
+
+		while (line_start < text.size())
+		{
+			auto line_end = text.find('\n', line_start);
+			if (line_end == std::string::npos) line_end = text.size();
+			const std::string_view line(text.data() + line_start, line_end - line_start);
+			line_start = line_end + 1;
+
+			constexpr std::string_view page_key = "\"page\":";
+			const auto p = line.find(page_key);
+			if (p == std::string_view::npos) continue;
+			const auto quoted = line.substr(p + page_key.size());
+			const auto name = read_json_string(quoted.substr(0, json_string_length(quoted)));
+			if (name.empty()) continue;
+
+			std::array<int64_t, 4> medians{};
+			for (size_t i = 0; i < std::size(bench_stages); ++i)
+			{
+				const auto key = std::format("\"{}\":{{\"median\":", bench_stages[i]);
+				const auto k = line.find(key);
+				if (k != std::string_view::npos) medians[i] = atoll(std::string(line.substr(k + key.size(), 20)).c_str());
+			}
+			pages[name] = medians;
+		}
+		return pages;
+	}
+}
+
+corpus_bench_result run_corpus_benchmark(const corpus_bench_options& options)
+{
+	corpus_bench_result result;
+
+	std::vector<std::filesystem::path> files;
+	std::error_code ec;
+	for (const auto& entry : std::filesystem::directory_iterator(options.dir, ec))
+	{
+		const auto ext = entry.path().extension().string();
+		if (entry.is_regular_file() && (is_equal(ext, ".html") || is_equal(ext, ".htm")))
+		{
+			files.push_back(entry.path());
+		}
+	}
+	std::ranges::sort(files);
+
+	if (files.empty())
+	{
+		result.report = std::format("{}: no .html files\n", options.dir);
+		return result;
+	}
+
+	std::map<std::string, std::array<int64_t, 4>> baseline;
+	if (!options.baseline_path.empty())
+	{
+		baseline = read_bench_baseline(get_file_contents(options.baseline_path));
+		if (baseline.empty()) result.report += std::format("{}: no baseline pages read\n", options.baseline_path);
+	}
+
+	result.report += std::format("{:<40} {:>8} {:>24} {:>24} {:>24} {:>24}\n", "page (us: median/p90/min)", "KB",
+	                             "parse", "style", "layout", "total");
+	result.json = std::format("{{\"width\":{},\"warmup\":{},\"runs\":{},\"pages\":[\n", options.width,
+	                          options.warmup, options.runs);
+	if (options.counters && !hw_counters::start()) result.report += std::format("Counters: {}\n", hw_counters::status());
+
+	for (const auto& file : files)
+	{
+		const auto name = file.filename().string();
+		const auto html = get_file_contents(file.string());
+		if (html.empty()) continue;
+
+		for (int i = 0; i < options.warmup; ++i) layout_html_headless(html, {.width = options.width});
+
+		std::vector<int64_t> samples[std::size(bench_stages)];
+		hw_counters::reset();
+		int elements = 0;
+		for (int i = 0; i < std::max(1, options.runs); ++i)
+		{
+			const auto r = layout_html_headless(html, {.width = options.width});
+			elements = r.stats.elements;
+			samples[0].push_back(r.parse_us);
+			samples[1].push_back(r.style_us);
+			samples[2].push_back(r.layout_us);
+			samples[3].push_back(r.parse_style_us + r.layout_us);
+		}
+
+		std::string row = std::format("{:<40} {:>8}", name, html.size() / 1024);
+		std::string json_row = result.pages ? ",\n{\"page\":" : "{\"page\":";
+		append_json_string(json_row, name);
+		std::string verdicts;
+		const auto base = baseline.find(name);
+
+		for (size_t i = 0; i < std::size(bench_stages); ++i)
+		{
+			const auto s = summarize(std::move(samples[i]));
+			row += std::format(" {:>24}", std::format("{}/{}/{}", s.median, s.p90, s.min));
+			json_row += std::format(",\"{}\":{{\"median\":{},\"p90\":{},\"min\":{}}}", bench_stages[i], s.median,
+			                        s.p90, s.min);
+
+			if (base != baseline.end() && base->second[i] > 0)
+			{
+				const auto was = base->second[i];
+				const auto limit = static_cast<double>(was) * (1.0 + options.threshold_pct / 100.0);
+				if (static_cast<double>(s.median) > limit && s.median - was >= options.floor_us)
+				{
+					++result.regressions;
+					verdicts += std::format("  REGRESSION {} {}: median {} us, baseline {} us (+{:.0f}%)\n", name,
+					                        bench_stages[i], s.median, was,
+					                        100.0 * static_cast<double>(s.median - was) / static_cast<double>(was));
+				}
+			}
+		}
+
+		result.report += row + "\n" + verdicts;
+		if (hw_counters::on()) result.report += hw_counters::report(elements, std::max(1, options.runs));
+		result.json += json_row + "}";
+		++result.pages;
+	}
+
+	result.json += "\n]";
+	hw_counters::stop();
+
+	// Throughput: every page `runs` times, spread over 1, 2, 4 ... jobs threads
+	// sharing one layout cache, as a batch service would run them.
+	if (options.jobs > 1 && result.pages)
+	{
+		std::vector<std::string> pages;
+		for (const auto& file : files)
+		{
+			if (auto html = get_file_contents(file.string()); !html.empty()) pages.push_back(std::move(html));
+		}
+
+		std::vector<int> levels;
+		for (auto j = 1; j < options.jobs; j *= 2) levels.push_back(j);
+		levels.push_back(options.jobs);
+
+		const auto cache = std::make_shared<layout_cache>();
+		const auto count = pages.size() * static_cast<size_t>(std::max(1, options.runs));
+		const auto lay_out = [&](const size_t i)
+		{
+			layout_html_headless(pages[i % pages.size()], {.width = options.width, .cache = cache});
+		};
+		parallel_for(static_cast<unsigned>(options.jobs), pages.size(), lay_out);
+
+		result.report += std::format("\n{:<8} {:>12} {:>10} {:>12}  ({} layouts each, {} hardware threads)\n",
+		                             "jobs", "pages/s", "speedup", "efficiency", count,
+		                             std::thread::hardware_concurrency());
+		result.json += ",\"throughput\":[";
+		double single = 0;
+
+		for (const auto jobs : levels)
+		{
+			const auto started = std::chrono::steady_clock::now();
+			parallel_for(static_cast<unsigned>(jobs), count, lay_out);
+			const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+			const auto rate = seconds > 0 ? static_cast<double>(count) / seconds : 0.0;
+			if (jobs == 1) single = rate;
+
+			const auto speedup = single > 0 ? rate / single : 0.0;
+			result.report += std::format("{:<8} {:>12.1f} {:>10.2f} {:>11.0f}%\n", jobs, rate, speedup,
+			                             100.0 * speedup / jobs);
+			result.json += std::format("{}{{\"jobs\":{},\"pages_per_second\":{:.1f}}}", jobs == 1 ? "" : ",",
+			                           jobs, rate);
+		}
+
+		result.json += "]";
+	}
+
+	result.json += "}\n";
+	if (!baseline.empty())
+	{
+		result.report += std::format("{} regressions over {}% against {}\n", result.regressions,
+		                             options.threshold_pct, options.baseline_path);
+	}
+	return result;
+}
@@ -19,37 +19,101 @@ public:
 	using callback_t = std::function<void(const std::string& file, uint32_t error, uint32_t httpStatus,
 	                                      const std::string& url)>;
 
-	explicit http_request(callback_t callback) : m_callback(std::move(callback))
+	// With keeps_file the callback takes over the downloaded file and deletes
+	// it when done, so it can hand the file to another thread.
+	explicit http_request(callback_t callback, const bool keeps_file = false)
+		: m_callback(std::move(callback)), m_keeps_file(keeps_file)
 	{
 	}
 
 	~http_request() = default;
 
+	// Withdraws this request; its callback will not run. The download itself
+	// is dropped, or aborted if it has started, once no other request is
+	// waiting on the same URL.
 	void cancel()
+	{
+		std::function<void()> release;
+		{
+			std::lock_guard lk(m_mutex);
+			m_cancelled = true;
+			release = std::move(m_release);
+		}
+		if (release) release();
+	}
+
+	bool cancelled()
 	{
 		std::lock_guard lk(m_mutex);
-		if (m_async) m_async->cancel();
+		return m_cancelled;
 	}
 
-	// Internal — set by http when the request is launched.
-	void set_async(pf::async_http_request_ptr a)
+	// Internal — set by http when the request is queued.
+	void set_release(std::function<void()> f)
 	{
 		std::lock_guard lk(m_mutex);
-		m_async = std::move(a);
+		m_release = std::move(f);
 	}
 
 	callback_t m_callback;
+	bool m_keeps_file = false;
+	// When the first body byte arrived; unset if none did. Valid once the
+	// callback runs.
+	std::chrono::steady_clock::time_point m_first_byte;
 	std::mutex m_mutex;
-	pf::async_http_request_ptr m_async;
+	bool m_cancelled = false;
+	std::function<void()> m_release;
+};
+
+// Order in which queued downloads start. Stylesheets block rendering, so
+// they always go first; images in the first screenful go before the rest.
+enum class fetch_priority
+{
+	blocking,
+	viewport,
+	offscreen,
 };
 
-// Async HTTP — owns a pf::async_http_session and tracks in-flight requests
-// so they can be cancelled together at shutdown.
+// Async HTTP — owns a pf::async_http_session and schedules downloads on it.
+// Requests queue by priority and start as a connection to their host comes
+// free; a URL already queued or in flight is fetched once for every request
+// waiting on it.
 class http
 {
-	pf::async_http_session_ptr m_session;
-	std::mutex m_mutex;
-	std::vector<std::shared_ptr<http_request>> m_requests;
+	// One URL being fetched, and every request waiting on it.
+	struct fetch
+	{
+		std::string url;
+		std::string host;
+		fetch_priority priority = fetch_priority::blocking;
+		uint64_t order = 0;
+		std::vector<std::shared_ptr<http_request>> waiters;
+		pf::async_http_request_ptr async;
+		bool finished = false; // complete() has run, so there is nothing left to abort
+	};
+
+	// Shared with the completion callbacks, which hold it weakly, so one that
+	// lands after the http object is gone finds nothing rather than a dangling
+	// pointer.
+	struct scheduler
+	{
+		pf::async_http_session_ptr session;
+		std::mutex mutex;
+		std::vector<std::shared_ptr<fetch>> queued;
+		std::vector<std::shared_ptr<fetch>> active;
+		std::map<std::string, int, ltstr> per_host;
+		uint64_t next_order = 0;
+		bool stopped = false;
+	};
+
+	std::shared_ptr<scheduler> m_sched;
+
+	static void pump(const std::shared_ptr<scheduler>& sched);
+	static void launch(const std::shared_ptr<scheduler>& sched, const std::shared_ptr<fetch>& f);
+	static void complete(const std::weak_ptr<scheduler>& weak, const std::shared_ptr<fetch>& f,
+	                     const std::string& file_path, uint32_t error, uint32_t status,
+	                     std::chrono::steady_clock::time_point first_byte = {});
+	static void release(const std::shared_ptr<scheduler>& sched, const std::shared_ptr<fetch>& f);
 
 public:
 	http() = default;
@@ -59,7 +123,10 @@ public:
 	http& operator=(const http&) = delete;
 
 	bool open(std::string_view user_agent);
-	bool download_file(const std::string& url, const std::shared_ptr<http_request>& request);
+	bool download_file(const std::string& url, const std::shared_ptr<http_request>& request,
+	                   fetch_priority priority = fetch_priority::blocking);
+	void promote(const std::string& url, fetch_priority priority);
+	size_t queued();
 	void stop();
 	void close();
 };
@@ -78,8 +145,6 @@ struct html_entities
 	wchar_t Code;
 };
 
-extern html_entities g_html_entities[];
-
 enum token_type
 {
 	TT_ERROR = -1,
@@ -112,7 +177,16 @@ public:
 	{
 	}
 
-	token_type get_token() { return (this->*m_scan)(); }
+	token_type get_token() { return m_partial ? get_partial_token() : (this->*m_scan)(); }
+
+	// Points the scanner at a longer copy of the same text; the position
+	// carries over. While `partial` is set the text may still grow, so a token
+	// that runs into the end of the buffer is withheld until more arrives.
+	void set_input(const std::string_view src, const bool partial)
+	{
+		m_src = src;
+		m_partial = partial;
+	}
 
 	std::string_view get_value() const { return m_value; }
 	std::string_view get_tag_name() const { return m_tag_name; }
@@ -137,6 +211,25 @@ private:
 	token_type m_end_token = TT_EOF; // token emitted once that region ends
 	bool m_got_tail = false;
 
+	// Scanner state a withheld token rewinds to when the source is partial.
+	struct resume_point
+	{
+		size_t pos = 0;
+		scan_function scan = nullptr;
+		std::string_view close;
+		token_type end_token = TT_EOF;
+		bool got_tail = false;
+		std::string tag;
+	};
+
+	bool m_partial = false;
+	resume_point m_resume;
+	resume_point m_lookahead;
+
+	void save(resume_point& rp) const;
+	void restore(const resume_point& rp);
+	token_type get_partial_token();
+
 	static bool is_ws(const char c)
 	{
 		return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
@@ -195,18 +288,6 @@ class render_win32;
 class element;
 
 
-struct stop_tags_t
-{
-	const char* tags;
-	const char* stop_parent;
-};
-
-struct omitted_end_tags_t
-{
-	const char* tag;
-	const char* followed_tags;
-};
-
 
 // A structural summary of a laid-out tree. Everything here is derived from box
 // geometry alone, so it can be gathered headlessly and compared between runs.
@@ -230,13 +311,124 @@ struct layout_stats
 };
 
 
+struct html_stream;
+struct owned_temp_file;
+
+// Where create_from_bytes spent its time: tokenizing and tree building, then
+// the master sheet, the page's sheets and the cascade.
+struct document_stage_times
+{
+	int64_t parse_us = 0;
+	int64_t style_us = 0;
+};
+
+// What arriving images have cost in layout since the page was loaded.
+struct image_layout_counts
+{
+	int queued = 0; // relayouts posted to the UI thread
+	int pending = 0; // arrivals waiting on the one still queued
+	int avoided = 0; // arrivals whose boxes were already sized
+};
+
+// What a document holds in memory, by kind. Bytes are the objects plus the
+// heap blocks they own, as the containers report their capacity; allocator
+// overhead and OS font and bitmap handles are not included.
+struct memory_footprint
+{
+	memory_use elements; // element nodes, their strings and child lists
+	memory_use text_nodes; // text and space nodes
+	memory_use props; // css_props blocks
+	memory_use style_entries; // m_style and m_attr_style declarations
+	memory_use used_selectors;
+	memory_use line_boxes;
+	memory_use table_grids;
+	memory_use source; // decoded page text and the attribute arena
+	memory_use selectors;
+	memory_use rules; // declaration blocks the selectors share
+	memory_use buckets;
+	memory_use fonts;
+	memory_use images; // decoded pixels
+
+	size_t total() const;
+	// One line per kind, then the total.
+	std::string report() const;
+};
+
+// Layout time per element, collected when a document has a layout profile.
+// Inclusive time counts the element's descendants, exclusive time does not;
+// passes counts how often it was laid out, as tables and flex items are
+// laid out more than once.
+struct layout_cost
+{
+	int64_t inclusive_ns = 0;
+	int64_t exclusive_ns = 0;
+	int passes = 0;
+};
+
+class layout_profile
+{
+	struct frame
+	{
+		const element* el;
+		int64_t start_ns;
+		int64_t child_ns;
+	};
+
+	std::vector<frame> m_stack;
+	std::unordered_map<const element*, layout_cost> m_costs;
+
+public:
+	// False when el is already the innermost frame, as when place_element
+	// hands a block to render; the outer frame keeps the time.
+	bool enter(const element* el, bool pass);
+	void leave();
+
+	const std::unordered_map<const element*, layout_cost>& costs() const { return m_costs; }
+
+	// One "html;body;div#main.content <ns>" line per distinct path, exclusive
+	// time, for flamegraph.pl, speedscope or inferno.
+	std::string folded_stacks() const;
+	// The elements with the most exclusive time, one per line.
+	std::string report(size_t top) const;
+};
+
+// Fonts opened for documents, by "face:size:weight:style:decoration". A
+// document has its own unless it shares a layout_cache's; the handles are
+// released with the last owner.
+struct font_cache
+{
+	std::map<std::string, font_item, ltstr> fonts;
+	std::shared_mutex mutex; // shared for lookups, exclusive to add
+
+	font_cache() = default;
+	font_cache(const font_cache&) = delete;
+	font_cache& operator=(const font_cache&) = delete;
+	~font_cache();
+};
+
+// What a run of many headless layouts keeps from one document to the next:
+// master.css as parsed and the fonts opened so far. Shareable across threads.
+class layout_cache
+{
+	std::mutex m_mutex;
+	std::shared_ptr<const css> m_master;
+	std::shared_ptr<font_cache> m_fonts = std::make_shared<font_cache>();
+
+public:
+	// Null until a document has parsed master.css.
+	std::shared_ptr<const css> master_stylesheet();
+	// Keeps a copy of a freshly parsed master.css; the first one kept wins.
+	void keep_master_stylesheet(const css& styles);
+	const std::shared_ptr<font_cache>& fonts() const { return m_fonts; }
+};
+
 class document : public std::enable_shared_from_this<document>
 {
 	view_host& m_view;
 
 	std::shared_ptr<element> m_root;
-	std::map<std::string, font_item, ltstr> m_fonts;
-	std::mutex m_fonts_mutex;
+	std::shared_ptr<font_cache> m_fonts = std::make_shared<font_cache>();
+	std::shared_ptr<layout_cache> m_cache;
 	css m_styles;
 	web_color m_def_color;
 	size m_size;
@@ -244,10 +436,21 @@ class document : public std::enable_shared_from_this<document>
 
 	position::vector m_fixed_boxes;
 	std::vector<std::shared_ptr<media_query_list>> m_media_lists;
+	// Thresholds across m_media_lists, rebuilt when a list is added, and the
+	// viewport the lists were last evaluated at.
+	media_breakpoints m_breakpoints;
+	bool m_breakpoints_stale = true;
+	std::pair<int, int> m_media_band{-1, -1};
+	std::pair<int, int> m_media_size{-1, -1};
 	element* m_over_element;
 
 	http m_http;
 	std::string m_source; // decoded UTF-8 page text; the DOM points into this
+	text_arena m_text_arena; // attribute values that could not point into m_source
+	page_names m_page_names; // what selectors may ask for; the rest are pruned
+	size_t m_pruned_reported = 0; // selectors pruned as of the last diagnostic
+	document_stage_times m_stage_times;
+	std::unique_ptr<layout_profile> m_layout_profile; // null unless profiling
 	std::string m_url;
 	std::string m_caption;
 	std::string m_cursor;
@@ -256,14 +459,80 @@ class document : public std::enable_shared_from_this<document>
 	// UI thread only: set while a coalesced restyle is already queued.
 	bool m_restyle_pending = false;
 
+	// UI thread only: images that landed since the last queued relayout, how
+	// many relayouts were queued, and how many arrivals needed none at all.
+	int m_image_layouts_pending = 0;
+	int m_image_layouts_queued = 0;
+	int m_image_layouts_avoided = 0;
+
+	// Parse state of a page whose bytes are still arriving; see begin_stream.
+	std::unique_ptr<html_stream> m_stream;
+
 	std::map<std::string, pf::bitmap_ptr, ltstr> m_images;
 
+	// An image decoded smaller than its natural size. Layout still sees the
+	// natural size; target is the device-pixel box the bitmap was made for,
+	// and the downloaded file is kept to decode again if the box outgrows it.
+	struct scaled_image
+	{
+		size natural;
+		size target;
+		std::shared_ptr<owned_temp_file> source;
+		bool redecoding = false;
+	};
+
+	std::map<std::string, scaled_image, ltstr> m_scaled_images;
+	// Also painted as a background or list marker, at natural size, so never
+	// decoded smaller.
+	std::set<std::string, ltstr> m_natural_images;
+
+	// Image decode accounting for the current page, shared with the decode
+	// workers. bitmap_bytes is what decoded bitmaps hold now: bytes come off
+	// as images are replaced, dropped or cleared with the page.
+	struct decode_stats
+	{
+		std::atomic<int64_t> bitmap_bytes{0};
+		std::atomic<int64_t> peak_bytes{0};
+		std::atomic<int64_t> decode_us{0};
+
+		void add(const int64_t bytes)
+		{
+			const auto now = bitmap_bytes += bytes;
+			auto peak = peak_bytes.load();
+			while (now > peak && !peak_bytes.compare_exchange_weak(peak, now))
+			{
+			}
+		}
+	};
+
+	std::shared_ptr<decode_stats> m_decode_stats = std::make_shared<decode_stats>();
+
+	// Fetches the preload scanner started while the source was still being
+	// parsed, keyed by resolved URL. The real request claims the entry rather
+	// than downloading the resource a second time.
+	struct preload_entry
+	{
+		std::chrono::steady_clock::time_point started;
+		bool claimed = false;
+		std::chrono::steady_clock::time_point claimed_at{};
+		std::chrono::steady_clock::time_point first_byte{};
+	};
+
+	std::map<std::string, preload_entry, ltstr> m_preloads;
+	bool m_first_css_reported = false;
+
 public:
 	document(view_host& view);
 	~document();
 
 	void clear();
+	// Withdraws every download the page started, queued or running. Called
+	// when the view moves to another page: pending callbacks would otherwise
+	// keep this document alive until its last resource landed.
+	void cancel_loads();
 	void load_master_stylesheet(const std::string& str);
+	// master.css, copied from the layout cache when it has parsed it already.
+	void load_master_stylesheet();
 	pf::font_handle get_font(const std::string& name, int size, const std::string& weight, const std::string& style,
 	                         const std::string& decoration, font_metrics* fm);
 	int render(int max_width, render_type rt = render_all);
@@ -288,6 +557,7 @@ public:
 	bool on_mouse_leave(position::vector& redraw_boxes);
 
 	element* root() { return m_root.get(); };
+	const css& styles() const { return m_styles; }
 	void add_fixed_box(const position& pos);
 	void add_media_list(const std::shared_ptr<media_query_list>& list);
 	const std::string& url() const { return m_url; };
@@ -296,12 +566,29 @@ public:
 	void set_base_url(const std::string& base_url);
 	void link(const element* el);
 	void import_css(const std::string& url, const std::string& baseurl, const std::string& media = empty);
+	void preload_css(const std::string& url, const std::string& media);
+	void preload_image(const std::string& url);
 	void on_anchor_click(const std::string& url, element* el);
 	void set_cursor(const std::string& cursor);
 	const std::string& cursor() const { return m_cursor; }
 
 	bool is_image_cached(const std::string& src, const std::string& baseurl);
-	void load_image(const std::string& url, const std::string& base);
+	// natural_size: painted as a background or list marker rather than an <img>.
+	void load_image(const std::string& url, const std::string& base, bool natural_size = false);
+	void promote_visible_images();
+	std::vector<const element*> image_elements(const std::string& image_url) const;
+	size image_display_size(const std::string& image_url) const;
+	// Device pixels to decode the image at, or nothing for its natural size.
+	size image_decode_target(const std::string& image_url) const;
+	void decode_image(const std::string& image_url, std::shared_ptr<owned_temp_file> file);
+	// False if the page no longer has a slot for the image, which is dropped.
+	// A bitmap smaller than natural keeps source to be decoded again from.
+	bool image_decoded(const std::string& image_url, pf::bitmap_ptr image, size natural, int64_t decode_us,
+	                   bool placeholder, size target = {}, std::shared_ptr<owned_temp_file> source = nullptr);
+	// After layout: decodes again any image now shown larger than its bitmap.
+	void redecode_outgrown_images();
+	void image_arrived(const std::string& image_url);
+	size get_image_size(const std::string& url, const std::string& base);
 	pf::bitmap_ptr find_image(const std::string& url);
 	pf::bitmap_ptr find_image(const std::string& url, const std::string& base);
 
@@ -326,11 +613,42 @@ public:
 	void set_root(std::unique_ptr<element> r);
 	void add_stylesheet(const std::string& text, const std::string& baseurl, const std::string& media);
 
+	// A view of `text` that lives as long as the document: `text` itself when
+	// it lies in the finished page source, otherwise a copy in the arena.
+	std::string_view keep_text(std::string_view text);
+
+	const document_stage_times& stage_times() const { return m_stage_times; }
+
+	image_layout_counts image_layouts() const
+	{
+		return {m_image_layouts_queued, m_image_layouts_pending, m_image_layouts_avoided};
+	}
+
+	memory_footprint measure_memory();
+
+	// Start collecting per-element layout time from the next render.
+	void enable_layout_profile() { m_layout_profile = std::make_unique<layout_profile>(); }
+	layout_profile* layout_profiler() const { return m_layout_profile.get(); }
+
+	// Tags, ids and classes the tree uses, recorded as the parser sets them.
+	page_names& names() { return m_page_names; }
+
 	// Parse `bytes` (raw, any encoding) as the document source. The decoded
 	// UTF-8 text is retained for the lifetime of the document so the DOM can
-	// reference it directly.
+	// reference it directly; UTF-8 input moved in becomes that text as it is.
+	// With a cache, the document takes master.css and its fonts from it.
 	static std::shared_ptr<document> create_from_bytes(view_host& view, const std::string& url,
-	                                                   std::string_view bytes, std::string_view content_type = {});
+	                                                   std::string bytes, std::string_view content_type = {},
+	                                                   const std::shared_ptr<layout_cache>& cache = nullptr);
+
+	// Incremental counterpart of create_from_bytes for a page still arriving
+	// over the network. Each append_bytes parses whatever complete markup has
+	// landed and styles the new nodes, so the top of a long page can be laid
+	// out early. finish_stream parses the rest and runs the full cascade.
+	static std::shared_ptr<document> begin_stream(view_host& view, const std::string& url,
+	                                              std::string_view content_type = {});
+	void append_bytes(std::string_view bytes);
+	void finish_stream();
 
 	friend class html_view;
 
@@ -338,8 +656,18 @@ private:
 	pf::font_handle add_font(const std::string& name, int size, const std::string& weight, const std::string& style,
 	                         const std::string& decoration, font_metrics* fm);
 
+	void parse_available(bool last);
+	void style_partial_tree();
+
+	void fetch_css(const std::string& css_url, const std::string& media);
+	bool claim_preload(const std::string& url, const std::string& type);
+	void report_first_css_byte(const std::string& url);
+
 	bool update_media_lists(const media_features& features);
+	const media_breakpoints& media_breakpoints_for();
+	void restyle_for_viewport();
 	void update_styles(element* root_el);
+	void sort_styles();
 	void apply_stylesheet();
 	void request_restyle();
 };
@@ -350,40 +678,101 @@ struct layout_result
 	int width = 0;
 	int height = 0;
 	int64_t parse_style_us = 0;
+	int64_t parse_us = 0; // parse_style_us split into its two stages
+	int64_t style_us = 0;
 	int64_t layout_us = 0;
 	layout_stats stats;
 	std::vector<std::string> anomalies;
 	std::vector<std::string> box_dump;
 	std::string layout_json;
+	std::string selector_profile;
+	std::string layout_profile; // the elements with the most layout time
+	std::string layout_folded; // the same time as folded stacks
+	memory_footprint memory;
+};
+
+// What layout_html_headless measures and reports besides the page size. Set
+// only the fields that differ, e.g. {.width = 600, .dump_depth = 8}.
+struct layout_options
+{
+	int width = 1902;
+	int height = 896;
+	bool verbose = false;
+	int dump_depth = 0; // box_dump this many levels deep
+	bool dump_json = false;
+	int profile_selectors = 0; // rank this many of the costliest selectors into selector_profile
+	bool profile_layout = false; // time each element
+	bool measure_memory = false; // fill memory, which otherwise stays empty; the walk is not free
+	std::shared_ptr<layout_cache> cache = nullptr; // layouts sharing one parse master.css once and reuse fonts
 };
 
-layout_result layout_html_headless(const std::string& html, int width, int height, bool verbose = false,
-                                   int dump_depth = 0, bool dump_json = false);
+// `html` becomes the document source; a UTF-8 page moved in is parsed where
+// it lies, with no copy.
+layout_result layout_html_headless(std::string html, const layout_options& options = {});
 
 // Lays out a snippet and returns the box of the element with the given id, in
 // document coordinates. An empty box means the id was not found.
 position layout_html_headless_probe(const std::string& html, int width, const std::string& id);
 
+// Times the keyword, tag, entity and color lookups against the linear scans
+// they replaced and returns a report, one lookup per line.
+std::string run_lookup_benchmark();
+
+// Times tokenizing and tree construction over tag-dense generated markup and
+// returns a report, one kind of markup per line.
+std::string run_parse_benchmark();
+
+// Times every stylesheet selector against every element of the page at path
+// and returns a one-line report of tests, matches and ns per test.
+std::string run_selector_benchmark(const std::string& path);
+
+struct corpus_bench_options
+{
+	std::string dir; // every .html/.htm file directly inside is a page
+	int width = 1902;
+	int warmup = 2; // untimed runs per page first
+	int runs = 10; // timed runs per page
+	std::string baseline_path; // JSON from an earlier run to compare against
+	double threshold_pct = 10; // slower than the baseline by more is a regression
+	int64_t floor_us = 100; // differences below this are noise, whatever the ratio
+	bool counters = false; // hardware counters per stage, where the platform has them
+	int jobs = 1; // above 1, also measure pages per second on 1, 2, 4 ... jobs threads
+};
+
+struct corpus_bench_result
+{
+	std::string report; // table for the console
+	std::string json; // the same figures, in the form baseline_path reads
+	int pages = 0;
+	int regressions = 0;
+};
+
+// Runs each page of a corpus through parse, cascade and layout, and reports
+// median, p90 and min per stage per page. The per-page figures always come
+// from one thread; jobs only adds the throughput table.
+corpus_bench_result run_corpus_benchmark(const corpus_bench_options& options);
+
 
 class parser
 {
+	// An element on the parse stack, with the atom its tag has in the
+	// tree-construction rules.
+	struct open_element
+	{
+		element* el;
+		int tag;
+	};
+
 	document& m_doc;
 	std::unique_ptr<element> m_root;
-	std::vector<element*> m_parse_stack;
+	std::vector<open_element> m_parse_stack;
 
 	// Nodes the tree refused. They stay on the parse stack so tag nesting keeps
 	// its shape, so they have to outlive the parse.
 	std::vector<std::unique_ptr<element>> m_detached;
 
-	static stop_tags_t m_stop_tags[];
-	static omitted_end_tags_t m_omitted_end_tags[];
-
 public:
-	parser(document& d) : m_doc(d)
-	{
-		m_root = create_element("html");
-		m_parse_stack.push_back(m_root.get());
-	}
+	parser(document& d);
 
 	bool is_stack_empty() const { return m_parse_stack.empty(); };
 	std::unique_ptr<element> release_root() { return std::move(m_root); };
@@ -400,11 +789,14 @@ public:
 	void parse_cdata_start();
 	void parse_cdata_end();
 	void parse_data(std::string_view val);
-	void parse_push_element(std::unique_ptr<element> el);
+
+private:
+	static bool is_open_as(const open_element& open, int tag, std::string_view tag_name);
+
+	void parse_push_element(std::unique_ptr<element> el, int tag);
 	bool parse_pop_element();
-	bool parse_pop_element(std::string_view tag, const char* stop_tags = "");
+	bool parse_pop_element(int tag, std::string_view tag_name, int stop_tag);
 	void parse_pop_void_element();
-	void parse_pop_to_parent(const char* parents, const char* stop_parent);
-	void parse_close_omitted_end(std::string_view tag);
-	void parse_open_omitted_start(std::string_view tag);
+	void parse_close_omitted_end(int tag);
+	void parse_open_omitted_start(int tag);
 };
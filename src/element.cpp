@@ -5,6 +5,30 @@
 #include "element.h"
 #include "document.h"
 
+namespace
+{
+	// Charges the enclosing scope to an element while the document has a
+	// layout profile; otherwise it holds a null pointer and does nothing.
+	class layout_scope
+	{
+		layout_profile* m_profile;
+
+	public:
+		layout_scope(layout_profile* profile, const element* el, const bool pass)
+			: m_profile(profile && profile->enter(el, pass) ? profile : nullptr)
+		{
+		}
+
+		~layout_scope()
+		{
+			if (m_profile) m_profile->leave();
+		}
+
+		layout_scope(const layout_scope&) = delete;
+		layout_scope& operator=(const layout_scope&) = delete;
+	};
+}
+
 
 const css_props& css_props::defaults()
 {
@@ -335,32 +359,110 @@ std::unique_ptr<element> element::append_child(std::unique_ptr<element> el)
 	}
 
 	el->parent(this);
+
+	// A page that is still arriving may already have been styled, and the
+	// generated ::after box has to stay last.
+	if (!m_children.empty() && m_children.back()->m_type == el_after)
+	{
+		m_children.insert(m_children.end() - 1, std::move(el));
+		children_changed();
+		return {};
+	}
+
 	m_children.push_back(std::move(el));
+	children_changed();
 	return {};
 }
 
+namespace
+{
+	// Names seen on almost every page; interning these needs no lock.
+	keyword_list(common_attr_names,
+	             "id;class;style;src;href;rel;type;name;alt;title;width;height;align;valign;media;content;"
+	             "charset;lang;dir;role;colspan;rowspan;border;cellspacing;cellpadding;color;face;size;clear;"
+	             "background;bgcolor;value;target;for;action;method;loading;srcset;sizes;tabindex;hidden;"
+	             "async;defer;integrity;crossorigin;property;itemprop;itemscope;itemtype;aria-label;"
+	             "aria-hidden;data-src;data-probe;xmlns;viewbox;fill;d;http-equiv;label;placeholder");
+
+	bool is_attr_named(const element_attr& attr, const std::string_view name)
+	{
+		return attr.name.size() == name.size() && _strnicmp(attr.name.data(), name.data(), name.size()) == 0;
+	}
+}
+
+std::string_view attr_atom(const std::string_view name)
+{
+	if (const int i = common_attr_names.find(name); i >= 0) return common_attr_names.key(i);
+
+	std::string lower(name);
+	for (auto& ch : lower) ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+
+	// Pages on other threads mostly look up names already interned (data-*,
+	// aria-*), so only an insert takes the lock exclusively.
+	static std::shared_mutex mutex;
+	static std::set<std::string, std::less<>> names;
+	{
+		std::shared_lock lock(mutex);
+		if (const auto it = names.find(lower); it != names.end()) return *it;
+	}
+	std::lock_guard lock(mutex);
+	return *names.insert(std::move(lower)).first;
+}
+
 void element::set_attr(const std::string_view k, const std::string_view val)
 {
 	if (!k.empty())
 	{
-		m_attrs[std::string(k)] = val;
+		// Values from the scanner are views into the page, or into its
+		// scratch buffer when entities were decoded; only the latter is copied.
+		const auto value = m_doc.keep_text(val);
+
+		const auto found = std::ranges::find_if(m_attrs, [k](const element_attr& a) { return is_attr_named(a, k); });
+
+		if (found != m_attrs.end()) found->value = value;
+		else m_attrs.push_back({attr_atom(k), value});
 
 		// Selector bucketing reads these in apply_stylesheet, which runs before
 		// parse_styles, so they must be live as soon as the parser sets them.
-		if (is_equal(k, "id")) m_id = val;
-		else if (is_equal(k, "class")) m_class = val;
+		if (is_equal(k, "id"))
+		{
+			m_id = value;
+			m_doc.names().add_id(value);
+		}
+		else if (is_equal(k, "class"))
+		{
+			m_class = value;
+			m_doc.names().add_classes(value);
+		}
 	}
 }
 
-std::string_view element::get_attr(const std::string_view name, const std::string_view def) const
+// A handful of attributes at most, so a linear probe over the inline array
+// beats any lookup structure.
+const element_attr* element::find_attr(const std::string_view name) const
 {
-	const auto attr = m_attrs.find(name);
+	for (const auto& attr : m_attrs)
+	{
+		if (is_attr_named(attr, name)) return &attr;
+	}
 
-	if (attr != m_attrs.end())
+	return nullptr;
+}
+
+const element_attr* element::find_attr_atom(const std::string_view atom) const
+{
+	for (const auto& attr : m_attrs)
 	{
-		return attr->second;
+		if (attr.name.data() == atom.data()) return &attr;
 	}
-	return def;
+
+	return nullptr;
+}
+
+std::string_view element::get_attr(const std::string_view name, const std::string_view def) const
+{
+	const auto* attr = find_attr(name);
+	return attr ? attr->value : def;
 }
 
 // True when every whitespace-delimited token of `needles` also appears in
@@ -402,6 +504,27 @@ static bool contains_all_tokens(const std::string_view haystack, const std::stri
 	return true;
 }
 
+void element::measure_memory(memory_footprint& m) const
+{
+	size_t bytes = sizeof(element) + m_children.capacity() * sizeof(m_children[0]) + heap_bytes(m_text) +
+		heap_bytes(m_transformed_text) + heap_bytes(m_src) + heap_bytes(m_tag) + m_attrs.heap_bytes() +
+		m_positioned.capacity() * sizeof(element*) + m_boxes.capacity() * sizeof(m_boxes[0]) +
+		(m_floats_left.capacity() + m_floats_right.capacity()) * sizeof(floated_box) +
+		m_pseudo_classes.capacity() * sizeof(std::string);
+	for (const auto& pc : m_pseudo_classes) bytes += heap_bytes(pc);
+
+	const bool text = m_type == el_text || m_type == el_space;
+	(text ? m.text_nodes : m.elements).add(1, bytes);
+
+	if (m_css) m.props.add(1, sizeof(css_props));
+	m.style_entries.add(m_style.entries() + m_attr_style.entries(), m_style.heap_bytes() + m_attr_style.heap_bytes());
+	m.used_selectors.add(m_used_styles.size(), m_used_styles.capacity() * sizeof(used_selector));
+	for (const auto& b : m_boxes) m.line_boxes.add(1, sizeof(box) + b->heap_bytes());
+	if (m_grid) m.table_grids.add(1, sizeof(table_grid) + m_grid->heap_bytes());
+
+	for (const auto& child : m_children) child->measure_memory(m);
+}
+
 void element::apply_stylesheet(const css& styles)
 {
 	if (m_type == el_before || m_type == el_after || m_type == el_text || m_type == el_space || m_type == el_style ||
@@ -425,86 +548,113 @@ void element::apply_stylesheet(const css& styles)
 	// Build a small candidate list from the buckets that could possibly match this
 	// element's rightmost compound, instead of scanning every selector in the sheet.
 	// Typically 10-100x fewer candidates on real pages (e.g. Wikipedia).
-	using selector_list = std::vector<std::shared_ptr<css_selector>>;
-	const selector_list* probe_lists[32];
+	struct probe
+	{
+		const uint32_t* at;
+		const uint32_t* end;
+	};
+	probe probes[32];
 	size_t probe_count = 0;
 
-	const auto add_list = [&](const selector_list* list)
+	const auto add_list = [&](const css::selector_list* list)
 	{
-		if (list && !list->empty() && probe_count < std::size(probe_lists))
+		if (list && !list->empty() && probe_count < std::size(probes))
 		{
-			probe_lists[probe_count++] = list;
+			probes[probe_count++] = {list->data(), list->data() + list->size()};
 		}
 	};
 
-	const auto& universal = styles.universal_selectors();
-	if (!universal.empty()) probe_lists[probe_count++] = &universal;
+	// Bucket names were lowercased at selector parse; the attributes are raw,
+	// so fold here to keep the old case-insensitive behaviour.
+	std::string folded;
+	const auto lower = [&](const std::string_view name) -> std::string_view
+	{
+		if (std::ranges::none_of(name, [](const char c) { return c >= 'A' && c <= 'Z'; })) return name;
+		folded.assign(name);
+		for (auto& ch : folded) ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+		return folded;
+	};
+
+	add_list(&styles.universal_selectors());
 	if (!m_tag.empty()) add_list(styles.selectors_by_tag(m_tag)); // m_tag is already lowercased by the parser
-	if (!m_id.empty())
+	if (!m_id.empty()) add_list(styles.selectors_by_id(lower(m_id)));
+	for (size_t start = 0; start < m_class.size();)
 	{
-		// Selector side was lowercased via trim_lower during selector parse; the
-		// id attribute is raw, so lowercase here to match the old case-insensitive behavior.
-		std::string id_lower = m_id;
-		for (auto& ch : id_lower) ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
-		add_list(styles.selectors_by_id(id_lower));
+		// Walk the class attribute in place rather than splitting it.
+		const auto ws = " \t\r\n\f";
+		start = m_class.find_first_not_of(ws, start);
+		if (start == std::string_view::npos) break;
+		auto end = m_class.find_first_of(ws, start);
+		if (end == std::string_view::npos) end = m_class.size();
+		add_list(styles.selectors_by_class(lower(m_class.substr(start, end - start))));
+		start = end;
 	}
-	if (!m_class.empty())
+
+	// Each bucket is in cascade order, so candidates come out of a k-way merge
+	// of the heads. A selector keyed by classes {a,b} sits in both buckets; its
+	// copies meet at the same rank and all but the first are skipped.
+	uint32_t last_rank = UINT32_MAX;
+	const bool profiling = css::s_profile;
+
+	while (true)
 	{
-		// Split the element's class attribute once rather than per candidate
-		// selector as the old select_equal/class path did.
-		auto classes = split_string(m_class);
-		for (auto& c : classes)
+		size_t best = probe_count;
+		uint32_t best_rank = UINT32_MAX;
+
+		for (size_t i = 0; i < probe_count; ++i)
 		{
-			trim(c);
-			if (c.empty()) continue;
-			for (auto& ch : c) ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
-			add_list(styles.selectors_by_class(c));
+			if (probes[i].at == probes[i].end) continue;
+			const auto r = styles.rank(*probes[i].at);
+			if (r < best_rank)
+			{
+				best_rank = r;
+				best = i;
+			}
 		}
-	}
 
-	// A selector keyed by class list {a,b} is registered in both bucket a and
-	// bucket b; dedup by shared_ptr identity while preserving (specificity, order).
-	selector_list candidates;
-	candidates.reserve(64);
-	for (size_t i = 0; i < probe_count; ++i)
-	{
-		for (const auto& s : *probe_lists[i]) candidates.push_back(s);
-	}
-	if (probe_count > 1)
-	{
-		// Sort by pointer identity for dedup, then resort by selector order.
-		std::sort(candidates.begin(), candidates.end(),
-		          [](const auto& a, const auto& b) { return a.get() < b.get(); });
-		candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
-		std::sort(candidates.begin(), candidates.end(), std::less<std::shared_ptr<css_selector>>());
-	}
+		if (best == probe_count) break;
 
-	for (const auto& sel : candidates)
-	{
-		if (!sel->is_media_valid())
+		const auto index = *probes[best].at++;
+		if (best_rank == last_rank) continue;
+		last_rank = best_rank;
+
+		const auto& sel = styles.selector(index);
+
+		if (!sel.is_media_valid())
 		{
 			continue;
 		}
 
 		// The bucket narrows by rightmost key; the selector's tag may still disqualify
 		// (e.g. selector "a.foo" is in bucket "foo" but only applies to <a>).
-		const auto& sel_tag = sel->m_right.m_tag;
-		if (!sel_tag.empty() && sel_tag != "*" && sel_tag != m_tag)
+		if (!sel.m_right.m_any_tag && sel.m_right.m_tag != m_tag)
 		{
 			continue;
 		}
 
-		const int apply = select(*sel, false);
+		int apply;
+
+		if (profiling)
+		{
+			const auto t0 = std::chrono::steady_clock::now();
+			apply = select(sel, false);
+			const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0);
+			styles.record_cost(index, ns.count(), apply != select_no_match);
+		}
+		else
+		{
+			apply = select(sel, false);
+		}
 
 		if (apply != select_no_match)
 		{
-			used_selector us(sel, false);
+			used_selector us(index, false);
 
 			if (apply & select_match_pseudo_class)
 			{
-				if (select(*sel, true))
+				if (select(sel, true))
 				{
-					add_style(sel->m_style);
+					add_style(sel.m_style);
 					us.m_used = true;
 				}
 			}
@@ -514,7 +664,7 @@ void element::apply_stylesheet(const css& styles)
 
 				if (el)
 				{
-					el->add_style(sel->m_style);
+					el->add_style(sel.m_style);
 				}
 			}
 			else if (apply & select_match_with_before)
@@ -523,12 +673,12 @@ void element::apply_stylesheet(const css& styles)
 
 				if (el)
 				{
-					el->add_style(sel->m_style);
+					el->add_style(sel.m_style);
 				}
 			}
 			else
 			{
-				add_style(sel->m_style);
+				add_style(sel.m_style);
 				us.m_used = true;
 			}
 
@@ -550,7 +700,7 @@ void element::get_content_size(size& sz, const int max_width)
 	}
 	else if (m_type == el_image)
 	{
-		sz = image_size(m_doc.find_image(m_src));
+		sz = m_doc.get_image_size(m_src, empty);
 	}
 	else
 	{
@@ -748,6 +898,8 @@ std::string element::get_style_property(const prop_id name, const bool inherited
 
 void element::parse_styles(const bool is_reparse)
 {
+	m_styled = true;
+
 	if (m_type == el_text || m_type == el_space)
 	{
 		m_text_transform = static_cast<text_transform>(value_index(
@@ -1108,7 +1260,7 @@ void element::parse_styles(const bool is_reparse)
 			const auto url = css::parse_css_url(list_image);
 			const auto list_image_baseurl = get_style_property(prop_id::list_style_image_baseurl, true);
 
-			m_doc.load_image(url, list_image_baseurl);
+			m_doc.load_image(url, list_image_baseurl, true);
 		}
 	}
 
@@ -1173,6 +1325,11 @@ int element::render(int x, int y, int max_width, bool second_pass)
 	{
 		return 0;
 	}
+
+	layout_scope scope(m_doc.layout_profiler(), this, true);
+	// One span per formatting context; the boxes inside it fold into it.
+	trace::zone zone(trace::on() && is_floats_holder() ? "render" : nullptr, "layout");
+	zone.detail(m_tag);
 	if (m_type == el_table)
 	{
 		int parent_width = max_width;
@@ -1497,7 +1654,7 @@ int element::render(int x, int y, int max_width, bool second_pass)
 
 		m_pos.move_to(x, y);
 
-		auto sz = image_size(m_doc.find_image(m_src));
+		auto sz = m_doc.get_image_size(m_src, empty);
 
 		m_pos.width = sz.width;
 		m_pos.height = sz.height;
@@ -1884,8 +2041,6 @@ int element::render(int x, int y, int max_width, bool second_pass)
 		// Flex grow/shrink
 		for (auto& line : lines)
 		{
-			int item_count = line.end - line.start;
-			int total_gaps = m_flex_gap * std::max(0, item_count - 1);
 			int free_space = container_main - line.total_main;
 
 			if (free_space > 0)
@@ -2306,7 +2461,7 @@ int element::render(int x, int y, int max_width, bool second_pass)
 		{
 			auto url = css::parse_css_url(list_image);
 			auto list_image_baseurl = get_style_property(prop_id::list_style_image_baseurl, true);
-			auto sz = image_size(m_doc.find_image(url, list_image_baseurl));
+			auto sz = m_doc.get_image_size(url, list_image_baseurl);
 
 			if (min_height < sz.height)
 			{
@@ -2368,11 +2523,12 @@ int element::render(int x, int y, int max_width, bool second_pass)
 	if (ret_width < max_width && !second_pass && m_parent)
 	{
 		if (m_display == display_inline_block ||
-			props().width.is_predefined() &&
-			(m_float != float_none ||
-				m_display == display_table ||
-				m_el_position == element_position_absolute ||
-				m_el_position == element_position_fixed
+			(props().width.is_predefined() &&
+				(m_float != float_none ||
+					m_display == display_table ||
+					m_el_position == element_position_absolute ||
+					m_el_position == element_position_fixed
+				)
 			)
 		)
 		{
@@ -2469,6 +2625,7 @@ void element::init()
 				while (i != m_children.end() && (*i)->is_white_space())
 				{
 					i = m_children.erase(i);
+					children_changed();
 				}
 			}
 			else
@@ -2571,6 +2728,8 @@ int element::select(const css_selector& selector, const bool apply_pseudo)
 	return right_res;
 }
 
+// Runs over the form css_element_selector::parse compiled: attributes are
+// found by atom, class lists are pre-split and nth arguments pre-parsed.
 int element::select(const css_element_selector& selector, const bool apply_pseudo)
 {
 	if (m_type == el_text || m_type == el_space)
@@ -2578,64 +2737,45 @@ int element::select(const css_element_selector& selector, const bool apply_pseud
 		return select_no_match;
 	}
 
-	if (!selector.m_tag.empty() && selector.m_tag != "*")
+	if (!selector.m_any_tag && m_tag != selector.m_tag)
 	{
-		if (m_tag != selector.m_tag)
-		{
-			return select_no_match;
-		}
+		return select_no_match;
 	}
 
 	int res = select_match;
 
 	for (const auto& sa : selector.m_attrs)
 	{
-		// Pseudo cases never read an attribute; keep the map probe out of their way.
-		const auto attr_value = (sa.condition == select_pseudo_element || sa.condition == select_pseudo_class)
-			                        ? std::string_view()
-			                        : get_attr(sa.attribute);
-
 		switch (sa.condition)
 		{
 		case select_exists:
-			if (!m_attrs.contains(sa.attribute))
-			{
-				return select_no_match;
-			}
+			if (!find_attr_atom(sa.atom)) return select_no_match;
 			break;
 		case select_equal:
 			{
-				if (attr_value.empty())
-				{
-					return select_no_match;
-				}
+				const auto* attr = find_attr_atom(sa.atom);
+				if (!attr || attr->value.empty()) return select_no_match;
+
 				if (sa.attribute == "class")
 				{
-					// Every whitespace-delimited token of the selector must appear
-					// in the element's class list. Walked in place -- this runs for
-					// every candidate selector on every element, so the old
-					// split_string pair was the single hottest allocation in the cascade.
-					if (!contains_all_tokens(attr_value, sa.val))
+					// Every class the selector names must be a token of the
+					// element's class list. Walked in place: this runs for every
+					// candidate selector on every element.
+					for (const auto& c : sa.classes)
 					{
-						return select_no_match;
+						if (!contains_all_tokens(attr->value, c)) return select_no_match;
 					}
 				}
-				else
+				else if (!is_equal(sa.val, attr->value))
 				{
-					if (!is_equal(sa.val, attr_value))
-					{
-						return select_no_match;
-					}
+					return select_no_match;
 				}
 			}
 			break;
 		case select_contain_str:
 			{
-				if (attr_value.empty())
-				{
-					return select_no_match;
-				}
-				if (attr_value.find(sa.val) == std::string_view::npos)
+				const auto* attr = find_attr_atom(sa.atom);
+				if (!attr || attr->value.empty() || attr->value.find(sa.val) == std::string_view::npos)
 				{
 					return select_no_match;
 				}
@@ -2643,12 +2783,9 @@ int element::select(const css_element_selector& selector, const bool apply_pseud
 			break;
 		case select_start_str:
 			{
-				if (attr_value.empty())
-				{
-					return select_no_match;
-				}
-				if (attr_value.length() < sa.val.length() ||
-					_strnicmp(attr_value.data(), sa.val.c_str(), sa.val.length()))
+				const auto* attr = find_attr_atom(sa.atom);
+				if (!attr || attr->value.empty() || attr->value.length() < sa.val.length() ||
+					_strnicmp(attr->value.data(), sa.val.c_str(), sa.val.length()))
 				{
 					return select_no_match;
 				}
@@ -2656,169 +2793,34 @@ int element::select(const css_element_selector& selector, const bool apply_pseud
 			break;
 		case select_end_str:
 			{
-				if (attr_value.empty())
-				{
-					return select_no_match;
-				}
-				if (attr_value.length() < sa.val.length())
-				{
-					return select_no_match;
-				}
-				const auto offset = attr_value.length() - sa.val.length();
-				if (_strnicmp(attr_value.data() + offset, sa.val.c_str(), sa.val.length()) != 0)
+				const auto* attr = find_attr_atom(sa.atom);
+				if (!attr || attr->value.empty() || attr->value.length() < sa.val.length() ||
+					_strnicmp(attr->value.data() + attr->value.length() - sa.val.length(), sa.val.c_str(),
+					          sa.val.length()) != 0)
 				{
 					return select_no_match;
 				}
 			}
 			break;
 		case select_pseudo_element:
-			if (sa.val == "after")
-			{
-				res |= select_match_with_after;
-			}
-			else if (sa.val == "before")
-			{
-				res |= select_match_with_before;
-			}
-			else
-			{
-				return select_no_match;
-			}
+			if (!sa.pseudo_element) return select_no_match;
+			res |= sa.pseudo_element;
 			break;
 		case select_pseudo_class:
-			if (apply_pseudo)
+			if (!apply_pseudo)
 			{
-				if (!m_parent) return select_no_match;
-
-				std::string selector_param;
-				std::string selector_name;
-
-				const auto begin = sa.val.find_first_of('(');
-				const auto end = begin == std::string::npos ? std::string::npos : find_close_bracket(sa.val, begin);
-
-				if (begin != std::string::npos && end != std::string::npos)
-				{
-					selector_param = sa.val.substr(begin + 1, end - begin - 1);
-				}
-
-				if (begin != std::string::npos)
+				// Structural classes are settled by the tree alone, so a failure
+				// here is final; only state such as :hover waits for the second pass.
+				const bool structural = sa.pseudo != -1 && !(sa.negated && sa.negated->m_dynamic);
+				if (structural && (!m_parent || !matches_pseudo_class(sa, true)))
 				{
-					selector_name = sa.val.substr(0, begin);
-					trim(selector_name);
-				}
-				else
-				{
-					selector_name = sa.val;
-				}
-
-				const int selector = value_index(selector_name, pseudo_class_strings);
-
-				switch (selector)
-				{
-				case pseudo_class_only_child:
-					if (!m_parent->is_only_child(this, false))
-					{
-						return select_no_match;
-					}
-					break;
-				case pseudo_class_only_of_type:
-					if (!m_parent->is_only_child(this, true))
-					{
-						return select_no_match;
-					}
-					break;
-				case pseudo_class_first_child:
-					if (!m_parent->is_nth_child(this, 0, 1, false))
-					{
-						return select_no_match;
-					}
-					break;
-				case pseudo_class_first_of_type:
-					if (!m_parent->is_nth_child(this, 0, 1, true))
-					{
-						return select_no_match;
-					}
-					break;
-				case pseudo_class_last_child:
-					if (!m_parent->is_nth_last_child(this, 0, 1, false))
-					{
-						return select_no_match;
-					}
-					break;
-				case pseudo_class_last_of_type:
-					if (!m_parent->is_nth_last_child(this, 0, 1, true))
-					{
-						return select_no_match;
-					}
-					break;
-				case pseudo_class_nth_child:
-				case pseudo_class_nth_of_type:
-				case pseudo_class_nth_last_child:
-				case pseudo_class_nth_last_of_type:
-					{
-						if (selector_param.empty()) return select_no_match;
-
-						int num = 0;
-						int off = 0;
-
-						parse_nth_child_params(selector_param, num, off);
-						if (!num && !off) return select_no_match;
-						switch (selector)
-						{
-						case pseudo_class_nth_child:
-							if (!m_parent->is_nth_child(this, num, off, false))
-							{
-								return select_no_match;
-							}
-							break;
-						case pseudo_class_nth_of_type:
-							if (!m_parent->is_nth_child(this, num, off, true))
-							{
-								return select_no_match;
-							}
-							break;
-						case pseudo_class_nth_last_child:
-							if (!m_parent->is_nth_last_child(this, num, off, false))
-							{
-								return select_no_match;
-							}
-							break;
-						case pseudo_class_nth_last_of_type:
-							if (!m_parent->is_nth_last_child(this, num, off, true))
-							{
-								return select_no_match;
-							}
-							break;
-						}
-					}
-					break;
-				case pseudo_class_not:
-					{
-						css_element_selector sel;
-						sel.parse(selector_param);
-						if (select(sel, apply_pseudo))
-						{
-							return select_no_match;
-						}
-					}
-					break;
-				case pseudo_class_root:
-					if (m_parent != nullptr && m_parent->m_parent != nullptr)
-					{
-						return select_no_match;
-					}
-					break;
-				default:
-					if (std::find(m_pseudo_classes.begin(), m_pseudo_classes.end(), sa.val) == m_pseudo_classes.end())
-					{
-						return select_no_match;
-					}
-					break;
+					return select_no_match;
 				}
+				res |= select_match_pseudo_class;
 			}
-			else
+			else if (!m_parent || !matches_pseudo_class(sa, apply_pseudo))
 			{
-				res |= select_match_pseudo_class;
+				return select_no_match;
 			}
 			break;
 		}
@@ -2826,6 +2828,39 @@ int element::select(const css_element_selector& selector, const bool apply_pseud
 	return res;
 }
 
+bool element::matches_pseudo_class(const css_attribute_selector& sa, const bool apply_pseudo)
+{
+	switch (sa.pseudo)
+	{
+	case pseudo_class_only_child:
+		return m_parent->is_only_child(this, false);
+	case pseudo_class_only_of_type:
+		return m_parent->is_only_child(this, true);
+	case pseudo_class_first_child:
+		return m_parent->is_nth_child(this, 0, 1, false);
+	case pseudo_class_first_of_type:
+		return m_parent->is_nth_child(this, 0, 1, true);
+	case pseudo_class_last_child:
+		return m_parent->is_nth_last_child(this, 0, 1, false);
+	case pseudo_class_last_of_type:
+		return m_parent->is_nth_last_child(this, 0, 1, true);
+	case pseudo_class_nth_child:
+		return (sa.nth_num || sa.nth_off) && m_parent->is_nth_child(this, sa.nth_num, sa.nth_off, false);
+	case pseudo_class_nth_of_type:
+		return (sa.nth_num || sa.nth_off) && m_parent->is_nth_child(this, sa.nth_num, sa.nth_off, true);
+	case pseudo_class_nth_last_child:
+		return (sa.nth_num || sa.nth_off) && m_parent->is_nth_last_child(this, sa.nth_num, sa.nth_off, false);
+	case pseudo_class_nth_last_of_type:
+		return (sa.nth_num || sa.nth_off) && m_parent->is_nth_last_child(this, sa.nth_num, sa.nth_off, true);
+	case pseudo_class_not:
+		return !sa.negated || !select(*sa.negated, apply_pseudo);
+	case pseudo_class_root:
+		return m_parent->m_parent == nullptr;
+	default:
+		return std::ranges::find(m_pseudo_classes, sa.val) != m_pseudo_classes.end();
+	}
+}
+
 element* element::find_ancestor(const css_selector& selector, const bool apply_pseudo, bool* is_pseudo)
 {
 	if (!m_parent)
@@ -3455,7 +3490,7 @@ void element::parse_background()
 
 	if (!props().bg.m_image.empty())
 	{
-		m_doc.load_image(props().bg.m_image, props().bg.m_baseurl.empty() ? "" : props().bg.m_baseurl);
+		m_doc.load_image(props().bg.m_image, props().bg.m_baseurl.empty() ? "" : props().bg.m_baseurl, true);
 	}
 }
 
@@ -3471,6 +3506,30 @@ void element::add_positioned(element* el)
 	}
 }
 
+// Finds the nodes the parser appended since the tree was last styled. They all
+// follow the styled ones in document order, so only the right edge of the tree
+// is walked: `spine` gets the styled elements along it, top-down, and
+// `appended` the roots of the unstyled subtrees, in reverse document order.
+void element::collect_appended(std::vector<element*>& spine, std::vector<element*>& appended)
+{
+	spine.push_back(this);
+
+	for (auto i = m_children.size(); i-- > 0;)
+	{
+		const auto child = m_children[i].get();
+		if (child->m_type == el_after) continue;
+
+		if (!child->m_styled)
+		{
+			appended.push_back(child);
+			continue;
+		}
+
+		child->collect_appended(spine, appended);
+		break;
+	}
+}
+
 void element::calc_outlines(const int parent_width)
 {
 	m_padding.left = props().padding.left.calc_percent(parent_width);
@@ -3529,14 +3588,14 @@ void element::parse_attributes()
 
 		if (!str.empty())
 		{
-			m_style.add_property("text-align", str, "", false);
+			m_attr_style.add_property("text-align", str, "", false);
 		}
 
 		str = get_attr("valign");
 
 		if (!str.empty())
 		{
-			m_style.add_property("vertical-align", str, "", false);
+			m_attr_style.add_property("vertical-align", str, "", false);
 		}
 	}
 	else if (m_type == el_title)
@@ -3549,7 +3608,7 @@ void element::parse_attributes()
 
 		if (!str.empty())
 		{
-			m_style.add_property("width", str, "", false);
+			m_attr_style.add_property("width", str, "", false);
 		}
 
 		str = get_attr("background");
@@ -3559,21 +3618,21 @@ void element::parse_attributes()
 			std::string url = "url('";
 			url += str;
 			url += "')";
-			m_style.add_property("background-image", url, "", false);
+			m_attr_style.add_property("background-image", url, "", false);
 		}
 
 		str = get_attr("align");
 
 		if (!str.empty())
 		{
-			m_style.add_property("text-align", str, "", false);
+			m_attr_style.add_property("text-align", str, "", false);
 		}
 
 		str = get_attr("valign");
 
 		if (!str.empty())
 		{
-			m_style.add_property("vertical-align", str, "", false);
+			m_attr_style.add_property("vertical-align", str, "", false);
 		}
 	}
 	else if (m_type == el_table)
@@ -3582,7 +3641,7 @@ void element::parse_attributes()
 
 		if (!str.empty())
 		{
-			m_style.add_property("width", str, "", false);
+			m_attr_style.add_property("width", str, "", false);
 		}
 
 		str = get_attr("align");
@@ -3594,12 +3653,12 @@ void element::parse_attributes()
 			switch (align)
 			{
 			case 1:
-				m_style.add_property("margin-left", "auto", "", false);
-				m_style.add_property("margin-right", "auto", "", false);
+				m_attr_style.add_property("margin-left", "auto", "", false);
+				m_attr_style.add_property("margin-right", "auto", "", false);
 				break;
 			case 2:
-				m_style.add_property("margin-left", "auto", "", false);
-				m_style.add_property("margin-right", "0", "", false);
+				m_attr_style.add_property("margin-left", "auto", "", false);
+				m_attr_style.add_property("margin-right", "0", "", false);
 				break;
 			}
 		}
@@ -3611,14 +3670,14 @@ void element::parse_attributes()
 			std::string val = str;
 			val += " ";
 			val += str;
-			m_style.add_property("border-spacing", val, "", false);
+			m_attr_style.add_property("border-spacing", val, "", false);
 		}
 
 		str = get_attr("border");
 
 		if (!str.empty())
 		{
-			m_style.add_property("border-width", str, "", false);
+			m_attr_style.add_property("border-width", str, "", false);
 		}
 	}
 	else if (m_type == el_style)
@@ -3635,7 +3694,7 @@ void element::parse_attributes()
 
 		if (!str.empty())
 		{
-			m_style.add_property("text-align", str, "", false);
+			m_attr_style.add_property("text-align", str, "", false);
 		}
 	}
 	if (m_type == el_link)
@@ -3670,14 +3729,14 @@ void element::parse_attributes()
 
 		if (!attr_height.empty())
 		{
-			m_style.add_property("height", attr_height, empty, false);
+			m_attr_style.add_property("height", attr_height, empty, false);
 		}
 
 		const std::string attr_width(get_attr("width"));
 
 		if (!attr_width.empty())
 		{
-			m_style.add_property("width", attr_width, empty, false);
+			m_attr_style.add_property("width", attr_width, empty, false);
 		}
 	}
 	else if (m_type == el_svg)
@@ -3685,21 +3744,21 @@ void element::parse_attributes()
 		std::string str(get_attr("width"));
 		if (!str.empty())
 		{
-			m_style.add_property("width", str, empty, false);
+			m_attr_style.add_property("width", str, empty, false);
 		}
 		else
 		{
-			m_style.add_property("width", "24px", empty, false);
+			m_attr_style.add_property("width", "24px", empty, false);
 		}
 
 		str = get_attr("height");
 		if (!str.empty())
 		{
-			m_style.add_property("height", str, empty, false);
+			m_attr_style.add_property("height", str, empty, false);
 		}
 		else
 		{
-			m_style.add_property("height", "24px", empty, false);
+			m_attr_style.add_property("height", "24px", empty, false);
 		}
 	}
 	else if (m_type == el_font)
@@ -3708,14 +3767,14 @@ void element::parse_attributes()
 
 		if (!str.empty())
 		{
-			m_style.add_property("color", str, empty, false);
+			m_attr_style.add_property("color", str, empty, false);
 		}
 
 		str = get_attr("face");
 
 		if (!str.empty())
 		{
-			m_style.add_property("font-family", str, empty, false);
+			m_attr_style.add_property("font-family", str, empty, false);
 		}
 
 		str = get_attr("size");
@@ -3725,27 +3784,27 @@ void element::parse_attributes()
 			int sz = safe_stoi(str);
 			if (sz <= 1)
 			{
-				m_style.add_property("font-size", "x-small", empty, false);
+				m_attr_style.add_property("font-size", "x-small", empty, false);
 			}
 			else if (sz >= 6)
 			{
-				m_style.add_property("font-size", "xx-large", empty, false);
+				m_attr_style.add_property("font-size", "xx-large", empty, false);
 			}
 			else
 			{
 				switch (sz)
 				{
 				case 2:
-					m_style.add_property("font-size", "small", empty, false);
+					m_attr_style.add_property("font-size", "small", empty, false);
 					break;
 				case 3:
-					m_style.add_property("font-size", "medium", empty, false);
+					m_attr_style.add_property("font-size", "medium", empty, false);
 					break;
 				case 4:
-					m_style.add_property("font-size", "large", empty, false);
+					m_attr_style.add_property("font-size", "large", empty, false);
 					break;
 				case 5:
-					m_style.add_property("font-size", "x-large", empty, false);
+					m_attr_style.add_property("font-size", "x-large", empty, false);
 					break;
 				}
 			}
@@ -3757,7 +3816,7 @@ void element::parse_attributes()
 
 		if (!str.empty())
 		{
-			m_style.add_property("text-align", str, empty, false);
+			m_attr_style.add_property("text-align", str, empty, false);
 		}
 	}
 	else if (m_type == el_break)
@@ -3766,7 +3825,7 @@ void element::parse_attributes()
 
 		if (!attr_clear.empty())
 		{
-			m_style.add_property("clear", attr_clear, empty, false);
+			m_attr_style.add_property("clear", attr_clear, empty, false);
 		}
 	}
 	else if (m_type == el_base)
@@ -3775,12 +3834,33 @@ void element::parse_attributes()
 		return; //?
 	}
 
+	m_style.combine(m_attr_style);
+
 	for (const auto& child : m_children)
 	{
 		child->parse_attributes();
 	}
 }
 
+void element::restyle(const css& styles)
+{
+	reset_cascade();
+	apply_stylesheet(styles);
+	parse_styles();
+}
+
+void element::reset_cascade()
+{
+	if (is_text_node()) return;
+
+	m_style = m_attr_style;
+
+	for (const auto& child : m_children)
+	{
+		child->reset_cascade();
+	}
+}
+
 std::string element::get_text() const
 {
 	if (m_type == el_cdata || m_type == el_comment || m_type == el_text || m_type == el_style || m_type == el_space)
@@ -3934,9 +4014,10 @@ bool element::find_styles_changes(position::vector& redraw_boxes, const int x, c
 	bool apply = false;
 	for (auto iter = m_used_styles.begin(); iter != m_used_styles.end() && !apply; ++iter)
 	{
-		if (iter->m_selector->is_media_valid())
+		const auto& sel = m_doc.styles().selector(iter->m_selector);
+		if (sel.is_media_valid())
 		{
-			const int res = select(*iter->m_selector, true);
+			const int res = select(sel, true);
 			if ((res == select_no_match && iter->m_used) || (res == select_match && !iter->m_used))
 			{
 				apply = true;
@@ -4192,6 +4273,8 @@ bool element::is_break() const
 void element::set_tag_name(const std::string_view name)
 {
 	m_tag = name;
+	m_doc.names().add_tag(name);
+	if (m_parent) m_parent->children_changed();
 }
 
 void element::draw_background(render_win32& renderer, int x, int y, const position* clip)
@@ -4300,6 +4383,8 @@ int element::render_inline(element* container, const int max_width)
 		return 0;
 	}
 
+	layout_scope scope(m_doc.layout_profiler(), this, true);
+
 	int ret_width = 0;
 	int rw = 0;
 	for (const auto& child : m_children)
@@ -4318,6 +4403,10 @@ int element::place_element(element* el, const int max_width)
 {
 	if (el->get_display() == display_none) return 0;
 
+	// Text is measured in place and stays with the container's time.
+	const bool is_text = el->m_type == el_text || el->m_type == el_space;
+	layout_scope scope(is_text ? nullptr : m_doc.layout_profiler(), el, true);
+
 	if (el->get_display() == display_inline)
 	{
 		return el->render_inline(this, max_width);
@@ -4614,6 +4703,11 @@ bool element::is_replaced() const
 	return m_type == el_image || m_type == el_svg;
 }
 
+bool element::has_specified_size() const
+{
+	return m_type == el_image && !props().width.is_predefined() && !props().height.is_predefined();
+}
+
 int element::finish_last_box(const bool end_of_render)
 {
 	int line_top = 0;
@@ -5059,7 +5153,8 @@ void element::init_background_paint(const position pos, background_paint& bg_pai
 
 	if (bg_paint.image)
 	{
-		bg_paint.image_size = image_size(bg_paint.image);
+		// Natural size, even when the bitmap was decoded smaller.
+		bg_paint.image_size = m_doc.get_image_size(bg->m_image, bg->m_baseurl);
 
 		if (bg_paint.image_size.width && bg_paint.image_size.height)
 		{
@@ -5154,7 +5249,7 @@ void element::draw_list_marker(render_win32& renderer, const position& pos)
 	{
 		lm.image = css::parse_css_url(list_image);
 		lm.baseurl = get_style_property(prop_id::list_style_image_baseurl, true);
-		img_size = image_size(m_doc.find_image(lm.image, lm.baseurl));
+		img_size = m_doc.get_image_size(lm.image, lm.baseurl);
 	}
 
 	const int ln_height = line_height();
@@ -5344,6 +5439,8 @@ void element::render_positioned(const render_type rt)
 		return;
 	}
 
+	layout_scope scope(m_doc.layout_profiler(), this, false);
+
 	const position wnd_position = m_doc.client_pos();
 
 	for (const auto& el : m_positioned)
@@ -5373,14 +5470,10 @@ void element::render_positioned(const render_type rt)
 		{
 			int parent_height = 0;
 			int parent_width = 0;
-			int client_x = 0;
-			int client_y = 0;
 			if (el_position == element_position_fixed)
 			{
 				parent_height = wnd_position.height;
 				parent_width = wnd_position.width;
-				client_x = wnd_position.left();
-				client_y = wnd_position.top();
 			}
 			else
 			{
@@ -5606,108 +5699,56 @@ overflow element::get_overflow() const
 	return m_overflow;
 }
 
-bool element::is_nth_child(const element* el, const int num, const int off, const bool of_type)
+// An+B matches when (idx - B) is a non-negative multiple of A, which for a
+// negative A means counting back from B.
+static bool is_nth(const int idx, const int num, const int off)
 {
-	int idx = 1;
-
-	for (const auto& child : m_children)
-	{
-		if (child->get_display() != display_inline_text)
-		{
-			if (!of_type || (of_type && el->get_tag_name() == child->get_tag_name()))
-			{
-				if (el == child.get())
-				{
-					if (num != 0)
-					{
-						// An+B matches when (idx - B) is a non-negative multiple of A,
-						// which for a negative A means counting back from B.
-						if ((idx - off) % num == 0 && (idx - off) / num >= 0)
-						{
-							return true;
-						}
-					}
-					else if (idx == off)
-					{
-						return true;
-					}
-					return false;
-				}
-				idx++;
-			}
-			if (el == child.get()) break;
-		}
-	}
-	return false;
+	if (num != 0) return (idx - off) % num == 0 && (idx - off) / num >= 0;
+	return idx == off;
 }
 
-bool element::is_nth_last_child(const element* el, const int num, const int off, const bool of_type)
+void element::index_children()
 {
-	int idx = 1;
-	for (auto child = m_children.rbegin(); child != m_children.rend(); ++child)
-	{
-		if ((*child)->get_display() != display_inline_text)
-		{
-			if (!of_type || (of_type && el->get_tag_name() == (*child)->get_tag_name()))
-			{
-				if (el == child->get())
-				{
-					if (num != 0)
-					{
-						if ((idx - off) % num == 0 && (idx - off) / num >= 0)
-						{
-							return true;
-						}
-					}
-					else if (idx == off)
-					{
-						return true;
-					}
-					return false;
-				}
-				idx++;
-			}
-			if (el == child->get()) break;
-		}
-	}
-	return false;
-}
+	if (m_children_indexed) return;
 
-// Parses the An+B microsyntax: "odd", "even", "3", "n", "2n", "-n+3", "2n + 1".
-void element::parse_nth_child_params(const std::string& param, int& num, int& off)
-{
-	num = 0;
-	off = 0;
+	std::unordered_map<std::string_view, int> of_type;
+	int count = 0;
 
-	std::string s;
-	for (const auto c : param)
+	for (size_t i = 0; i < m_children.size(); ++i)
 	{
-		if (!is_space_char(c)) s += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+		auto& child = *m_children[i];
+		child.m_sibling = {};
+		child.m_sibling.slot = static_cast<int>(i);
+		if (child.get_display() == display_inline_text) continue;
+
+		child.m_sibling.pos = ++count;
+		child.m_sibling.pos_of_type = ++of_type[child.m_tag];
 	}
 
-	if (s == "odd")
+	for (const auto& child : m_children)
 	{
-		num = 2;
-		off = 1;
-		return;
-	}
-	if (s == "even")
-	{
-		num = 2;
-		return;
+		if (!child->m_sibling.pos) continue;
+		child->m_sibling.from_end = count - child->m_sibling.pos + 1;
+		child->m_sibling.from_end_of_type = of_type[child->m_tag] - child->m_sibling.pos_of_type + 1;
 	}
 
-	const auto n = s.find('n');
+	m_children_indexed = true;
+}
 
-	if (n == std::string::npos)
-	{
-		off = safe_stoi(s);
-		return;
-	}
+bool element::is_nth_child(const element* el, const int num, const int off, const bool of_type)
+{
+	if (el->m_parent != this) return false;
+	index_children();
+	const int idx = of_type ? el->m_sibling.pos_of_type : el->m_sibling.pos;
+	return idx && is_nth(idx, num, off);
+}
 
-	const auto a = s.substr(0, n);
-	num = a.empty() || a == "+" ? 1 : a == "-" ? -1 : safe_stoi(a);
-	off = safe_stoi(s.substr(n + 1));
+bool element::is_nth_last_child(const element* el, const int num, const int off, const bool of_type)
+{
+	if (el->m_parent != this) return false;
+	index_children();
+	const int idx = of_type ? el->m_sibling.from_end_of_type : el->m_sibling.from_end;
+	return idx && is_nth(idx, num, off);
 }
 
 void element::calc_document_size(size& sz, const int x /*= 0*/, const int y /*= 0*/)
@@ -5766,30 +5807,21 @@ void element::get_redraw_box(position& pos, const int x /*= 0*/, const int y /*=
 element* element::find_adjacent_sibling(const element* el, const css_selector& selector,
                                         const bool apply_pseudo /*= true*/, bool* is_pseudo /*= 0*/)
 {
-	element* ret = nullptr;
+	if (el->m_parent != this) return nullptr;
+	index_children();
 
-	for (const auto& e : m_children)
+	for (int i = el->m_sibling.slot - 1; i >= 0; --i)
 	{
-		if (e->get_display() != display_inline_text)
+		const auto& e = m_children[i];
+		if (e->get_display() == display_inline_text) continue;
+
+		const int res = e->select(selector, apply_pseudo);
+		if (res == select_no_match) return nullptr;
+		if (is_pseudo)
 		{
-			if (e.get() == el)
-			{
-				if (ret)
-				{
-					const int res = ret->select(selector, apply_pseudo);
-					if (res != select_no_match)
-					{
-						if (is_pseudo)
-						{
-							*is_pseudo = (res & select_match_pseudo_class) != 0;
-						}
-						return ret;
-					}
-				}
-				return nullptr;
-			}
-			ret = e.get();
+			*is_pseudo = (res & select_match_pseudo_class) != 0;
 		}
+		return e.get();
 	}
 	return nullptr;
 }
@@ -5797,28 +5829,23 @@ element* element::find_adjacent_sibling(const element* el, const css_selector& s
 element* element::find_sibling(const element* el, const css_selector& selector, const bool apply_pseudo /*= true*/,
                                bool* is_pseudo /*= 0*/)
 {
-	element* ret = nullptr;
+	if (el->m_parent != this) return nullptr;
+	index_children();
 
-	for (const auto& e : m_children)
+	// Only the siblings before el can match, and the first match decides.
+	for (int i = 0; i < el->m_sibling.slot; ++i)
 	{
-		if (e->get_display() != display_inline_text)
+		const auto& e = m_children[i];
+		if (e->get_display() == display_inline_text) continue;
+
+		const int res = e->select(selector, apply_pseudo);
+		if (res != select_no_match)
 		{
-			if (e.get() == el)
-			{
-				return ret;
-			}
-			if (!ret)
+			if (is_pseudo)
 			{
-				const int res = e->select(selector, apply_pseudo);
-				if (res != select_no_match)
-				{
-					if (is_pseudo)
-					{
-						*is_pseudo = (res & select_match_pseudo_class) != 0;
-					}
-					ret = e.get();
-				}
+				*is_pseudo = (res & select_match_pseudo_class) != 0;
 			}
+			return e.get();
 		}
 	}
 	return nullptr;
@@ -5826,23 +5853,10 @@ element* element::find_sibling(const element* el, const css_selector& selector,
 
 bool element::is_only_child(const element* el, const bool of_type)
 {
-	int child_count = 0;
-	for (const auto& child : m_children)
-	{
-		if (child->get_display() != display_inline_text)
-		{
-			if (!of_type || (of_type && el->get_tag_name() == child->get_tag_name()))
-			{
-				child_count++;
-			}
-			if (child_count > 1) break;
-		}
-	}
-	if (child_count > 1)
-	{
-		return false;
-	}
-	return true;
+	if (el->m_parent != this) return true;
+	index_children();
+	const auto& at = el->m_sibling;
+	return of_type ? at.pos_of_type + at.from_end_of_type <= 2 : at.pos + at.from_end <= 2;
 }
 
 void element::update_floats(const int dy, element* parent)
@@ -5889,6 +5903,7 @@ void element::remove_before_after()
 		if (m_children.front()->get_tag_name() == "::before")
 		{
 			m_children.erase(m_children.begin());
+			children_changed();
 		}
 	}
 	if (!m_children.empty())
@@ -5896,6 +5911,7 @@ void element::remove_before_after()
 		if (m_children.back()->get_tag_name() == "::after")
 		{
 			m_children.erase(m_children.end() - 1);
+			children_changed();
 		}
 	}
 }
@@ -5914,6 +5930,7 @@ element* element::get_element_before()
 	const auto raw = el.get();
 	raw->parent(this);
 	m_children.insert(m_children.begin(), std::move(el));
+	children_changed();
 	return raw;
 }
 
@@ -5930,6 +5947,7 @@ element* element::get_element_after()
 	const auto raw = el.get();
 	raw->parent(this);
 	m_children.push_back(std::move(el));
+	children_changed();
 	return raw;
 }
 
@@ -6038,17 +6056,18 @@ void element::refresh_styles()
 	{
 		usel.m_used = false;
 
-		if (usel.m_selector->is_media_valid())
+		const auto& sel = m_doc.styles().selector(usel.m_selector);
+		if (sel.is_media_valid())
 		{
-			const int apply = select(*usel.m_selector, false);
+			const int apply = select(sel, false);
 
 			if (apply != select_no_match)
 			{
 				if (apply & select_match_pseudo_class)
 				{
-					if (select(*usel.m_selector, true))
+					if (select(sel, true))
 					{
-						add_style(usel.m_selector->m_style);
+						add_style(sel.m_style);
 						usel.m_used = true;
 					}
 				}
@@ -6057,7 +6076,7 @@ void element::refresh_styles()
 					element* el = get_element_after();
 					if (el)
 					{
-						el->add_style(usel.m_selector->m_style);
+						el->add_style(sel.m_style);
 					}
 				}
 				else if (apply & select_match_with_before)
@@ -6065,12 +6084,12 @@ void element::refresh_styles()
 					element* el = get_element_before();
 					if (el)
 					{
-						el->add_style(usel.m_selector->m_style);
+						el->add_style(sel.m_style);
 					}
 				}
 				else
 				{
-					add_style(usel.m_selector->m_style);
+					add_style(sel.m_style);
 					usel.m_used = true;
 				}
 			}
@@ -6307,7 +6326,7 @@ void element::add_text(const std::string& txt)
 	std::string word;
 	std::string esc;
 
-	for (auto i = 0; i < txt.length(); i++)
+	for (size_t i = 0; i < txt.length(); i++)
 	{
 		if (txt.at(i) == ' ' || txt.at(i) == '\t' || (txt.at(i) == '\\' && !esc.empty()))
 		{
@@ -10,6 +10,19 @@
 
 class element;
 
+// An attribute as an element holds it. The name is interned, lower case and
+// shared by every element; the value views the page source, or the document's
+// text arena when it had to be copied.
+struct element_attr
+{
+	std::string_view name;
+	std::string_view value;
+};
+
+// The interned copy of an attribute name. Elements and selectors both store
+// names this way, so two names are equal exactly when their views are.
+std::string_view attr_atom(std::string_view name);
+
 enum box_type
 {
 	box_block,
@@ -72,6 +85,8 @@ public:
 	void y_shift(int shift);
 	void new_width(int left, int right, std::vector<element*>& els);
 
+	size_t heap_bytes() const { return m_items.capacity() * sizeof(element*); }
+
 private:
 	element* get_last_space();
 	bool is_break_only() const;
@@ -252,6 +267,14 @@ public:
 	table_column& column(const int c) { return m_columns[c]; }
 	table_row& row(const int r) { return m_rows[r]; }
 
+	size_t heap_bytes() const
+	{
+		size_t bytes = m_cells.capacity() * sizeof(m_cells[0]) + m_columns.capacity() * sizeof(table_column) +
+			m_rows.capacity() * sizeof(table_row);
+		for (const auto& row : m_cells) bytes += row.capacity() * sizeof(table_cell);
+		return bytes;
+	}
+
 	int rows_count() { return m_rows_count; }
 	int cols_count() { return m_cols_count; }
 
@@ -299,6 +322,7 @@ public:
 
 class box;
 class background;
+struct memory_footprint;
 class render_win32;
 
 enum element_type
@@ -361,7 +385,6 @@ class element
 {
 	friend class box;
 	friend class el_table;
-	friend class element;
 	friend class table_grid;
 
 protected:
@@ -375,10 +398,28 @@ protected:
 	margins m_borders;
 	bool m_skip;
 	bool m_loaded;
+	// Set by parse_styles. A page that is still arriving styles only the
+	// nodes appended since its previous pass.
+	bool m_styled = false;
 	std::vector<std::unique_ptr<element>> m_children;
 
-	std::string m_id;
-	std::string m_class;
+	// Where this element sits among its parent's element children (text is
+	// skipped), 1-based from either end and among siblings of the same tag.
+	// The parent fills these in on the first structural match after its
+	// child list changes, so :nth-child and friends are O(1).
+	struct sibling_index
+	{
+		int slot = 0; // position in the parent's m_children
+		int pos = 0;
+		int pos_of_type = 0;
+		int from_end = 0;
+		int from_end_of_type = 0;
+	};
+	sibling_index m_sibling;
+	bool m_children_indexed = false;
+
+	std::string_view m_id;
+	std::string_view m_class;
 	std::string m_text;
 	std::string m_transformed_text;
 	size m_size;
@@ -388,7 +429,8 @@ protected:
 	std::string m_src;
 	std::string m_tag;
 	style m_style;
-	std::map<std::string, std::string, ltstr_sv> m_attrs;
+	style m_attr_style; // presentational attributes such as align and width, below every rule
+	small_vector<element_attr, 3> m_attrs;
 	vertical_align m_vertical_align;
 	text_align m_text_align;
 	style_display m_display;
@@ -518,8 +560,14 @@ public:
 	bool is_nth_child(const element* el, int num, int off, bool of_type);
 	bool is_nth_last_child(const element* el, int num, int off, bool of_type);
 	bool is_only_child(const element* el, bool of_type);
+	void index_children();
+	void children_changed() { m_children_indexed = false; }
 	bool is_point_inside(int x, int y);
 	bool is_replaced() const;
+	// An <img> whose box comes from width/height rather than the bitmap, so
+	// the bitmap arriving changes what is painted but not the layout.
+	bool has_specified_size() const;
+	const std::string& get_src() const { return m_src; }
 	bool is_white_space();
 	bool on_lbutton_down();
 	bool on_lbutton_up();
@@ -528,6 +576,9 @@ public:
 	bool set_pseudo_class(const std::string& pclass, bool add);
 	const std::string& get_tag_name() const { return m_tag; }
 	std::string_view get_attr(std::string_view name, std::string_view def = {}) const;
+	const element_attr* find_attr(std::string_view name) const;
+	const element_attr* find_attr_atom(std::string_view atom) const;
+	bool matches_pseudo_class(const css_attribute_selector& sa, bool apply_pseudo);
 	std::string get_cursor() const;
 	std::string get_style_property(prop_id name, bool inherited,
 	                               std::string_view def = {}) const;
@@ -574,9 +625,15 @@ public:
 	void add_positioned(element* el);
 	void add_style(const std::shared_ptr<style>& st);
 	void apply_stylesheet(const css& styles);
+	// Adds this subtree's nodes, styles and boxes to m.
+	void measure_memory(memory_footprint& m) const;
+	// Drops what the cascade applied to this subtree and runs it again, so
+	// rules that stopped applying are gone; presentational attributes stay.
+	void restyle(const css& styles);
 	void apply_vertical_align();
 	void calc_document_size(size& sz, int x = 0, int y = 0);
 	void calc_outlines(int parent_width);
+	void collect_appended(std::vector<element*>& spine, std::vector<element*>& appended);
 	void draw(render_win32& renderer, int x, int y, const position* clip);
 	void draw_background(render_win32& renderer, int x, int y, const position* clip);
 	void draw_children(render_win32& renderer, int x, int y, const position* clip, draw_flag flag, int zindex);
@@ -591,6 +648,7 @@ public:
 	void parse_attributes();
 	void parse_styles(bool is_reparse = false);
 	void refresh_styles();
+	void reset_cascade();
 	void render_positioned(render_type rt = render_all);
 	void set_attr(std::string_view name, std::string_view val);
 	void set_css_width(const css_length& w);
@@ -607,7 +665,6 @@ protected:
 	void parse_background();
 	void init_background_paint(position pos, background_paint& bg_paint, const background* bg);
 	void draw_list_marker(render_win32& renderer, const position& pos);
-	void parse_nth_child_params(const std::string& param, int& num, int& off);
 	void remove_before_after();
 	void add_text(const std::string& txt);
 	void add_function(const std::string& fnc, const std::string& params);
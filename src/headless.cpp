@@ -0,0 +1,579 @@
+// headless.cpp - Command-line parsing and the windowless modes: layout of a
+// local file, the batch layout server, the corpus and micro benchmarks, and
+// the unit test report.
+
+#include "pch.h"
+#include "headless.h"
+
+#include <charconv>
+#include <iostream>
+
+// Defined in core.cpp — runs the registered in-process unit tests and
+// returns an HTML report. Failed cases contain the substring "FAILED".
+extern std::string run_tests();
+
+namespace
+{
+	// Headless layout of a local HTML file. No window and no message loop, so
+	// no async resource can ever land and the result is repeatable. Prints
+	// "<file>: <w>x<h>" plus stage timings, structure and layout anomalies.
+	int run_layout(const command_line& cl, const int height)
+	{
+		const auto& path = cl.layout_path;
+		const auto dump_json = cl.layout_dump_json;
+		auto html = get_file_contents(path);
+
+		if (html.empty())
+		{
+			pf::write_stdout(std::format("Layout: cannot read {}\n", path));
+			return 11;
+		}
+
+		layout_result r;
+		const auto runs = std::max(1, cl.layout_repeats);
+		if (cl.counters) hw_counters::start();
+
+		for (auto i = 0; i < runs; ++i)
+		{
+			// The last run is handed the file buffer itself, so a single run
+			// parses the page in the memory it was read into.
+			if (cl.layout_alloc) alloc_stats::start();
+			hw_counters::reset();
+			r = layout_html_headless(i + 1 < runs ? html : std::move(html),
+			                         {.width = cl.layout_width, .height = height,
+			                          .verbose = !dump_json && cl.layout_verbose, .dump_depth = cl.layout_dump,
+			                          .dump_json = dump_json, .profile_selectors = cl.layout_profile,
+			                          .profile_layout = !cl.layout_flame.empty(), .measure_memory = cl.eval_memory});
+			alloc_stats::stop();
+			if (!dump_json)
+				pf::write_stdout(std::format("{}: {}x{} (parse+style {} us, layout {} us)\n",
+				                             path, r.width, r.height, r.parse_style_us, r.layout_us));
+		}
+
+		if (dump_json)
+		{
+			pf::write_stdout(r.layout_json + "\n");
+			return r.height > 0 ? 0 : 12;
+		}
+
+		const auto& s = r.stats;
+		pf::write_stdout(std::format(
+			"  nodes: {} elements, {} text, {} images, depth {}; right edge {}, {} hidden subtrees\n",
+			s.elements, s.text_nodes, s.images, s.max_depth, s.right_edge, s.hidden_subtrees));
+		const auto anomalies = s.overflow_x + s.negative_x + s.zero_area_text + s.unsized_image + s.negative_size;
+
+		if (anomalies)
+		{
+			pf::write_stdout(std::format(
+				"  anomalies: {} overflow-x, {} negative-x, {} zero-height-text, {} unsized-image, {} negative-size\n",
+				s.overflow_x, s.negative_x, s.zero_area_text, s.unsized_image, s.negative_size));
+
+			for (const auto& a : r.anomalies) pf::write_stdout("    " + a + "\n");
+		}
+		else
+		{
+			pf::write_stdout("  anomalies: none\n");
+		}
+
+		for (const auto& line : r.box_dump) pf::write_stdout(line + "\n");
+		pf::write_stdout(r.selector_profile);
+		pf::write_stdout(r.layout_profile);
+		if (cl.eval_memory) pf::write_stdout(r.memory.report());
+		if (cl.layout_alloc)
+		{
+			pf::write_stdout(alloc_stats::available
+				                 ? "Allocations, last run:\n" + alloc_stats::report()
+				                 : std::string("Allocations: not counted, this build has no POTATO_ALLOC_STATS\n"));
+		}
+		if (cl.counters) pf::write_stdout(hw_counters::report(static_cast<size_t>(s.elements)));
+		hw_counters::stop();
+
+		if (!cl.layout_flame.empty())
+		{
+			std::ofstream out(cl.layout_flame, std::ios::out | std::ios::binary);
+			out << r.layout_folded;
+			if (!out) pf::write_stdout(std::format("Layout: cannot write {}\n", cl.layout_flame));
+		}
+
+		return r.height > 0 ? 0 : 12;
+	}
+
+	// The members of a one-line JSON object, each as the raw text of its
+	// value. Nested objects and arrays are kept whole, not parsed.
+	std::map<std::string, std::string, std::less<>> read_json_fields(const std::string_view line)
+	{
+		std::map<std::string, std::string, std::less<>> fields;
+		size_t i = line.find('{');
+		if (i == std::string_view::npos) return fields;
+
+		const auto skip_space = [&] { while (i < line.size() && is_space_char(line[i])) ++i; };
+		const auto skip_string = [&]
+		{
+			for (++i; i < line.size() && line[i] != '"'; ++i)
+			{
+				if (line[i] == '\\') ++i;
+			}
+			++i;
+		};
+
+		for (++i;;)
+		{
+			skip_space();
+			if (i >= line.size() || line[i] != '"') break;
+
+			const auto key_start = i + 1;
+			skip_string();
+			if (i > line.size()) break;
+			const auto key = line.substr(key_start, i - 1 - key_start);
+
+			skip_space();
+			if (i >= line.size() || line[i] != ':') break;
+			++i;
+			skip_space();
+
+			const auto value_start = i;
+			int depth = 0;
+
+			while (i < line.size())
+			{
+				const auto c = line[i];
+				if (c == '"')
+				{
+					skip_string();
+					continue;
+				}
+				if (c == '{' || c == '[') ++depth;
+				else if ((c == '}' || c == ']') && depth > 0) --depth;
+				else if ((c == ',' || c == '}') && depth == 0) break;
+				++i;
+			}
+
+			auto value = line.substr(value_start, std::min(i, line.size()) - value_start);
+			while (!value.empty() && is_space_char(value.back())) value.remove_suffix(1);
+			fields.emplace(key, value);
+
+			if (i >= line.size() || line[i] != ',') break;
+			++i;
+		}
+
+		return fields;
+	}
+
+	int json_int(const std::map<std::string, std::string, std::less<>>& fields, const std::string_view key,
+	             const int def)
+	{
+		const auto it = fields.find(key);
+		return it == fields.end() ? def : safe_stoi(it->second, def);
+	}
+
+	bool json_bool(const std::map<std::string, std::string, std::less<>>& fields, const std::string_view key)
+	{
+		const auto it = fields.find(key);
+		return it != fields.end() && it->second == "true";
+	}
+
+	// A request's "id", written back as an integer when it is one and as a
+	// JSON string otherwise, so whatever the request held cannot break the
+	// result line.
+	void append_json_id(std::string& out, const std::string_view raw)
+	{
+		int64_t n = 0;
+		const auto [end, ec] = std::from_chars(raw.data(), raw.data() + raw.size(), n);
+		if (!raw.empty() && ec == std::errc() && end == raw.data() + raw.size())
+		{
+			out += std::to_string(n);
+			return;
+		}
+		append_json_string(out, raw.starts_with('"') ? read_json_string(raw) : std::string(raw));
+	}
+
+	struct served
+	{
+		std::string out; // the result line, without its newline
+		bool failed = false;
+		int64_t cached_us = 0;
+		int64_t uncached_us = 0;
+	};
+
+	// One --serve request, laid out with the shared cache.
+	served serve_request(const command_line& cl, const std::map<std::string, std::string, std::less<>>& fields,
+	                     const std::shared_ptr<layout_cache>& cache)
+	{
+		served s;
+		s.out = "{";
+		if (const auto id = fields.find("id"); id != fields.end())
+		{
+			s.out += "\"id\":";
+			append_json_id(s.out, id->second);
+			s.out += ',';
+		}
+
+		const auto path = fields.contains("path") ? read_json_string(fields.find("path")->second) : std::string();
+		s.out += "\"path\":";
+		append_json_string(s.out, path);
+
+		auto html = fields.contains("html") ? read_json_string(fields.find("html")->second) : get_file_contents(path);
+
+		if (html.empty())
+		{
+			s.failed = true;
+			s.out += ",\"ok\":false,\"error\":\"cannot read\"}";
+			return s;
+		}
+
+		const auto width = json_int(fields, "width", cl.layout_width);
+		const auto height = json_int(fields, "height", 896);
+		const auto dump_json = json_bool(fields, "dump_json");
+
+		const auto t0 = std::chrono::steady_clock::now();
+		const auto r = layout_html_headless(cl.serve_compare ? html : std::move(html),
+		                                    {.width = width, .height = height, .dump_json = dump_json, .cache = cache});
+		const auto t1 = std::chrono::steady_clock::now();
+		s.cached_us = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count();
+
+		// The same page in this process with a cache of its own: master.css
+		// parsed and fonts opened again. Process start-up is not measured.
+		if (cl.serve_compare)
+		{
+			layout_html_headless(std::move(html), {.width = width, .height = height, .dump_json = dump_json});
+			s.uncached_us = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - t1).count();
+		}
+
+		s.failed = r.height <= 0;
+		s.out += std::format(",\"ok\":{},\"width\":{},\"height\":{},\"parse_us\":{},\"style_us\":{},"
+		                     "\"layout_us\":{},\"elements\":{},\"text_nodes\":{},\"anomalies\":[",
+		                     r.height > 0, r.width, r.height, r.parse_us, r.style_us, r.layout_us,
+		                     r.stats.elements, r.stats.text_nodes);
+
+		for (size_t i = 0; i < r.anomalies.size(); ++i)
+		{
+			if (i) s.out += ',';
+			append_json_string(s.out, r.anomalies[i]);
+		}
+
+		s.out += ']';
+		if (dump_json) s.out += ",\"layout\":" + r.layout_json;
+		s.out += '}';
+		return s;
+	}
+
+	// Batch layout: one JSON request per line on stdin, one JSON result per
+	// line on stdout, until end of input. Every layout shares one cache, so
+	// master.css is parsed once and fonts are opened once for the whole run.
+	// A request is {"path": file} or {"html": markup}, optionally with "id"
+	// (returned with the result), "width", "height" and "dump_json".
+	//
+	// Requests are laid out on cl.jobs threads while stdin is still being
+	// read; results are written in request order as soon as each is next.
+	int run_layout_server(const command_line& cl)
+	{
+		const auto cache = std::make_shared<layout_cache>();
+		const auto started = std::chrono::steady_clock::now();
+		const auto jobs = static_cast<unsigned>(std::max(1, cl.jobs));
+		const size_t in_flight = jobs * 4;
+
+		std::mutex mutex;
+		std::condition_variable written;
+		std::map<size_t, served> finished;
+		size_t queued = 0;
+		size_t next_out = 0;
+		int failed = 0;
+		int64_t cached_us = 0;
+		int64_t uncached_us = 0;
+
+		const auto finish = [&](const size_t seq, served s)
+		{
+			std::lock_guard lock(mutex);
+			finished.emplace(seq, std::move(s));
+
+			for (auto it = finished.begin(); it != finished.end() && it->first == next_out; ++next_out)
+			{
+				const auto& r = it->second;
+				if (r.failed) ++failed;
+				cached_us += r.cached_us;
+				uncached_us += r.uncached_us;
+				pf::write_stdout(r.out + "\n");
+				it = finished.erase(it);
+			}
+
+			written.notify_all();
+		};
+
+		{
+			worker_pool pool(jobs);
+			std::string line;
+
+			while (std::getline(std::cin, line))
+			{
+				auto fields = read_json_fields(line);
+				if (fields.empty()) continue;
+
+				// Bounded, so a long stream of inline pages is not all held at once.
+				{
+					std::unique_lock lock(mutex);
+					written.wait(lock, [&] { return queued - next_out < in_flight; });
+				}
+
+				pool.post([&, seq = queued++, fields = std::move(fields)]
+				{
+					finish(seq, serve_request(cl, fields, cache));
+				});
+			}
+
+			// The pool drops work not yet started when it goes, so wait first.
+			std::unique_lock lock(mutex);
+			written.wait(lock, [&] { return next_out == queued; });
+		}
+
+		const auto pages = static_cast<int>(queued);
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		const auto rate = [pages](const double s) { return s > 0 ? pages / s : 0.0; };
+		auto summary = std::format("{{\"summary\":{{\"pages\":{},\"failed\":{},\"jobs\":{},\"seconds\":{:.3f},"
+		                           "\"pages_per_second\":{:.1f}", pages, failed, jobs, seconds, rate(seconds));
+
+		// Summed over threads, so these compare per-layout cost, not wall time.
+		if (cl.serve_compare)
+		{
+			const auto cached = rate(cached_us / 1e6);
+			const auto uncached = rate(uncached_us / 1e6);
+			summary += std::format(",\"shared_cache_pages_per_second\":{:.1f},"
+			                       "\"own_cache_pages_per_second\":{:.1f},\"shared_cache_speedup\":{:.2f}",
+			                       cached, uncached, uncached > 0 ? cached / uncached : 0.0);
+		}
+
+		pf::write_stdout(summary + "}}\n");
+		return failed ? 11 : 0;
+	}
+
+	int run_corpus(const command_line& cl)
+	{
+		auto options = cl.bench;
+		options.width = cl.layout_width;
+		options.counters = cl.counters;
+		options.jobs = cl.jobs;
+		const auto result = run_corpus_benchmark(options);
+		pf::write_stdout(result.report);
+
+		if (!cl.bench_out.empty())
+		{
+			std::ofstream out(cl.bench_out, std::ios::out | std::ios::binary);
+			out << result.json;
+			if (!out) pf::write_stdout(std::format("Bench: cannot write {}\n", cl.bench_out));
+		}
+
+		return result.pages == 0 ? 15 : result.regressions ? 14 : 0;
+	}
+}
+
+command_line parse_command_line(const std::span<const std::string_view> params)
+{
+	command_line cl;
+
+	for (const auto& p : params)
+	{
+		if (p == "/test" || p == "--test" || p == "-test")
+		{
+			cl.command = "--test";
+			break;
+		}
+		if (p == "--bench-lookups" || p == "--bench-parse" || p == "--bench-decode")
+		{
+			cl.command = p;
+			break;
+		}
+		if (p == "--bench-select" || p.starts_with("--bench-select:"))
+		{
+			cl.command = "--bench-select";
+			if (const auto colon = p.find(':'); colon != std::string_view::npos) cl.select_path = p.substr(colon + 1);
+			break;
+		}
+
+		if (p.starts_with("/layout:") || p.starts_with("--layout:"))
+		{
+			cl.layout_path = p.substr(p.find(':') + 1);
+		}
+		else if (p == "--verbose" || p == "-v")
+		{
+			cl.layout_verbose = true;
+		}
+		else if (p.starts_with("--width:"))
+		{
+			cl.layout_width = safe_stoi(std::string(p.substr(p.find(':') + 1)), cl.layout_width);
+		}
+		else if (p.starts_with("--repeat:"))
+		{
+			cl.layout_repeats = safe_stoi(std::string(p.substr(p.find(':') + 1)), 1);
+		}
+		else if (p == "--dump")
+		{
+			cl.layout_dump = 64;
+		}
+		else if (p.starts_with("--dump:"))
+		{
+			cl.layout_dump = safe_stoi(std::string(p.substr(p.find(':') + 1)), 64);
+		}
+		else if (p == "--dump-json")
+		{
+			cl.layout_dump_json = true;
+		}
+		else if (p == "--profile-selectors")
+		{
+			cl.layout_profile = 25;
+		}
+		else if (p.starts_with("--profile-selectors:"))
+		{
+			cl.layout_profile = safe_stoi(std::string(p.substr(p.find(':') + 1)), 25);
+		}
+		else if (p.starts_with("--bench:"))
+		{
+			cl.bench.dir = p.substr(p.find(':') + 1);
+		}
+		else if (p.starts_with("--warmup:"))
+		{
+			cl.bench.warmup = safe_stoi(std::string(p.substr(p.find(':') + 1)), cl.bench.warmup);
+		}
+		else if (p.starts_with("--runs:"))
+		{
+			cl.bench.runs = safe_stoi(std::string(p.substr(p.find(':') + 1)), cl.bench.runs);
+		}
+		else if (p.starts_with("--baseline:"))
+		{
+			cl.bench.baseline_path = p.substr(p.find(':') + 1);
+		}
+		else if (p.starts_with("--threshold:"))
+		{
+			cl.bench.threshold_pct = safe_stof(std::string(p.substr(p.find(':') + 1)), 10.0f);
+		}
+		else if (p.starts_with("--bench-out:"))
+		{
+			cl.bench_out = p.substr(p.find(':') + 1);
+		}
+		else if (p == "--serve")
+		{
+			cl.serve = true;
+		}
+		else if (p == "--compare")
+		{
+			cl.serve_compare = true;
+		}
+		else if (p == "--jobs" || p.starts_with("--jobs:"))
+		{
+			const auto n = p == "--jobs" ? 0 : safe_stoi(std::string(p.substr(p.find(':') + 1)), 0);
+			cl.jobs = n > 0 ? n : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+			// Only the built-in metrics are known safe to measure from
+			// several threads; elsewhere layouts run one at a time.
+			if constexpr (!pf::concurrent_text) cl.jobs = 1;
+		}
+		else if (p == "--counters")
+		{
+			cl.counters = true;
+		}
+		else if (p == "--mem")
+		{
+			cl.eval_memory = true;
+		}
+		else if (p == "--alloc-stats")
+		{
+			cl.layout_alloc = true;
+		}
+		else if (p.starts_with("--flame:"))
+		{
+			cl.layout_flame = p.substr(p.find(':') + 1);
+		}
+		else if (p.starts_with("--trace:"))
+		{
+			cl.trace_path = p.substr(p.find(':') + 1);
+		}
+		else if (p.starts_with("/eval:") || p.starts_with("--eval:"))
+		{
+			const auto separator = p.find(':');
+			cl.eval_url = p.substr(separator + 1);
+		}
+		else if (!p.starts_with("-") && !p.starts_with("/") && cl.startup_url.empty())
+		{
+			cl.startup_url = p;
+		}
+	}
+
+	return cl;
+}
+
+bool run_headless(const command_line& cl, int& exit_code)
+{
+	exit_code = 0;
+
+	if (cl.command == "--test") return false;
+	if (cl.command == "--bench-lookups")
+	{
+		pf::write_stdout(run_lookup_benchmark());
+		return true;
+	}
+	if (cl.command == "--bench-parse")
+	{
+		pf::write_stdout(run_parse_benchmark());
+		return true;
+	}
+	if (cl.command == "--bench-select")
+	{
+		pf::write_stdout(run_selector_benchmark(cl.select_path));
+		return true;
+	}
+	if (cl.command == "--bench-decode")
+	{
+		pf::write_stdout(run_decode_benchmark());
+		return true;
+	}
+
+	// The allocation counts are process-wide, so layouts on other threads would
+	// land in them; the hardware counters follow one thread and would miss them.
+	if ((cl.layout_alloc || cl.counters) && cl.jobs > 1)
+	{
+		pf::write_stdout(cl.layout_alloc
+			                 ? "--alloc-stats counts the whole process; it cannot be used with --jobs above 1\n"
+			                 : "--counters counts one thread; it cannot be used with --jobs above 1\n");
+		exit_code = 16;
+		return true;
+	}
+
+	if (!cl.bench.dir.empty())
+	{
+		exit_code = run_corpus(cl);
+		return true;
+	}
+
+	if (cl.serve)
+	{
+		exit_code = run_layout_server(cl);
+		return true;
+	}
+
+	if (cl.layout_path.empty()) return false;
+
+	// Layout runs write the trace as they finish; an evaluation writes it when
+	// it completes, or on exit if the window is closed first.
+	if (!cl.trace_path.empty()) trace::start(cl.trace_path);
+	exit_code = run_layout(cl, 896);
+	if (!cl.trace_path.empty() && !trace::finish())
+	{
+		pf::write_stdout(std::format("Trace: cannot write {}\n", cl.trace_path));
+	}
+	return true;
+}
+
+int run_unit_tests()
+{
+	pf::write_stdout("Potato self-test: running unit tests ...\n");
+	const auto report = run_tests();
+	const auto report_path = pf::platform_temp_file_path("potato_tests_");
+	if (const auto out = pf::open_file_for_write(pf::file_path{report_path}))
+	{
+		out->write(reinterpret_cast<const uint8_t*>(report.data()),
+		           static_cast<uint32_t>(report.size()));
+	}
+	const bool unit_failed = report.find("FAILED") != std::string::npos;
+	pf::write_stdout(std::format(
+		"Unit tests: {} (report: {})\n",
+		unit_failed ? "FAIL" : "PASS", report_path));
+	return unit_failed ? 10 : 0;
+}
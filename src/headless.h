@@ -0,0 +1,54 @@
+// headless.h - The command line, and the modes that need no window: --layout:,
+// --serve, the benchmarks and the unit tests. Shared by the browser and
+// potato-headless.
+
+#pragma once
+#include "document.h"
+
+
+struct command_line
+{
+	// The first of --test, --bench-lookups, --bench-parse, --bench-select[:file]
+	// or --bench-decode; the parameters after it are not read.
+	std::string command;
+	std::string select_path = "test-files/site-elements.html";
+
+	std::string layout_path;
+	int layout_width = 1902;
+	int layout_repeats = 1;
+	bool layout_verbose = false;
+	int layout_dump = 0;
+	bool layout_dump_json = false;
+	int layout_profile = 0;
+	std::string layout_flame;
+	bool layout_alloc = false;
+	bool counters = false;
+
+	corpus_bench_options bench;
+	std::string bench_out;
+	std::string trace_path;
+
+	// --serve reads layout requests as JSON lines on stdin; --compare also
+	// lays out each page with a cache of its own, to measure what sharing saves.
+	bool serve = false;
+	bool serve_compare = false;
+
+	// Threads for --serve and the --bench: throughput table; --jobs alone or
+	// --jobs:0 means one per hardware thread.
+	int jobs = 1;
+
+	std::string eval_url;
+	bool eval_memory = false;
+	std::string startup_url;
+};
+
+command_line parse_command_line(std::span<const std::string_view> params);
+
+// Runs the mode the command line asks for when it needs no window, and sets
+// exit_code. False for --test, which each front end runs its own way, and for
+// anything that opens the browser.
+bool run_headless(const command_line& cl, int& exit_code);
+
+// Runs the in-process unit tests, writes the HTML report to a temp file and
+// returns 10 if any failed.
+int run_unit_tests();
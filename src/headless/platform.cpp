@@ -0,0 +1,538 @@
+// platform.cpp - The headless pf:: backend: files, stdout, encodings, URL
+// resolution, embedded resources and the built-in font metrics.
+
+#include "pch.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace pf
+{
+	bitmap_ptr load_bitmap_file(const file_path&)
+	{
+		return nullptr;
+	}
+
+	namespace
+	{
+		class std_file final : public writable_file
+		{
+		public:
+			explicit std_file(FILE* f) : m_file(f)
+			{
+			}
+
+			~std_file() override
+			{
+				fclose(m_file);
+			}
+
+			uint32_t write(const uint8_t* data, const uint32_t size) override
+			{
+				return static_cast<uint32_t>(fwrite(data, 1, size, m_file));
+			}
+
+		private:
+			FILE* m_file;
+		};
+	}
+
+	writable_file_handle_ptr open_file_for_write(const file_path& path)
+	{
+		FILE* f = fopen(path.path.c_str(), "wb");
+		if (!f) return nullptr;
+		return std::make_shared<std_file>(f);
+	}
+
+	bool platform_delete_file(const file_path& path)
+	{
+		std::error_code ec;
+		return std::filesystem::remove(path.path, ec);
+	}
+
+	std::string platform_temp_file_path(const std::string_view prefix)
+	{
+		static std::atomic<uint32_t> counter{0};
+		std::error_code ec;
+		auto dir = std::filesystem::temp_directory_path(ec);
+		if (ec) dir = ".";
+#if defined(__unix__) || defined(__APPLE__)
+		const auto pid = static_cast<uint32_t>(getpid());
+#else
+		const auto pid = 0u;
+#endif
+		return (dir / std::format("{}{}_{}.tmp", prefix, pid, counter++)).string();
+	}
+
+	void write_stdout(const std::string_view text)
+	{
+		fwrite(text.data(), 1, text.size(), stdout);
+		fflush(stdout);
+	}
+
+	isize platform_screen_size()
+	{
+		return {1920, 1080};
+	}
+
+	int platform_screen_dpi()
+	{
+		return 96;
+	}
+
+	// ── Text ──────────────────────────────────────────────────────────────
+
+	namespace
+	{
+		// Decodes one code point at i and advances past it; malformed bytes
+		// come back as U+FFFD, one byte at a time.
+		char32_t next_code_point(const std::string_view s, size_t& i)
+		{
+			const auto c = static_cast<uint8_t>(s[i++]);
+			if (c < 0x80) return c;
+
+			const int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : -1;
+			if (extra < 0 || i + extra > s.size()) return 0xFFFD;
+
+			char32_t cp = c & (0x3F >> extra);
+			for (int k = 0; k < extra; ++k)
+			{
+				const auto b = static_cast<uint8_t>(s[i + k]);
+				if (!is_utf8_continuation(b)) return 0xFFFD;
+				cp = (cp << 6) | (b & 0x3F);
+			}
+			i += extra;
+			return cp;
+		}
+	}
+
+	std::wstring utf8_to_utf16(const std::string_view text)
+	{
+		std::wstring result;
+		result.reserve(text.size());
+
+		for (size_t i = 0; i < text.size();)
+		{
+			const auto cp = next_code_point(text, i);
+
+			// Where wchar_t holds a whole code point, as on Linux and macOS,
+			// there are no surrogates.
+			if (sizeof(wchar_t) == 2 && cp >= 0x10000)
+			{
+				result.push_back(static_cast<wchar_t>(0xD800 + ((cp - 0x10000) >> 10)));
+				result.push_back(static_cast<wchar_t>(0xDC00 + ((cp - 0x10000) & 0x3FF)));
+			}
+			else
+			{
+				result.push_back(static_cast<wchar_t>(cp));
+			}
+		}
+
+		return result;
+	}
+
+	std::string utf16_to_utf8(const std::wstring_view text)
+	{
+		std::string result;
+		result.reserve(text.size());
+
+		for (size_t i = 0; i < text.size(); ++i)
+		{
+			auto cp = static_cast<char32_t>(text[i]);
+
+			if (cp >= 0xD800 && cp < 0xDC00 && i + 1 < text.size())
+			{
+				const auto low = static_cast<char32_t>(text[i + 1]);
+
+				if (low >= 0xDC00 && low < 0xE000)
+				{
+					cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+					++i;
+				}
+			}
+
+			char32_to_utf8(std::back_inserter(result), cp);
+		}
+
+		return result;
+	}
+
+	std::string transcode_to_utf8(const std::string_view bytes, const uint32_t codepage)
+	{
+		if (codepage == 65001) return std::string(bytes);
+
+		std::string result;
+		result.reserve(bytes.size());
+
+		if (codepage == 1200 || codepage == 1201)
+		{
+			std::wstring units;
+			units.reserve(bytes.size() / 2);
+
+			for (size_t i = 0; i + 1 < bytes.size(); i += 2)
+			{
+				const auto lo = static_cast<uint8_t>(bytes[i + (codepage == 1201 ? 1 : 0)]);
+				const auto hi = static_cast<uint8_t>(bytes[i + (codepage == 1201 ? 0 : 1)]);
+				units.push_back(static_cast<wchar_t>(lo | (hi << 8)));
+			}
+
+			return utf16_to_utf8(units);
+		}
+
+		for (const auto c : bytes) char32_to_utf8(std::back_inserter(result), static_cast<uint8_t>(c));
+		return result;
+	}
+
+	uint32_t charset_to_codepage(const std::string_view charset)
+	{
+		static constexpr struct
+		{
+			std::string_view label;
+			uint32_t codepage;
+		} labels[] = {
+			{"utf-8", 65001}, {"utf8", 65001}, {"unicode-1-1-utf-8", 65001},
+			{"utf-16", 1200}, {"utf-16le", 1200}, {"utf-16be", 1201},
+			{"windows-874", 874}, {"tis-620", 874}, {"iso-8859-11", 874},
+			{"windows-1250", 1250}, {"windows-1251", 1251}, {"windows-1252", 1252},
+			{"windows-1253", 1253}, {"windows-1254", 1254}, {"windows-1255", 1255},
+			{"windows-1256", 1256}, {"windows-1257", 1257}, {"windows-1258", 1258},
+			{"iso-8859-1", 1252}, {"latin1", 1252}, {"ascii", 1252}, {"us-ascii", 1252},
+			{"iso-8859-9", 1254}, {"latin5", 1254},
+			{"koi8-r", 20866}, {"koi8-u", 21866},
+			{"iso-8859-2", 28592}, {"iso-8859-3", 28593}, {"iso-8859-4", 28594},
+			{"iso-8859-5", 28595}, {"iso-8859-6", 28596}, {"iso-8859-7", 28597},
+			{"iso-8859-8", 28598}, {"iso-8859-13", 28603}, {"iso-8859-15", 28605},
+		};
+
+		auto label = std::string(charset);
+		std::ranges::transform(label, label.begin(), [](const char c)
+		{
+			return static_cast<char>(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+		});
+
+		while (!label.empty() && (label.front() == ' ' || label.front() == '"')) label.erase(0, 1);
+		while (!label.empty() && (label.back() == ' ' || label.back() == '"')) label.pop_back();
+
+		for (const auto& l : labels)
+		{
+			if (l.label == label) return l.codepage;
+		}
+
+		return 0;
+	}
+
+	// RFC 3986 reference resolution, plus plain relative file paths for
+	// documents loaded from disk.
+	std::string resolve_url(const std::string_view base, const std::string_view url)
+	{
+		const auto scheme_end = [](const std::string_view s) -> size_t
+		{
+			const auto colon = s.find(':');
+			if (colon == std::string_view::npos || colon < 2) return std::string_view::npos;
+			const auto slash = s.find_first_of("/?#");
+			return slash != std::string_view::npos && slash < colon ? std::string_view::npos : colon;
+		};
+
+		if (url.empty()) return std::string(base);
+		if (base.empty() || scheme_end(url) != std::string_view::npos) return std::string(url);
+
+		const auto base_scheme = scheme_end(base);
+		const auto authority_start = base_scheme == std::string_view::npos ? 0 : base_scheme + 1;
+		const auto has_authority = base.substr(authority_start).starts_with("//");
+		const auto path_start = has_authority
+			                        ? std::min(base.find_first_of("/?#", authority_start + 2), base.size())
+			                        : authority_start;
+
+		if (url.starts_with("//"))
+		{
+			return std::string(base.substr(0, authority_start)) + std::string(url);
+		}
+
+		const auto base_path_end = std::min(base.find_first_of("?#", path_start), base.size());
+
+		if (url.front() == '#')
+		{
+			return std::string(base.substr(0, std::min(base.find('#'), base.size()))) + std::string(url);
+		}
+
+		if (url.front() == '?')
+		{
+			return std::string(base.substr(0, base_path_end)) + std::string(url);
+		}
+
+		std::string path;
+
+		if (url.front() == '/')
+		{
+			path = url;
+		}
+		else
+		{
+			const auto base_path = base.substr(path_start, base_path_end - path_start);
+			const auto last_slash = base_path.rfind('/');
+			if (last_slash != std::string_view::npos) path = base_path.substr(0, last_slash + 1);
+			else if (has_authority) path = "/";
+			path += url;
+		}
+
+		// Remove dot segments, keeping the query and fragment as they are.
+		const auto tail_start = std::min(path.find_first_of("?#"), path.size());
+		const auto tail = path.substr(tail_start);
+		const auto absolute = !path.empty() && path.front() == '/';
+		std::vector<std::string> segments;
+		size_t pos = absolute ? 1 : 0;
+		auto trailing_slash = false;
+
+		while (pos <= tail_start)
+		{
+			const auto next = std::min(path.find('/', pos), tail_start);
+			const auto segment = path.substr(pos, next - pos);
+			trailing_slash = next < tail_start || segment.empty() || segment == "." || segment == "..";
+
+			if (segment == "..")
+			{
+				if (!segments.empty() && segments.back() != "..") segments.pop_back();
+				else if (!absolute) segments.push_back("..");
+			}
+			else if (segment != "." && (next < tail_start || !segment.empty()))
+			{
+				segments.push_back(segment);
+			}
+
+			pos = next + 1;
+		}
+
+		std::string result(base.substr(0, path_start));
+		if (absolute) result += '/';
+
+		for (size_t i = 0; i < segments.size(); ++i)
+		{
+			if (i) result += '/';
+			result += segments[i];
+		}
+
+		if (trailing_slash && !segments.empty()) result += '/';
+		return result + tail;
+	}
+
+	std::string_view embedded_resource_text(const std::string_view name)
+	{
+		for (const auto& r : embedded_resources())
+		{
+			if (r.name == name) return r.text;
+		}
+
+		return {};
+	}
+
+	// ── Fonts ─────────────────────────────────────────────────────────────
+
+	namespace
+	{
+		enum class font_family { sans, serif, mono };
+
+		// Advance widths in 1/1000 em for U+0020..U+007E, from the standard
+		// Helvetica and Times-Roman AFM files.
+		constexpr std::array<uint16_t, 95> sans_widths = {
+			278, 278, 355, 556, 556, 889, 667, 191, 333, 333, 389, 584, 278, 333, 278, 278,
+			556, 556, 556, 556, 556, 556, 556, 556, 556, 556, 278, 278, 584, 584, 584, 556,
+			1015, 667, 667, 722, 722, 667, 611, 778, 722, 278, 500, 667, 556, 833, 722, 778,
+			667, 778, 722, 667, 611, 722, 667, 944, 667, 667, 611, 278, 278, 278, 469, 556,
+			333, 556, 556, 500, 556, 556, 278, 556, 556, 222, 222, 500, 222, 833, 556, 556,
+			556, 556, 333, 500, 278, 556, 500, 722, 500, 500, 500, 334, 260, 334, 584,
+		};
+
+		constexpr std::array<uint16_t, 95> serif_widths = {
+			250, 333, 408, 500, 500, 833, 778, 180, 333, 333, 500, 564, 250, 333, 250, 278,
+			500, 500, 500, 500, 500, 500, 500, 500, 500, 500, 278, 278, 564, 564, 564, 444,
+			921, 722, 667, 667, 722, 611, 556, 722, 722, 333, 389, 722, 611, 889, 722, 722,
+			556, 722, 667, 556, 611, 722, 722, 944, 722, 722, 611, 333, 278, 333, 469, 500,
+			333, 444, 500, 444, 500, 444, 333, 500, 500, 278, 278, 500, 278, 778, 500, 500,
+			500, 500, 333, 389, 278, 500, 500, 722, 500, 500, 444, 480, 200, 480, 541,
+		};
+
+		struct family_metrics
+		{
+			double ascent;
+			double descent;
+			double x_height;
+			uint16_t other; // Advance for characters outside the table.
+		};
+
+		constexpr family_metrics sans_metrics = {0.905, 0.212, 0.519, 556};
+		constexpr family_metrics serif_metrics = {0.891, 0.216, 0.448, 500};
+		constexpr family_metrics mono_metrics = {0.833, 0.300, 0.423, 600};
+
+		const family_metrics& metrics_of(const font_family family)
+		{
+			return family == font_family::sans ? sans_metrics : family == font_family::serif ? serif_metrics : mono_metrics;
+		}
+
+		struct face
+		{
+			font_family family = font_family::serif;
+			int size = 0;
+			bool bold = false;
+			bool italic = false;
+
+			// Pixel advances, each rounded on its own as a rasterised font
+			// rounds glyph advances.
+			std::array<int, 95> ascii{};
+			int other = 0;
+			int wide = 0;
+		};
+
+		// A handle is the address of its face. The deque never moves an entry
+		// and nothing is erased, so measuring needs no lock; only creating does.
+		std::mutex g_faces_mutex;
+		std::deque<face> g_faces;
+
+		// Words that place a named family, tried in this order, so
+		// "DejaVu Sans Mono" is mono and "Microsoft Sans Serif" is sans.
+		constexpr std::string_view mono_words[] = {"mono", "courier", "consolas", "console", "menlo", "monaco",
+		                                           "code"};
+		constexpr std::string_view sans_words[] = {"sans", "arial", "helvetica", "segoe", "verdana", "tahoma",
+		                                           "roboto", "calibri", "trebuchet"};
+		constexpr std::string_view serif_words[] = {"serif", "times", "georgia", "garamond", "cambria", "palatino",
+		                                            "roman"};
+
+		std::optional<font_family> classify_family(std::string_view name)
+		{
+			if (name == "monospace" || name == "ui-monospace") return font_family::mono;
+			if (name == "sans-serif" || name == "system-ui" || name == "ui-sans-serif") return font_family::sans;
+			if (name == "serif" || name == "ui-serif" || name == "cursive" || name == "fantasy")
+				return font_family::serif;
+
+			std::vector<std::string_view> words;
+			for (size_t start = 0; start < name.size();)
+			{
+				const auto end = std::min(name.find_first_of(" -", start), name.size());
+				if (end > start) words.push_back(name.substr(start, end - start));
+				start = end + 1;
+			}
+
+			const auto any = [&](const auto& table)
+			{
+				return std::ranges::any_of(words, [&](const std::string_view w)
+				{
+					return std::ranges::find(table, w) != std::end(table);
+				});
+			};
+
+			if (any(mono_words)) return font_family::mono;
+			if (any(sans_words)) return font_family::sans;
+			if (any(serif_words)) return font_family::serif;
+			return std::nullopt;
+		}
+
+		// The first family in the list that is known stands in for the one a
+		// real font system would find installed; a list naming none is serif.
+		font_family classify(const std::string_view list)
+		{
+			std::string lower;
+			for (const auto c : list)
+			{
+				if (c != '"' && c != '\'') lower += static_cast<char>(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+			}
+
+			for (size_t start = 0; start <= lower.size();)
+			{
+				const auto end = std::min(lower.find(',', start), lower.size());
+				auto name = std::string_view(lower).substr(start, end - start);
+				while (!name.empty() && name.front() == ' ') name.remove_prefix(1);
+				while (!name.empty() && name.back() == ' ') name.remove_suffix(1);
+				if (const auto family = classify_family(name)) return *family;
+				start = end + 1;
+			}
+
+			return font_family::serif;
+		}
+
+		int scaled(const int units, const face& f)
+		{
+			const auto px = units * f.size / 1000.0 * (f.bold ? 1.06 : 1.0);
+			return static_cast<int>(std::lround(px));
+		}
+
+		bool is_wide(const char32_t cp)
+		{
+			return (cp >= 0x1100 && cp <= 0x115F) || (cp >= 0x2E80 && cp <= 0xA4CF) ||
+				(cp >= 0xAC00 && cp <= 0xD7A3) || (cp >= 0xF900 && cp <= 0xFAFF) ||
+				(cp >= 0xFF00 && cp <= 0xFF60) || (cp >= 0x20000 && cp <= 0x3FFFD);
+		}
+	}
+
+	font_handle create_font_handle(const font_def& def, font_metrics_data* metrics)
+	{
+		face f;
+		f.family = classify(def.face);
+		f.size = std::abs(def.size);
+		f.bold = def.weight >= 600;
+		f.italic = def.italic;
+
+		const auto& m = metrics_of(f.family);
+
+		if (metrics)
+		{
+			metrics->ascent = static_cast<int>(std::lround(f.size * m.ascent));
+			metrics->descent = static_cast<int>(std::lround(f.size * m.descent));
+			metrics->height = metrics->ascent + metrics->descent;
+			metrics->x_height = static_cast<int>(std::lround(f.size * m.x_height));
+		}
+
+		std::lock_guard lock(g_faces_mutex);
+
+		for (const auto& existing : g_faces)
+		{
+			if (existing.family == f.family && existing.size == f.size && existing.bold == f.bold &&
+				existing.italic == f.italic)
+				return reinterpret_cast<font_handle>(&existing);
+		}
+
+		for (size_t i = 0; i < f.ascii.size(); ++i)
+		{
+			const auto units = f.family == font_family::sans
+				                   ? sans_widths[i]
+				                   : f.family == font_family::serif
+				                   ? serif_widths[i]
+				                   : m.other;
+			f.ascii[i] = scaled(units, f);
+		}
+
+		f.other = scaled(m.other, f);
+		f.wide = scaled(1000, f);
+		return reinterpret_cast<font_handle>(&g_faces.emplace_back(f));
+	}
+
+	void delete_font_handle(font_handle)
+	{
+		// Faces are shared between equal definitions, so they stay until exit.
+	}
+
+	isize measure_text_with_font(const font_handle font, const std::string_view text)
+	{
+		if (font == 0) return {};
+		const auto* f = reinterpret_cast<const face*>(font);
+
+		int width = 0;
+
+		for (size_t i = 0; i < text.size();)
+		{
+			const auto cp = next_code_point(text, i);
+
+			if (cp >= 0x20 && cp < 0x7F) width += f->ascii[cp - 0x20];
+			else if (cp == 0xA0) width += f->ascii[0];
+			else if (cp < 0x20 || (cp >= 0x300 && cp < 0x370) || cp == 0x200B || cp == 0xFEFF) continue;
+			else width += is_wide(cp) ? f->wide : f->other;
+		}
+
+		const auto& m = metrics_of(f->family);
+		return {width, static_cast<int>(std::lround(f->size * m.ascent) + std::lround(f->size * m.descent))};
+	}
+
+	async_http_session_ptr create_async_http_session(std::string_view)
+	{
+		return nullptr;
+	}
+}
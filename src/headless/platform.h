@@ -0,0 +1,297 @@
+// platform.h - The pf:: surface the engine needs, for the potato-headless
+// build on GCC and Clang. Stands in for platform-h: no window, no network,
+// no image decoding. Fonts come from fixed advance tables, so layout is the
+// same on every machine and independent of which fonts are installed.
+
+#pragma once
+
+#include <cmath>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifndef _WIN32
+#include <strings.h>
+
+// The MSVC CRT names the engine uses.
+#define __in
+
+inline int _stricmp(const char* a, const char* b) { return strcasecmp(a, b); }
+inline int _strnicmp(const char* a, const char* b, const size_t n) { return strncasecmp(a, b, n); }
+inline int _vscprintf(const char* fmt, va_list args) { return vsnprintf(nullptr, 0, fmt, args); }
+
+inline int vsprintf_s(char* buffer, const size_t size, const char* fmt, va_list args)
+{
+	return vsnprintf(buffer, size, fmt, args);
+}
+
+inline int _itoa_s(const int value, char* buffer, const size_t size, int /*radix*/)
+{
+	return snprintf(buffer, size, "%d", value) < 0 ? 1 : 0;
+}
+#endif
+
+namespace pf
+{
+	struct isize
+	{
+		int cx = 0;
+		int cy = 0;
+	};
+
+	struct irect
+	{
+		int left = 0;
+		int top = 0;
+		int right = 0;
+		int bottom = 0;
+
+		irect() = default;
+		irect(const int l, const int t, const int r, const int b) : left(l), top(t), right(r), bottom(b)
+		{
+		}
+
+		int width() const { return right - left; }
+		int height() const { return bottom - top; }
+	};
+
+	struct color_t
+	{
+		uint8_t r = 0;
+		uint8_t g = 0;
+		uint8_t b = 0;
+		uint8_t a = 255;
+
+		color_t() = default;
+		color_t(const int r_, const int g_, const int b_, const int a_ = 255) :
+			r(static_cast<uint8_t>(r_)), g(static_cast<uint8_t>(g_)), b(static_cast<uint8_t>(b_)),
+			a(static_cast<uint8_t>(a_))
+		{
+		}
+	};
+
+	struct file_path
+	{
+		std::string path;
+
+		file_path() = default;
+		explicit file_path(std::string p) : path(std::move(p))
+		{
+		}
+
+		std::string_view view() const { return path; }
+	};
+
+	// 32-bit BGRA pixels, row major, as the Windows backend stores them.
+	struct bitmap
+	{
+		int width = 0;
+		int height = 0;
+		std::vector<uint32_t> pixels;
+
+		bitmap(const int w, const int h, std::vector<uint32_t> p) : width(w), height(h), pixels(std::move(p))
+		{
+		}
+
+		bool empty() const { return pixels.empty(); }
+	};
+
+	using bitmap_ptr = std::shared_ptr<bitmap>;
+
+	// No codecs in the headless build: always null, so pages lay out with the
+	// engine's placeholder sizes.
+	bitmap_ptr load_bitmap_file(const file_path& path);
+
+	// ── Files and output ──────────────────────────────────────────────────
+
+	struct writable_file
+	{
+		virtual ~writable_file() = default;
+		virtual uint32_t write(const uint8_t* data, uint32_t size) = 0;
+	};
+
+	using writable_file_handle_ptr = std::shared_ptr<writable_file>;
+
+	writable_file_handle_ptr open_file_for_write(const file_path& path);
+	bool platform_delete_file(const file_path& path);
+	std::string platform_temp_file_path(std::string_view prefix);
+	void write_stdout(std::string_view text);
+
+	// A fixed 1920x1080 screen at 96 dpi, so viewport units resolve the same
+	// everywhere.
+	isize platform_screen_size();
+	int platform_screen_dpi();
+
+	// ── Text ──────────────────────────────────────────────────────────────
+
+	inline bool is_utf8_continuation(const uint8_t c)
+	{
+		return (c & 0xC0) == 0x80;
+	}
+
+	template <typename It>
+	It char32_to_utf8(It out, const char32_t cp)
+	{
+		if (cp < 0x80)
+		{
+			*out++ = static_cast<char>(cp);
+		}
+		else if (cp < 0x800)
+		{
+			*out++ = static_cast<char>(0xC0 | (cp >> 6));
+			*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else if (cp < 0x10000)
+		{
+			*out++ = static_cast<char>(0xE0 | (cp >> 12));
+			*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		else
+		{
+			*out++ = static_cast<char>(0xF0 | (cp >> 18));
+			*out++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+			*out++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+			*out++ = static_cast<char>(0x80 | (cp & 0x3F));
+		}
+		return out;
+	}
+
+	// Wide strings are UTF-16 where wchar_t is 16 bits and UTF-32 where it is 32.
+	std::wstring utf8_to_utf16(std::string_view text);
+	std::string utf16_to_utf8(std::wstring_view text);
+
+	// Only UTF-8 (65001) and UTF-16 (1200, 1201) are transcoded here; the
+	// engine decodes the single-byte code pages itself. Anything else is read
+	// as Latin-1.
+	std::string transcode_to_utf8(std::string_view bytes, uint32_t codepage);
+
+	// Windows code page for a WHATWG encoding label, 0 if unknown.
+	uint32_t charset_to_codepage(std::string_view charset);
+
+	std::string resolve_url(std::string_view base, std::string_view url);
+
+	// ── Resources ─────────────────────────────────────────────────────────
+
+	struct embedded_resource
+	{
+		std::string_view name;
+		std::string_view text;
+	};
+
+	// Defined in the source file CMake generates from the EMBED list.
+	std::span<const embedded_resource> embedded_resources();
+	std::string_view embedded_resource_text(std::string_view name);
+
+	// ── Fonts ─────────────────────────────────────────────────────────────
+
+	using font_handle = uintptr_t;
+
+	// The built-in metrics stand in for installed fonts, so font_def::face may
+	// be a whole CSS family list; the first family known here is used.
+#define PF_FONT_FACE_LIST 1
+	// Faces never move once created, so text is measured from any thread.
+#define PF_CONCURRENT_TEXT 1
+
+	struct font_def
+	{
+		std::string face;
+		int size = 0;
+		int weight = 400;
+		bool italic = false;
+		bool underline = false;
+		bool strikeout = false;
+	};
+
+	struct font_metrics_data
+	{
+		int height = 0;
+		int ascent = 0;
+		int descent = 0;
+		int x_height = 0;
+	};
+
+	// Faces map to one of three built-in metric sets: sans (Helvetica
+	// advances), serif (Times) or monospace. Handles live until exit,
+	// and measuring is safe from any thread.
+	font_handle create_font_handle(const font_def& def, font_metrics_data* metrics);
+	void delete_font_handle(font_handle font);
+	isize measure_text_with_font(font_handle font, std::string_view text);
+
+	// The headless build never paints; the renderer still compiles against
+	// this, and every call is a no-op.
+	class draw_context
+	{
+	public:
+		void set_clip_rect(const irect&)
+		{
+		}
+
+		void clear_clip_rect()
+		{
+		}
+
+		void fill_solid_rect(const irect&, color_t)
+		{
+		}
+
+		void fill_solid_rect(int, int, int, int, color_t)
+		{
+		}
+
+		void draw_bitmap(const irect&, const bitmap&)
+		{
+		}
+
+		void draw_text_h(int, int, const char*, font_handle, color_t)
+		{
+		}
+
+		void draw_ellipse(int, int, int, int, color_t, int)
+		{
+		}
+
+		void fill_ellipse(int, int, int, int, color_t)
+		{
+		}
+	};
+
+	// ── Network ───────────────────────────────────────────────────────────
+
+	struct async_http_callbacks
+	{
+		std::function<void(int status_code, std::string content_type, uint64_t content_length)> on_headers;
+		std::function<void(const uint8_t* data, size_t size)> on_data;
+		std::function<void()> on_complete;
+		std::function<void(std::string error)> on_error;
+	};
+
+	struct async_http_request
+	{
+		virtual ~async_http_request() = default;
+		virtual void cancel() = 0;
+	};
+
+	using async_http_request_ptr = std::shared_ptr<async_http_request>;
+
+	struct async_http_session
+	{
+		virtual ~async_http_session() = default;
+		virtual async_http_request_ptr get(std::string_view url, async_http_callbacks callbacks) = 0;
+		virtual void stop() = 0;
+	};
+
+	using async_http_session_ptr = std::shared_ptr<async_http_session>;
+
+	// Always null: the headless build has no network, and the engine treats a
+	// missing session as every fetch failing.
+	async_http_session_ptr create_async_http_session(std::string_view user_agent);
+}
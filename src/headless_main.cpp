@@ -0,0 +1,44 @@
+// headless_main.cpp - Entry point for potato-headless: the browser's command
+// line without a window, for GCC and Clang builds and CI.
+
+#include "pch.h"
+#include "headless.h"
+
+namespace
+{
+	constexpr std::string_view usage =
+		"usage: potato-headless --layout:<file> [--width:N] [--repeat:N] [--verbose] [--dump[:N]] [--dump-json]\n"
+		"                       [--profile-selectors[:N]] [--flame:<file>] [--alloc-stats] [--counters]\n"
+		"                       [--mem] [--trace:<file>]\n"
+		"       potato-headless --serve [--compare] [--jobs:N] [--width:N] < requests.jsonl\n"
+		"       potato-headless --bench:<dir> [--warmup:N] [--runs:N] [--baseline:<file>] [--threshold:N]\n"
+		"                       [--bench-out:<file>] [--width:N] [--counters] [--jobs:N]\n"
+		"       potato-headless --bench-lookups | --bench-parse | --bench-select[:<file>] | --bench-decode\n"
+		"       potato-headless --test\n"
+		"exit codes: 10 a unit test failed; 11 a page could not be read or laid out; 12 a layout came out empty;\n"
+		"            14 a --bench: stage regressed past --threshold; 15 --bench: found no pages;\n"
+		"            16 options that cannot be combined\n";
+}
+
+int main(const int argc, char* argv[])
+{
+	std::vector<std::string_view> params;
+	for (auto i = 1; i < argc; ++i) params.emplace_back(argv[i]);
+
+	const auto cl = parse_command_line(params);
+
+	// No network here, so --test is the unit tests alone.
+	if (cl.command == "--test") return run_unit_tests();
+
+	int exit_code = 0;
+	if (run_headless(cl, exit_code)) return exit_code;
+
+	pf::write_stdout(usage);
+	return 2;
+}
+
+// There is no message loop, so work posted back to the UI thread never runs;
+// the browser's --layout: runs drop it the same way by exiting first.
+void dispatch_to_ui(std::function<void()>)
+{
+}
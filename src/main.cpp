@@ -6,6 +6,7 @@
 #include "pch.h"
 #include "platform.h"
 #include "document.h"
+#include "headless.h"
 #include "style.h"
 
 namespace
@@ -71,17 +72,45 @@ namespace
 			_on_resource_finished = std::move(f);
 		}
 
-		void load_html(const std::string& url, const std::string& html, const std::string& content_type = {})
+		void load_html(const std::string& url, std::string html, const std::string& content_type = {})
 		{
 			_last_layout_width = 0;
 			_scroll_y = 0;
 			_content_height = 0;
+			if (_doc) _doc->cancel_loads();
 			_doc.reset();
 			if (!html.empty())
-				_doc = document::create_from_bytes(*this, url, html, content_type);
+				_doc = document::create_from_bytes(*this, url, std::move(html), content_type);
 			if (_frame) _frame->invalidate();
 		}
 
+		// Incremental load: the page is parsed and styled as its bytes land,
+		// so the top of a long document shows before the last byte arrives.
+		void begin_html(const std::string& url, const std::string& content_type)
+		{
+			_last_layout_width = 0;
+			_scroll_y = 0;
+			_content_height = 0;
+			if (_doc) _doc->cancel_loads();
+			_doc = document::begin_stream(*this, url, content_type);
+			if (_frame) _frame->invalidate();
+		}
+
+		void append_html(const std::string_view bytes)
+		{
+			if (_doc) _doc->append_bytes(bytes);
+		}
+
+		void finish_html()
+		{
+			if (_doc) _doc->finish_stream();
+		}
+
+		std::string memory_report()
+		{
+			return _doc ? _doc->measure_memory().report() : std::string("Memory: no document\n");
+		}
+
 		// ── view_host ──
 		void layout() override
 		{
@@ -94,6 +123,13 @@ namespace
 			if (_frame) _frame->invalidate();
 		}
 
+		void invalidate_box(const position& b) override
+		{
+			if (_frame)
+				_frame->invalidate_rect(pf::irect(b.x, b.y - _scroll_y,
+				                                  b.x + b.width, b.y - _scroll_y + b.height));
+		}
+
 		void open(const std::string& url) override
 		{
 			if (_on_open) _on_open(url);
@@ -104,6 +140,11 @@ namespace
 			if (_on_diagnostic) _on_diagnostic(message);
 		}
 
+		bool diagnostics_on() const override
+		{
+			return static_cast<bool>(_on_diagnostic);
+		}
+
 		void resource_started(const std::string& type, const std::string& url) override
 		{
 			if (_on_resource_started) _on_resource_started(type, url);
@@ -424,11 +465,15 @@ namespace
 		pf::async_http_request_ptr _pending;
 		std::string _current_url;
 		uint64_t _load_token = 0;
+		size_t _streamed_bytes = 0; // body bytes of the current navigation so far
 		std::string _startup_url;
 		std::string _eval_url;
 		bool _eval_page_loaded = false;
 		int _eval_pending_resources = 0;
 		int _eval_failed_resources = 0;
+		int _eval_pending_stylesheets = 0;
+		int _eval_loaded_stylesheets = 0;
+		bool _eval_memory = false; // print the document's footprint when done
 		std::chrono::steady_clock::time_point _eval_started;
 		std::chrono::steady_clock::time_point _eval_last_activity;
 
@@ -579,6 +624,7 @@ namespace
 				_pending.reset();
 			}
 			++_load_token;
+			_streamed_bytes = 0;
 
 			if (url == "res://test.htm" || url == "about:blank")
 			{
@@ -604,7 +650,6 @@ namespace
 
 				const uint64_t token = _load_token;
 				std::weak_ptr<main_frame_reactor> weak_self = shared_from_this();
-				auto body = std::make_shared<std::string>();
 				auto type = std::make_shared<std::string>();
 
 				pf::async_http_callbacks cb;
@@ -622,16 +667,23 @@ namespace
 								status, content_type, content_length, url));
 					});
 				};
-				cb.on_data = [body](const uint8_t* data, const size_t size)
+				// Each piece is parsed on the UI thread as it lands. Headers
+				// are queued first, so the content type is known by then.
+				cb.on_data = [weak_self, type, url, token](const uint8_t* data, const size_t size)
 				{
-					body->append(reinterpret_cast<const char*>(data), size);
+					pf::run_ui([weak_self, type, url, token,
+						bytes = std::string(reinterpret_cast<const char*>(data), size)]
+					{
+						if (const auto self = weak_self.lock())
+							self->on_download_data(token, url, bytes, *type);
+					});
 				};
-				cb.on_complete = [weak_self, body, type, url, token]
+				cb.on_complete = [weak_self, url, token]
 				{
-					pf::run_ui([weak_self, body, type, url, token]
+					pf::run_ui([weak_self, url, token]
 					{
 						if (const auto self = weak_self.lock())
-							self->on_download_complete(token, url, *body, *type, {});
+							self->on_download_complete(token, url, {});
 					});
 				};
 				cb.on_error = [weak_self, url, token](std::string err)
@@ -639,7 +691,7 @@ namespace
 					pf::run_ui([weak_self, url, token, err = std::move(err)]
 					{
 						if (const auto self = weak_self.lock())
-							self->on_download_complete(token, url, {}, {}, err);
+							self->on_download_complete(token, url, err);
 					});
 				};
 
@@ -649,9 +701,23 @@ namespace
 			// Unknown scheme: keep the current page rather than blanking it.
 		}
 
-		void on_download_complete(const uint64_t token, const std::string& url,
-		                          const std::string& body, const std::string& content_type,
-		                          const std::string& error)
+		void on_download_data(const uint64_t token, const std::string& url, const std::string& bytes,
+		                      const std::string& content_type)
+		{
+			// Stale response (newer navigation issued).
+			if (token != _load_token || !_content_reactor || bytes.empty()) return;
+
+			if (_streamed_bytes == 0)
+			{
+				_current_url = url;
+				_content_reactor->begin_html(url, content_type);
+			}
+
+			_streamed_bytes += bytes.size();
+			_content_reactor->append_html(bytes);
+		}
+
+		void on_download_complete(const uint64_t token, const std::string& url, const std::string& error)
 		{
 			// Stale response (newer navigation issued).
 			if (token != _load_token) return;
@@ -659,7 +725,10 @@ namespace
 
 			if (!_content_reactor) return;
 
-			if (!error.empty() || body.empty())
+			const auto received = _streamed_bytes;
+			_streamed_bytes = 0;
+
+			if (received == 0)
 			{
 				eval_log(std::format("Navigation failed: {}: {}", url,
 				                     error.empty() ? "empty response" : error));
@@ -671,9 +740,13 @@ namespace
 				return;
 			}
 
-			_current_url = url;
-			eval_log(std::format("Navigation downloaded: {} bytes: {}", body.size(), url));
-			_content_reactor->load_html(url, body, content_type);
+			// A connection that drops part way still shows what did arrive.
+			if (!error.empty())
+				eval_log(std::format("Navigation interrupted after {} bytes: {}: {}", received, url, error));
+			else
+				eval_log(std::format("Navigation downloaded: {} bytes: {}", received, url));
+
+			_content_reactor->finish_html();
 			_eval_page_loaded = true;
 		}
 
@@ -784,6 +857,7 @@ namespace
 				[this](const std::string& type, const std::string& url)
 				{
 					++_eval_pending_resources;
+					if (type == "stylesheet") ++_eval_pending_stylesheets;
 					eval_log(std::format("{} request: {}", type, url));
 				});
 			_content_reactor->set_on_resource_finished(
@@ -792,6 +866,16 @@ namespace
 					_eval_pending_resources = std::max(0, _eval_pending_resources - 1);
 					if (!success) ++_eval_failed_resources;
 					eval_log(std::format("{} {}: {}", type, success ? "loaded" : "failed", url));
+
+					if (type == "stylesheet")
+					{
+						if (success) ++_eval_loaded_stylesheets;
+						_eval_pending_stylesheets = std::max(0, _eval_pending_stylesheets - 1);
+						if (_eval_pending_stylesheets == 0)
+						{
+							eval_log(std::format("All stylesheets landed: {} loaded", _eval_loaded_stylesheets));
+						}
+					}
 				});
 			_content->set_reactor(_content_reactor);
 			main_frame->accept_drop_files(true);
@@ -815,9 +899,11 @@ namespace
 		}
 
 	public:
-		explicit main_frame_reactor(std::string startup_url = {}, const bool evaluate = false)
+		explicit main_frame_reactor(std::string startup_url = {}, const bool evaluate = false,
+		                            const bool eval_memory = false)
 			: _startup_url(std::move(startup_url)),
-			  _eval_url(evaluate ? _startup_url : std::string())
+			  _eval_url(evaluate ? _startup_url : std::string()),
+			  _eval_memory(eval_memory)
 		{
 			_eval_started = std::chrono::steady_clock::now();
 			_eval_last_activity = _eval_started;
@@ -859,6 +945,8 @@ namespace
 					                     _eval_pending_resources, _eval_failed_resources,
 					                     elapsed >= std::chrono::seconds(60)));
 					frame->kill_timer(k_eval_timer);
+					if (_eval_memory && _content_reactor) pf::write_stdout(_content_reactor->memory_report());
+					trace::finish();
 					frame->close();
 				}
 				return 0;
@@ -909,66 +997,8 @@ namespace
 
 // ── App entry points ──────────────────────────────────────────────────────
 
-// Defined in core.cpp — runs the registered in-process unit tests and
-// returns an HTML report. Failed cases contain the substring "FAILED".
-extern std::string run_tests();
-
 namespace
 {
-	// Headless layout of a local HTML file. No window and no message loop, so
-	// no async resource can ever land and the result is repeatable. Prints
-	// "<file>: <w>x<h>" plus stage timings, structure and layout anomalies.
-	int run_layout(const std::string& path, const int width, const int height, const int repeats,
-	               const bool verbose, const int dump_depth, const bool dump_json)
-	{
-		const auto html = get_file_contents(path);
-
-		if (html.empty())
-		{
-			pf::write_stdout(std::format("Layout: cannot read {}\n", path));
-			return 11;
-		}
-
-		layout_result r;
-
-		for (auto i = 0; i < std::max(1, repeats); ++i)
-		{
-			r = layout_html_headless(html, width, height, dump_json ? false : verbose, dump_depth, dump_json);
-			if (!dump_json)
-				pf::write_stdout(std::format("{}: {}x{} (parse+style {} us, layout {} us)\n",
-				                             path, r.width, r.height, r.parse_style_us, r.layout_us));
-		}
-
-		if (dump_json)
-		{
-			pf::write_stdout(r.layout_json + "\n");
-			return r.height > 0 ? 0 : 12;
-		}
-
-		const auto& s = r.stats;
-		pf::write_stdout(std::format(
-			"  nodes: {} elements, {} text, {} images, depth {}; right edge {}, {} hidden subtrees\n",
-			s.elements, s.text_nodes, s.images, s.max_depth, s.right_edge, s.hidden_subtrees));
-		const auto anomalies = s.overflow_x + s.negative_x + s.zero_area_text + s.unsized_image + s.negative_size;
-
-		if (anomalies)
-		{
-			pf::write_stdout(std::format(
-				"  anomalies: {} overflow-x, {} negative-x, {} zero-height-text, {} unsized-image, {} negative-size\n",
-				s.overflow_x, s.negative_x, s.zero_area_text, s.unsized_image, s.negative_size));
-
-			for (const auto& a : r.anomalies) pf::write_stdout("    " + a + "\n");
-		}
-		else
-		{
-			pf::write_stdout("  anomalies: none\n");
-		}
-
-		for (const auto& line : r.box_dump) pf::write_stdout(line + "\n");
-
-		return r.height > 0 ? 0 : 12;
-	}
-
 	// Combined self-test:
 	//   1. Runs the in-process unit tests (run_tests() from core.cpp) and
 	//      writes the HTML report to a temp file.
@@ -977,22 +1007,8 @@ namespace
 	// Prints progress to stdout. Returns 0 on success, non-zero on failure.
 	int run_self_test()
 	{
-		int result = 0;
-
 		// 1. Unit tests
-		pf::write_stdout("Potato self-test: running unit tests ...\n");
-		const auto report = run_tests();
-		const auto report_path = pf::platform_temp_file_path("potato_tests_");
-		if (const auto out = pf::open_file_for_write(pf::file_path{report_path}))
-		{
-			out->write(reinterpret_cast<const uint8_t*>(report.data()),
-			           static_cast<uint32_t>(report.size()));
-		}
-		const bool unit_failed = report.find("FAILED") != std::string::npos;
-		pf::write_stdout(std::format(
-			"Unit tests: {} (report: {})\n",
-			unit_failed ? "FAIL" : "PASS", report_path));
-		if (unit_failed) result = 10;
+		int result = run_unit_tests();
 
 		// 2. Network fetch — exercise the same async HTTP path the browser
 		//    uses to load pages, stylesheets and images. We block the calling
@@ -1121,77 +1137,33 @@ app_init_result app_init(const pf::window_frame_ptr& main_frame,
 	r.start_gui = true;
 	r.exit_code = 0;
 
-	std::string eval_url;
-	std::string startup_url;
-	std::string layout_path;
-	int layout_width = 1902;
-	int layout_repeats = 1;
-	bool layout_verbose = false;
-	int layout_dump = 0;
-	bool layout_dump_json = false;
+	auto cl = parse_command_line(params);
 
-	for (const auto& p : params)
+	if (cl.command == "--test")
 	{
-		if (p == "/test" || p == "--test" || p == "-test")
-		{
-			r.start_gui = false;
-			r.exit_code = run_self_test();
-			return r;
-		}
-		if (p.starts_with("/layout:") || p.starts_with("--layout:"))
-		{
-			layout_path = p.substr(p.find(':') + 1);
-		}
-		else if (p == "--verbose" || p == "-v")
-		{
-			layout_verbose = true;
-		}
-		else if (p.starts_with("--width:"))
-		{
-			layout_width = safe_stoi(std::string(p.substr(p.find(':') + 1)), layout_width);
-		}
-		else if (p.starts_with("--repeat:"))
-		{
-			layout_repeats = safe_stoi(std::string(p.substr(p.find(':') + 1)), 1);
-		}
-		else if (p == "--dump")
-		{
-			layout_dump = 64;
-		}
-		else if (p.starts_with("--dump:"))
-		{
-			layout_dump = safe_stoi(std::string(p.substr(p.find(':') + 1)), 64);
-		}
-		else if (p == "--dump-json")
-		{
-			layout_dump_json = true;
-		}
-		else if (p.starts_with("/eval:") || p.starts_with("--eval:"))
-		{
-			const auto separator = p.find(':');
-			eval_url = p.substr(separator + 1);
-		}
-		else if (!p.starts_with("-") && !p.starts_with("/") && startup_url.empty())
-		{
-			startup_url = p;
-		}
+		r.start_gui = false;
+		r.exit_code = run_self_test();
+		return r;
 	}
 
-	if (!layout_path.empty())
+	if (run_headless(cl, r.exit_code))
 	{
 		r.start_gui = false;
-		r.exit_code = run_layout(layout_path, layout_width, 896, layout_repeats, layout_verbose, layout_dump,
-		                         layout_dump_json);
 		return r;
 	}
 
+	// An evaluation writes the trace when it completes, or on exit if the
+	// window is closed first.
+	if (!cl.trace_path.empty() && !cl.eval_url.empty()) trace::start(cl.trace_path);
+
 	if (main_frame)
 	{
 		// Evaluation runs are automated, so keep their window off the desktop.
-		r.offscreen_gui = !eval_url.empty();
+		r.offscreen_gui = !cl.eval_url.empty();
 		main_frame->set_text("Potato");
-		if (!eval_url.empty()) startup_url = eval_url;
-		const auto reactor = std::make_shared<main_frame_reactor>(std::move(startup_url), !eval_url.empty());
+		if (!cl.eval_url.empty()) cl.startup_url = cl.eval_url;
+		const auto reactor = std::make_shared<main_frame_reactor>(std::move(cl.startup_url), !cl.eval_url.empty(),
+		                                                                cl.eval_memory);
 		reactor->attach(main_frame);
 		main_frame->set_reactor(reactor);
 	}
@@ -1205,6 +1177,7 @@ void app_idle()
 
 void app_destroy()
 {
+	trace::finish();
 }
 
 // Portable UI dispatch entry point declared in core.h. Forwards to the
@@ -9,20 +9,31 @@
 
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
 #include <cstring>
 #include <deque>
+#include <filesystem>
 #include <format>
 #include <fstream>
 #include <functional>
 #include <map>
 #include <memory>
 #include <mutex>
+#include <numeric>
 #include <set>
+#include <shared_mutex>
+#include <span>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "platform.h"
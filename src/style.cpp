@@ -6,31 +6,6 @@
 #include "document.h"
 
 
-auto prop_id_strings =
-	"-potato-border-spacing-x;-potato-border-spacing-y;align-items;align-self;"
-	"background-attachment;background-clip;background-color;background-image;"
-	"background-image-baseurl;background-origin;background-position;background-repeat;"
-	"background-size;border-bottom-color;border-bottom-left-radius-x;border-bottom-left-radius-y;"
-	"border-bottom-right-radius-x;border-bottom-right-radius-y;border-bottom-style;border-bottom-width;"
-	"border-collapse;border-left-color;border-left-style;border-left-width;"
-	"border-radius-x;border-radius-y;border-right-color;border-right-style;"
-	"border-right-width;border-spacing;border-top-color;border-top-left-radius-x;"
-	"border-top-left-radius-y;border-top-right-radius-x;border-top-right-radius-y;border-top-style;"
-	"border-top-width;border-width;bottom;box-sizing;"
-	"clear;color;content;cursor;"
-	"display;flex-basis;flex-direction;flex-grow;"
-	"flex-shrink;flex-wrap;float;font-family;"
-	"font-size;font-style;font-variant;font-weight;"
-	"gap;height;justify-content;left;"
-	"line-height;list-style-image;list-style-image-baseurl;list-style-position;"
-	"list-style-type;margin-bottom;margin-left;margin-right;"
-	"margin-top;max-height;max-width;min-height;"
-	"min-width;overflow;padding-bottom;padding-left;"
-	"padding-right;padding-top;position;right;"
-	"text-align;text-decoration;text-indent;text-transform;"
-	"top;vertical-align;visibility;white-space;"
-	"width;z-index";
-
 prop_id prop_from_name(const std::string_view name)
 {
 	const auto i = value_index(name, prop_id_strings);
@@ -61,7 +36,7 @@ std::string_view style::get_custom_property(const std::string_view name) const
 
 static void should_map_every_property_id()
 {
-	const auto names = split_string(prop_id_strings, ';');
+	const auto names = split_string(prop_id_strings.c_str(), ';');
 	should::equal(static_cast<int>(prop_id::count), static_cast<int>(names.size()), "prop_id table size");
 
 	for (size_t i = 0; i < names.size(); ++i)
@@ -124,6 +99,14 @@ void style::parse_property(const std::string& name, const std::string& val, cons
 	}
 }
 
+size_t style::heap_bytes() const
+{
+	size_t bytes = m_props.capacity() * sizeof(entry) + m_custom.capacity() * sizeof(m_custom[0]);
+	for (const auto& e : m_props) bytes += ::heap_bytes(e.value);
+	for (const auto& [name, value] : m_custom) bytes += ::heap_bytes(name) + ::heap_bytes(value);
+	return bytes;
+}
+
 void style::combine(const style& src)
 {
 	for (const auto& e : src.m_props)
@@ -947,6 +930,69 @@ bool media_query_list::apply_media_features(const media_features& features)
 	return ret;
 }
 
+void media_breakpoints::sort()
+{
+	for (auto* v : {&widths, &heights})
+	{
+		std::ranges::sort(*v);
+		v->erase(std::unique(v->begin(), v->end()), v->end());
+	}
+}
+
+void media_query_list::add_breakpoints(media_breakpoints& points) const
+{
+	for (const auto& q : m_queries)
+	{
+		q->add_breakpoints(points);
+	}
+}
+
+void media_query::add_breakpoints(media_breakpoints& points) const
+{
+	for (const auto& e : m_expressions)
+	{
+		e.add_breakpoints(points);
+	}
+}
+
+// min-width:v turns true at v, max-width:v turns false at v + 1, and width:v
+// is true only between the two. Device and colour features do not follow the
+// viewport.
+void media_query_expression::add_breakpoints(media_breakpoints& points) const
+{
+	switch (feature)
+	{
+	case media_feature_width:
+		points.widths.push_back(check_as_bool ? 1 : val);
+		if (!check_as_bool) points.widths.push_back(val + 1);
+		break;
+	case media_feature_min_width:
+		points.widths.push_back(val);
+		break;
+	case media_feature_max_width:
+		points.widths.push_back(val + 1);
+		break;
+	case media_feature_height:
+		points.heights.push_back(check_as_bool ? 1 : val);
+		if (!check_as_bool) points.heights.push_back(val + 1);
+		break;
+	case media_feature_min_height:
+		points.heights.push_back(val);
+		break;
+	case media_feature_max_height:
+		points.heights.push_back(val + 1);
+		break;
+	case media_feature_orientation:
+	case media_feature_aspect_ratio:
+	case media_feature_min_aspect_ratio:
+	case media_feature_max_aspect_ratio:
+		points.any_resize = true;
+		break;
+	default:
+		break;
+	}
+}
+
 bool media_query_expression::check(const media_features& features) const
 {
 	switch (feature)
@@ -1400,6 +1446,113 @@ void css_element_selector::parse(const std::string& text)
 
 		el_end = text.find_first_of(".#[:", el_end);
 	}
+
+	compile();
+}
+
+// Parses the An+B microsyntax: "odd", "even", "3", "n", "2n", "-n+3", "2n + 1".
+static void parse_nth_child_params(const std::string& param, int& num, int& off)
+{
+	num = 0;
+	off = 0;
+
+	std::string s;
+	for (const auto c : param)
+	{
+		if (!is_space_char(c)) s += static_cast<char>(tolower(static_cast<unsigned char>(c)));
+	}
+
+	if (s == "odd")
+	{
+		num = 2;
+		off = 1;
+		return;
+	}
+	if (s == "even")
+	{
+		num = 2;
+		return;
+	}
+
+	const auto n = s.find('n');
+
+	if (n == std::string::npos)
+	{
+		off = safe_stoi(s);
+		return;
+	}
+
+	const auto a = s.substr(0, n);
+	num = a.empty() || a == "+" ? 1 : a == "-" ? -1 : safe_stoi(a);
+	off = safe_stoi(s.substr(n + 1));
+}
+
+void css_element_selector::compile()
+{
+	m_any_tag = m_tag.empty() || m_tag == "*";
+	m_dynamic = false;
+
+	for (auto& sa : m_attrs)
+	{
+		switch (sa.condition)
+		{
+		case select_pseudo_element:
+			sa.pseudo_element = sa.val == "after" ? select_match_with_after
+				                    : sa.val == "before" ? select_match_with_before : 0;
+			break;
+
+		case select_pseudo_class:
+			{
+				std::string name = sa.val;
+				std::string param;
+				const auto begin = sa.val.find('(');
+
+				if (begin != std::string::npos)
+				{
+					const auto end = find_close_bracket(sa.val, begin);
+					if (end != std::string::npos) param = sa.val.substr(begin + 1, end - begin - 1);
+					name = sa.val.substr(0, begin);
+					trim(name);
+				}
+
+				sa.pseudo = value_index(name, pseudo_class_strings);
+
+				switch (sa.pseudo)
+				{
+				case pseudo_class_nth_child:
+				case pseudo_class_nth_of_type:
+				case pseudo_class_nth_last_child:
+				case pseudo_class_nth_last_of_type:
+					parse_nth_child_params(param, sa.nth_num, sa.nth_off);
+					break;
+				case pseudo_class_not:
+					{
+						auto negated = std::make_shared<css_element_selector>();
+						negated->parse(param);
+						m_dynamic |= negated->m_dynamic;
+						sa.negated = std::move(negated);
+					}
+					break;
+				case -1:
+					m_dynamic = true;
+					break;
+				default:
+					break;
+				}
+			}
+			break;
+
+		default:
+			sa.atom = attr_atom(sa.attribute);
+
+			// The class list test wants every class, each a whole token.
+			if (sa.condition == select_equal && sa.attribute == "class")
+			{
+				for (auto& c : split_string(sa.val)) if (!c.empty()) sa.classes.push_back(std::move(c));
+			}
+			break;
+		}
+	}
 }
 
 
@@ -1458,7 +1611,7 @@ bool css_selector::parse(const std::string& text)
 
 	if (!left.empty())
 	{
-		m_left = std::make_shared<css_selector>(nullptr, std::shared_ptr<media_query_list>());
+		m_left = std::make_unique<css_selector>(nullptr, std::shared_ptr<media_query_list>());
 
 		if (!m_left->parse(trim_lower(left)))
 		{
@@ -1469,6 +1622,47 @@ bool css_selector::parse(const std::string& text)
 	return true;
 }
 
+std::string css_element_selector::to_string() const
+{
+	std::string result = m_tag;
+
+	for (const auto& a : m_attrs)
+	{
+		if (a.condition == select_pseudo_class || a.condition == select_pseudo_element)
+		{
+			// ::before parses as "pseudo-el", the legacy :before as "pseudo".
+			result += a.attribute == "pseudo-el" ? "::" : ":";
+			result += a.val;
+		}
+		else if (a.condition == select_equal && a.attribute == "class")
+		{
+			result += '.' + a.val;
+		}
+		else if (a.condition == select_equal && a.attribute == "id")
+		{
+			result += '#' + a.val;
+		}
+		else
+		{
+			// |= and ^= compile alike, as do ~= and *=.
+			static constexpr const char* ops[] = {"", "=", "*=", "^=", "$="};
+			result += '[' + a.attribute;
+			if (a.condition != select_exists) result += std::format("{}\"{}\"", ops[a.condition], a.val);
+			result += ']';
+		}
+	}
+
+	return result.empty() ? "*" : result;
+}
+
+std::string css_selector::to_string() const
+{
+	if (!m_left) return m_right.to_string();
+
+	static constexpr const char* combinators[] = {" ", " > ", " + ", " ~ "};
+	return m_left->to_string() + combinators[m_combinator] + m_right.to_string();
+}
+
 void css_selector::calc_specificity()
 {
 	if (!m_right.m_tag.empty() && m_right.m_tag != "*")
@@ -1513,8 +1707,15 @@ void css_selector::add_media_to_doc(const std::shared_ptr<document>& doc) const
 }
 
 void css::parse_stylesheet(const std::string& str, const std::string& baseurl, document& doc,
-                           std::shared_ptr<media_query_list>& media)
+                           std::shared_ptr<media_query_list>& media, const std::string_view sheet)
 {
+	if (!sheet.empty())
+	{
+		const auto found = std::ranges::find(m_sheets, sheet);
+		m_sheet = static_cast<uint32_t>(found - m_sheets.begin());
+		if (found == m_sheets.end()) m_sheets.emplace_back(sheet);
+	}
+
 	std::string text = str;
 
 	// remove comments
@@ -1592,6 +1793,30 @@ void css::parse_stylesheet(const std::string& str, const std::string& baseurl, d
 	}
 }
 
+std::vector<std::shared_ptr<media_query_list>> css::own_media_lists()
+{
+	std::vector<std::shared_ptr<media_query_list>> copies;
+	std::vector<const media_query_list*> originals;
+
+	for (auto& sel : m_selectors)
+	{
+		if (!sel.m_media_query) continue;
+
+		const auto found = std::ranges::find(originals, sel.m_media_query.get());
+		const auto i = static_cast<size_t>(found - originals.begin());
+
+		if (found == originals.end())
+		{
+			originals.push_back(sel.m_media_query.get());
+			copies.push_back(std::make_shared<media_query_list>(*sel.m_media_query));
+		}
+
+		sel.m_media_query = copies[i];
+	}
+
+	return copies;
+}
+
 std::string css::parse_css_url(const std::string& str)
 {
 	std::string result;
@@ -1628,22 +1853,16 @@ void css::parse_selectors(const std::string& text, const std::shared_ptr<style>&
 
 	for (auto tok : tokens)
 	{
-		auto selector = std::make_shared<css_selector>(styles, media);
+		css_selector selector(styles, media);
 
-		if (selector->parse(tok))
+		if (selector.parse(tok))
 		{
-			selector->calc_specificity();
-			add_selector(selector);
+			selector.calc_specificity();
+			add_selector(std::move(selector));
 		}
 	}
 }
 
-void css::sort_selectors()
-{
-	sort(m_selectors.begin(), m_selectors.end(), std::less<std::shared_ptr<css_selector>>());
-	rebuild_buckets();
-}
-
 // Classify each selector by the most specific part of its rightmost compound.
 // Priority: id > class > tag > universal. A class-keyed selector may require
 // multiple classes (e.g. ".foo.bar"); we register it in every matching bucket so
@@ -1694,32 +1913,244 @@ static selector_key compute_selector_key(const css_selector& sel)
 	return key;
 }
 
-void css::rebuild_buckets()
+void page_names::add(std::unordered_set<std::string, string_hash, std::equal_to<>>& set,
+                     const std::unordered_set<std::string, string_hash, std::equal_to<>>& wanted,
+                     const std::string_view name)
+{
+	if (name.empty()) return;
+
+	std::string lower(name);
+	for (auto& ch : lower) ch = static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+	if (wanted.contains(lower) && set.insert(lower).second) changed = true;
+	else set.insert(std::move(lower));
+}
+
+void page_names::add_classes(const std::string_view list)
+{
+	for (size_t start = 0; start < list.size();)
+	{
+		start = list.find_first_not_of(" \t\r\n\f", start);
+		if (start == std::string_view::npos) break;
+		auto end = list.find_first_of(" \t\r\n\f", start);
+		if (end == std::string_view::npos) end = list.size();
+		add(classes, wanted_classes, list.substr(start, end - start));
+		start = end;
+	}
+}
+
+// Every compound of the selector has to match some element, so one that needs
+// a tag, id or class absent from the page rules the whole selector out. The
+// first such name is noted as wanted: until it arrives, nothing can change.
+static bool can_match(const css_selector& sel, page_names& present)
+{
+	for (auto s = &sel; s; s = s->m_left.get())
+	{
+		const auto& right = s->m_right;
+		if (!right.m_any_tag && !present.tags.contains(right.m_tag))
+		{
+			present.wanted_tags.insert(right.m_tag);
+			return false;
+		}
+
+		for (const auto& a : right.m_attrs)
+		{
+			if (a.condition != select_equal) continue;
+			if (a.attribute == "id" && !present.ids.contains(a.val))
+			{
+				present.wanted_ids.insert(a.val);
+				return false;
+			}
+
+			for (const auto& c : a.classes)
+			{
+				if (!present.classes.contains(c))
+				{
+					present.wanted_classes.insert(c);
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+prune_stats css::sort_selectors(page_names* present, const bool measure_buckets)
+{
+	if (present)
+	{
+		present->wanted_tags.clear();
+		present->wanted_ids.clear();
+		present->wanted_classes.clear();
+	}
+
+	std::vector<uint32_t> live;
+	live.reserve(m_selectors.size());
+	for (uint32_t i = 0; i < m_selectors.size(); ++i)
+	{
+		m_selectors[i].m_key = compute_selector_key(m_selectors[i]);
+		if (!present || can_match(m_selectors[i], *present)) live.push_back(i);
+	}
+
+	// The arena keeps parse order; only the ranks move.
+	std::ranges::sort(live, [this](const uint32_t a, const uint32_t b) { return m_selectors[a] < m_selectors[b]; });
+
+	m_rank.assign(m_selectors.size(), UINT32_MAX);
+	for (uint32_t r = 0; r < live.size(); ++r) m_rank[live[r]] = r;
+
+	rebuild_buckets(live);
+
+	// Estimate the index as list entries plus one map node and key per bucket.
+	const auto bucket_bytes = [](const size_t entries, const size_t buckets, const size_t key_chars)
+	{
+		constexpr size_t node = sizeof(std::string) + sizeof(selector_list) + 2 * sizeof(void*);
+		return entries * sizeof(uint32_t) + buckets * node + key_chars;
+	};
+
+	const auto measure = [&](const auto& selectors_in) -> size_t
+	{
+		std::set<std::string_view> keys;
+		size_t entries = 0;
+		size_t chars = 0;
+		for (const auto i : selectors_in)
+		{
+			for (const auto& v : m_selectors[i].m_key.values)
+			{
+				++entries;
+				if (keys.insert(v).second) chars += v.size();
+			}
+			if (m_selectors[i].m_key.values.empty()) ++entries;
+		}
+		return bucket_bytes(entries, keys.size(), chars);
+	};
+
+	prune_stats stats;
+	stats.kept = live.size();
+	stats.dropped = m_selectors.size() - live.size();
+	if (present && measure_buckets)
+	{
+		std::vector<uint32_t> all(m_selectors.size());
+		std::iota(all.begin(), all.end(), 0u);
+		stats.bucket_bytes = measure(live);
+		stats.unpruned_bucket_bytes = measure(all);
+	}
+	return stats;
+}
+
+std::string css::profile_report(const size_t top) const
+{
+	std::vector<uint32_t> order;
+	selector_cost total;
+	for (uint32_t i = 0; i < m_cost.size(); ++i)
+	{
+		if (!m_cost[i].candidates) continue;
+		order.push_back(i);
+		total.candidates += m_cost[i].candidates;
+		total.matches += m_cost[i].matches;
+		total.ns += m_cost[i].ns;
+	}
+
+	const auto tried = order.size();
+	std::ranges::sort(order, [this](const uint32_t a, const uint32_t b) { return m_cost[a].ns > m_cost[b].ns; });
+	if (order.size() > top) order.resize(top);
+
+	static constexpr const char* kinds[] = {"id", "class", "tag", "universal"};
+
+	auto result = std::format("Selectors: {} tried, {} candidates, {} matches, {:.2f} ms in select\n",
+	                          tried,
+	                          total.candidates, total.matches, total.ns / 1e6);
+	result += std::format("  {:>8} {:>6} {:>10} {:>8} {:>6}  {:<9} {:<24} {}\n",
+	                      "ms", "share", "candidates", "matches", "ns/try", "bucket", "sheet", "selector");
+
+	for (const auto i : order)
+	{
+		const auto& c = m_cost[i];
+		const auto& sel = m_selectors[i];
+		const auto& sheet = sel.m_sheet < m_sheets.size() ? m_sheets[sel.m_sheet] : std::string();
+		result += std::format("  {:>8.3f} {:>5.1f}% {:>10} {:>8} {:>6}  {:<9} {:<24} {}\n",
+		                      c.ns / 1e6, total.ns ? 100.0 * c.ns / total.ns : 0.0, c.candidates, c.matches,
+		                      c.ns / c.candidates, kinds[sel.m_key.kind],
+		                      sheet.size() > 24 ? "..." + sheet.substr(sheet.size() - 21) : sheet, sel.to_string());
+	}
+
+	return result;
+}
+
+static size_t selector_heap_bytes(const css_element_selector& sel)
+{
+	size_t bytes = heap_bytes(sel.m_tag) + sel.m_attrs.capacity() * sizeof(css_attribute_selector);
+	for (const auto& a : sel.m_attrs)
+	{
+		bytes += heap_bytes(a.attribute) + heap_bytes(a.val) + a.classes.capacity() * sizeof(std::string);
+		for (const auto& c : a.classes) bytes += heap_bytes(c);
+		if (a.negated) bytes += sizeof(css_element_selector) + selector_heap_bytes(*a.negated);
+	}
+	return bytes;
+}
+
+void css::measure_memory(memory_use& selectors, memory_use& rules, memory_use& buckets) const
+{
+	std::unordered_set<const style*> blocks;
+	selectors.add(m_selectors.size(), m_selectors.capacity() * sizeof(css_selector) +
+	              m_rank.capacity() * sizeof(uint32_t) + m_cost.capacity() * sizeof(selector_cost));
+
+	for (const auto& sel : m_selectors)
+	{
+		size_t bytes = sel.m_key.values.capacity() * sizeof(std::string);
+		for (const auto& v : sel.m_key.values) bytes += heap_bytes(v);
+		// The compounds to the left are separate objects, one per combinator.
+		for (const auto* part = &sel; part; part = part->m_left.get())
+		{
+			if (part != &sel) bytes += sizeof(css_selector);
+			bytes += selector_heap_bytes(part->m_right);
+		}
+		selectors.bytes += bytes;
+
+		// A selector list such as "h1, h2" shares one declaration block.
+		if (sel.m_style && blocks.insert(sel.m_style.get()).second)
+		{
+			rules.add(1, sizeof(style) + sel.m_style->heap_bytes());
+		}
+	}
+
+	constexpr size_t node = sizeof(std::string) + sizeof(selector_list) + 2 * sizeof(void*);
+	for (const auto* map : {&m_by_id, &m_by_class, &m_by_tag})
+	{
+		for (const auto& [key, list] : *map)
+		{
+			buckets.add(1, node + heap_bytes(key) + list.capacity() * sizeof(uint32_t));
+		}
+		buckets.bytes += map->bucket_count() * sizeof(void*);
+	}
+	buckets.add(1, m_universal.capacity() * sizeof(uint32_t));
+}
+
+void css::rebuild_buckets(const std::vector<uint32_t>& live)
 {
 	m_by_id.clear();
 	m_by_class.clear();
 	m_by_tag.clear();
 	m_universal.clear();
 
-	for (const auto& sel : m_selectors)
+	// live is already in rank order, so every list comes out sorted.
+	for (const auto i : live)
 	{
-		sel->m_key = compute_selector_key(*sel);
-		switch (sel->m_key.kind)
+		const auto& sel = m_selectors[i];
+		switch (sel.m_key.kind)
 		{
 		case selector_key::bucket_id:
-			m_by_id[sel->m_key.values.front()].push_back(sel);
+			m_by_id[sel.m_key.values.front()].push_back(i);
 			break;
 		case selector_key::bucket_class:
-			for (const auto& c : sel->m_key.values)
+			for (const auto& c : sel.m_key.values)
 			{
-				m_by_class[c].push_back(sel);
+				m_by_class[c].push_back(i);
 			}
 			break;
 		case selector_key::bucket_tag:
-			m_by_tag[sel->m_key.values.front()].push_back(sel);
+			m_by_tag[sel.m_key.values.front()].push_back(i);
 			break;
 		case selector_key::bucket_universal:
-			m_universal.push_back(sel);
+			m_universal.push_back(i);
 			break;
 		}
 	}
@@ -1943,6 +2374,8 @@ void render_win32::draw_list_marker(const list_marker& marker)
 			fill_rect(draw_x, draw_y, draw_width, draw_height, marker.color, css_border_radius());
 		}
 		break;
+	default:
+		break;
 	}
 	release_clip();
 }
@@ -1958,7 +2391,7 @@ size image_size(const pf::bitmap_ptr& bm)
 }
 
 
-void render_win32::draw_background(render_win32& renderer, const background_paint& bg)
+void render_win32::draw_background(render_win32&, const background_paint& bg)
 {
 	apply_clip();
 
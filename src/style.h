@@ -252,8 +252,31 @@ enum class prop_id : uint16_t
 	unknown = 0xFFFF,
 };
 
-// Semicolon table in prop_id order; searched by value_index.
-extern const char* prop_id_strings;
+// In prop_id order, so a property's keyword index is its prop_id.
+keyword_list(prop_id_strings,
+	"-potato-border-spacing-x;-potato-border-spacing-y;align-items;align-self;"
+	"background-attachment;background-clip;background-color;background-image;"
+	"background-image-baseurl;background-origin;background-position;background-repeat;"
+	"background-size;border-bottom-color;border-bottom-left-radius-x;border-bottom-left-radius-y;"
+	"border-bottom-right-radius-x;border-bottom-right-radius-y;border-bottom-style;border-bottom-width;"
+	"border-collapse;border-left-color;border-left-style;border-left-width;"
+	"border-radius-x;border-radius-y;border-right-color;border-right-style;"
+	"border-right-width;border-spacing;border-top-color;border-top-left-radius-x;"
+	"border-top-left-radius-y;border-top-right-radius-x;border-top-right-radius-y;border-top-style;"
+	"border-top-width;border-width;bottom;box-sizing;"
+	"clear;color;content;cursor;"
+	"display;flex-basis;flex-direction;flex-grow;"
+	"flex-shrink;flex-wrap;float;font-family;"
+	"font-size;font-style;font-variant;font-weight;"
+	"gap;height;justify-content;left;"
+	"line-height;list-style-image;list-style-image-baseurl;list-style-position;"
+	"list-style-type;margin-bottom;margin-left;margin-right;"
+	"margin-top;max-height;max-width;min-height;"
+	"min-width;overflow;padding-bottom;padding-left;"
+	"padding-right;padding-top;position;right;"
+	"text-align;text-decoration;text-indent;text-transform;"
+	"top;vertical-align;visibility;white-space;"
+	"width;z-index");
 
 prop_id prop_from_name(std::string_view name);
 
@@ -307,6 +330,9 @@ public:
 		m_custom.clear();
 	}
 
+	size_t entries() const { return m_props.size() + m_custom.size(); }
+	size_t heap_bytes() const;
+
 private:
 	void parse_property(const std::string& txt, const std::string& baseurl);
 	void parse_property(const std::string& name, const std::string& val, const std::string& baseurl);
@@ -322,6 +348,26 @@ private:
 };
 
 
+// Viewport widths and heights at which some media query can change its
+// answer: a query is true on one side of each threshold and may be false on
+// the other. Between two thresholds every query answers the same, so a
+// resize that stays inside a band needs no re-evaluation.
+struct media_breakpoints
+{
+	std::vector<int> widths;
+	std::vector<int> heights;
+	bool any_resize = false; // orientation or aspect ratio can flip anywhere
+
+	void sort();
+
+	// Which band a viewport falls in; equal bands give equal media answers.
+	std::pair<int, int> band(const int width, const int height) const
+	{
+		return {static_cast<int>(std::ranges::upper_bound(widths, width) - widths.begin()),
+		        static_cast<int>(std::ranges::upper_bound(heights, height) - heights.begin())};
+	}
+};
+
 struct media_query_expression
 {
 	media_feature feature = media_feature_none;
@@ -331,6 +377,7 @@ struct media_query_expression
 
 	media_query_expression() = default;
 	bool check(const media_features& features) const;
+	void add_breakpoints(media_breakpoints& points) const;
 };
 
 class media_query
@@ -346,6 +393,7 @@ public:
 
 	static std::shared_ptr<media_query> create_from_string(const std::string& str);
 	bool check(const media_features& features) const;
+	void add_breakpoints(media_breakpoints& points) const;
 };
 
 class media_query_list
@@ -361,6 +409,7 @@ public:
 	bool is_used() const { return m_is_used; }
 
 	bool apply_media_features(const media_features& features); // returns true if the m_is_used changed
+	void add_breakpoints(media_breakpoints& points) const;
 };
 
 
@@ -382,11 +431,23 @@ enum attr_select_condition
 
 //////////////////////////////////////////////////////////////////////////
 
+class css_element_selector;
+
 struct css_attribute_selector
 {
 	std::string attribute;
 	std::string val;
 	attr_select_condition condition = select_exists;
+
+	// Filled in by css_element_selector::parse, so matching reads these and
+	// never parses or lowercases anything.
+	std::string_view atom; // interned attribute name, as elements store it
+	std::vector<std::string> classes; // class names every one of which must be present
+	int pseudo = -1; // pseudo_class, or -1 for a state such as :hover
+	int pseudo_element = 0; // select_match_with_before/after; 0 never matches
+	int nth_num = 0; // An+B of an :nth-* pseudo-class
+	int nth_off = 0;
+	std::shared_ptr<const css_element_selector> negated; // argument of :not()
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -396,9 +457,15 @@ class css_element_selector
 public:
 	std::string m_tag;
 	std::vector<css_attribute_selector> m_attrs;
+	bool m_any_tag = true; // no type selector, or '*'
+	bool m_dynamic = false; // matching depends on :hover and the like
 
 
 	void parse(const std::string& txt);
+	std::string to_string() const;
+
+private:
+	void compile();
 };
 
 //////////////////////////////////////////////////////////////////////////
@@ -434,24 +501,42 @@ class css_selector
 public:
 	int m_specificity = 0;
 	css_element_selector m_right;
-	std::shared_ptr<css_selector> m_left;
+	std::unique_ptr<css_selector> m_left;
 	css_combinator m_combinator = combinator_descendant;
 	std::shared_ptr<style> m_style;
 	int m_order = 0;
 	std::shared_ptr<media_query_list> m_media_query;
 	selector_key m_key;
+	uint32_t m_sheet = 0; // index into css::sheets()
 
 	css_selector(const std::shared_ptr<style>& s,
 	             const std::shared_ptr<media_query_list>& media) : m_style(s), m_media_query(media)
 	{
 	}
 
-	~css_selector()
+	// Copies the compound chain; the declaration block and media list stay shared.
+	css_selector(const css_selector& other) :
+		m_specificity(other.m_specificity), m_right(other.m_right),
+		m_left(other.m_left ? std::make_unique<css_selector>(*other.m_left) : nullptr),
+		m_combinator(other.m_combinator), m_style(other.m_style), m_order(other.m_order),
+		m_media_query(other.m_media_query), m_key(other.m_key), m_sheet(other.m_sheet)
 	{
 	}
 
+	css_selector(css_selector&&) noexcept = default;
+	css_selector& operator=(css_selector&&) noexcept = default;
+
+	css_selector& operator=(const css_selector& other)
+	{
+		if (this != &other) *this = css_selector(other);
+		return *this;
+	}
+
 	bool parse(const std::string& text);
 	void calc_specificity();
+	// Rebuilt from the compiled parts, lowercased, for reports; the source
+	// text is not kept.
+	std::string to_string() const;
 
 	bool is_media_valid() const
 	{
@@ -487,71 +572,152 @@ inline bool operator <(const css_selector& v1, const css_selector& v2)
 	return v1.m_specificity < v2.m_specificity;
 }
 
-inline bool operator >(const std::shared_ptr<css_selector>& v1, const std::shared_ptr<css_selector>& v2)
-{
-	return *v1 > *v2;
-}
-
-inline bool operator <(const std::shared_ptr<css_selector>& v1, const std::shared_ptr<css_selector>& v2)
-{
-	return *v1 < *v2;
-}
-
 //////////////////////////////////////////////////////////////////////////
 
+// A selector that matched an element's buckets, by its index in css::m_selectors.
 class used_selector
 {
 public:
-	std::shared_ptr<css_selector> m_selector;
+	uint32_t m_selector = 0;
 	bool m_used = false;
 
-	used_selector(const std::shared_ptr<css_selector>& s, const bool used) : m_selector(s), m_used(used)
+	used_selector(const uint32_t s, const bool used) : m_selector(s), m_used(used)
 	{
 	}
+};
+
+// Lets the bucket maps be probed with a string_view.
+struct string_hash
+{
+	using is_transparent = void;
+
+	size_t operator()(const std::string_view s) const noexcept
+	{
+		return std::hash<std::string_view>()(s);
+	}
+};
 
-	used_selector(const used_selector& other) : m_selector(other.m_selector), m_used(other.m_used)
+// Tags, ids and classes present in a document, lowercased, so the sheet can
+// leave out selectors that name something the page never uses. Filled in as
+// the parser sets tags and attributes. The wanted sets hold, for each pruned
+// selector, one name it still lacks; changed says one of those arrived since
+// the buckets were last built, so a re-sort would bring a selector back.
+struct page_names
+{
+	std::unordered_set<std::string, string_hash, std::equal_to<>> tags;
+	std::unordered_set<std::string, string_hash, std::equal_to<>> ids;
+	std::unordered_set<std::string, string_hash, std::equal_to<>> classes;
+	std::unordered_set<std::string, string_hash, std::equal_to<>> wanted_tags;
+	std::unordered_set<std::string, string_hash, std::equal_to<>> wanted_ids;
+	std::unordered_set<std::string, string_hash, std::equal_to<>> wanted_classes;
+	bool changed = false;
+
+	void add_tag(std::string_view name) { add(tags, wanted_tags, name); }
+	void add_id(std::string_view name) { add(ids, wanted_ids, name); }
+	void add_classes(std::string_view list);
+
+	void clear()
 	{
+		tags.clear();
+		ids.clear();
+		classes.clear();
+		wanted_tags.clear();
+		wanted_ids.clear();
+		wanted_classes.clear();
+		changed = false;
 	}
+
+private:
+	void add(std::unordered_set<std::string, string_hash, std::equal_to<>>& set,
+	         const std::unordered_set<std::string, string_hash, std::equal_to<>>& wanted, std::string_view name);
+};
+
+// What sort_selectors left out. Bucket bytes are an estimate of the index
+// and its keys, with and without the pruning, and only filled in on request.
+struct prune_stats
+{
+	size_t kept = 0;
+	size_t dropped = 0;
+	size_t bucket_bytes = 0;
+	size_t unpruned_bucket_bytes = 0;
+};
+
+
+// What one selector cost during apply_stylesheet while profiling is on.
+// Candidates are the times a bucket offered it past the media and tag
+// checks; ns covers the first select() only.
+struct selector_cost
+{
+	uint64_t candidates = 0;
+	uint64_t matches = 0;
+	uint64_t ns = 0;
 };
 
 
 class css
 {
-	std::vector<std::shared_ptr<css_selector>> m_selectors;
+	// Selectors in the order they were parsed, so an index stays valid for the
+	// life of the sheet; elements and buckets hold indices, never pointers.
+	std::vector<css_selector> m_selectors;
+	// Cascade position of each selector, by (specificity, order). Pruned
+	// selectors have no rank and sit in no bucket.
+	std::vector<uint32_t> m_rank;
+	// Where each selector came from: a URL, "master.css" or "<style>".
+	std::vector<std::string> m_sheets;
+	uint32_t m_sheet = 0;
+	mutable std::vector<selector_cost> m_cost;
+
+public:
+	// Set before a document is created to collect selector costs for it.
+	// Per thread, so concurrent layouts profile independently; off by default.
+	static inline thread_local bool s_profile = false;
 
 	// Bucketed index: element selection probes only the buckets matching the
-	// element's tag / id / class names plus a universal fallback. Rebuilt from
-	// m_selectors each sort_selectors() call.
-	using selector_list = std::vector<std::shared_ptr<css_selector>>;
-	std::unordered_map<std::string, selector_list> m_by_id;
-	std::unordered_map<std::string, selector_list> m_by_class;
-	std::unordered_map<std::string, selector_list> m_by_tag;
+	// element's tag / id / class names plus a universal fallback. Each list is
+	// sorted by rank, so candidates are a k-way merge of a few lists. Rebuilt
+	// from m_selectors each sort_selectors() call.
+	using selector_list = std::vector<uint32_t>;
+
+private:
+	std::unordered_map<std::string, selector_list, string_hash, std::equal_to<>> m_by_id;
+	std::unordered_map<std::string, selector_list, string_hash, std::equal_to<>> m_by_class;
+	std::unordered_map<std::string, selector_list, string_hash, std::equal_to<>> m_by_tag;
 	selector_list m_universal;
 
 public:
 	css() = default;
 	~css() = default;
 
-	const std::vector<std::shared_ptr<css_selector>>& selectors() const
+	const std::vector<css_selector>& selectors() const
 	{
 		return m_selectors;
 	}
 
+	const css_selector& selector(const uint32_t i) const
+	{
+		return m_selectors[i];
+	}
+
+	uint32_t rank(const uint32_t i) const
+	{
+		return m_rank[i];
+	}
+
 	// Bucketed accessors used by element::apply_stylesheet. Returns nullptr when
 	// the bucket is empty; callers are expected to handle the empty case cheaply.
-	const selector_list* selectors_by_id(const std::string& id) const
+	const selector_list* selectors_by_id(const std::string_view id) const
 	{
 		const auto it = m_by_id.find(id);
 		return it == m_by_id.end() ? nullptr : &it->second;
 	}
 
-	const selector_list* selectors_by_class(const std::string& cls) const
+	const selector_list* selectors_by_class(const std::string_view cls) const
 	{
 		const auto it = m_by_class.find(cls);
 		return it == m_by_class.end() ? nullptr : &it->second;
 	}
 
-	const selector_list* selectors_by_tag(const std::string& tag) const
+	const selector_list* selectors_by_tag(const std::string_view tag) const
 	{
 		const auto it = m_by_tag.find(tag);
 		return it == m_by_tag.end() ? nullptr : &it->second;
@@ -559,18 +725,50 @@ public:
 
 	const selector_list& universal_selectors() const { return m_universal; }
 
+	const std::vector<std::string>& sheets() const { return m_sheets; }
+	const std::vector<selector_cost>& costs() const { return m_cost; }
+
+	void record_cost(const uint32_t i, const uint64_t ns, const bool matched) const
+	{
+		if (m_cost.size() < m_selectors.size()) m_cost.resize(m_selectors.size());
+		auto& c = m_cost[i];
+		c.candidates += 1;
+		c.matches += matched ? 1 : 0;
+		c.ns += ns;
+	}
+
+	// The selectors that took the most select() time, one per line.
+	std::string profile_report(size_t top) const;
+
+	// Selectors with their compiled parts, the declaration blocks they share,
+	// and the bucket index.
+	void measure_memory(memory_use& selectors, memory_use& rules, memory_use& buckets) const;
+
 	void clear()
 	{
 		m_selectors.clear();
+		m_rank.clear();
 		m_by_id.clear();
 		m_by_class.clear();
 		m_by_tag.clear();
 		m_universal.clear();
+		m_sheets.clear();
+		m_sheet = 0;
+		m_cost.clear();
 	}
 
+	// Gives the selectors copies of the media lists they use and returns the
+	// copies, so a copied sheet evaluates its media queries apart from the
+	// original.
+	std::vector<std::shared_ptr<media_query_list>> own_media_lists();
+
+	// A non-empty sheet names where the text came from; nested @media and
+	// @supports blocks leave it empty and keep the enclosing sheet's name.
 	void parse_stylesheet(const std::string& str, const std::string& baseurl, document& doc,
-	                      std::shared_ptr<media_query_list>& media);
-	void sort_selectors();
+	                      std::shared_ptr<media_query_list>& media, std::string_view sheet = {});
+	// Ranks and buckets the selectors. With names, a selector whose compounds
+	// need a tag, id or class the page lacks can never match and is left out.
+	prune_stats sort_selectors(page_names* present = nullptr, bool measure_buckets = false);
 
 	static std::string parse_css_url(const std::string& str);
 
@@ -580,13 +778,14 @@ private:
 	void parse_selectors(const std::string& txt, const std::shared_ptr<style>& styles,
 	                     std::shared_ptr<media_query_list>& media);
 
-	void add_selector(const std::shared_ptr<css_selector>& selector)
+	void add_selector(css_selector&& selector)
 	{
-		selector->m_order = static_cast<int>(m_selectors.size());
-		m_selectors.push_back(selector);
+		selector.m_order = static_cast<int>(m_selectors.size());
+		selector.m_sheet = m_sheet;
+		m_selectors.push_back(std::move(selector));
 	}
 
-	// Build m_by_id/m_by_class/m_by_tag/m_universal from m_selectors. Assumes
-	// m_selectors is already sorted by (specificity, order).
-	void rebuild_buckets();
+	// Build m_by_id/m_by_class/m_by_tag/m_universal from the live selectors,
+	// each list in cascade order. Assumes m_rank is current.
+	void rebuild_buckets(const std::vector<uint32_t>& live);
 };
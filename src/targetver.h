@@ -3,4 +3,6 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include <SDKDDKVer.h>
+#endif